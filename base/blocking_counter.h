@@ -0,0 +1,57 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#ifndef _BASE_BLOCKING_COUNTER_H
+#define _BASE_BLOCKING_COUNTER_H
+
+#include <condition_variable>
+#include <mutex>
+
+namespace base {
+
+// Allows a thread to wait until a batch of tasks it has issued to other threads finishes.
+// Example:
+//   BlockingCounter bc(tasks.size());
+//   for (auto& t : tasks) pool.RunTask([&t, &bc] { t.Run(); bc.Dec(); });
+//   bc.Wait();
+//
+// Dec() touches the object only while holding the mutex, therefore it is safe to destroy the
+// counter right after Wait() returns.
+class BlockingCounter {
+ public:
+  explicit BlockingCounter(unsigned initial_count = 0) : count_(initial_count) {}
+
+  // Must be called before the corresponding tasks are issued.
+  void Add(unsigned delta) {
+    std::lock_guard<std::mutex> lock(mu_);
+    count_ += delta;
+  }
+
+  void Dec() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (--count_ == 0)
+      cv_.notify_all();
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait(lock, [this] { return count_ == 0; });
+  }
+
+  bool IsDone() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return count_ == 0;
+  }
+
+ private:
+  std::mutex mu_;
+  std::condition_variable cv_;
+  unsigned count_;
+
+  BlockingCounter(const BlockingCounter&) = delete;
+  void operator=(const BlockingCounter&) = delete;
+};
+
+}  // namespace base
+
+#endif  // _BASE_BLOCKING_COUNTER_H
@@ -88,6 +88,10 @@ uint64_t Fingerprint(const char* str, uint32_t len) {
 
 uint64_t FingerprintXX64(const char* str, uint32_t len) { return XXH64(str, len, 180776); }
 
+uint64_t FingerprintXX64(const char* str, uint32_t len, uint64_t seed) {
+  return XXH64(str, len, seed);
+}
+
 uint32_t FingerprintXX32(const char* str, uint32_t len) { return XXH32(str, len, 90573); }
 
 }  // namespace base
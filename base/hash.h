@@ -30,6 +30,7 @@ inline uint32_t Fingerprint32(const std::string& str) {
 }
 
 uint64_t FingerprintXX64(const char* str, uint32_t len);
+uint64_t FingerprintXX64(const char* str, uint32_t len, uint64_t seed);
 uint32_t FingerprintXX32(const char* str, uint32_t len);
 
 }  // namespace base
@@ -0,0 +1,443 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/caching_file.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <vector>
+
+#include "base/commandlineflags.h"
+#include "base/hash.h"
+#include "base/logging.h"
+#include "file/file_util.h"
+#include "strings/stringprintf.h"
+
+DEFINE_string(file_cache_dir, "", "If set, remote files are cached on local disk in this dir");
+DEFINE_uint64(file_cache_size_mb, 10240, "Maximal size of the local file cache");
+
+using std::string;
+using base::Status;
+using base::StatusCode;
+using strings::Slice;
+
+namespace file {
+
+namespace {
+
+constexpr char kIndexFile[] = "INDEX";
+constexpr char kLockFile[] = "LOCK";
+constexpr char kTmpMarker[] = ".tmp.";
+
+// Leftovers of crashed writers are removed after this time.
+constexpr time_t kStaleTmpSec = 3600;
+
+// Chunk files are named <16 hex digits of the file key>-<chunk index>.
+bool IsChunkName(const char* name) {
+  size_t len = strlen(name);
+  if (len < 18 || name[16] != '-')
+    return false;
+  for (unsigned i = 0; i < 16; ++i) {
+    if (!isxdigit(name[i]))
+      return false;
+  }
+  for (size_t i = 17; i < len; ++i) {
+    if (!isdigit(name[i]))
+      return false;
+  }
+  return true;
+}
+
+// flock based lock that serializes index updates and evictions between processes.
+class DirLock {
+ public:
+  explicit DirLock(int fd) : fd_(fd) {
+    if (fd_ >= 0) flock(fd_, LOCK_EX);
+  }
+  ~DirLock() {
+    if (fd_ >= 0) flock(fd_, LOCK_UN);
+  }
+ private:
+  int fd_;
+};
+
+Status WriteFully(int fd, const uint8* data, size_t size) {
+  while (size > 0) {
+    ssize_t res = write(fd, data, size);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      return StatusFileError();
+    }
+    data += res;
+    size -= res;
+  }
+  return Status::OK;
+}
+
+// Writes data to a unique temporary file and renames it to path, so that readers never see
+// partially written files.
+Status AtomicWrite(const string& path, Slice data) {
+  static std::atomic_uint counter(0);
+  string tmp = StringPrintf("%s%s%d.%u", path.c_str(), kTmpMarker, getpid(), counter++);
+  int fd = open(tmp.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return StatusFileError();
+  Status st = WriteFully(fd, data.ubuf(), data.size());
+  close(fd);
+  if (st.ok() && rename(tmp.c_str(), path.c_str()) < 0)
+    st = StatusFileError();
+  if (!st.ok())
+    unlink(tmp.c_str());
+  return st;
+}
+
+}  // namespace
+
+ChunkCache::ChunkCache(const string& dir, const Options& opts) : dir_(dir), opts_(opts) {
+  CHECK_GT(opts_.chunk_size, 0);
+}
+
+ChunkCache::~ChunkCache() {
+  WARN_IF_ERROR(Flush());
+  if (lock_fd_ >= 0)
+    close(lock_fd_);
+}
+
+string ChunkCache::Path(const string& chunk) const {
+  return file_util::JoinPath(dir_, chunk);
+}
+
+Status ChunkCache::Open() {
+  if (!file_util::RecursivelyCreateDir(dir_, 0755) && access(dir_.c_str(), W_OK) != 0) {
+    return Status(StatusCode::IO_ERROR, "Can not create cache dir " + dir_);
+  }
+  string lock_path = Path(kLockFile);
+  lock_fd_ = open(lock_path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+  if (lock_fd_ < 0)
+    return StatusFileError();
+
+  DirLock lock(lock_fd_);
+  std::lock_guard<std::mutex> guard(mu_);
+
+  // The index defines the access order. Its entries are validated against the directory,
+  // which is the source of truth.
+  string index;
+  if (file_util::ReadFileToString(Path(kIndexFile), &index)) {
+    char name[64];
+    unsigned long long sz;
+    for (const char* line = index.c_str(); *line; ) {
+      if (sscanf(line, "%63s %llu", name, &sz) == 2 && IsChunkName(name) && !index_.count(name)) {
+        struct stat sb;
+        if (stat(Path(name).c_str(), &sb) == 0) {
+          lru_.push_back(Entry{name, uint64(sb.st_size)});
+          index_.emplace(name, std::prev(lru_.end()));
+          total_size_ += sb.st_size;
+        }
+      }
+      const char* next = strchr(line, '\n');
+      if (!next) break;
+      line = next + 1;
+    }
+  }
+
+  // Chunks written by other processes that are not in our index are considered the oldest.
+  DIR* dir = opendir(dir_.c_str());
+  if (!dir)
+    return StatusFileError();
+  std::vector<std::pair<time_t, Entry>> unindexed;
+  time_t now = time(nullptr);
+  while (struct dirent* de = readdir(dir)) {
+    bool is_chunk = IsChunkName(de->d_name);
+    bool is_tmp = !is_chunk && strstr(de->d_name, kTmpMarker) != nullptr;
+    if ((!is_chunk && !is_tmp) || index_.count(de->d_name))
+      continue;
+    struct stat sb;
+    string path = Path(de->d_name);
+    if (stat(path.c_str(), &sb) != 0)
+      continue;
+    if (is_tmp) {
+      if (sb.st_mtime + kStaleTmpSec < now)
+        unlink(path.c_str());
+      continue;
+    }
+    unindexed.emplace_back(sb.st_mtime, Entry{de->d_name, uint64(sb.st_size)});
+  }
+  closedir(dir);
+
+  std::sort(unindexed.begin(), unindexed.end(),
+            [](const std::pair<time_t, Entry>& a, const std::pair<time_t, Entry>& b) {
+              return a.first > b.first; });
+  for (auto& t : unindexed) {
+    lru_.push_front(std::move(t.second));
+    index_.emplace(lru_.front().name, lru_.begin());
+    total_size_ += lru_.front().size;
+    dirty_ = true;
+  }
+  VLOG(1) << "Opened file cache " << dir_ << " with " << index_.size() << " chunks, "
+          << total_size_ << " bytes";
+
+  return Status::OK;
+}
+
+uint64 ChunkCache::size() const {
+  std::lock_guard<std::mutex> guard(mu_);
+  return total_size_;
+}
+
+void ChunkCache::Erase(const string& chunk) {
+  std::lock_guard<std::mutex> guard(mu_);
+  auto it = index_.find(chunk);
+  if (it != index_.end()) {
+    total_size_ -= it->second->size;
+    lru_.erase(it->second);
+    index_.erase(it);
+    dirty_ = true;
+  }
+}
+
+bool ChunkCache::Contains(const string& chunk) {
+  std::lock_guard<std::mutex> guard(mu_);
+  return index_.count(chunk) > 0;
+}
+
+bool ChunkCache::Read(const string& chunk, size_t chunk_length, size_t offset, size_t length,
+                      uint8* dest) {
+  DCHECK_LE(offset + length, chunk_length);
+
+  string path = Path(chunk);
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    // Could be evicted by another process.
+    Erase(chunk);
+    ++misses_;
+    return false;
+  }
+
+  struct stat sb;
+  bool valid = fstat(fd, &sb) == 0 && size_t(sb.st_size) == chunk_length;
+  while (valid && length > 0) {
+    ssize_t res = pread(fd, dest, length, offset);
+    if (res <= 0) {
+      valid = res < 0 && errno == EINTR;
+      continue;
+    }
+    dest += res;
+    offset += res;
+    length -= res;
+  }
+  close(fd);
+
+  if (!valid) {
+    LOG(WARNING) << "Dropping invalid cache chunk " << path;
+    unlink(path.c_str());
+    Erase(chunk);
+    ++misses_;
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(mu_);
+    auto it = index_.find(chunk);
+    if (it == index_.end()) {
+      // The chunk was written by another process after we opened the cache.
+      lru_.push_back(Entry{chunk, chunk_length});
+      index_.emplace(chunk, std::prev(lru_.end()));
+      total_size_ += chunk_length;
+    } else {
+      lru_.splice(lru_.end(), lru_, it->second);
+    }
+    dirty_ = true;
+  }
+  ++hits_;
+  return true;
+}
+
+Status ChunkCache::Write(const string& chunk, Slice data) {
+  RETURN_IF_ERROR(AtomicWrite(Path(chunk), data));
+
+  {
+    std::lock_guard<std::mutex> guard(mu_);
+    auto it = index_.find(chunk);
+    if (it != index_.end()) {
+      total_size_ -= it->second->size;
+      lru_.erase(it->second);
+      index_.erase(it);
+    }
+    lru_.push_back(Entry{chunk, data.size()});
+    index_.emplace(chunk, std::prev(lru_.end()));
+    total_size_ += data.size();
+    dirty_ = true;
+  }
+  EvictIfNeeded();
+
+  return Status::OK;
+}
+
+void ChunkCache::EvictIfNeeded() {
+  std::vector<string> victims;
+  {
+    std::lock_guard<std::mutex> guard(mu_);
+    if (total_size_ <= opts_.capacity)
+      return;
+    const uint64 target = opts_.capacity * std::min(std::max(opts_.low_water, 0.0), 1.0);
+
+    // Never evict the chunk that has just been written.
+    while (total_size_ > target && lru_.size() > 1) {
+      Entry& e = lru_.front();
+      total_size_ -= e.size;
+      index_.erase(e.name);
+      victims.push_back(std::move(e.name));
+      lru_.pop_front();
+    }
+  }
+  if (victims.empty())
+    return;
+
+  // Readers that already opened an evicted chunk keep reading it, unlink is safe.
+  DirLock lock(lock_fd_);
+  for (const string& name : victims) {
+    unlink(Path(name).c_str());
+  }
+  WARN_IF_ERROR(SaveIndex());
+}
+
+Status ChunkCache::Flush() {
+  if (lock_fd_ < 0)
+    return Status::OK;
+  DirLock lock(lock_fd_);
+  return SaveIndex();
+}
+
+Status ChunkCache::SaveIndex() {
+  string index;
+  {
+    std::lock_guard<std::mutex> guard(mu_);
+    if (!dirty_)
+      return Status::OK;
+    for (const Entry& e : lru_) {
+      index.append(e.name).append(" ").append(std::to_string(e.size)).append("\n");
+    }
+    dirty_ = false;
+  }
+  return AtomicWrite(Path(kIndexFile), index);
+}
+
+ChunkCache* ChunkCache::Default() {
+  static ChunkCache* cache = []() -> ChunkCache* {
+    if (FLAGS_file_cache_dir.empty())
+      return nullptr;
+    Options opts;
+    opts.capacity = FLAGS_file_cache_size_mb << 20;
+    ChunkCache* res = new ChunkCache(FLAGS_file_cache_dir, opts);
+    Status st = res->Open();
+    if (!st.ok()) {
+      LOG(ERROR) << "Could not open file cache " << FLAGS_file_cache_dir << ": " << st;
+      delete res;
+      return nullptr;
+    }
+    return res;
+  }();
+  return cache;
+}
+
+CachingReadonlyFile::CachingReadonlyFile(StringPiece name, ReadonlyFile* file, ChunkCache* cache)
+    : ReadonlyFile(1), file_(file), cache_(cache), size_(file->Size()),
+      mtime_(file->ModificationTime()) {
+  string key = StringPrintf("%s:%zu:%ld", name.as_string().c_str(), size_, long(mtime_));
+  prefix_ = StringPrintf("%016" PRIx64 "-", base::Fingerprint(key));
+}
+
+CachingReadonlyFile::~CachingReadonlyFile() {
+  WARN_IF_ERROR(CloseImpl());
+}
+
+string CachingReadonlyFile::ChunkName(size_t index) const {
+  return prefix_ + std::to_string(index);
+}
+
+size_t CachingReadonlyFile::ChunkLength(size_t index) const {
+  size_t start = index * cache_->chunk_size();
+  return std::min(cache_->chunk_size(), size_ - start);
+}
+
+size_t CachingReadonlyFile::FetchLength(size_t first, size_t last) const {
+  return std::min(last * cache_->chunk_size(), size_) - first * cache_->chunk_size();
+}
+
+Status CachingReadonlyFile::FetchChunks(size_t first, size_t last, uint8* scratch,
+                                        Slice* data) {
+  const size_t chunk_size = cache_->chunk_size();
+  size_t start = first * chunk_size;
+  size_t length = FetchLength(first, last);
+  RETURN_IF_ERROR(file_->Read(start, length, data, scratch));
+  if (data->size() != length) {
+    return Status(StatusCode::IO_ERROR, "Short read from the underlying file");
+  }
+
+  // The cache is best-effort, its failures do not fail the read.
+  for (size_t i = first; i < last; ++i) {
+    Slice chunk(data->ubuf() + (i - first) * chunk_size, ChunkLength(i));
+    WARN_IF_ERROR(cache_->Write(ChunkName(i), chunk));
+  }
+  return Status::OK;
+}
+
+Status CachingReadonlyFile::ReadImpl(size_t offset, size_t length, Slice* result,
+                                     uint8* buffer) {
+  result->clear();
+  if (length == 0) return Status::OK;
+  if (offset > size_) {
+    return Status(StatusCode::RUNTIME_ERROR, "Invalid read range");
+  }
+  if (offset + length > size_) {
+    length = size_ - offset;
+  }
+
+  const size_t chunk_size = cache_->chunk_size();
+  const size_t end = offset + length;
+  size_t pos = offset;
+  while (pos < end) {
+    size_t index = pos / chunk_size;
+    size_t chunk_start = index * chunk_size;
+    size_t n = std::min(chunk_start + chunk_size, end) - pos;
+    if (cache_->Read(ChunkName(index), ChunkLength(index), pos - chunk_start, n,
+                     buffer + pos - offset)) {
+      pos += n;
+      continue;
+    }
+
+    // Fetch the missing chunk together with the following missing chunks of this request.
+    size_t last = index + 1;
+    size_t last_needed = (end - 1) / chunk_size;
+    while (last <= last_needed && !cache_->Contains(ChunkName(last)))
+      ++last;
+
+    // The scratch is per call since the file may be read by several threads at once.
+    std::unique_ptr<uint8[]> scratch(new uint8[FetchLength(index, last)]);
+    Slice data;
+    RETURN_IF_ERROR(FetchChunks(index, last, scratch.get(), &data));
+    size_t copy_end = std::min(end, last * chunk_size);
+    memcpy(buffer + pos - offset, data.ubuf() + pos - chunk_start, copy_end - pos);
+    pos = copy_end;
+  }
+  *result = Slice(buffer, length);
+
+  return Status::OK;
+}
+
+Status CachingReadonlyFile::CloseImpl() {
+  if (!file_)
+    return Status::OK;
+  Status st = file_->Close();
+  file_.reset();
+  WARN_IF_ERROR(cache_->Flush());
+  return st;
+}
+
+}  // namespace file
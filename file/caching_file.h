@@ -0,0 +1,129 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "file/file.h"
+
+namespace file {
+
+// Size-bounded LRU directory of fixed-size file chunks on local disk.
+// Chunks are published via atomic renames, hence several processes may share the same
+// directory. Each process tracks the access order of its own reads and persists it into the
+// INDEX file, eviction and index updates are serialized between processes via the LOCK file.
+// Chunks that were added by other processes are picked up when the cache is opened.
+//
+// Thread-safe.
+class ChunkCache {
+ public:
+  struct Options {
+    size_t chunk_size = 1 << 20;
+    uint64 capacity = 10ULL << 30;
+
+    // Once the cache exceeds its capacity, it evicts down to this fraction of the capacity.
+    // Evictions and index rewrites then happen in batches rather than on every write.
+    double low_water = 0.9;
+  };
+
+  ChunkCache(const std::string& dir, const Options& opts);
+
+  // Persists the index.
+  ~ChunkCache();
+
+  // Creates the directory if needed and loads the index.
+  base::Status Open() MUST_USE_RESULT;
+
+  // Reads [offset, offset + length) of the chunk into dest. Returns false if the chunk does not
+  // exist or its size differs from chunk_length.
+  bool Read(const std::string& chunk, size_t chunk_length, size_t offset, size_t length,
+            uint8* dest);
+
+  // Returns true if this process knows about the chunk.
+  bool Contains(const std::string& chunk);
+
+  // Stores the chunk, possibly evicting least recently used chunks.
+  base::Status Write(const std::string& chunk, strings::Slice data) MUST_USE_RESULT;
+
+  // Writes the index if it has changed.
+  base::Status Flush() MUST_USE_RESULT;
+
+  size_t chunk_size() const { return opts_.chunk_size; }
+  const std::string& dir() const { return dir_; }
+
+  uint64 size() const;
+  uint64 hits() const { return hits_; }
+  uint64 misses() const { return misses_; }
+
+  // Returns the process-wide cache configured by --file_cache_dir or null if it is not set.
+  static ChunkCache* Default();
+
+ private:
+  struct Entry {
+    std::string name;
+    uint64 size;
+  };
+  typedef std::list<Entry> LruList;
+
+  void Erase(const std::string& chunk);
+  void EvictIfNeeded();
+  base::Status SaveIndex();
+
+  std::string Path(const std::string& chunk) const;
+
+  const std::string dir_;
+  const Options opts_;
+  int lock_fd_ = -1;
+
+  mutable std::mutex mu_;
+  LruList lru_;  // front - least recently used.
+  std::unordered_map<std::string, LruList::iterator> index_;
+  uint64 total_size_ = 0;
+  bool dirty_ = false;
+
+  std::atomic<uint64> hits_{0}, misses_{0};
+};
+
+// Read-through cache over another ReadonlyFile. The chunks are keyed by the name, the size and
+// the modification time of the underlying file so that a modified file never serves stale data.
+// Reads that miss the cache fetch all consecutive missing chunks with a single read from the
+// underlying file.
+class CachingReadonlyFile : public ReadonlyFile {
+ public:
+  // Takes ownership over file. Does not take ownership over cache.
+  CachingReadonlyFile(StringPiece name, ReadonlyFile* file, ChunkCache* cache);
+  ~CachingReadonlyFile();
+
+  size_t Size() const override { return size_; }
+  time_t ModificationTime() const override { return mtime_; }
+
+ protected:
+  base::Status ReadImpl(size_t offset, size_t length, strings::Slice* result,
+                        uint8* buffer) override;
+  base::Status CloseImpl() override;
+
+ private:
+  std::string ChunkName(size_t index) const;
+  size_t ChunkLength(size_t index) const;
+
+  // Number of bytes in chunks [first, last).
+  size_t FetchLength(size_t first, size_t last) const;
+
+  // Fetches chunks [first, last) from file_ into scratch and stores them in the cache.
+  // scratch must hold FetchLength(first, last) bytes.
+  base::Status FetchChunks(size_t first, size_t last, uint8* scratch, strings::Slice* data);
+
+  std::unique_ptr<ReadonlyFile> file_;
+  ChunkCache* cache_;
+  const size_t size_;
+  const time_t mtime_;
+  std::string prefix_;
+};
+
+}  // namespace file
@@ -0,0 +1,259 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/caching_file.h"
+
+#include <atomic>
+#include <thread>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "file/file_util.h"
+#include "file/list_file.h"
+#include "util/sinksource.h"
+
+namespace file {
+
+using strings::Slice;
+using base::Status;
+using std::string;
+
+namespace {
+
+// In-memory file that counts the reads that reach it.
+class CountingFile : public ReadonlyFile {
+ public:
+  CountingFile(const string& contents, time_t mtime, std::atomic_uint* reads)
+      : ReadonlyFile(1), contents_(contents), mtime_(mtime), reads_(reads) {}
+
+  size_t Size() const override { return contents_.size(); }
+  time_t ModificationTime() const override { return mtime_; }
+
+ protected:
+  Status ReadImpl(size_t offset, size_t length, Slice* result, uint8* buffer) override {
+    ++*reads_;
+    // Copies like a remote file would, so that the callers' buffers are written.
+    length = std::min(length, contents_.size() - offset);
+    memcpy(buffer, contents_.data() + offset, length);
+    *result = Slice(buffer, length);
+    return Status::OK;
+  }
+
+  Status CloseImpl() override { return Status::OK; }
+
+ private:
+  string contents_;
+  time_t mtime_;
+  std::atomic_uint* reads_;
+};
+
+string TestString(size_t len) {
+  string res(len, '\0');
+  for (size_t i = 0; i < len; ++i)
+    res[i] = 'a' + (i * 31 + i / 7) % 26;
+  return res;
+}
+
+}  // namespace
+
+class CachingFileTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = base::GetTestTempPath("chunk_cache");
+    file_util::DeleteRecursively(dir_);
+    opts_.chunk_size = 1000;
+    opts_.capacity = 1 << 20;
+  }
+
+  ChunkCache* NewCache() {
+    ChunkCache* cache = new ChunkCache(dir_, opts_);
+    CHECK_STATUS(cache->Open());
+    return cache;
+  }
+
+  string ReadAll(ReadonlyFile* file, size_t offset, size_t length) {
+    std::unique_ptr<uint8[]> buf(new uint8[length]);
+    Slice result;
+    CHECK_STATUS(file->Read(offset, length, &result, buf.get()));
+    return result.as_string();
+  }
+
+  string dir_;
+  ChunkCache::Options opts_;
+  std::atomic_uint reads_{0};
+};
+
+TEST_F(CachingFileTest, ReadThrough) {
+  string contents = TestString(10500);
+  std::unique_ptr<ChunkCache> cache(NewCache());
+
+  CachingReadonlyFile file("s3://bucket/a", new CountingFile(contents, 1, &reads_), cache.get());
+  EXPECT_EQ(contents.size(), file.Size());
+
+  // Consecutive missing chunks are fetched with a single read.
+  EXPECT_EQ(contents.substr(1500, 3000), ReadAll(&file, 1500, 3000));
+  EXPECT_EQ(1, reads_);
+  EXPECT_EQ(4000, cache->size());
+
+  EXPECT_EQ(contents.substr(2000, 2000), ReadAll(&file, 2000, 2000));
+  EXPECT_EQ(1, reads_);
+
+  // Reads past the end are truncated, the last chunk is shorter.
+  EXPECT_EQ(contents.substr(10000), ReadAll(&file, 10000, 2000));
+  EXPECT_EQ(2, reads_);
+
+  EXPECT_EQ(contents, ReadAll(&file, 0, contents.size()));
+  EXPECT_TRUE(file.Close().ok());
+}
+
+TEST_F(CachingFileTest, Persistence) {
+  string contents = TestString(5000);
+  {
+    std::unique_ptr<ChunkCache> cache(NewCache());
+    CachingReadonlyFile file("s3://bucket/a", new CountingFile(contents, 1, &reads_),
+                             cache.get());
+    EXPECT_EQ(contents, ReadAll(&file, 0, contents.size()));
+    EXPECT_TRUE(file.Close().ok());
+  }
+  EXPECT_EQ(1, reads_);
+
+  // Another cache instance over the same directory, e.g. the next run of the job.
+  std::unique_ptr<ChunkCache> cache(NewCache());
+  EXPECT_EQ(5000, cache->size());
+  CachingReadonlyFile file("s3://bucket/a", new CountingFile(contents, 1, &reads_),
+                           cache.get());
+  EXPECT_EQ(contents, ReadAll(&file, 0, contents.size()));
+  EXPECT_EQ(1, reads_);
+  EXPECT_EQ(5, cache->hits());
+
+  // Modified file must not be served from the cache.
+  string modified = TestString(5001);
+  CachingReadonlyFile file2("s3://bucket/a", new CountingFile(modified, 1, &reads_),
+                            cache.get());
+  EXPECT_EQ(modified, ReadAll(&file2, 0, modified.size()));
+  EXPECT_EQ(2, reads_);
+
+  CachingReadonlyFile file3("s3://bucket/a", new CountingFile(contents, 2, &reads_),
+                            cache.get());
+  EXPECT_EQ(contents, ReadAll(&file3, 0, contents.size()));
+  EXPECT_EQ(3, reads_);
+}
+
+TEST_F(CachingFileTest, Eviction) {
+  opts_.capacity = 3000;
+  string contents = TestString(10000);
+  std::unique_ptr<ChunkCache> cache(NewCache());
+  CachingReadonlyFile file("s3://bucket/a", new CountingFile(contents, 1, &reads_), cache.get());
+
+  for (size_t offset = 0; offset < contents.size(); offset += 1000) {
+    EXPECT_EQ(contents.substr(offset, 1000), ReadAll(&file, offset, 1000));
+    EXPECT_LE(cache->size(), opts_.capacity);
+  }
+  EXPECT_EQ(10, reads_);
+
+  // The last chunks are still cached, the first ones were evicted.
+  EXPECT_EQ(contents.substr(9000), ReadAll(&file, 9000, 1000));
+  EXPECT_EQ(10, reads_);
+  EXPECT_EQ(contents.substr(0, 1000), ReadAll(&file, 0, 1000));
+  EXPECT_EQ(11, reads_);
+}
+
+TEST_F(CachingFileTest, LowWater) {
+  opts_.capacity = 10000;
+  opts_.low_water = 0.5;
+  string contents = TestString(20000);
+  std::unique_ptr<ChunkCache> cache(NewCache());
+  CachingReadonlyFile file("s3://bucket/a", new CountingFile(contents, 1, &reads_), cache.get());
+
+  EXPECT_EQ(contents.substr(0, 10000), ReadAll(&file, 0, 10000));
+  EXPECT_EQ(10000, cache->size());
+
+  // Exceeding the capacity evicts a batch of chunks down to the low water mark.
+  EXPECT_EQ(contents.substr(10000, 1000), ReadAll(&file, 10000, 1000));
+  EXPECT_EQ(5000, cache->size());
+  EXPECT_EQ(contents.substr(11000, 4000), ReadAll(&file, 11000, 4000));
+  EXPECT_EQ(9000, cache->size());
+}
+
+TEST_F(CachingFileTest, CorruptedChunk) {
+  string contents = TestString(2000);
+  std::unique_ptr<ChunkCache> cache(NewCache());
+  CachingReadonlyFile file("s3://bucket/a", new CountingFile(contents, 1, &reads_), cache.get());
+  EXPECT_EQ(contents, ReadAll(&file, 0, contents.size()));
+
+  // Truncate all the chunks behind the cache's back.
+  for (const string& path : file_util::ExpandFiles(file_util::JoinPath(dir_, "*-*"))) {
+    file_util::WriteStringToFileOrDie("garbage", path);
+  }
+  EXPECT_EQ(contents, ReadAll(&file, 0, contents.size()));
+
+  // Each of the invalid chunks is refetched.
+  EXPECT_EQ(3, reads_);
+  EXPECT_EQ(3, cache->misses());
+}
+
+TEST_F(CachingFileTest, ConcurrentMisses) {
+  string contents = TestString(100000);
+  std::unique_ptr<ChunkCache> cache(NewCache());
+  CachingReadonlyFile file("s3://bucket/a", new CountingFile(contents, 1, &reads_), cache.get());
+
+  // The threads read overlapping ranges of different sizes that mostly miss the cache.
+  std::vector<std::thread> threads;
+  std::atomic_int mismatches{0};
+  for (unsigned t = 0; t < 8; ++t) {
+    threads.emplace_back([&, t] {
+      size_t length = 500 + t * 700;
+      std::unique_ptr<uint8[]> buf(new uint8[length]);
+      Slice result;
+      for (size_t offset = t * 300; offset < contents.size(); offset += length) {
+        CHECK_STATUS(file.Read(offset, length, &result, buf.get()));
+        if (result != Slice(contents, offset, length))
+          ++mismatches;
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  EXPECT_EQ(0, mismatches);
+
+  // Chunks written by racing fetches hold the right data.
+  reads_ = 0;
+  EXPECT_EQ(contents, ReadAll(&file, 0, contents.size()));
+  EXPECT_EQ(0, reads_);
+}
+
+TEST_F(CachingFileTest, ListFile) {
+  using namespace list_file;
+
+  util::StringSink* sink = new util::StringSink;
+  ListWriter writer(sink);
+  ASSERT_TRUE(writer.Init().ok());
+  for (unsigned i = 0; i < 1000; ++i) {
+    ASSERT_TRUE(writer.AddRecord("record" + std::to_string(i)).ok());
+  }
+  ASSERT_TRUE(writer.Flush().ok());
+
+  std::unique_ptr<ChunkCache> cache(NewCache());
+  unsigned first_pass_reads = 0;
+  for (unsigned pass = 0; pass < 2; ++pass) {
+    ListReader reader(new CachingReadonlyFile("s3://bucket/list",
+                                              new CountingFile(sink->contents(), 1, &reads_),
+                                              cache.get()),
+                      TAKE_OWNERSHIP);
+    Slice record;
+    string scratch;
+    unsigned index = 0;
+    while (reader.ReadRecord(&record, &scratch)) {
+      ASSERT_EQ("record" + std::to_string(index), record.as_string());
+      ++index;
+    }
+    EXPECT_EQ(1000, index);
+    if (pass == 0)
+      first_pass_reads = reads_;
+  }
+  EXPECT_GT(first_pass_reads, 0);
+  EXPECT_EQ(first_pass_reads, reads_);
+  EXPECT_EQ(sink->contents().size(), cache->size());
+}
+
+}  // namespace file
@@ -20,12 +20,16 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <memory>
+#include <mutex>
 
 #include "base/logging.h"
 #include "base/macros.h"
+#include "file/caching_file.h"
+#include "file/s3_file.h"
 
 using std::string;
 using base::Status;
@@ -175,6 +179,10 @@ bool Exists(StringPiece fname) {
   return access(fname.data(), F_OK) == 0;
 }
 
+bool IsInS3Namespace(StringPiece name) {
+  return name.starts_with("s3://");
+}
+
 bool Delete(StringPiece name) {
   int err;
   if ((err = unlink(name.data())) == 0) {
@@ -196,21 +204,42 @@ static inline const uint8* MmapFile(int fd, size_t size, off_t offset) {
 
 
 
+// A mapped window of the file. It is unmapped when neither the file nor any of the
+// readers that pinned it with ReadMapped() refer to it.
+struct MmapRegion {
+  const uint8* base;
+  size_t size;
+
+  MmapRegion(const uint8* b, size_t sz) : base(b), size(sz) {}
+  ~MmapRegion() {
+    if (munmap(const_cast<uint8*>(base), size) < 0) {
+      LOG(ERROR) << "munmap failed " << strerror(errno);
+    }
+  }
+};
+
 class PosixMmapReadonlyFile : public ReadonlyFile {
   int fd_;
-  const uint8* base_;
   size_t sz_;
+
+  std::mutex mu_;  // Protects the current window.
+  std::shared_ptr<MmapRegion> region_;
   size_t mmap_offs_ = 0;
 
   size_t mmap_size() const { return std::min(kMaxMmapSize, sz_ - mmap_offs_); }
 
+  // Validates the range and makes sure it is inside the current window.
+  // Returns false with OK status if the range is too large to be mapped.
+  bool MapRange(size_t offset, size_t* length, Status* status);
+
  public:
   PosixMmapReadonlyFile(int fd, const uint8* base, size_t sz, int retries)
-    : ReadonlyFile(retries), fd_(fd), base_(base), sz_(sz) {
+    : ReadonlyFile(retries), fd_(fd), sz_(sz),
+      region_(std::make_shared<MmapRegion>(base, std::min(sz, kMaxMmapSize))) {
   }
 
   virtual ~PosixMmapReadonlyFile() {
-    if (base_) {
+    if (region_) {
       LOG(WARNING) << " ReadonlyFile::Close was not called";
       WARN_IF_ERROR(Close());
     }
@@ -218,62 +247,97 @@ class PosixMmapReadonlyFile : public ReadonlyFile {
 
   Status ReadImpl(size_t offset, size_t length, StringPiece* result, uint8* buffer) override;
 
+  bool ReadMapped(size_t offset, size_t length, strings::Slice* result,
+                  std::shared_ptr<const void>* pin) override;
+
   Status CloseImpl() override;
 
   size_t Size() const override {
     return sz_;
   }
-};
 
-Status PosixMmapReadonlyFile::ReadImpl(
-    size_t offset, size_t length, StringPiece* result, uint8* buf) {
-  Status s;
-  result->clear();
-  if (length == 0) return s;
+  time_t ModificationTime() const override;
+};
 
+bool PosixMmapReadonlyFile::MapRange(size_t offset, size_t* length, Status* status) {
   if (offset > sz_) {
-    return Status(StatusCode::RUNTIME_ERROR, "Invalid read range");
+    *status = Status(StatusCode::RUNTIME_ERROR, "Invalid read range");
+    return false;
   }
 
-  if (offset + length > sz_) {
-    length = sz_ - offset;
+  if (offset + *length > sz_) {
+    *length = sz_ - offset;
   }
-  size_t end_offs = offset + length;
+  size_t end_offs = offset + *length;
   static const size_t kPageSize = sysconf(_SC_PAGESIZE);
   size_t mmap_offs = offset & ~(kPageSize - 1);   // align by page boundary.
 
-  // We do not mmap huge blocks (max kMaxMmapSize), so we fallback into reading
-  // from the file into the destination buffer.
+  // We do not mmap huge blocks (max kMaxMmapSize).
   if (mmap_offs + kMaxMmapSize < end_offs) {
-    ssize_t r = read_all(fd_, buf, length, offset);
-    if (r < 0) {
-      return StatusFileError();
-    }
-
-    *result = StringPiece(buf, length);
-    return Status::OK;
+    return false;
   }
 
-  if (offset < mmap_offs_ || end_offs > mmap_offs_ + kMaxMmapSize) {
-    if (base_ && munmap(const_cast<uint8*>(base_), mmap_size()) < 0)
-      return StatusFileError();
-
+  if (!region_ || offset < mmap_offs_ || end_offs > mmap_offs_ + kMaxMmapSize) {
+    // The previous window stays mapped while it is pinned.
+    region_.reset();
     mmap_offs_ = mmap_offs;
 
     VLOG(1) << "MMap offset " << mmap_offs_ << " length " << mmap_size();
-    base_ = MmapFile(fd_, mmap_size(), mmap_offs_);
+    const uint8* base = MmapFile(fd_, mmap_size(), mmap_offs_);
 
-    if (base_ == MAP_FAILED) {
-      base_ = nullptr;
+    if (base == MAP_FAILED) {
       LOG(WARNING) << "MAP_FAILED";
+      *status = StatusFileError();
+      return false;
+    }
+    region_ = std::make_shared<MmapRegion>(base, mmap_size());
+  }
+  return true;
+}
+
+Status PosixMmapReadonlyFile::ReadImpl(
+    size_t offset, size_t length, StringPiece* result, uint8* buf) {
+  Status s;
+  result->clear();
+  if (length == 0) return s;
+
+  std::lock_guard<std::mutex> lock(mu_);
+  if (!MapRange(offset, &length, &s)) {
+    if (!s.ok())
+      return s;
+
+    // Fallback into reading from the file into the destination buffer.
+    ssize_t r = read_all(fd_, buf, length, offset);
+    if (r < 0) {
       return StatusFileError();
     }
+
+    *result = StringPiece(buf, length);
+    return Status::OK;
   }
-  *result = StringPiece(base_ + offset - mmap_offs_, length);
+  // The window may be remapped once the lock is released, so the caller gets a copy.
+  // ReadMapped() is the zero-copy path.
+  memcpy(buf, region_->base + offset - mmap_offs_, length);
+  *result = StringPiece(buf, length);
 
   return Status::OK;
 }
 
+bool PosixMmapReadonlyFile::ReadMapped(size_t offset, size_t length, strings::Slice* result,
+                                       std::shared_ptr<const void>* pin) {
+  Status s;
+  std::lock_guard<std::mutex> lock(mu_);
+  if (length == 0 || !MapRange(offset, &length, &s))
+    return false;
+  *result = StringPiece(region_->base + offset - mmap_offs_, length);
+  *pin = region_;
+  return true;
+}
+
+time_t PosixMmapReadonlyFile::ModificationTime() const {
+  struct stat sb;
+  return fstat(fd_, &sb) == 0 ? sb.st_mtime : 0;
+}
 
 Status PosixMmapReadonlyFile::CloseImpl() {
   if (fd_ > 0) {
@@ -281,10 +345,8 @@ Status PosixMmapReadonlyFile::CloseImpl() {
     close(fd_);
     fd_ = -1;
   }
-  if (base_ && munmap(const_cast<uint8*>(base_), mmap_size()) < 0) {
-    return StatusFileError();
-  }
-  base_ = nullptr;
+  std::lock_guard<std::mutex> lock(mu_);
+  region_.reset();
 
   return Status::OK;
 }
@@ -331,6 +393,11 @@ class PosixReadFile: public ReadonlyFile {
   }
 
   size_t Size() const override { return file_size_; }
+
+  time_t ModificationTime() const override {
+    struct stat sb;
+    return fstat(fd_, &sb) == 0 ? sb.st_mtime : 0;
+  }
 };
 
 base::Status ReadonlyFile::Read(size_t offset, size_t length, strings::Slice* result,
@@ -357,6 +424,14 @@ base::Status ReadonlyFile::Close() {
 }
 
 base::StatusObject<ReadonlyFile*> ReadonlyFile::Open(StringPiece name, const Options& opts) {
+  if (IsRemoteFile(name)) {
+    auto res = OpenS3File(name, opts);
+    ChunkCache* cache = ChunkCache::Default();
+    if (!res.ok() || cache == nullptr)
+      return res;
+    return new CachingReadonlyFile(name, res.obj, cache);
+  }
+
   int retries = opts.retries;
   while (retries-- > 0) {
     int fd = open(name.data(), O_RDONLY);
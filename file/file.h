@@ -3,6 +3,7 @@
 //
 #pragma once
 
+#include <memory>
 #include <string>
 
 #include "base/integral_types.h"
@@ -28,17 +29,35 @@ class ReadonlyFile {
     bool sequential = true;
     bool drop_cache_on_close = true;
     int retries = 1;
+
+    // Remote (s3://, http://) files only: reads are split into ranges of this size
+    // and fetched concurrently, sequential reads prefetch remote_parallelism ranges ahead.
+    // 1 fetches on the reading thread, otherwise the requests run on a pool that is shared
+    // by all the remote files, see --s3_read_threads.
+    size_t remote_range_size = 1 << 22;
+    int remote_parallelism = 4;
+
     Options() : use_mmap(true) {}
   };
 
   virtual ~ReadonlyFile();
 
   // Reads upto length bytes and updates the result to point to the data.
-  // May use buffer for storing data. In case, EOF reached sets result.size() < length but still
-  // returns Status::OK.
+  // May use buffer for storing data, so it must hold at least length bytes.
+  // In case, EOF reached sets result.size() < length but still returns Status::OK.
   base::Status Read(size_t offset, size_t length, strings::Slice* result,
                     uint8* buffer) MUST_USE_RESULT;
 
+  // Zero-copy read for files that are mapped into memory. On success, sets result to point
+  // into the mapping and *pin to a reference that keeps that memory valid after
+  // the file moves on to other regions or is closed.
+  // Returns false if the range can not be accessed this way, in which case
+  // Read() should be used.
+  virtual bool ReadMapped(size_t offset, size_t length, strings::Slice* result,
+                          std::shared_ptr<const void>* pin) {
+    return false;
+  }
+
   // releases the system handle for this file.
   // The object must be deleted.
   base::Status Close();
@@ -46,6 +65,9 @@ class ReadonlyFile {
 
   virtual size_t Size() const = 0;
 
+  // Returns the modification time of the underlying object or 0 if it's unknown.
+  virtual time_t ModificationTime() const { return 0; }
+
   // Factory function that creates the ReadonlyFile object.
   // The ownership is passed to the caller.
   static base::StatusObject<ReadonlyFile*> Open(StringPiece name,
@@ -140,6 +162,7 @@ class FileCloser {
   FileCloser(const FileCloser&) = delete;
 };
 
+// Returns true if name is an s3:// path.
 bool IsInS3Namespace(StringPiece name);
 
 struct StatShort {
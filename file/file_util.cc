@@ -28,7 +28,6 @@
 #include <sys/stat.h>
 #include <sys/sendfile.h>  // sendfile
 #include <wordexp.h>
-#include <zlib.h>
 
 #include <memory>
 #include <vector>
@@ -36,8 +35,10 @@
 #include "base/walltime.h"
 
 #include "base/logging.h"
+#include "file/filesource.h"
 #include "strings/join.h"
 #include "strings/stringprintf.h"
+#include "util/gzip_sink.h"
 
 using std::vector;
 using base::Status;
@@ -367,18 +368,20 @@ std::vector<file::StatShort> StatFiles(StringPiece path) {
   return res;
 }
 
-void CompressToGzip(StringPiece file, uint8_t compress_level) {
+void CompressToGzip(StringPiece file, uint8_t compress_level, unsigned threads) {
   base::StatusObject<file::ReadonlyFile*> src = file::ReadonlyFile::Open(file);
   CHECK(src.ok()) << file;
 
   string wfile = StrCat(file, ".gz");
+  File* dest = file::Open(wfile);
+  CHECK(dest) << wfile;
 
-  gzFile dest = gzopen(wfile.c_str(), "wb");
-  gzbuffer(dest, 1 << 16);
-  gzsetparams(dest, compress_level, Z_DEFAULT_STRATEGY);
+  util::ParallelGzipSink::Options opts;
+  opts.level = compress_level;
+  opts.threads = threads;
+  util::ParallelGzipSink gz_sink(new file::Sink(dest, TAKE_OWNERSHIP), TAKE_OWNERSHIP, opts);
 
-  base::Status status;
-  constexpr unsigned kBufSize = 1 << 15;
+  constexpr unsigned kBufSize = 1 << 20;
   std::unique_ptr<uint8[]> buf(new uint8[kBufSize]);
   size_t offs = 0;
   StringPiece result;
@@ -387,7 +390,7 @@ void CompressToGzip(StringPiece file, uint8_t compress_level) {
     if (result.empty())
       break;
 
-    CHECK_GT(gzwrite(dest, result.data(), result.size()), 0);
+    CHECK_STATUS(gz_sink.Append(result));
     if (result.size() < kBufSize)
       break;
     offs += result.size();
@@ -395,7 +398,7 @@ void CompressToGzip(StringPiece file, uint8_t compress_level) {
   CHECK(src.obj->Close().ok());
   delete src.obj;
 
-  gzclose_w(dest);
+  CHECK_STATUS(gz_sink.Flush());
   CHECK(file::Delete(file));
 }
 
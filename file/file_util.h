@@ -72,7 +72,9 @@ std::vector<file::StatShort> StatFiles(StringPiece path);
 base::Status StatFilesSafe(StringPiece path, std::vector<file::StatShort>* res);
 
 // Creates 'file.gz', compresses file, once successful, deletes it. fails on any error.
-void CompressToGzip(StringPiece file, uint8_t compress_level = 2);
+// The file is compressed by 'threads' threads (0 means the number of cpus) into a single-member
+// gzip stream.
+void CompressToGzip(StringPiece file, uint8_t compress_level = 2, unsigned threads = 1);
 
 void CopyFileOrDie(StringPiece src, StringPiece dest_path);
 
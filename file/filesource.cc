@@ -4,14 +4,25 @@
 
 #include "file/filesource.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base/commandlineflags.h"
 #include "base/logging.h"
 #include "file/file.h"
+#include "file/s3_file.h"
 #include "strings/split.h"
 #include "strings/strip.h"
 #include "strings/util.h"
 #include "util/bzip_source.h"
+#include "util/parallel_decompress_source.h"
 #include "util/zlib_source.h"
 
+DEFINE_int32(decompress_threads, 4, "Number of threads that decompress bzip2 and multi-member "
+             "gzip inputs. 0 decompresses on the reading thread.");
+
 namespace file {
 
 using strings::Slice;
@@ -53,15 +64,121 @@ bool Source::RefillInternal() {
   return result.size() < refill;
 }
 
-util::Source* Source::Uncompressed(ReadonlyFile* file, uint32 buffer_size) {
-  Source* first = new Source(file, TAKE_OWNERSHIP, buffer_size);
-  if (util::BzipSource::IsBzipSource(first))
+static util::Source* WrapUncompressed(util::Source* first) {
+  using util::ParallelDecompressSource;
+
+  ParallelDecompressSource::Options opts;
+  opts.threads = FLAGS_decompress_threads;
+  if (util::BzipSource::IsBzipSource(first)) {
+    if (FLAGS_decompress_threads > 0)
+      return new ParallelDecompressSource(first, TAKE_OWNERSHIP, ParallelDecompressSource::BZIP2,
+                                          opts);
     return new util::BzipSource(first, TAKE_OWNERSHIP);
-  if (util::ZlibSource::IsZlibSource(first))
+  }
+  if (util::ZlibSource::IsZlibSource(first)) {
+    if (FLAGS_decompress_threads > 0)
+      return new ParallelDecompressSource(first, TAKE_OWNERSHIP, ParallelDecompressSource::GZIP,
+                                          opts);
     return new util::ZlibSource(first, TAKE_OWNERSHIP);
+  }
   return first;
 }
 
+util::Source* Source::Uncompressed(ReadonlyFile* file, uint32 buffer_size) {
+  return WrapUncompressed(new Source(file, TAKE_OWNERSHIP, buffer_size));
+}
+
+constexpr size_t MmapSource::kDefaultWindowSize;
+
+MmapSource::MmapSource(int fd, uint64 file_size, size_t window_size)
+    : fd_(fd), file_size_(file_size), window_size_(window_size) {
+}
+
+MmapSource::~MmapSource() {
+  Unmap();
+  close(fd_);
+}
+
+base::StatusObject<MmapSource*> MmapSource::Open(StringPiece name, size_t window_size) {
+  static const size_t kPageSize = sysconf(_SC_PAGESIZE);
+
+  int fd = open(name.data(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return StatusFileError();
+  struct stat sb;
+  if (fstat(fd, &sb) < 0) {
+    Status st = StatusFileError();
+    close(fd);
+    return st;
+  }
+  window_size = std::max(kPageSize, (window_size + kPageSize - 1) & ~(kPageSize - 1));
+  return new MmapSource(fd, sb.st_size, window_size);
+}
+
+void MmapSource::Unmap() {
+  if (window_) {
+    munmap(const_cast<uint8*>(window_), window_len_);
+    window_ = nullptr;
+    window_len_ = 0;
+  }
+}
+
+void MmapSource::Remap(uint32 minimal_size) {
+  static const size_t kPageSize = sysconf(_SC_PAGESIZE);
+
+  Unmap();
+  window_offs_ = pos_ & ~uint64(kPageSize - 1);
+
+  // The window must cover the requested flat region even if it's larger than window_size_.
+  size_t len = std::max<size_t>(window_size_, pos_ - window_offs_ + minimal_size);
+  window_len_ = std::min<uint64>(len, file_size_ - window_offs_);
+
+  void* ptr = mmap(NULL, window_len_, PROT_READ, MAP_SHARED | MAP_NORESERVE, fd_, window_offs_);
+  if (ptr == MAP_FAILED) {
+    status_ = StatusFileError();
+    window_len_ = 0;
+    return;
+  }
+  madvise(ptr, window_len_, MADV_SEQUENTIAL);
+  window_ = reinterpret_cast<const uint8*>(ptr);
+  VLOG(1) << "Mapped [" << window_offs_ << ", " << window_end() << ")";
+}
+
+Slice MmapSource::Peek(uint32 minimal_size) {
+  if (pos_ >= file_size_ || !status_.ok())
+    return Slice();
+  uint64 needed_end = std::min<uint64>(pos_ + std::max(minimal_size, 1u), file_size_);
+  if (!window_ || pos_ < window_offs_ || needed_end > window_end()) {
+    Remap(minimal_size);
+    if (!window_)
+      return Slice();
+  }
+  size_t avail = std::min<uint64>(window_end() - pos_, kuint32max);
+  return Slice(window_ + (pos_ - window_offs_), avail);
+}
+
+void MmapSource::Skip(size_t n) {
+  DCHECK_LE(pos_ + n, file_size_);
+  pos_ += n;
+}
+
+util::Source* OpenUncompressed(StringPiece name) {
+  if (!IsRemoteFile(name)) {
+    auto res = MmapSource::Open(name);
+    if (res.ok())
+      return WrapUncompressed(res.obj);
+    LOG(ERROR) << "Failed to open " << name << ": " << res.status;
+    return nullptr;
+  }
+
+  auto res = ReadonlyFile::Open(name);
+  if (!res.ok()) {
+    LOG(ERROR) << "Failed to open " << name << ": " << res.status;
+    return nullptr;
+  }
+  return Source::Uncompressed(res.obj);
+}
+
 Sink::~Sink() {
   if (ownership_ == TAKE_OWNERSHIP)
     CHECK(file_->Close());
@@ -80,13 +197,8 @@ LineReader::LineReader(const std::string& fl) : LineReader() {
 }
 
 bool LineReader::Open(const std::string& filename) {
-  auto res = ReadonlyFile::Open(filename);
-  if (!res.ok()) {
-    LOG(ERROR) << "Failed to open " << filename << ": " << res.status;
-    return false;
-  }
-  source_ = file::Source::Uncompressed(res.obj);
-  return true;
+  source_ = OpenUncompressed(filename);
+  return source_ != nullptr;
 }
 
 LineReader::~LineReader() {
@@ -5,6 +5,7 @@
 #define FILESOURCE_H
 
 #include "base/integral_types.h"
+#include "base/port.h"
 #include "strings/stringpiece.h"
 #include "util/sinksource.h"
 
@@ -28,6 +29,7 @@ class Source : public util::BufferredSource {
 
   // Returns the source wrapping the file. If the file is compressed, than the stream
   // automatically inflates the compressed data. The returned source owns the file object.
+  // bzip2 and multi-member gzip files are decompressed on --decompress_threads threads.
   static util::Source* Uncompressed(ReadonlyFile* file,
                                     uint32 buffer_size = BufferredSource::kDefaultBufferSize);
  private:
@@ -38,6 +40,49 @@ class Source : public util::BufferredSource {
   Ownership ownership_;
 };
 
+// Reads a local file via mmap. Peek() returns slices pointing directly into the mapping, so
+// unlike Source there is no copying and no buffer size limit: a single Peek may return the whole
+// mapped window. Files larger than window_size are mapped window by window.
+class MmapSource : public util::Source {
+ public:
+  static constexpr size_t kDefaultWindowSize = 1U << 28;  // 256MB
+
+  ~MmapSource();
+
+  static base::StatusObject<MmapSource*> Open(
+      StringPiece name, size_t window_size = kDefaultWindowSize) MUST_USE_RESULT;
+
+  strings::Slice Peek(uint32 minimal_size = 0) override;
+  void Skip(size_t n) override;
+  base::Status status() const override { return status_; }
+
+  uint64 file_size() const { return file_size_; }
+
+ private:
+  MmapSource(int fd, uint64 file_size, size_t window_size);
+
+  // Maps the window that contains [pos_, pos_ + minimal_size).
+  void Remap(uint32 minimal_size);
+  void Unmap();
+
+  uint64 window_end() const { return window_offs_ + window_len_; }
+
+  int fd_;
+  const uint64 file_size_;
+  const size_t window_size_;
+
+  const uint8* window_ = nullptr;
+  uint64 window_offs_ = 0;
+  size_t window_len_ = 0;
+  uint64 pos_ = 0;
+  base::Status status_;
+};
+
+// Opens a local or a remote file and returns a source that inflates it if it is compressed.
+// Local files are read via MmapSource.
+// Returns null and logs the error if the file could not be opened.
+util::Source* OpenUncompressed(StringPiece name);
+
 class Sink : public util::Sink {
 public:
   // file must be open for writing.
@@ -0,0 +1,118 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/filesource.h"
+
+#include <zlib.h>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "file/file_util.h"
+
+namespace file {
+
+using strings::Slice;
+using std::string;
+
+class FileSourceTest : public testing::Test {
+ protected:
+  string WriteLines(const string& name, unsigned count, string* contents) {
+    contents->clear();
+    for (unsigned i = 0; i < count; ++i) {
+      contents->append("line number ").append(std::to_string(i)).append("\n");
+    }
+    string path = base::GetTestTempPath(name);
+    file_util::WriteStringToFileOrDie(*contents, path);
+    return path;
+  }
+};
+
+TEST_F(FileSourceTest, MmapWindows) {
+  string contents;
+  string path = WriteLines("lines.txt", 10000, &contents);
+
+  // Tiny window forces many remaps.
+  auto res = MmapSource::Open(path, 4096);
+  ASSERT_TRUE(res.ok()) << res.status;
+  std::unique_ptr<MmapSource> src(res.obj);
+  EXPECT_EQ(contents.size(), src->file_size());
+
+  string read;
+  unsigned peeks = 0;
+  while (true) {
+    // Minimal sizes that cross the window boundaries.
+    Slice s = src->Peek(5000);
+    if (s.empty())
+      break;
+    ++peeks;
+    ASSERT_TRUE(s.size() >= 5000 || read.size() + s.size() == contents.size());
+    size_t n = std::min<size_t>(s.size(), 3001);
+    read.append(s.data(), n);
+    src->Skip(n);
+  }
+  EXPECT_TRUE(src->status().ok());
+  EXPECT_TRUE(read == contents);
+  EXPECT_GT(peeks, contents.size() / 3001);
+}
+
+TEST_F(FileSourceTest, EmptyFile) {
+  string path = base::GetTestTempPath("empty.txt");
+  file_util::WriteStringToFileOrDie("", path);
+  auto res = MmapSource::Open(path);
+  ASSERT_TRUE(res.ok());
+  std::unique_ptr<MmapSource> src(res.obj);
+  EXPECT_TRUE(src->Peek().empty());
+
+  EXPECT_FALSE(MmapSource::Open(base::GetTestTempPath("missing.txt")).ok());
+}
+
+TEST_F(FileSourceTest, MmapRead) {
+  // Larger than the mmap window of ReadonlyFile.
+  string contents;
+  string path = WriteLines("lines3.txt", 1000000, &contents);
+  auto res = ReadonlyFile::Open(path);
+  ASSERT_TRUE(res.ok()) << res.status;
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  ASSERT_GT(file->Size(), 16 << 20);
+
+  // The first result stays valid after the second read moves the window.
+  uint8 buf1[100], buf2[100];
+  Slice first, second;
+  ASSERT_TRUE(file->Read(0, sizeof(buf1), &first, buf1).ok());
+  ASSERT_TRUE(file->Read(file->Size() - sizeof(buf2), sizeof(buf2), &second, buf2).ok());
+  ASSERT_TRUE(file->Close().ok());
+
+  EXPECT_EQ(contents.substr(0, sizeof(buf1)), first.as_string());
+  EXPECT_EQ(contents.substr(contents.size() - sizeof(buf2)), second.as_string());
+}
+
+TEST_F(FileSourceTest, LineReader) {
+  string contents;
+  string path = WriteLines("lines2.txt", 1000, &contents);
+
+  LineReader reader(path);
+  string line;
+  unsigned index = 0;
+  while (reader.Next(&line)) {
+    ASSERT_EQ("line number " + std::to_string(index), line);
+    ++index;
+  }
+  EXPECT_EQ(1000, index);
+
+  // Compressed input goes through ZlibSource on top of MmapSource.
+  string gz_path = base::GetTestTempPath("lines2.txt.gz");
+  gzFile gz = gzopen(gz_path.c_str(), "wb");
+  ASSERT_TRUE(gz != nullptr);
+  ASSERT_EQ(contents.size(), gzwrite(gz, contents.data(), contents.size()));
+  gzclose(gz);
+
+  LineReader gz_reader(gz_path);
+  index = 0;
+  while (gz_reader.Next(&line)) {
+    ASSERT_EQ("line number " + std::to_string(index), line);
+    ++index;
+  }
+  EXPECT_EQ(1000, index);
+}
+
+}  // namespace file
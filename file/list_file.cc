@@ -232,13 +232,6 @@ Status ListWriter::Init() {
   return Status::OK;
 }
 
-inline void ListWriter::AddRecordToArray(Slice size_enc, Slice record) {
-  memcpy(array_next_, size_enc.data(), size_enc.size());
-  memcpy(array_next_ + size_enc.size(), record.data(), record.size());
-  array_next_ += size_enc.size() + record.size();
-  ++array_records_;
-}
-
 inline Status ListWriter::FlushArray() {
   if (array_records_ == 0) return Status::OK;
 
@@ -255,64 +248,76 @@ inline Status ListWriter::FlushArray() {
   return st;
 }
 
-Status ListWriter::AddRecord(strings::Slice record) {
+inline Status ListWriter::PadFullBlock() {
+  if (block_leftover() > kBlockHeaderSize)
+    return Status::OK;
+
+  // Block trailing bytes. Just fill them with zeroes.
+  uint8 kBlockFilling[kBlockHeaderSize] = {0};
+  RETURN_IF_ERROR(dest_->Append(Slice(kBlockFilling, block_leftover())));
+  block_offset_ = 0;
+  block_leftover_ = block_size_;
+  return Status::OK;
+}
+
+Status ListWriter::ReserveRecord(uint32 size, uint8** dest) {
   CHECK(init_called_) << "ListWriter::Init was not called.";
+  *dest = nullptr;
 
-  Varint32Encoder record_size_encoded(record.size());
-  const uint32 record_size_total = record_size_encoded.size() + record.size();
-  // Try to accomodate either in the array or a single block.  Multiple iterations might be
-  // needed since we might fragment the record.
-  bool fragmenting = false;
-  ++records_added_;
-  while (true) {
-    if (array_records_ > 0) {
-      if (array_next_ + record_size_total <= array_end_) {
-        AddRecordToArray(record_size_encoded.slice(), record);
-        return Status::OK;
-      }
+  Varint32Encoder record_size_encoded(size);
+  const uint32 record_size_total = record_size_encoded.size() + size;
+  if (array_records_ > 0) {
+    if (array_next_ + record_size_total > array_end_) {
+      // We must either split the record or transfer to the next block.
       RETURN_IF_ERROR(FlushArray());
-      // Also we must either split the record or transfer to the next block.
-    }
-    if (block_leftover() <= kBlockHeaderSize) {
-      // Block trailing bytes. Just fill them with zeroes.
-      uint8 kBlockFilling[kBlockHeaderSize] = {0};
-      RETURN_IF_ERROR(dest_->Append(Slice(kBlockFilling, block_leftover())));
-      block_offset_ = 0;
-      block_leftover_ = block_size_;
     }
-
-    if (fragmenting) {
-      size_t fragment_length = record.size();
-      RecordType type = kLastType;
-      if (fragment_length > block_leftover() - kBlockHeaderSize) {
-        fragment_length = block_leftover() - kBlockHeaderSize;
-        type = kMiddleType;
-      }
-      RETURN_IF_ERROR(EmitPhysicalRecord(type, record.ubuf(), fragment_length));
-      if (type == kLastType)
-        return Status::OK;
-      record.remove_prefix(fragment_length);
-      continue;
-    }
-    if (record_size_total + kArrayRecordMaxHeaderSize < block_leftover()) {
-      // Lets start the array accumulation.
-      // We leave space at the beginning to prepend the header at the end.
-      array_next_ = array_store_.get() + kArrayRecordMaxHeaderSize;
-      array_end_ = array_store_.get() + block_leftover();
-      AddRecordToArray(record_size_encoded.slice(), record);
+  }
+  if (array_records_ == 0) {
+    RETURN_IF_ERROR(PadFullBlock());
+    if (record_size_total + kArrayRecordMaxHeaderSize >= block_leftover())
       return Status::OK;
-    }
-    if (kBlockHeaderSize + record.size() <= block_leftover()) {
-      // We have space for one record in this block but not for the array.
-      return EmitPhysicalRecord(kFullType, record.ubuf(), record.size());
-    }
-    // We must fragment.
-    fragmenting = true;
-    const size_t fragment_length = block_leftover() - kBlockHeaderSize;
-    RETURN_IF_ERROR(EmitPhysicalRecord(kFirstType, record.ubuf(), fragment_length));
+
+    // Lets start the array accumulation.
+    // We leave space at the beginning to prepend the header at the end.
+    array_next_ = array_store_.get() + kArrayRecordMaxHeaderSize;
+    array_end_ = array_store_.get() + block_leftover();
+  }
+  memcpy(array_next_, record_size_encoded.data(), record_size_encoded.size());
+  *dest = array_next_ + record_size_encoded.size();
+  array_next_ += record_size_total;
+  ++array_records_;
+  ++records_added_;
+  return Status::OK;
+}
+
+Status ListWriter::AddRecord(strings::Slice record) {
+  uint8* dest = nullptr;
+  RETURN_IF_ERROR(ReserveRecord(record.size(), &dest));
+  if (dest != nullptr) {
+    memcpy(dest, record.data(), record.size());
+    return Status::OK;
+  }
+
+  // The record does not fit into an array. The array was flushed and a new block started
+  // if the current one was full.
+  ++records_added_;
+  if (kBlockHeaderSize + record.size() <= block_leftover()) {
+    // We have space for one record in this block but not for the array.
+    return EmitPhysicalRecord(kFullType, record.ubuf(), record.size());
+  }
+
+  // We must fragment.
+  size_t fragment_length = block_leftover() - kBlockHeaderSize;
+  RETURN_IF_ERROR(EmitPhysicalRecord(kFirstType, record.ubuf(), fragment_length));
+  record.remove_prefix(fragment_length);
+  while (true) {
+    RETURN_IF_ERROR(PadFullBlock());
+    fragment_length = block_leftover() - kBlockHeaderSize;
+    if (record.size() <= fragment_length)
+      return EmitPhysicalRecord(kLastType, record.ubuf(), record.size());
+    RETURN_IF_ERROR(EmitPhysicalRecord(kMiddleType, record.ubuf(), fragment_length));
     record.remove_prefix(fragment_length);
-  };
-  return Status(StatusCode::INTERNAL_ERROR, "Should not reach here");
+  }
 }
 
 Status ListWriter::Flush() {
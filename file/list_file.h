@@ -25,7 +25,8 @@ class ListWriter {
   struct Options {
     uint8 block_size_multiplier = 1;  // the block size is 64KB * multiplier
     bool use_compression = true;
-    uint8 compress_method = list_file::kCompressionLZ4;
+    // LZ4 blocks can be read only by readers built with the LZ4 codec.
+    uint8 compress_method = list_file::kCompressionZlib;
     uint8 compress_level = 1;
     bool append = false;
 
@@ -44,6 +45,14 @@ class ListWriter {
 
   base::Status Init();
   base::Status AddRecord(StringPiece slice);
+
+  // Reserves space for a record of the given size in the current array block and sets *dest
+  // to it, so that the record can be written in place. The caller must write size bytes to
+  // *dest before the next call to the writer.
+  // Sets *dest to NULL if the record does not fit into an array, in which case it must be
+  // added with AddRecord().
+  base::Status ReserveRecord(uint32 size, uint8** dest);
+
   base::Status Flush();
 
   uint32 records_added() const { return records_added_;}
@@ -77,7 +86,10 @@ class ListWriter {
 
   uint32 block_leftover() const { return block_leftover_; }
 
-  void AddRecordToArray(strings::Slice size_enc, strings::Slice record);
+  // Pads the rest of the block with zeroes and moves to the next one if the block can not
+  // hold another record.
+  base::Status PadFullBlock();
+
   base::Status FlushArray();
 
   base::Status (*compress_func_)(int level, const void* src, size_t len, void* dest,
@@ -9,6 +9,8 @@
 
 #include "file/list_file.h"
 #include "file/filesource.h"
+#include "file/sstable/sorting_builder.h"
+#include "file/sstable/sstable.h"
 #include "file/sstable/sstable_builder.h"
 #include "strings/stringprintf.h"
 #include "util/lmdb/disk_table.h"
@@ -72,11 +74,8 @@ ProtoWriter::ProtoWriter(StringPiece filename, const gpb::Descriptor* dscr, Opti
     writer_->AddMeta(kProtoSetKey, fd_set_str_);
     writer_->AddMeta(kProtoTypeKey, dscr->full_name());
   } else if (opts.format == SSTABLE) {
-    File* fl = CHECK_NOTNULL(Open(filename));
-    sink_.reset(new Sink(fl, TAKE_OWNERSHIP));
-    table_builder_.reset(new sstable::TableBuilder(sstable::Options(), sink_.get()));
-    table_builder_->AddMeta(kProtoSetKey, fd_set_str_);
-    table_builder_->AddMeta(kProtoTypeKey, dscr->full_name());
+    file_name_ = filename.as_string();
+    OpenTable();
   } else {
     LOG(FATAL) << "Invalid format " << opts.format;
   }
@@ -86,13 +85,70 @@ ProtoWriter::~ProtoWriter() {
   if (writer_) CHECK_STATUS(writer_->Flush());
 }
 
+void ProtoWriter::OpenTable() {
+  table_builder_.reset();
+  File* fl = CHECK_NOTNULL(Open(file_name_));
+  sink_.reset(new Sink(fl, TAKE_OWNERSHIP));
+  table_builder_.reset(new sstable::TableBuilder(sstable::Options(), sink_.get()));
+  table_builder_->AddMeta(kProtoSetKey, fd_set_str_);
+  table_builder_->AddMeta(kProtoTypeKey, dscr_->full_name());
+}
+
+Status ProtoWriter::StartSorting() {
+  sstable::SortingBuilder::Options opts;
+  opts.mem_sort_size_mb = options_.sstable_sort_mb;
+  sorting_builder_.reset(new sstable::SortingBuilder(file_name_ + ".run", opts));
+  if (num_streamed_ == 0)
+    return Status::OK;
+
+  // The streamed entries are read back from the table, which is rewritten by Flush().
+  RETURN_IF_ERROR(table_builder_->Finish());
+  RETURN_IF_ERROR(sink_->Flush());
+  table_builder_.reset();
+  sink_.reset();
+
+  auto res = ReadonlyFile::Open(file_name_);
+  RETURN_IF_ERROR(res.status);
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  Status st;
+  {
+    auto table_res = sstable::Table::Open(sstable::ReadOptions(), file.get());
+    RETURN_IF_ERROR(table_res.status);
+    std::unique_ptr<sstable::Table> table(table_res.obj);
+    std::unique_ptr<sstable::Iterator> it(table->NewIterator());
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      sorting_builder_->Add(it->key(), it->value());
+    }
+    st = it->status();
+  }
+  Status close_st = file->Close();
+  return st.ok() ? close_st : st;
+}
+
 util::Status ProtoWriter::Add(const ::google::protobuf::MessageLite& msg) {
   CHECK_EQ(dscr_->full_name(), msg.GetTypeName());
+  RETURN_IF_ERROR(StartRecord());
+
+  const int msg_size = msg.ByteSize();
+  uint8* dest = nullptr;
+  RETURN_IF_ERROR(writer_->ReserveRecord(msg_size, &dest));
+  if (dest != nullptr) {
+    msg.SerializeWithCachedSizesToArray(dest);
+    return Status::OK;
+  }
 
-  return AddSerialized(msg.SerializeAsString());
+  // Large records are fragmented by AddRecord().
+  value_buf_.resize(msg_size);
+  msg.SerializeWithCachedSizesToArray(reinterpret_cast<uint8*>(&value_buf_[0]));
+  return writer_->AddRecord(value_buf_);
 }
 
 util::Status ProtoWriter::AddSerialized(const std::string& data) {
+  RETURN_IF_ERROR(StartRecord());
+  return writer_->AddRecord(data);
+}
+
+util::Status ProtoWriter::StartRecord() {
   CHECK(writer_);
   if (!was_init_) {
     RETURN_IF_ERROR(writer_->Init());
@@ -108,28 +164,31 @@ util::Status ProtoWriter::AddSerialized(const std::string& data) {
     writer_->AddMeta(kProtoTypeKey, dscr_->full_name());
     RETURN_IF_ERROR(writer_->Init());
   }
-  return writer_->AddRecord(data);
+  return Status::OK;
 }
 
 util::Status ProtoWriter::Add(strings::Slice key, const ::google::protobuf::MessageLite& msg) {
   CHECK_EQ(dscr_->full_name(), msg.GetTypeName());
-   if (options_.format == SSTABLE) {
-    if (!key.empty()) {
-      char* ptr = arena_.Allocate(key.size());
-      memcpy(ptr, key.data(), key.size());
-      key = Slice(ptr, key.size());
-    }
-    int msg_size = msg.ByteSize();
-    strings::Slice value;
-    if (msg_size > 0) {
-      char* ptr = arena_.Allocate(msg_size);
-      msg.SerializeWithCachedSizesToArray(reinterpret_cast<uint8*>(ptr));
-      value.set(ptr, msg_size);
-    }
-    k_v_vec_.emplace_back(key, value);
-  } else {
+  if (options_.format != SSTABLE) {
     LOG(FATAL) << "Incorrect call";
   }
+  int msg_size = msg.ByteSize();
+  value_buf_.resize(msg_size);
+  msg.SerializeWithCachedSizesToArray(reinterpret_cast<uint8*>(&value_buf_[0]));
+
+  if (!sorting_builder_) {
+    int res = num_streamed_ == 0 ? 1 : key.compare(Slice(last_key_));
+    if (res > 0) {
+      table_builder_->Add(key, value_buf_);
+      last_key_.assign(key.data(), key.size());
+      ++num_streamed_;
+      return table_builder_->status();
+    }
+    if (res == 0)
+      return Status::OK;  // The first message of a key wins, as with SortingBuilder.
+    RETURN_IF_ERROR(StartSorting());
+  }
+  sorting_builder_->Add(key, value_buf_);
   return Status::OK;
 }
 
@@ -142,12 +201,12 @@ util::Status ProtoWriter::Flush() {
     return writer_->Flush();
   }
   if (options_.format == SSTABLE) {
-    auto cmp = [](const KVSlice& a, const KVSlice& b) { return a.first.compare(b.first) < 0;};
-    std::sort(k_v_vec_.begin(), k_v_vec_.end(), cmp);
-    for (const auto& k_v : k_v_vec_) {
-      table_builder_->Add(k_v.first, k_v.second);
+    if (sorting_builder_) {
+      OpenTable();
+      RETURN_IF_ERROR(sorting_builder_->Finish(table_builder_.get()));
+    } else {
+      RETURN_IF_ERROR(table_builder_->Finish());
     }
-    RETURN_IF_ERROR(table_builder_->Finish());
     return sink_->Flush();
   }
   return Status::OK;
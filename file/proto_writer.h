@@ -8,7 +8,6 @@
 
 #include "strings/stringpiece.h"
 #include "base/status.h"
-#include "base/arena.h"
 
 namespace google {
 namespace protobuf {
@@ -29,6 +28,7 @@ extern const char kProtoSetKey[];
 extern const char kProtoTypeKey[];
 
 namespace sstable {
+class SortingBuilder;
 class TableBuilder;
 }  // namespace sstable
 
@@ -37,8 +37,9 @@ enum ProtoWriterFormat {LIST_FILE, SSTABLE};
 struct ProtoWriterOptions {
   ProtoWriterFormat format;
 
+  // LZ4 blocks can be read only by readers built with the LZ4 codec.
   enum CompressMethod {SNAPPY_COMPRESS = 1, ZLIB_COMPRESS = 2, LZ4_COMPRESS = 3} compress_method
-        = LZ4_COMPRESS;
+        = ZLIB_COMPRESS;
   uint8 compress_level = 1;
 
   // if max_entries_per_file > 0 then
@@ -50,6 +51,11 @@ struct ProtoWriterOptions {
   // Whether to append to the existing file or otherwrite it.
   bool append = false;
 
+  // SSTABLE format: memory for sorting the entries when keys are not added in increasing
+  // order. Sorted runs that exceed it are spilled to temporary files next to the table and
+  // merged by Flush().
+  uint32 sstable_sort_mb = 256;
+
   ProtoWriterOptions() : format(LIST_FILE) {}
 };
 
@@ -60,15 +66,21 @@ class ProtoWriter {
   std::unique_ptr<util::Sink> sink_;
   std::unique_ptr<sstable::TableBuilder> table_builder_;
 
-  typedef std::pair<strings::Slice, strings::Slice> KVSlice;
-  std::vector<KVSlice> k_v_vec_;
+  // SSTABLE format: entries are streamed into table_builder_ while their keys increase and
+  // go through sorting_builder_ from the first key that does not.
+  std::unique_ptr<sstable::SortingBuilder> sorting_builder_;
+  std::string last_key_;
+  uint64 num_streamed_ = 0;
+
+  // Serialized messages that are not written in place, reused between records.
+  std::string value_buf_;
+
   const ::google::protobuf::Descriptor* dscr_;
-  base::Arena arena_;
 
   bool was_init_ = false;
   uint32 entries_per_shard_ = 0;
   uint32 shard_index_ = 0;
-  std::string base_name_, fd_set_str_;
+  std::string file_name_, base_name_, fd_set_str_;
 public:
   typedef ProtoWriterFormat Format;
   typedef ProtoWriterOptions Options;
@@ -78,10 +90,14 @@ public:
 
   ~ProtoWriter();
 
+  // Serializes msg directly into the block of the list writer, unless the record has to be
+  // split between blocks.
   base::Status Add(const ::google::protobuf::MessageLite& msg);
   base::Status AddSerialized(const std::string& data);
 
-  // Used for key-value tables.
+  // Used for key-value tables. Keys may come in any order. When a key is added more than
+  // once, the table keeps the first message. Keys that are added in increasing order are
+  // written directly, without buffering.
   base::Status Add(strings::Slice key, const ::google::protobuf::MessageLite& msg);
 
   base::Status Flush();
@@ -89,6 +105,14 @@ public:
   const ListWriter* writer() const { return writer_.get();}
   const std::string& GetTypeName() const { return dscr_->full_name(); }
  private:
+  // Initializes the list writer or moves to the next shard before adding a record.
+  base::Status StartRecord();
+
+  void OpenTable();
+
+  // Moves the entries that were streamed into the table to sorting_builder_.
+  base::Status StartSorting();
+
   Options options_;
 };
 
@@ -0,0 +1,156 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/proto_writer.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "base/gtest.h"
+#include "base/random.h"
+#include "base/status.pb.h"
+#include "file/file.h"
+#include "file/list_file.h"
+#include "file/sstable/sstable.h"
+#include "strings/stringprintf.h"
+
+namespace file {
+
+using std::string;
+using strings::Slice;
+
+class ProtoWriterTest : public testing::Test {
+ protected:
+  static string Key(unsigned i) { return StringPrintf("key%07u", i); }
+
+  static base::StatusProto Message(unsigned i, unsigned version = 0) {
+    base::StatusProto msg;
+    msg.set_status_code(base::StatusCode::IO_ERROR);
+    msg.add_error_msg(StringPrintf("error %u.%u", i, version) + string(i % 100, 'e'));
+    return msg;
+  }
+
+  // Checks that the table at path_ maps Key(i) to Message(i, version(i)) for i in [0, count).
+  template <typename Version> void VerifyTable(unsigned count, Version version) {
+    auto res = ReadonlyFile::Open(path_);
+    ASSERT_TRUE(res.ok()) << res.status;
+    std::unique_ptr<ReadonlyFile> file(res.obj);
+    auto table_res = sstable::Table::Open(sstable::ReadOptions(), file.get());
+    ASSERT_TRUE(table_res.ok()) << table_res.status;
+    std::unique_ptr<sstable::Table> table(table_res.obj);
+    EXPECT_EQ(base::StatusProto::descriptor()->full_name(),
+              table->GetMeta().at(kProtoTypeKey));
+
+    std::unique_ptr<sstable::Iterator> it(table->NewIterator());
+    unsigned n = 0;
+    base::StatusProto msg;
+    for (it->SeekToFirst(); it->Valid(); it->Next(), ++n) {
+      ASSERT_EQ(Key(n), it->key());
+      ASSERT_TRUE(msg.ParseFromArray(it->value().data(), it->value().size()));
+      ASSERT_EQ(Message(n, version(n)).SerializeAsString(), msg.SerializeAsString()) << n;
+    }
+    EXPECT_TRUE(it->status().ok());
+    EXPECT_EQ(count, n);
+    table.reset();
+    EXPECT_TRUE(file->Close().ok());
+  }
+
+  void SetUp() override {
+    path_ = base::GetTestTempPath("proto_writer.sst");
+  }
+
+  string path_;
+};
+
+TEST_F(ProtoWriterTest, SortedTable) {
+  const unsigned kCount = 10000;
+  ProtoWriter::Options opts;
+  opts.format = SSTABLE;
+  ProtoWriter writer(path_, base::StatusProto::descriptor(), opts);
+  for (unsigned i = 0; i < kCount; ++i) {
+    ASSERT_TRUE(writer.Add(Key(i), Message(i)).ok());
+    if (i % 10 == 0) {
+      ASSERT_TRUE(writer.Add(Key(i), Message(i, 1)).ok());  // Ignored.
+    }
+  }
+  ASSERT_TRUE(writer.Flush().ok());
+  VerifyTable(kCount, [](unsigned) { return 0; });
+}
+
+TEST_F(ProtoWriterTest, UnsortedTable) {
+  const unsigned kCount = 30000;
+  std::vector<unsigned> order(kCount);
+  for (unsigned i = 0; i < kCount; ++i)
+    order[i] = i;
+  // The first keys are streamed, the rest come in random order.
+  MTRandom rnd(10);
+  for (unsigned i = kCount - 1; i > 1000; --i) {
+    std::swap(order[i], order[1000 + rnd.Rand32() % (i - 999)]);
+  }
+
+  ProtoWriter::Options opts;
+  opts.format = SSTABLE;
+  opts.sstable_sort_mb = 1;  // Spills sorted runs.
+  ProtoWriter writer(path_, base::StatusProto::descriptor(), opts);
+  for (unsigned i : order) {
+    ASSERT_TRUE(writer.Add(Key(i), Message(i, i % 3 == 0)).ok());
+  }
+  // Duplicates of streamed and sorted keys are ignored.
+  for (unsigned i = 0; i < kCount; i += 3) {
+    ASSERT_TRUE(writer.Add(Key(i), Message(i, 2)).ok());
+  }
+  ASSERT_TRUE(writer.Flush().ok());
+  VerifyTable(kCount, [](unsigned i) { return i % 3 == 0; });
+  EXPECT_FALSE(Exists(path_ + ".run00000.lst"));
+}
+
+TEST_F(ProtoWriterTest, ListFile) {
+  // Records of all sizes, from empty to ones that are fragmented between several blocks.
+  path_ = base::GetTestTempPath("proto_writer.lst");
+  std::vector<base::StatusProto> msgs;
+  MTRandom rnd(20);
+  for (unsigned i = 0; i < 3000; ++i) {
+    base::StatusProto msg;
+    msg.set_status_code(base::StatusCode::OK);
+    unsigned size = i % 100 == 99 ? rnd.Rand32() % (1 << 20) : rnd.Skewed(12);
+    msg.add_error_msg(string(size, 'a' + i % 26));
+    msgs.push_back(msg);
+  }
+  {
+    ProtoWriter writer(path_, base::StatusProto::descriptor());
+    for (const auto& msg : msgs) {
+      ASSERT_TRUE(writer.Add(msg).ok());
+    }
+    ASSERT_TRUE(writer.AddSerialized(msgs[0].SerializeAsString()).ok());
+    ASSERT_TRUE(writer.Flush().ok());
+    EXPECT_EQ(msgs.size() + 1, writer.writer()->records_added());
+  }
+  msgs.push_back(msgs[0]);
+
+  ListReader reader(path_);
+  Slice record;
+  string scratch;
+  for (const auto& msg : msgs) {
+    ASSERT_TRUE(reader.ReadRecord(&record, &scratch));
+    ASSERT_EQ(msg.SerializeAsString(), record);
+  }
+  EXPECT_FALSE(reader.ReadRecord(&record, &scratch));
+}
+
+static void BM_AddMessage(benchmark::State& state) {
+  base::StatusProto msg;
+  msg.set_status_code(base::StatusCode::IO_ERROR);
+  msg.add_error_msg(string(state.range_x(), 'e'));
+  ProtoWriter::Options opts;
+  opts.compress_method = ProtoWriter::Options::LZ4_COMPRESS;
+  ProtoWriter writer(base::GetTestTempPath("bench.lst"), base::StatusProto::descriptor(), opts);
+  while (state.KeepRunning()) {
+    CHECK_STATUS(writer.Add(msg));
+  }
+  CHECK_STATUS(writer.Flush());
+  state.SetBytesProcessed(state.iterations() * msg.ByteSize());
+}
+BENCHMARK(BM_AddMessage)->Arg(16)->Arg(256)->Arg(4096);
+
+}  // namespace file
@@ -0,0 +1,700 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/s3_file.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "base/blocking_counter.h"
+#include "base/commandlineflags.h"
+#include "base/logging.h"
+#include "util/sp_task_pool.h"
+
+DEFINE_string(s3_endpoint, "s3.amazonaws.com",
+              "host[:port] of the S3 compatible endpoint that serves s3:// paths");
+DEFINE_int32(s3_read_threads, 16, "Threads that fetch the ranges of remote files. They are "
+             "shared by all the open files.");
+
+using std::string;
+using base::Status;
+using base::StatusCode;
+using strings::Slice;
+
+namespace file {
+
+namespace {
+
+constexpr char kS3Prefix[] = "s3://";
+constexpr char kHttpPrefix[] = "http://";
+
+constexpr unsigned kSocketTimeoutSec = 30;
+constexpr unsigned kMinBackoffMs = 50;
+constexpr unsigned kMaxBackoffMs = 2000;
+constexpr size_t kRecvBufSize = 1 << 14;
+
+// Error bodies up to this size are drained in order to keep the connection alive.
+constexpr int64 kMaxDrainSize = 1 << 16;
+
+struct Url {
+  string host;
+  string port;
+  string path;
+
+  string HostHeader() const { return port == "80" ? host : host + ":" + port; }
+};
+
+bool ParseUrl(StringPiece name, Url* url) {
+  StringPiece host_port;
+  if (name.starts_with(kS3Prefix)) {
+    name.remove_prefix(sizeof(kS3Prefix) - 1);
+    host_port = FLAGS_s3_endpoint;
+    url->path = "/" + name.as_string();
+  } else if (name.starts_with(kHttpPrefix)) {
+    name.remove_prefix(sizeof(kHttpPrefix) - 1);
+    size_t pos = name.find_first_of('/');
+    if (pos == StringPiece::npos)
+      return false;
+    host_port = name.substr(0, pos);
+    url->path = name.substr(pos).as_string();
+  } else {
+    return false;
+  }
+  size_t pos = host_port.find_first_of(':');
+  if (pos == StringPiece::npos) {
+    url->host = host_port.as_string();
+    url->port = "80";
+  } else {
+    url->host = host_port.substr(0, pos).as_string();
+    url->port = host_port.substr(pos + 1).as_string();
+  }
+  return !url->host.empty() && !url->port.empty() && url->path.size() > 1;
+}
+
+Status SocketError(const char* op) {
+  if (errno == EAGAIN || errno == EWOULDBLOCK)
+    return Status(StatusCode::IO_TIMEOUT, string(op) + " timed out");
+  char buf[256];
+  return Status(StatusCode::IO_ERROR, string(op) + ": " + strerror_r(errno, buf, sizeof(buf)));
+}
+
+struct Response {
+  int code = 0;
+  int64 content_length = -1;
+  time_t last_modified = 0;
+  bool keep_alive = true;
+};
+
+// Blocking HTTP/1.1 connection. Not thread-safe.
+class Connection {
+ public:
+  explicit Connection(int fd) : fd_(fd), buf_(new char[kRecvBufSize]) {}
+  ~Connection() { close(fd_); }
+
+  static base::StatusObject<Connection*> Connect(const Url& url);
+
+  Status Send(const string& data);
+
+  // Reads the status line and the headers of the response.
+  Status ReadHeader(Response* resp);
+
+  // Reads exactly n bytes of the body into dest.
+  Status ReadBody(uint8* dest, size_t n);
+  Status SkipBody(size_t n);
+
+ private:
+  Status Fill();
+
+  int fd_;
+  std::unique_ptr<char[]> buf_;
+  size_t begin_ = 0, end_ = 0;  // unconsumed bytes in buf_.
+};
+
+base::StatusObject<Connection*> Connection::Connect(const Url& url) {
+  struct addrinfo hints, *servinfo = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  int res = getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &servinfo);
+  if (res != 0) {
+    return Status(StatusCode::GET_ADDR_INFO_FAILED, url.host + ": " + gai_strerror(res));
+  }
+
+  int fd = -1;
+  for (struct addrinfo* p = servinfo; p != nullptr; p = p->ai_next) {
+    fd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(servinfo);
+
+  if (fd < 0)
+    return SocketError("connect");
+
+  struct timeval tv{kSocketTimeoutSec, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  return new Connection(fd);
+}
+
+Status Connection::Send(const string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t res = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      return SocketError("send");
+    }
+    sent += res;
+  }
+  return Status::OK;
+}
+
+Status Connection::Fill() {
+  if (begin_ == end_) {
+    begin_ = end_ = 0;
+  } else if (end_ == kRecvBufSize) {
+    if (begin_ == 0)
+      return Status(StatusCode::IO_ERROR, "Response header is too large");
+    memmove(buf_.get(), buf_.get() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+  }
+
+  while (true) {
+    ssize_t res = recv(fd_, buf_.get() + end_, kRecvBufSize - end_, 0);
+    if (res > 0) {
+      end_ += res;
+      return Status::OK;
+    }
+    if (res == 0)
+      return Status(StatusCode::IO_END_OF_FILE, "Connection closed by peer");
+    if (errno != EINTR)
+      return SocketError("recv");
+  }
+}
+
+Status Connection::ReadHeader(Response* resp) {
+  const char* hdr_end;
+  while (true) {
+    hdr_end = static_cast<const char*>(memmem(buf_.get() + begin_, end_ - begin_, "\r\n\r\n", 4));
+    if (hdr_end)
+      break;
+    RETURN_IF_ERROR(Fill());
+  }
+
+  StringPiece header(buf_.get() + begin_, hdr_end + 2 - (buf_.get() + begin_));
+  begin_ = hdr_end + 4 - buf_.get();
+
+  size_t eol = header.find_first_of('\n');
+  StringPiece status_line = header.substr(0, eol);
+  // "HTTP/1.1 206 Partial Content"
+  if (!status_line.starts_with("HTTP/1.") || status_line.size() < 12)
+    return Status(StatusCode::IO_ERROR, "Bad status line: " + status_line.as_string());
+  resp->keep_alive = status_line[7] != '0';
+  resp->code = atoi(status_line.data() + 9);
+  resp->content_length = -1;
+  resp->last_modified = 0;
+
+  while (eol != StringPiece::npos) {
+    size_t start = eol + 1;
+    eol = header.find_first_of('\n', start);
+    StringPiece line = header.substr(start, eol == StringPiece::npos ? StringPiece::npos :
+                                                                       eol - start);
+    size_t colon = line.find_first_of(':');
+    if (colon == StringPiece::npos)
+      continue;
+    StringPiece name = line.substr(0, colon);
+    StringPiece value = line.substr(colon + 1);
+    while (!value.empty() && (value[0] == ' ' || value[0] == '\t'))
+      value.remove_prefix(1);
+
+    if (name.size() == 14 && strncasecmp(name.data(), "content-length", 14) == 0) {
+      resp->content_length = strtoll(value.data(), nullptr, 10);
+    } else if (name.size() == 13 && strncasecmp(name.data(), "last-modified", 13) == 0) {
+      // RFC 7231 IMF-fixdate: "Wed, 21 Oct 2015 07:28:00 GMT".
+      struct tm tm;
+      memset(&tm, 0, sizeof(tm));
+      string date = value.as_string();
+      if (strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S", &tm))
+        resp->last_modified = timegm(&tm);
+    } else if (name.size() == 10 && strncasecmp(name.data(), "connection", 10) == 0) {
+      if (value.size() >= 5 && strncasecmp(value.data(), "close", 5) == 0)
+        resp->keep_alive = false;
+      else if (value.size() >= 10 && strncasecmp(value.data(), "keep-alive", 10) == 0)
+        resp->keep_alive = true;
+    }
+  }
+  return Status::OK;
+}
+
+Status Connection::ReadBody(uint8* dest, size_t n) {
+  size_t from_buf = std::min(n, end_ - begin_);
+  memcpy(dest, buf_.get() + begin_, from_buf);
+  begin_ += from_buf;
+  dest += from_buf;
+  n -= from_buf;
+
+  // Large bodies are received directly into the destination.
+  while (n > 0) {
+    ssize_t res = recv(fd_, dest, n, 0);
+    if (res > 0) {
+      dest += res;
+      n -= res;
+      continue;
+    }
+    if (res == 0)
+      return Status(StatusCode::IO_END_OF_FILE, "Connection closed while reading body");
+    if (errno != EINTR)
+      return SocketError("recv");
+  }
+  return Status::OK;
+}
+
+Status Connection::SkipBody(size_t n) {
+  while (n > 0) {
+    if (begin_ == end_) {
+      RETURN_IF_ERROR(Fill());
+    }
+    size_t skip = std::min(n, end_ - begin_);
+    begin_ += skip;
+    n -= skip;
+  }
+  return Status::OK;
+}
+
+// Thread-safe http client that keeps a pool of idle keep-alive connections to a single host.
+class HttpClient {
+ public:
+  explicit HttpClient(const Url& url) : url_(url) {}
+
+  // Returns the size and the modification time of the object.
+  Status Head(size_t* size, time_t* mtime, int* http_code);
+
+  // Fetches exactly [offset, offset + length) into dest.
+  Status GetRange(size_t offset, size_t length, uint8* dest, int* http_code);
+
+  const Url& url() const { return url_; }
+
+  void CloseIdle() {
+    std::lock_guard<std::mutex> lock(mu_);
+    idle_.clear();
+  }
+
+ private:
+  typedef std::unique_ptr<Connection> ConnectionPtr;
+
+  // Sends the request and reads the response header. Transparently reconnects if a pooled
+  // connection turned out to be closed by the server.
+  Status Execute(const string& request, ConnectionPtr* conn, Response* resp);
+
+  void Release(ConnectionPtr conn, const Response& resp) {
+    if (!resp.keep_alive)
+      return;
+    std::lock_guard<std::mutex> lock(mu_);
+    idle_.push_back(std::move(conn));
+  }
+
+  string RequestPrefix(const char* method) const {
+    return string(method) + " " + url_.path + " HTTP/1.1\r\nHost: " + url_.HostHeader() + "\r\n";
+  }
+
+  Status Error(const Response& resp) const {
+    return Status(StatusCode::IO_ERROR, "HTTP " + std::to_string(resp.code) + " for " +
+                  url_.HostHeader() + url_.path);
+  }
+
+  // Consumes the body of a failed response so that the connection can be reused.
+  void DrainError(ConnectionPtr conn, const Response& resp) {
+    if (resp.content_length >= 0 && resp.content_length <= kMaxDrainSize &&
+        conn->SkipBody(resp.content_length).ok()) {
+      Release(std::move(conn), resp);
+    }
+  }
+
+  const Url url_;
+  std::mutex mu_;
+  std::vector<ConnectionPtr> idle_;
+};
+
+Status HttpClient::Execute(const string& request, ConnectionPtr* conn, Response* resp) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!idle_.empty()) {
+      *conn = std::move(idle_.back());
+      idle_.pop_back();
+    }
+  }
+
+  if (*conn) {
+    Status st = (*conn)->Send(request);
+    if (st.ok())
+      st = (*conn)->ReadHeader(resp);
+    if (st.ok())
+      return st;
+    VLOG(1) << "Reconnecting after stale connection error " << st;
+    conn->reset();
+  }
+
+  auto res = Connection::Connect(url_);
+  if (!res.ok())
+    return res.status;
+  conn->reset(res.obj);
+  RETURN_IF_ERROR((*conn)->Send(request));
+  return (*conn)->ReadHeader(resp);
+}
+
+Status HttpClient::Head(size_t* size, time_t* mtime, int* http_code) {
+  ConnectionPtr conn;
+  Response resp;
+  *http_code = 0;
+  RETURN_IF_ERROR(Execute(RequestPrefix("HEAD") + "\r\n", &conn, &resp));
+  *http_code = resp.code;
+
+  // HEAD responses never have a body.
+  if (resp.code != 200)
+    return Error(resp);
+  if (resp.content_length < 0)
+    return Status(StatusCode::IO_ERROR, "Missing Content-Length for " + url_.path);
+  *size = resp.content_length;
+  *mtime = resp.last_modified;
+  Release(std::move(conn), resp);
+  return Status::OK;
+}
+
+Status HttpClient::GetRange(size_t offset, size_t length, uint8* dest, int* http_code) {
+  DCHECK_GT(length, 0);
+
+  string request = RequestPrefix("GET");
+  request.append("Range: bytes=").append(std::to_string(offset)).append("-")
+      .append(std::to_string(offset + length - 1)).append("\r\n\r\n");
+
+  ConnectionPtr conn;
+  Response resp;
+  *http_code = 0;
+  RETURN_IF_ERROR(Execute(request, &conn, &resp));
+  *http_code = resp.code;
+
+  if (resp.code == 206) {
+    if (resp.content_length != int64(length)) {
+      return Status(StatusCode::IO_ERROR, "Unexpected range length " +
+                    std::to_string(resp.content_length) + " vs " + std::to_string(length));
+    }
+    RETURN_IF_ERROR(conn->ReadBody(dest, length));
+    Release(std::move(conn), resp);
+    return Status::OK;
+  }
+
+  if (resp.code == 200) {
+    // The server ignored the range header and sends the whole object. A prefix is picked out
+    // of it and the connection is closed instead of reading the rest. Skipping to other
+    // offsets would download the whole prefix on every read.
+    if (offset > 0) {
+      return Status(StatusCode::IO_ERROR, "Server does not support range requests for " +
+                    url_.HostHeader() + url_.path);
+    }
+    if (resp.content_length >= 0 && uint64(resp.content_length) < length)
+      return Status(StatusCode::IO_ERROR, "Object is shorter than expected");
+    return conn->ReadBody(dest, length);
+  }
+
+  Status st = Error(resp);
+  DrainError(std::move(conn), resp);
+  return st;
+}
+
+// Client errors (besides timeouts and throttling) will not go away if we retry, neither will
+// a server that ignores ranges (200).
+inline bool IsRetriable(int http_code) {
+  return (http_code < 400 && http_code != 200) || http_code >= 500 || http_code == 408 ||
+         http_code == 429;
+}
+
+// Shared by all the remote files, a job may open hundreds of them.
+util::FuncTaskPool* FetchPool() {
+  static util::FuncTaskPool* pool = [] {
+    util::FuncTaskPool* res = new util::FuncTaskPool("s3read", 4,
+                                                     std::max(1, FLAGS_s3_read_threads));
+    res->Launch();
+    return res;
+  }();
+  return pool;
+}
+
+class S3ReadonlyFile : public ReadonlyFile {
+ public:
+  // Retries are handled per range request, hence the base class does not retry.
+  S3ReadonlyFile(HttpClient* client, size_t sz, time_t mtime, const Options& opts);
+
+  virtual ~S3ReadonlyFile() {
+    WARN_IF_ERROR(CloseImpl());
+  }
+
+  Status ReadImpl(size_t offset, size_t length, Slice* result, uint8* buffer) override;
+
+  Status CloseImpl() override;
+
+  size_t Size() const override { return size_; }
+
+  time_t ModificationTime() const override { return mtime_; }
+
+ private:
+  struct Chunk {
+    size_t offset, length;
+    std::unique_ptr<uint8[]> data;
+    Status status;
+    bool ready = false;
+
+    Chunk(size_t o, size_t l) : offset(o), length(l), data(new uint8[l]) {}
+  };
+  typedef std::shared_ptr<Chunk> ChunkPtr;
+
+  // Fetches the range with retries.
+  Status FetchRange(size_t offset, size_t length, uint8* dest);
+
+  // Splits the range into remote_range_size pieces and fetches them in parallel.
+  Status ParallelFetch(size_t offset, size_t length, uint8* dest);
+
+  Status ReadSequential(size_t offset, size_t length, uint8* dest);
+
+  void FetchChunk(const ChunkPtr& chunk);
+
+  void RunTask(std::function<void()> f) {
+    if (pool_)
+      pool_->RunTask(std::move(f));
+    else
+      f();
+  }
+
+  std::unique_ptr<HttpClient> client_;
+  const size_t size_;
+  const time_t mtime_;
+  const size_t range_size_;
+  const size_t prefetch_size_;
+  const bool sequential_;
+  const int retries_;
+  util::FuncTaskPool* pool_ = nullptr;  // Not owned, see FetchPool().
+
+  // Sequential read-ahead state.
+  std::mutex mu_;
+  std::condition_variable chunk_ready_;
+  std::deque<ChunkPtr> window_;  // consecutive chunks starting at or before the read offset.
+  size_t window_end_ = 0;
+  size_t last_read_end_ = 0;
+  unsigned pending_fetches_ = 0;  // FetchChunk tasks that have not finished yet.
+};
+
+S3ReadonlyFile::S3ReadonlyFile(HttpClient* client, size_t sz, time_t mtime,
+                               const Options& opts)
+    : ReadonlyFile(1), client_(client), size_(sz), mtime_(mtime),
+      range_size_(std::max<size_t>(opts.remote_range_size, 1 << 12)),
+      prefetch_size_(range_size_ * std::max(1, opts.remote_parallelism)),
+      sequential_(opts.sequential), retries_(std::max(1, opts.retries)) {
+  if (opts.remote_parallelism > 1)
+    pool_ = FetchPool();
+}
+
+Status S3ReadonlyFile::CloseImpl() {
+  std::unique_lock<std::mutex> lock(mu_);
+  // The pool is shared, hence we wait only for the tasks of this file.
+  chunk_ready_.wait(lock, [this] { return pending_fetches_ == 0; });
+  window_.clear();
+  client_->CloseIdle();
+  return Status::OK;
+}
+
+Status S3ReadonlyFile::FetchRange(size_t offset, size_t length, uint8* dest) {
+  unsigned backoff_ms = kMinBackoffMs;
+  Status st;
+  for (int attempt = 1; ; ++attempt) {
+    int http_code = 0;
+    st = client_->GetRange(offset, length, dest, &http_code);
+    if (st.ok() || attempt >= retries_ || !IsRetriable(http_code))
+      break;
+    LOG(WARNING) << "Retrying range " << offset << "-" << offset + length << " of "
+                 << client_->url().path << " after error " << st;
+    usleep(backoff_ms * 1000);
+    backoff_ms = std::min(backoff_ms * 2, kMaxBackoffMs);
+  }
+  return st;
+}
+
+Status S3ReadonlyFile::ParallelFetch(size_t offset, size_t length, uint8* dest) {
+  size_t num_ranges = (length + range_size_ - 1) / range_size_;
+  if (num_ranges == 1 || !pool_)
+    return FetchRange(offset, length, dest);
+
+  std::vector<Status> statuses(num_ranges);
+  base::BlockingCounter bc(num_ranges - 1);
+  for (size_t i = 1; i < num_ranges; ++i) {
+    size_t start = i * range_size_;
+    size_t len = std::min(range_size_, length - start);
+    pool_->RunTask([this, &statuses, &bc, i, offset, start, len, dest] {
+      statuses[i] = FetchRange(offset + start, len, dest + start);
+      bc.Dec();
+    });
+  }
+  // The calling thread fetches the first range itself.
+  statuses[0] = FetchRange(offset, range_size_, dest);
+  bc.Wait();
+
+  for (const auto& st : statuses) {
+    RETURN_IF_ERROR(st);
+  }
+  return Status::OK;
+}
+
+void S3ReadonlyFile::FetchChunk(const ChunkPtr& chunk) {
+  Status st = FetchRange(chunk->offset, chunk->length, chunk->data.get());
+
+  std::lock_guard<std::mutex> lock(mu_);
+  chunk->status = st;
+  chunk->ready = true;
+  --pending_fetches_;
+  chunk_ready_.notify_all();
+}
+
+Status S3ReadonlyFile::ReadSequential(size_t offset, size_t length, uint8* dest) {
+  const size_t end = offset + length;
+  std::vector<ChunkPtr> to_fetch;
+  std::unique_lock<std::mutex> lock(mu_);
+
+  while (!window_.empty() && window_.front()->offset + window_.front()->length <= offset) {
+    window_.pop_front();
+  }
+  bool hit = !window_.empty() && window_.front()->offset <= offset;
+  if (!hit) {
+    // Chunks that are still in flight own their buffers and will be released by their tasks.
+    window_.clear();
+
+    // We start reading ahead only when we see the second consecutive read.
+    // Otherwise random accesses (sstable lookups, footers) would pay for useless transfers.
+    if (offset != last_read_end_) {
+      last_read_end_ = end;
+      lock.unlock();
+      return ParallelFetch(offset, length, dest);
+    }
+    window_end_ = offset;
+  }
+  last_read_end_ = end;
+
+  size_t fetch_end = std::min(size_, end + prefetch_size_);
+  while (window_end_ < fetch_end) {
+    size_t len = std::min(range_size_, size_ - window_end_);
+    ChunkPtr chunk = std::make_shared<Chunk>(window_end_, len);
+    window_.push_back(chunk);
+    to_fetch.push_back(chunk);
+    ++pending_fetches_;
+    window_end_ += len;
+  }
+
+  // Concurrent readers may change window_ once mu_ is released, hence we pin the chunks that
+  // cover this read.
+  std::vector<ChunkPtr> covering;
+  for (const auto& chunk : window_) {
+    if (chunk->offset >= end)
+      break;
+    covering.push_back(chunk);
+  }
+
+  // FetchChunk may run inline if the pool queues are full, hence we must not hold mu_.
+  lock.unlock();
+  for (const auto& chunk : to_fetch) {
+    RunTask([this, chunk] { FetchChunk(chunk); });
+  }
+  lock.lock();
+
+  size_t pos = offset;
+  for (const auto& chunk : covering) {
+    chunk_ready_.wait(lock, [&chunk] { return chunk->ready; });
+    if (!chunk->status.ok()) {
+      Status st = chunk->status;
+      window_.clear();
+      last_read_end_ = 0;
+      return st;
+    }
+    DCHECK_LE(chunk->offset, pos);
+    size_t from = pos - chunk->offset;
+    size_t n = std::min(chunk->length - from, end - pos);
+    memcpy(dest, chunk->data.get() + from, n);
+    dest += n;
+    pos += n;
+  }
+  DCHECK_EQ(end, pos);
+
+  return Status::OK;
+}
+
+Status S3ReadonlyFile::ReadImpl(size_t offset, size_t length, Slice* result, uint8* buffer) {
+  result->clear();
+  if (length == 0 || offset == size_)
+    return Status::OK;
+  if (offset > size_) {
+    return Status(StatusCode::RUNTIME_ERROR, "Invalid read range");
+  }
+  if (offset + length > size_) {
+    length = size_ - offset;
+  }
+
+  if (sequential_) {
+    RETURN_IF_ERROR(ReadSequential(offset, length, buffer));
+  } else {
+    RETURN_IF_ERROR(ParallelFetch(offset, length, buffer));
+  }
+  *result = Slice(buffer, length);
+
+  return Status::OK;
+}
+
+}  // namespace
+
+bool IsRemoteFile(StringPiece name) {
+  return name.starts_with(kS3Prefix) || name.starts_with(kHttpPrefix);
+}
+
+base::StatusObject<ReadonlyFile*> OpenS3File(StringPiece name,
+                                             const ReadonlyFile::Options& opts) {
+  Url url;
+  if (!ParseUrl(name, &url)) {
+    return Status(StatusCode::INVALID_ARGUMENT, "Invalid url " + name.as_string());
+  }
+  std::unique_ptr<HttpClient> client(new HttpClient(url));
+
+  size_t size = 0;
+  time_t mtime = 0;
+  unsigned backoff_ms = kMinBackoffMs;
+  Status st;
+  for (int attempt = 1; ; ++attempt) {
+    int http_code = 0;
+    st = client->Head(&size, &mtime, &http_code);
+    if (st.ok())
+      return new S3ReadonlyFile(client.release(), size, mtime, opts);
+    if (attempt >= opts.retries || !IsRetriable(http_code))
+      break;
+    usleep(backoff_ms * 1000);
+    backoff_ms = std::min(backoff_ms * 2, kMaxBackoffMs);
+  }
+  return st;
+}
+
+}  // namespace file
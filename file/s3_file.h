@@ -0,0 +1,29 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#pragma once
+
+#include "file/file.h"
+
+namespace file {
+
+// Returns true if name should be served by OpenS3File, i.e. it is an "s3://bucket/key"
+// or "http://host[:port]/path" url.
+bool IsRemoteFile(StringPiece name);
+
+// Opens an object on an S3 compatible http endpoint for reading via ranged GET requests.
+// s3://bucket/key urls are resolved in path style against --s3_endpoint.
+//
+// Reads larger than opts.remote_range_size are split into ranges that are fetched in parallel.
+// If opts.sequential is set, the file prefetches opts.remote_parallelism ranges that follow
+// the last read so that a sequential scan does not stall on round-trips. Each range request
+// is retried up to opts.retries times with exponential backoff.
+// The requests of all the open files run on a single pool of --s3_read_threads threads.
+// Servers that ignore range requests can only serve reads from the start of the object.
+//
+// Requests are not signed, hence only public objects or endpoints that sign
+// on our behalf (proxies, gateways) are supported.
+base::StatusObject<ReadonlyFile*> OpenS3File(StringPiece name,
+                                             const ReadonlyFile::Options& opts) MUST_USE_RESULT;
+
+}  // namespace file
@@ -0,0 +1,396 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/s3_file.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "base/commandlineflags.h"
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "file/list_file.h"
+#include "util/sinksource.h"
+
+DECLARE_string(s3_endpoint);
+
+namespace file {
+
+using strings::Slice;
+using std::string;
+
+namespace {
+
+// Minimal in-process http server that serves HEAD and ranged GET requests for a fixed set
+// of objects.
+class FakeS3Server {
+ public:
+  FakeS3Server();
+  ~FakeS3Server();
+
+  void Put(const string& path, const string& contents) { objects_[path] = contents; }
+
+  // Responds with 503 to the next n GET requests.
+  void FailNext(int n) { fail_next_ = n; }
+
+  // Responds to GET requests with the whole object like servers without range support.
+  void IgnoreRanges() { ignore_ranges_ = true; }
+
+  unsigned port() const { return port_; }
+  int get_requests() const { return get_requests_; }
+  int connections() const { return connections_; }
+
+  string Url(const string& path) const {
+    return "http://127.0.0.1:" + std::to_string(port_) + path;
+  }
+
+ private:
+  void AcceptLoop();
+  void Serve(int fd);
+  bool HandleRequest(int fd, const string& header);
+
+  int listen_fd_;
+  unsigned port_;
+  std::map<string, string> objects_;
+  std::atomic_int fail_next_{0}, get_requests_{0}, connections_{0};
+  std::atomic_bool ignore_ranges_{false};
+
+  std::thread accept_thread_;
+  std::mutex mu_;
+  std::vector<int> fds_;
+  std::vector<std::thread> workers_;
+};
+
+FakeS3Server::FakeS3Server() {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(listen_fd_, 0);
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  CHECK_EQ(0, bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)));
+  CHECK_EQ(0, listen(listen_fd_, 16));
+
+  socklen_t len = sizeof(addr);
+  CHECK_EQ(0, getsockname(listen_fd_, (struct sockaddr*)&addr, &len));
+  port_ = ntohs(addr.sin_port);
+
+  accept_thread_ = std::thread(&FakeS3Server::AcceptLoop, this);
+}
+
+FakeS3Server::~FakeS3Server() {
+  shutdown(listen_fd_, SHUT_RDWR);
+  accept_thread_.join();
+  close(listen_fd_);
+
+  std::lock_guard<std::mutex> lock(mu_);
+  for (int fd : fds_)
+    shutdown(fd, SHUT_RDWR);
+  for (auto& t : workers_)
+    t.join();
+  for (int fd : fds_)
+    close(fd);
+}
+
+void FakeS3Server::AcceptLoop() {
+  while (true) {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0)
+      break;
+    ++connections_;
+    std::lock_guard<std::mutex> lock(mu_);
+    fds_.push_back(fd);
+    workers_.emplace_back(&FakeS3Server::Serve, this, fd);
+  }
+}
+
+void FakeS3Server::Serve(int fd) {
+  string buf;
+  char tmp[4096];
+  while (true) {
+    size_t pos = buf.find("\r\n\r\n");
+    if (pos == string::npos) {
+      ssize_t res = recv(fd, tmp, sizeof(tmp), 0);
+      if (res <= 0)
+        return;
+      buf.append(tmp, res);
+      continue;
+    }
+    string header = buf.substr(0, pos + 2);
+    buf.erase(0, pos + 4);
+    if (!HandleRequest(fd, header))
+      return;
+  }
+}
+
+bool FakeS3Server::HandleRequest(int fd, const string& header) {
+  char method[16], path[256];
+  CHECK_EQ(2, sscanf(header.c_str(), "%15s %255s", method, path));
+
+  string response;
+  auto it = objects_.find(path);
+  bool is_get = strcmp(method, "GET") == 0;
+
+  if (is_get)
+    ++get_requests_;
+
+  if (is_get && fail_next_ > 0) {
+    --fail_next_;
+    response = "HTTP/1.1 503 Slow Down\r\nContent-Length: 4\r\n\r\nbusy";
+  } else if (it == objects_.end()) {
+    response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+  } else if (!is_get || ignore_ranges_) {
+    response = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(it->second.size()) +
+               "\r\n\r\n";
+    if (is_get)
+      response.append(it->second);
+  } else {
+    const string& obj = it->second;
+    size_t range = header.find("Range: bytes=");
+    CHECK_NE(string::npos, range);
+    size_t first = 0, last = 0;
+    CHECK_EQ(2, sscanf(header.c_str() + range, "Range: bytes=%zu-%zu", &first, &last));
+    if (first >= obj.size()) {
+      response = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n";
+    } else {
+      last = std::min(last, obj.size() - 1);
+      response = "HTTP/1.1 206 Partial Content\r\nContent-Length: " +
+                 std::to_string(last + 1 - first) + "\r\n\r\n";
+      response.append(obj, first, last + 1 - first);
+    }
+  }
+
+  size_t sent = 0;
+  while (sent < response.size()) {
+    ssize_t res = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if (res <= 0)
+      return false;
+    sent += res;
+  }
+  return true;
+}
+
+string RandomString(size_t len) {
+  string res(len, '\0');
+  for (size_t i = 0; i < len; ++i)
+    res[i] = 'a' + (i * 7919 + i / 13) % 26;
+  return res;
+}
+
+}  // namespace
+
+class S3FileTest : public testing::Test {
+ protected:
+  string ReadAll(ReadonlyFile* file, size_t chunk) {
+    string res;
+    std::unique_ptr<uint8[]> buf(new uint8[chunk]);
+    Slice result;
+    for (size_t offset = 0; offset < file->Size(); offset += result.size()) {
+      CHECK(file->Read(offset, chunk, &result, buf.get()).ok());
+      CHECK(!result.empty());
+      res.append(result.data(), result.size());
+    }
+    return res;
+  }
+
+  FakeS3Server server_;
+};
+
+TEST_F(S3FileTest, Basic) {
+  string contents = RandomString(1000);
+  server_.Put("/bucket/small", contents);
+
+  auto res = ReadonlyFile::Open(server_.Url("/bucket/small"));
+  ASSERT_TRUE(res.ok()) << res.status;
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  EXPECT_EQ(1000, file->Size());
+
+  uint8 buf[200];
+  Slice result;
+  ASSERT_TRUE(file->Read(10, 100, &result, buf).ok());
+  EXPECT_EQ(contents.substr(10, 100), result.as_string());
+
+  // Reads past the end are truncated.
+  ASSERT_TRUE(file->Read(950, 200, &result, buf).ok());
+  EXPECT_EQ(contents.substr(950), result.as_string());
+
+  ASSERT_TRUE(file->Read(1000, 10, &result, buf).ok());
+  EXPECT_TRUE(result.empty());
+  EXPECT_TRUE(file->Close().ok());
+
+  // All the requests should have reused a single keep-alive connection.
+  EXPECT_EQ(1, server_.connections());
+}
+
+TEST_F(S3FileTest, ParallelRanges) {
+  string contents = RandomString(1 << 20);
+  server_.Put("/bucket/big", contents);
+
+  ReadonlyFile::Options opts;
+  opts.sequential = false;
+  opts.remote_range_size = 1 << 14;
+  opts.remote_parallelism = 4;
+
+  auto res = ReadonlyFile::Open(server_.Url("/bucket/big"), opts);
+  ASSERT_TRUE(res.ok()) << res.status;
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+
+  std::unique_ptr<uint8[]> buf(new uint8[contents.size()]);
+  Slice result;
+  ASSERT_TRUE(file->Read(0, contents.size(), &result, buf.get()).ok());
+  EXPECT_TRUE(result.as_string() == contents);
+  EXPECT_EQ(64, server_.get_requests());
+  EXPECT_TRUE(file->Close().ok());
+}
+
+TEST_F(S3FileTest, SequentialPrefetch) {
+  string contents = RandomString(300000);
+  server_.Put("/bucket/seq", contents);
+
+  ReadonlyFile::Options opts;
+  opts.remote_range_size = 1 << 14;
+
+  auto res = ReadonlyFile::Open(server_.Url("/bucket/seq"), opts);
+  ASSERT_TRUE(res.ok()) << res.status;
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+
+  // Reads that are not aligned with the ranges.
+  EXPECT_TRUE(ReadAll(file.get(), 10000) == contents);
+
+  // A random access after the scan.
+  uint8 buf[100];
+  Slice result;
+  ASSERT_TRUE(file->Read(1234, 100, &result, buf).ok());
+  EXPECT_EQ(contents.substr(1234, 100), result.as_string());
+  EXPECT_TRUE(file->Close().ok());
+}
+
+// Interleaved sequential scans by several threads keep replacing the read-ahead window
+// under each other.
+TEST_F(S3FileTest, ConcurrentSequential) {
+  string contents = RandomString(200000);
+  server_.Put("/bucket/shared", contents);
+
+  ReadonlyFile::Options opts;
+  opts.remote_range_size = 1 << 12;
+  opts.remote_parallelism = 4;
+
+  auto res = ReadonlyFile::Open(server_.Url("/bucket/shared"), opts);
+  ASSERT_TRUE(res.ok()) << res.status;
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+
+  std::vector<std::thread> threads;
+  std::atomic_int mismatches{0};
+  for (unsigned t = 0; t < 8; ++t) {
+    threads.emplace_back([&, t] {
+      // Every thread scans from its own start offset with its own read size.
+      size_t chunk = 1000 + t * 777;
+      std::unique_ptr<uint8[]> buf(new uint8[chunk]);
+      Slice result;
+      for (unsigned pass = 0; pass < 3; ++pass) {
+        for (size_t offset = t * 5000; offset < contents.size(); offset += result.size()) {
+          CHECK(file->Read(offset, chunk, &result, buf.get()).ok());
+          CHECK(!result.empty());
+          if (result != Slice(contents.data() + offset, result.size()))
+            ++mismatches;
+        }
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  EXPECT_EQ(0, mismatches);
+  EXPECT_TRUE(file->Close().ok());
+}
+
+TEST_F(S3FileTest, ListFile) {
+  using namespace list_file;
+
+  util::StringSink* sink = new util::StringSink;
+  ListWriter writer(sink);
+  ASSERT_TRUE(writer.Init().ok());
+  for (unsigned i = 0; i < 10000; ++i) {
+    ASSERT_TRUE(writer.AddRecord("record" + std::to_string(i)).ok());
+  }
+  ASSERT_TRUE(writer.Flush().ok());
+  server_.Put("/bucket/dir/records.lst", sink->contents());
+
+  FLAGS_s3_endpoint = "127.0.0.1:" + std::to_string(server_.port());
+  ListReader reader("s3://bucket/dir/records.lst");
+  Slice record;
+  string scratch;
+  unsigned index = 0;
+  while (reader.ReadRecord(&record, &scratch)) {
+    ASSERT_EQ("record" + std::to_string(index), record.as_string());
+    ++index;
+  }
+  EXPECT_EQ(10000, index);
+}
+
+TEST_F(S3FileTest, Retries) {
+  string contents = RandomString(5000);
+  server_.Put("/bucket/flaky", contents);
+
+  ReadonlyFile::Options opts;
+  opts.retries = 3;
+  auto res = ReadonlyFile::Open(server_.Url("/bucket/flaky"), opts);
+  ASSERT_TRUE(res.ok()) << res.status;
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+
+  uint8 buf[5000];
+  Slice result;
+  server_.FailNext(2);
+  ASSERT_TRUE(file->Read(0, 5000, &result, buf).ok());
+  EXPECT_TRUE(result.as_string() == contents);
+  EXPECT_EQ(3, server_.get_requests());
+
+  opts.retries = 1;
+  res = ReadonlyFile::Open(server_.Url("/bucket/flaky"), opts);
+  ASSERT_TRUE(res.ok()) << res.status;
+  file.reset(res.obj);
+  server_.FailNext(1);
+  EXPECT_FALSE(file->Read(0, 5000, &result, buf).ok());
+}
+
+TEST_F(S3FileTest, IgnoredRanges) {
+  string contents = RandomString(5000);
+  server_.Put("/bucket/norange", contents);
+  server_.IgnoreRanges();
+
+  ReadonlyFile::Options opts;
+  opts.retries = 3;
+  opts.sequential = false;
+  auto res = ReadonlyFile::Open(server_.Url("/bucket/norange"), opts);
+  ASSERT_TRUE(res.ok()) << res.status;
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+
+  // The prefix of the object can still be read.
+  uint8 buf[100];
+  Slice result;
+  ASSERT_TRUE(file->Read(0, 100, &result, buf).ok());
+  EXPECT_EQ(contents.substr(0, 100), result.as_string());
+
+  // Other reads fail without retries rather than download the object up to the offset.
+  EXPECT_FALSE(file->Read(1000, 100, &result, buf).ok());
+  EXPECT_EQ(2, server_.get_requests());
+  EXPECT_TRUE(file->Close().ok());
+}
+
+TEST_F(S3FileTest, NotFound) {
+  auto res = ReadonlyFile::Open(server_.Url("/bucket/missing"));
+  EXPECT_FALSE(res.ok());
+
+  res = ReadonlyFile::Open("http://127.0.0.1/");
+  EXPECT_FALSE(res.ok());
+}
+
+}  // namespace file
@@ -8,6 +8,7 @@
 
 #include <vector>
 #include <algorithm>
+#include "base/endian.h"
 #include "file/sstable/format.h"
 #include "file/sstable/iterator.h"
 #include "util/coding/fixed.h"
@@ -29,13 +30,37 @@ inline Status Corruption(const char* str) {
 
 inline uint32 Block::NumRestarts() const {
   DCHECK_GE(size_, sizeof(uint32));
-  return coding::DecodeFixed32(data_ + size_ - sizeof(uint32));
+  return coding::DecodeFixed32(data_ + size_ - sizeof(uint32)) & ~kBlockHashIndexFlag;
 }
 
-Block::Block(const BlockContents& contents)
-    : data_(contents.data.ubuf()),
-      size_(contents.data.size()),
-      owned_(contents.heap_allocated) {
+Block::Block(const BlockContents& contents) {
+  Init(contents);
+}
+
+void Block::Reset(const BlockContents& contents) {
+  if (owned_) {
+    delete[] data_;
+  }
+  Init(contents);
+}
+
+void Block::Init(const BlockContents& contents) {
+  data_ = contents.data.ubuf();
+  size_ = contents.data.size();
+  owned_ = contents.heap_allocated;
+  pin_ = contents.pin;
+  restart_offset_ = data_end_ = num_buckets_ = 0;
+  key_size_ = value_size_ = num_entries_ = 0;
+  values_ = value_ends_ = nullptr;
+
+  if (size_ >= sizeof(uint32)) {
+    uint32 trailer = coding::DecodeFixed32(data_ + size_ - sizeof(uint32));
+    if (trailer & kBlockFixedWidthFlag) {
+      InitFixedWidth(trailer & ~kBlockFixedWidthFlag);
+      return;
+    }
+  }
+
   if (size_ < sizeof(uint32)) {
     size_ = 0;  // Error marker
   } else {
@@ -46,8 +71,110 @@ Block::Block(const BlockContents& contents)
       size_ = 0;
     } else {
       restart_offset_ = size_ - (1 + num_restarts) * sizeof(uint32);
+      data_end_ = restart_offset_;
+    }
+  }
+
+  if (size_ > 0 && (coding::DecodeFixed32(data_ + size_ - sizeof(uint32)) & kBlockHashIndexFlag)) {
+    uint32 num_buckets = 0;
+    if (restart_offset_ >= sizeof(uint32)) {
+      num_buckets = coding::DecodeFixed32(data_ + restart_offset_ - sizeof(uint32));
+    }
+    if (num_buckets == 0 || num_buckets > kBlockHashMaxBuckets ||
+        num_buckets + sizeof(uint32) > restart_offset_) {
+      size_ = 0;  // Corrupted hash index.
+    } else {
+      num_buckets_ = num_buckets;
+      data_end_ = restart_offset_ - sizeof(uint32) - num_buckets;
+    }
+  }
+}
+
+void Block::InitFixedWidth(uint32 num_entries) {
+  constexpr size_t kTrailerSize = 3 * sizeof(uint32);
+  if (size_ < kTrailerSize) {
+    size_ = 0;
+    return;
+  }
+  const uint32 key_size = coding::DecodeFixed32(data_ + size_ - 2 * sizeof(uint32));
+  const uint32 value_size = coding::DecodeFixed32(data_ + size_ - kTrailerSize);
+  const uint64 data_size = size_ - kTrailerSize;
+  const uint64 keys_size = uint64(num_entries) * key_size;
+  const uint64 ends_size = value_size == 0 ? uint64(num_entries) * sizeof(uint32) : 0;
+  if (key_size == 0 || keys_size + ends_size > data_size) {
+    size_ = 0;
+    return;
+  }
+  const uint64 values_size = data_size - keys_size - ends_size;
+  values_ = data_ + keys_size;
+  if (value_size > 0) {
+    if (values_size != uint64(num_entries) * value_size) {
+      size_ = 0;
+      return;
+    }
+  } else {
+    // Validate the offsets once, so that FixedValue() does not need to.
+    value_ends_ = values_ + values_size;
+    uint32 prev = 0;
+    for (uint32 i = 0; i < num_entries; ++i) {
+      uint32 end = coding::DecodeFixed32(value_ends_ + i * sizeof(uint32));
+      if (end < prev || end > values_size) {
+        size_ = 0;
+        return;
+      }
+      prev = end;
     }
   }
+  key_size_ = key_size;
+  value_size_ = value_size;
+  num_entries_ = num_entries;
+}
+
+Slice Block::FixedValue(uint32 i) const {
+  if (value_size_ > 0) {
+    return Slice(values_ + i * value_size_, value_size_);
+  }
+  uint32 start = i == 0 ? 0 : coding::DecodeFixed32(value_ends_ + (i - 1) * sizeof(uint32));
+  uint32 end = coding::DecodeFixed32(value_ends_ + i * sizeof(uint32));
+  return Slice(values_ + start, end - start);
+}
+
+// Returns the index of the first element in [0, count) for which less() is false, or count.
+// The loop has no data dependent branches: the compiler turns the update of base into a
+// conditional move, so there are no mispredictions and the loads of the next iteration
+// do not wait for the comparison.
+template <typename Less> static inline uint32 BranchFreeLowerBound(uint32 count, Less less) {
+  if (count == 0)
+    return 0;
+  uint32 base = 0;
+  while (count > 1) {
+    uint32 half = count / 2;
+    base = less(base + half) ? base + half : base;
+    count -= half;
+  }
+  return base + less(base);
+}
+
+uint32 Block::FixedLowerBound(const Slice& target) const {
+  const uint8* keys = data_;
+  // Keys of 8 and 4 bytes are compared as big-endian integers.
+  if (target.size() == key_size_) {
+    if (key_size_ == 8) {
+      const uint64 val = BigEndian::Load64(target.data());
+      return BranchFreeLowerBound(num_entries_, [keys, val](uint32 i) {
+        return BigEndian::Load64(keys + i * 8) < val;
+      });
+    }
+    if (key_size_ == 4) {
+      const uint32 val = BigEndian::Load32(target.data());
+      return BranchFreeLowerBound(num_entries_, [keys, val](uint32 i) {
+        return BigEndian::Load32(keys + i * 4) < val;
+      });
+    }
+  }
+  return BranchFreeLowerBound(num_entries_, [this, &target](uint32 i) {
+    return FixedKey(i).compare(target) < 0;
+  });
 }
 
 Block::~Block() {
@@ -83,11 +210,13 @@ class Block::Iter : public Iterator {
   const uint8* const data_;      // underlying block contents
   uint32 const restarts_;     // Offset of restart array (list of fixed32)
   uint32 const num_restarts_; // Number of uint32 entries in restart array
+  uint32 const data_end_;     // Offset past the last entry (start of the hash index if any)
 
-  // current_ is offset in data_ of current entry.  >= restarts_ if !Valid
+  // current_ is offset in data_ of current entry.  >= data_end_ if !Valid
   uint32 current_;
   uint32 restart_index_;  // Index of restart block in which current_ falls
-  std::string key_;
+  std::string own_key_;
+  std::string& key_;      // own_key_ or the buffer of the caller.
   Slice value_;
   Status status_;
 
@@ -118,15 +247,19 @@ class Block::Iter : public Iterator {
  public:
   Iter(const uint8* data,
        uint32 restarts,
-       uint32 num_restarts)
+       uint32 num_restarts,
+       uint32 data_end,
+       std::string* key_buf = nullptr)
       : data_(data),
         restarts_(restarts),
         num_restarts_(num_restarts),
-        current_(restarts_),
-        restart_index_(num_restarts_) {
+        data_end_(data_end),
+        current_(data_end_),
+        restart_index_(num_restarts_),
+        key_(key_buf ? *key_buf : own_key_) {
   }
 
-  virtual bool Valid() const { return current_ < restarts_; }
+  virtual bool Valid() const { return current_ < data_end_; }
   virtual Status status() const { return status_; }
   virtual Slice key() const {
     DCHECK(Valid());
@@ -150,7 +283,7 @@ class Block::Iter : public Iterator {
     while (GetRestartPoint(restart_index_) >= original) {
       if (restart_index_ == 0) {
         // No more entries
-        current_ = restarts_;
+        current_ = data_end_;
         restart_index_ = num_restarts_;
         return;
       }
@@ -173,7 +306,7 @@ class Block::Iter : public Iterator {
       uint32 region_offset = GetRestartPoint(mid);
       uint32 shared, non_shared, value_length;
       const uint8* key_ptr = DecodeEntry(data_ + region_offset,
-                                         data_ + restarts_,
+                                         data_ + data_end_,
                                          &shared, &non_shared, &value_length);
       if (key_ptr == NULL || (shared != 0)) {
         CorruptionError();
@@ -211,14 +344,26 @@ class Block::Iter : public Iterator {
 
   virtual void SeekToLast() {
     SeekToRestartPoint(num_restarts_ - 1);
-    while (ParseNextKey() && NextEntryOffset() < restarts_) {
+    while (ParseNextKey() && NextEntryOffset() < data_end_) {
       // Keep skipping
     }
   }
 
+  // Looks for the exact key within the interval of a single restart point.
+  // Returns false if it is not there.
+  bool SeekInRestartInterval(uint32 index, const Slice& target) {
+    SeekToRestartPoint(index);
+    while (ParseNextKey() && restart_index_ <= index) {
+      int res = Compare(key_, target);
+      if (res >= 0)
+        return res == 0;
+    }
+    return false;
+  }
+
  private:
   void CorruptionError() {
-    current_ = restarts_;
+    current_ = data_end_;
     restart_index_ = num_restarts_;
     status_ = Corruption("bad entry in block");
     key_.clear();
@@ -228,10 +373,10 @@ class Block::Iter : public Iterator {
   bool ParseNextKey() {
     current_ = NextEntryOffset();
     const uint8* p = data_ + current_;
-    const uint8* limit = data_ + restarts_;  // Restarts come right after data
+    const uint8* limit = data_ + data_end_;  // Restarts or hash index come right after data
     if (p >= limit) {
       // No more entries to return.  Mark as invalid.
-      current_ = restarts_;
+      current_ = data_end_;
       restart_index_ = num_restarts_;
       return false;
     }
@@ -255,16 +400,125 @@ class Block::Iter : public Iterator {
   }
 };
 
+// Iterates over a block with the fixed width layout.
+class Block::FixedIter : public Iterator {
+ public:
+  explicit FixedIter(const Block* block) : block_(block), current_(block->num_entries_) {}
+
+  bool Valid() const override { return current_ < block_->num_entries_; }
+  Status status() const override { return Status::OK; }
+
+  Slice key() const override {
+    DCHECK(Valid());
+    return block_->FixedKey(current_);
+  }
+
+  Slice value() const override {
+    DCHECK(Valid());
+    return block_->FixedValue(current_);
+  }
+
+  void Next() override {
+    DCHECK(Valid());
+    ++current_;
+  }
+
+  void Prev() override {
+    DCHECK(Valid());
+    current_ = current_ == 0 ? block_->num_entries_ : current_ - 1;
+  }
+
+  void Seek(const Slice& target) override {
+    current_ = block_->FixedLowerBound(target);
+  }
+
+  void SeekToFirst() override { current_ = 0; }
+
+  void SeekToLast() override {
+    current_ = block_->num_entries_ == 0 ? 0 : block_->num_entries_ - 1;
+  }
+
+ private:
+  const Block* block_;
+  uint32 current_;  // num_entries_ if not valid.
+};
+
 Iterator* Block::NewIterator() {
   if (size_ < sizeof(uint32)) {
     return NewErrorIterator(Corruption("bad block contents"));
   }
+  if (fixed_width()) {
+    return new FixedIter(this);
+  }
   const uint32 num_restarts = NumRestarts();
   if (num_restarts == 0) {
     return NewEmptyIterator();
   } else {
-    return new Iter(data_, restart_offset_, num_restarts);
+    return new Iter(data_, restart_offset_, num_restarts, data_end_);
+  }
+}
+
+bool Block::Get(const Slice& key, Slice* value, Status* status, std::string* key_buf) const {
+  if (size_ < sizeof(uint32)) {
+    *status = Corruption("bad block contents");
+    return false;
+  }
+  if (fixed_width()) {
+    uint32 i = FixedLowerBound(key);
+    if (i == num_entries_ || FixedKey(i) != key)
+      return false;
+    *value = FixedValue(i);
+    return true;
+  }
+  const uint32 num_restarts = NumRestarts();
+  if (num_restarts == 0)
+    return false;
+
+  Iter iter(data_, restart_offset_, num_restarts, data_end_, key_buf);
+  bool found;
+  uint8 bucket = kBlockHashCollision;
+  if (num_buckets_ > 0) {
+    bucket = data_[data_end_ + BlockKeyHash(key) % num_buckets_];
+    if (bucket == kBlockHashNoEntry)
+      return false;
   }
+  if (bucket != kBlockHashCollision && bucket < num_restarts) {
+    found = iter.SeekInRestartInterval(bucket, key);
+  } else {
+    iter.Seek(key);
+    found = iter.Valid() && iter.key() == key;
+  }
+  *status = iter.status();
+  if (found) {
+    *value = iter.value();
+  }
+  return found;
+}
+
+bool Block::LowerBound(const Slice& target, Slice* value, Status* status,
+                       std::string* key_buf) const {
+  if (size_ < sizeof(uint32)) {
+    *status = Corruption("bad block contents");
+    return false;
+  }
+  if (fixed_width()) {
+    uint32 i = FixedLowerBound(target);
+    if (i == num_entries_)
+      return false;
+    *value = FixedValue(i);
+    return true;
+  }
+  const uint32 num_restarts = NumRestarts();
+  if (num_restarts == 0)
+    return false;
+
+  Iter iter(data_, restart_offset_, num_restarts, data_end_, key_buf);
+  iter.Seek(target);
+  *status = iter.status();
+  if (!iter.Valid())
+    return false;
+  *value = iter.value();
+  return true;
 }
 
 }  // namespace sstable
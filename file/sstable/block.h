@@ -6,7 +6,11 @@
 #define STORAGE_LEVELDB_TABLE_BLOCK_H_
 
 #include <cstddef>
+#include <memory>
+#include <string>
 #include "base/integral_types.h"
+#include "base/status.h"
+#include "strings/stringpiece.h"
 
 namespace file {
 namespace sstable {
@@ -18,24 +22,73 @@ class Block {
   // Initialize the block with the specified contents.
   explicit Block(const BlockContents& contents);
 
+  // An empty block, to be initialized by Reset().
+  Block() {}
+
   ~Block();
 
+  // Releases the current contents and initializes the block with the new ones, so that
+  // block objects can be reused without allocations.
+  void Reset(const BlockContents& contents);
+
   size_t size() const { return size_; }
   Iterator* NewIterator();
 
+  // Point lookup. Returns true and sets *value to point into the block if it contains key.
+  // Uses the hash index of the block if it has one.
+  // If key_buf is given, keys are decoded into it, so that lookups do not allocate once it
+  // has grown to the size of the keys.
+  bool Get(const strings::Slice& key, strings::Slice* value, base::Status* status,
+           std::string* key_buf = nullptr) const;
+
+  // Sets *value to point to the value of the first entry with a key >= target and returns
+  // true, or returns false if there is none. For index blocks, this is the handle of the
+  // block that may contain target. See Get() for key_buf.
+  bool LowerBound(const strings::Slice& target, strings::Slice* value, base::Status* status,
+                  std::string* key_buf = nullptr) const;
+
+  bool has_hash_index() const { return num_buckets_ > 0; }
+
+  // True if the block has the fixed width layout (see Options::fixed_key_size).
+  bool fixed_width() const { return key_size_ > 0; }
+
  private:
   uint32 NumRestarts() const;
 
-  const uint8* data_;
-  size_t size_;
-  uint32 restart_offset_;     // Offset in data_ of restart array
-  bool owned_;                  // Block owns data_[]
+  void Init(const BlockContents& contents);
+
+  void InitFixedWidth(uint32 num_entries);
+
+  // Fixed width layout accessors.
+  strings::Slice FixedKey(uint32 i) const {
+    return strings::Slice(data_ + i * key_size_, key_size_);
+  }
+  strings::Slice FixedValue(uint32 i) const;
+
+  // Returns the index of the first key >= target or num_entries_ if there is none.
+  uint32 FixedLowerBound(const strings::Slice& target) const;
+
+  const uint8* data_ = nullptr;
+  size_t size_ = 0;
+  uint32 restart_offset_ = 0; // Offset in data_ of restart array
+  uint32 data_end_ = 0;       // Offset in data_ past the last entry
+  uint32 num_buckets_ = 0;    // Size of the hash index, 0 if the block has none.
+  bool owned_ = false;          // Block owns data_[]
+  std::shared_ptr<const void> pin_;  // Keeps data_ valid if it points into a file mapping.
+
+  // Fixed width layout, key_size_ is 0 for the prefix compressed layout.
+  uint32 key_size_ = 0;
+  uint32 value_size_ = 0;     // 0 if the values have variable sizes.
+  uint32 num_entries_ = 0;
+  const uint8* values_ = nullptr;
+  const uint8* value_ends_ = nullptr;
 
   // No copying allowed
   Block(const Block&) = delete;
   void operator=(const Block&) = delete;
 
   class Iter;
+  class FixedIter;
 };
 }  // namespace sstable
 }  // namespace file
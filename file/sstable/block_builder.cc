@@ -25,11 +25,33 @@
 //     restarts: uint32[num_restarts]
 //     num_restarts: uint32
 // restarts[i] contains the offset within the block of the ith restart point.
+//
+// Blocks may have a hash index that maps key hashes to restart points so that point
+// lookups skip the binary search. It is stored before the restart array:
+//     buckets: uint8[num_buckets]
+//     num_buckets: uint32
+//     restarts: uint32[num_restarts]
+//     num_restarts | kBlockHashIndexFlag: uint32
+// A bucket holds the index of the restart point whose interval contains all the keys that
+// hash to the bucket, kBlockHashNoEntry if there are no such keys or kBlockHashCollision if
+// they belong to different intervals. Blocks with more than kBlockHashMaxRestarts restarts
+// are written without the index.
+//
+// Tables with Options::fixed_key_size use a different layout that stores the keys in a dense
+// array, so that a lookup is a binary search over the array without decoding entries:
+//     keys: char[num_entries * key_size]
+//     values: char[]
+//     value_ends: uint32[num_entries]     (only if value_size is 0)
+//     value_size: uint32                  (0 for values of variable sizes)
+//     key_size: uint32
+//     num_entries | kBlockFixedWidthFlag: uint32
+// value_ends[i] is the offset past the ith value relative to the start of the values.
 
 #include "file/sstable/block_builder.h"
 
 #include <algorithm>
 #include <assert.h>
+#include "file/sstable/format.h"
 #include "file/sstable/options.h"
 #include "util/coding/fixed.h"
 #include "util/coding/varint.h"
@@ -38,12 +60,15 @@ namespace file {
 namespace sstable {
 using strings::Slice;
 
-BlockBuilder::BlockBuilder(const Options* options)
+BlockBuilder::BlockBuilder(const Options* options, bool hash_index, bool fixed_width)
     : options_(options),
       restarts_(),
       counter_(0),
-      finished_(false) {
+      finished_(false),
+      hash_index_(hash_index && !fixed_width),
+      fixed_width_(fixed_width) {
   DCHECK_GE(options->block_restart_interval, 1);
+  DCHECK(!fixed_width || options->fixed_key_size > 0);
   restarts_.push_back(0);       // First restart point is at offset 0
 }
 
@@ -54,27 +79,85 @@ void BlockBuilder::Reset() {
   counter_ = 0;
   finished_ = false;
   last_key_.clear();
+  key_hashes_.clear();
+  values_.clear();
+  value_ends_.clear();
+}
+
+// Buckets are allocated for 75% utilization.
+static uint32_t NumHashBuckets(size_t num_keys) {
+  return std::min<size_t>(num_keys * 4 / 3 + 1, kBlockHashMaxBuckets);
 }
 
 size_t BlockBuilder::CurrentSizeEstimate() const {
+  if (fixed_width_) {
+    return buffer_.size() + values_.size() + (value_ends_.size() + 3) * sizeof(uint32_t);
+  }
+  size_t hash_size = hash_index_ ? NumHashBuckets(key_hashes_.size()) + sizeof(uint32_t) : 0;
   return (buffer_.size() +                        // Raw data buffer
+          hash_size +                             // Hash index
           restarts_.size() * sizeof(uint32_t) +   // Restart array
           sizeof(uint32_t));                      // Restart array length
 }
 
 Slice BlockBuilder::Finish() {
+  if (fixed_width_) {
+    const uint32_t num_entries = buffer_.size() / options_->fixed_key_size;
+    buffer_.append(values_);
+    for (uint32_t end : value_ends_) {
+      coding::AppendFixed32(end, &buffer_);
+    }
+    coding::AppendFixed32(options_->fixed_value_size, &buffer_);
+    coding::AppendFixed32(options_->fixed_key_size, &buffer_);
+    coding::AppendFixed32(num_entries | kBlockFixedWidthFlag, &buffer_);
+    finished_ = true;
+    return Slice(buffer_);
+  }
+
+  uint32_t num_restarts = restarts_.size();
+  if (hash_index_ && !key_hashes_.empty() && num_restarts <= kBlockHashMaxRestarts) {
+    const uint32_t num_buckets = NumHashBuckets(key_hashes_.size());
+    std::string buckets(num_buckets, char(kBlockHashNoEntry));
+    for (const auto& kh : key_hashes_) {
+      uint8_t& bucket = reinterpret_cast<uint8_t&>(buckets[kh.first % num_buckets]);
+      if (bucket == kBlockHashNoEntry) {
+        bucket = kh.second;
+      } else if (bucket != kh.second) {
+        bucket = kBlockHashCollision;
+      }
+    }
+    buffer_.append(buckets);
+    coding::AppendFixed32(num_buckets, &buffer_);
+    num_restarts |= kBlockHashIndexFlag;
+  }
+
   // Append restart array
   for (size_t i = 0; i < restarts_.size(); i++) {
     coding::AppendFixed32(restarts_[i], &buffer_);
   }
-  coding::AppendFixed32(restarts_.size(), &buffer_);
+  coding::AppendFixed32(num_restarts, &buffer_);
   finished_ = true;
   return Slice(buffer_);
 }
 
 void BlockBuilder::Add(const Slice& key, const Slice& value) {
-  Slice last_key_piece(last_key_);
   DCHECK(!finished_);
+  if (fixed_width_) {
+    const size_t key_size = options_->fixed_key_size;
+    DCHECK_EQ(key_size, key.size());
+    DCHECK(buffer_.empty() ||
+           key.compare(Slice(buffer_.data() + buffer_.size() - key_size, key_size)) > 0);
+    buffer_.append(key.data(), key.size());
+    values_.append(value.data(), value.size());
+    if (options_->fixed_value_size == 0) {
+      value_ends_.push_back(values_.size());
+    } else {
+      DCHECK_EQ(options_->fixed_value_size, value.size());
+    }
+    return;
+  }
+
+  Slice last_key_piece(last_key_);
   DCHECK_LE(counter_, options_->block_restart_interval);
   DCHECK(buffer_.empty() // No values yet?
          || key.compare(last_key_piece) > 0);
@@ -105,6 +188,10 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
   last_key_.append(key.data() + shared, non_shared);
   DCHECK(Slice(last_key_) == key);
   counter_++;
+
+  if (hash_index_) {
+    key_hashes_.emplace_back(BlockKeyHash(key), restarts_.size() - 1);
+  }
 }
 
 }  // namespace sstable
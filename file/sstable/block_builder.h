@@ -17,7 +17,12 @@ struct Options;
 
 class BlockBuilder {
  public:
-  explicit BlockBuilder(const Options* options);
+  // If hash_index is true, the block gets a hash index for point lookups
+  // (see block_builder.cc).
+  // If fixed_width is true, the block has the fixed width layout with the key and value
+  // sizes of options. hash_index is ignored then.
+  explicit BlockBuilder(const Options* options, bool hash_index = false,
+                        bool fixed_width = false);
 
   // Reset the contents as if the BlockBuilder was just constructed.
   void Reset();
@@ -48,6 +53,16 @@ class BlockBuilder {
   bool                  finished_;    // Has Finish() been called?
   std::string           last_key_;
 
+  // Hash index state: the hash of every key and the restart point it belongs to.
+  const bool            hash_index_;
+  std::vector<std::pair<uint32_t, uint32_t>> key_hashes_;
+
+  // Fixed width layout state: buffer_ holds the keys, values_ the values and value_ends_
+  // their end offsets if they have variable sizes.
+  const bool            fixed_width_;
+  std::string           values_;
+  std::vector<uint32_t> value_ends_;
+
   // No copying allowed
   BlockBuilder(const BlockBuilder&) = delete;
   void operator=(const BlockBuilder&) = delete;
@@ -0,0 +1,124 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/sstable/filter_policy.h"
+
+#include "base/hash.h"
+#include "base/logging.h"
+
+namespace file {
+namespace sstable {
+
+using strings::Slice;
+
+namespace {
+
+// A blocked bloom filter: the bit array is split into 512-bit lines and all the probes of a key
+// fall into a single line that is selected by the upper half of the key hash.
+// A lookup therefore touches one cache line instead of k random ones, at the price of
+// a slightly higher false positive rate for the same number of bits.
+//
+// Filter layout: [padding][lines][k][padding size].
+// The padding aligns the lines to 64 bytes relative to the start of the filter block so that
+// a line never straddles two cache lines once the block is loaded into an aligned buffer.
+constexpr size_t kLineBytes = 64;
+constexpr size_t kLineBits = kLineBytes * 8;
+
+class BlockedBloomFilterPolicy : public FilterPolicy {
+ public:
+  explicit BlockedBloomFilterPolicy(uint32_t bits_per_key) : bits_per_key_(bits_per_key) {
+    // We intentionally round down to reduce probing cost a little bit.
+    k_ = static_cast<uint32_t>(bits_per_key * 0.69);  // 0.69 =~ ln(2)
+    if (k_ < 1) k_ = 1;
+    if (k_ > 30) k_ = 30;
+  }
+
+  const char* Name() const override {
+    return "ubimo.BlockedBloomFilter";
+  }
+
+  void CreateFilter(const Slice* keys, uint32_t n, std::string* dst) const override {
+    size_t num_lines = (size_t(n) * bits_per_key_ + kLineBits - 1) / kLineBits;
+    if (num_lines == 0) num_lines = 1;
+
+    const size_t pad = (kLineBytes - dst->size() % kLineBytes) % kLineBytes;
+    const size_t init_size = dst->size() + pad;
+    dst->resize(init_size + num_lines * kLineBytes, 0);
+    dst->push_back(static_cast<char>(k_));  // Remember # of probes in filter
+    dst->push_back(static_cast<char>(pad));
+
+    uint8* array = reinterpret_cast<uint8*>(&(*dst)[init_size]);
+    for (uint32_t i = 0; i < n; ++i) {
+      uint64 h = Hash(keys[i]);
+      uint8* line = array + LineIndex(h, num_lines) * kLineBytes;
+      uint32_t h2 = static_cast<uint32_t>(h);
+      const uint32_t delta = (h2 >> 17) | (h2 << 15);  // Rotate right 17 bits
+      for (uint32_t j = 0; j < k_; ++j) {
+        const uint32_t bitpos = h2 % kLineBits;
+        line[bitpos / 8] |= (1 << (bitpos % 8));
+        h2 += delta;
+      }
+    }
+  }
+
+  bool KeyMayMatch(const Slice& key, const Slice& filter) const override {
+    const size_t len = filter.size();
+    if (len < 2) return false;
+
+    const uint8* data = filter.ubuf();
+    const uint32_t k = data[len - 2];
+    const size_t pad = data[len - 1];
+    if (k > 30 || pad + 2 > len || (len - 2 - pad) % kLineBytes != 0) {
+      // Reserved for potentially new encodings. Consider it a match.
+      return true;
+    }
+    const size_t num_lines = (len - 2 - pad) / kLineBytes;
+    if (num_lines == 0)
+      return false;
+
+    uint64 h = Hash(key);
+    const uint8* line = data + pad + LineIndex(h, num_lines) * kLineBytes;
+    uint32_t h2 = static_cast<uint32_t>(h);
+    const uint32_t delta = (h2 >> 17) | (h2 << 15);
+    bool match = true;
+
+    // Branch-free probing: all the bits are in the same cache line anyway.
+    for (uint32_t j = 0; j < k; ++j) {
+      const uint32_t bitpos = h2 % kLineBits;
+      match &= (line[bitpos / 8] >> (bitpos % 8)) & 1;
+      h2 += delta;
+    }
+    return match;
+  }
+
+ private:
+  // Both halves of the hash are used independently, so the fingerprint is finalized to spread
+  // every input bit over the whole 64-bit word.
+  static uint64 Hash(const Slice& key) {
+    uint64 h = base::Fingerprint(key.data(), key.size());
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  // Maps the upper 32 bits of the hash into [0, num_lines) without a division.
+  static size_t LineIndex(uint64 h, size_t num_lines) {
+    return ((h >> 32) * num_lines) >> 32;
+  }
+
+  uint32_t bits_per_key_;
+  uint32_t k_;
+};
+
+}  // namespace
+
+const FilterPolicy* NewBloomFilterPolicy(uint32_t bits_per_key) {
+  CHECK_GT(bits_per_key, 0);
+  return new BlockedBloomFilterPolicy(bits_per_key);
+}
+
+}  // namespace sstable
+}  // namespace file
@@ -0,0 +1,306 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "file/sstable/cache.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "base/hash.h"
+#include "base/logging.h"
+
+namespace file {
+namespace sstable {
+
+using strings::Slice;
+
+Cache::~Cache() {
+}
+
+namespace {
+
+// LRU cache implementation
+//
+// Cache entries have an "in_cache" boolean indicating whether the cache has a
+// reference on the entry.  The only ways that this can become false without the
+// entry being passed to its "deleter" are via Erase(), via Insert() when
+// an element with a duplicate key is inserted, or on destruction of the cache.
+//
+// The cache keeps two linked lists of items in the cache.  All items in the
+// cache are in one list or the other, and never both.  Items still referenced
+// by clients but erased from the cache are in neither list.  The lists are:
+// - in-use:  contains the items currently referenced by clients, in no
+//   particular order.
+// - LRU:  contains the items not currently referenced by clients, in LRU order
+// Elements are moved between these lists by the Ref() and Unref() methods,
+// when they detect an element in the cache acquiring or losing its only
+// external reference.
+struct LRUHandle {
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  LRUHandle* next;
+  LRUHandle* prev;
+  size_t charge;
+  uint32 refs;
+  bool in_cache;  // Whether entry is in the cache.
+  std::string key_data;
+
+  Slice key() const { return key_data; }
+};
+
+struct SliceHash {
+  size_t operator()(const Slice& s) const {
+    return base::MurmurHash3_x86_32(s.ubuf(), s.size(), 0);
+  }
+};
+
+// A single shard of sharded cache.
+class LRUCache {
+ public:
+  LRUCache();
+  ~LRUCache();
+
+  // Separate from constructor so caller can easily make an array of LRUCache
+  void SetCapacity(size_t capacity) { capacity_ = capacity; }
+
+  // Like Cache methods.
+  Cache::Handle* Insert(const Slice& key, void* value, size_t charge,
+                        void (*deleter)(const Slice& key, void* value));
+  Cache::Handle* Lookup(const Slice& key);
+  void Release(Cache::Handle* handle);
+  void Erase(const Slice& key);
+
+  void AddStats(Cache::Stats* stats) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats->hits += hits_;
+    stats->misses += misses_;
+    stats->charge += usage_;
+  }
+
+ private:
+  void LRU_Remove(LRUHandle* e);
+  void LRU_Append(LRUHandle* list, LRUHandle* e);
+  void Ref(LRUHandle* e);
+  void Unref(LRUHandle* e);
+  bool FinishErase(LRUHandle* e);
+  LRUHandle* RemoveFromTable(const Slice& key);
+
+  // Initialized before use.
+  size_t capacity_ = 0;
+
+  // mutex_ protects the following state.
+  mutable std::mutex mutex_;
+  size_t usage_ = 0;
+  uint64 hits_ = 0;
+  uint64 misses_ = 0;
+
+  // Dummy head of LRU list.
+  // lru.prev is newest entry, lru.next is oldest entry.
+  // Entries have refs==1 and in_cache==true.
+  LRUHandle lru_;
+
+  // Dummy head of in-use list.
+  // Entries are in use by clients, and have refs >= 2 and in_cache==true.
+  LRUHandle in_use_;
+
+  // Keys point into the handles.
+  std::unordered_map<Slice, LRUHandle*, SliceHash> table_;
+};
+
+LRUCache::LRUCache() {
+  // Make empty circular linked lists.
+  lru_.next = &lru_;
+  lru_.prev = &lru_;
+  in_use_.next = &in_use_;
+  in_use_.prev = &in_use_;
+}
+
+LRUCache::~LRUCache() {
+  CHECK(in_use_.next == &in_use_) << "Cache is destroyed with unreleased handles";
+  for (LRUHandle* e = lru_.next; e != &lru_; ) {
+    LRUHandle* next = e->next;
+    DCHECK(e->in_cache);
+    e->in_cache = false;
+    DCHECK_EQ(e->refs, 1);  // Invariant of lru_ list.
+    Unref(e);
+    e = next;
+  }
+}
+
+void LRUCache::Ref(LRUHandle* e) {
+  if (e->refs == 1 && e->in_cache) {  // If on lru_ list, move to in_use_ list.
+    LRU_Remove(e);
+    LRU_Append(&in_use_, e);
+  }
+  e->refs++;
+}
+
+void LRUCache::Unref(LRUHandle* e) {
+  DCHECK_GT(e->refs, 0);
+  e->refs--;
+  if (e->refs == 0) { // Deallocate.
+    DCHECK(!e->in_cache);
+    (*e->deleter)(e->key(), e->value);
+    delete e;
+  } else if (e->in_cache && e->refs == 1) {  // No longer in use; move to lru_ list.
+    LRU_Remove(e);
+    LRU_Append(&lru_, e);
+  }
+}
+
+void LRUCache::LRU_Remove(LRUHandle* e) {
+  e->next->prev = e->prev;
+  e->prev->next = e->next;
+}
+
+void LRUCache::LRU_Append(LRUHandle* list, LRUHandle* e) {
+  // Make "e" newest entry by inserting just before *list
+  e->next = list;
+  e->prev = list->prev;
+  e->prev->next = e;
+  e->next->prev = e;
+}
+
+Cache::Handle* LRUCache::Lookup(const Slice& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = table_.find(key);
+  if (it == table_.end()) {
+    ++misses_;
+    return nullptr;
+  }
+  ++hits_;
+  Ref(it->second);
+  return reinterpret_cast<Cache::Handle*>(it->second);
+}
+
+void LRUCache::Release(Cache::Handle* handle) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Unref(reinterpret_cast<LRUHandle*>(handle));
+}
+
+Cache::Handle* LRUCache::Insert(const Slice& key, void* value, size_t charge,
+                                void (*deleter)(const Slice& key, void* value)) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  LRUHandle* e = new LRUHandle;
+  e->value = value;
+  e->deleter = deleter;
+  e->charge = charge;
+  e->key_data = key.as_string();
+  e->in_cache = false;
+  e->refs = 1;  // for the returned handle.
+
+  if (capacity_ > 0) {
+    e->refs++;  // for the cache's reference.
+    e->in_cache = true;
+    LRU_Append(&in_use_, e);
+    usage_ += charge;
+    LRUHandle* old = RemoveFromTable(e->key());
+    table_.emplace(e->key(), e);
+    FinishErase(old);
+  } // else don't cache.  (Tests use capacity_==0 to turn off caching.)
+
+  while (usage_ > capacity_ && lru_.next != &lru_) {
+    LRUHandle* old = lru_.next;
+    DCHECK_EQ(old->refs, 1);
+    bool erased = FinishErase(RemoveFromTable(old->key()));
+    DCHECK(erased);
+  }
+
+  return reinterpret_cast<Cache::Handle*>(e);
+}
+
+LRUHandle* LRUCache::RemoveFromTable(const Slice& key) {
+  auto it = table_.find(key);
+  if (it == table_.end())
+    return nullptr;
+  LRUHandle* e = it->second;
+  table_.erase(it);
+  return e;
+}
+
+// If e != NULL, finish removing *e from the cache; it has already been removed
+// from the hash table.  Return whether e != NULL.
+bool LRUCache::FinishErase(LRUHandle* e) {
+  if (e != nullptr) {
+    DCHECK(e->in_cache);
+    LRU_Remove(e);
+    e->in_cache = false;
+    usage_ -= e->charge;
+    Unref(e);
+  }
+  return e != nullptr;
+}
+
+void LRUCache::Erase(const Slice& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  FinishErase(RemoveFromTable(key));
+}
+
+constexpr unsigned kNumShardBits = 4;
+constexpr unsigned kNumShards = 1 << kNumShardBits;
+
+class ShardedLRUCache : public Cache {
+ public:
+  explicit ShardedLRUCache(size_t capacity) {
+    const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
+    for (unsigned s = 0; s < kNumShards; s++) {
+      shard_[s].SetCapacity(per_shard);
+    }
+  }
+
+  Handle* Insert(const Slice& key, void* value, size_t charge,
+                 void (*deleter)(const Slice& key, void* value)) override {
+    return shard_[Shard(key)].Insert(key, value, charge, deleter);
+  }
+
+  Handle* Lookup(const Slice& key) override {
+    return shard_[Shard(key)].Lookup(key);
+  }
+
+  void Release(Handle* handle) override {
+    LRUHandle* h = reinterpret_cast<LRUHandle*>(handle);
+    shard_[Shard(h->key())].Release(handle);
+  }
+
+  void Erase(const Slice& key) override {
+    shard_[Shard(key)].Erase(key);
+  }
+
+  void* Value(Handle* handle) override {
+    return reinterpret_cast<LRUHandle*>(handle)->value;
+  }
+
+  uint64 NewId() override {
+    return ++last_id_;
+  }
+
+  Stats GetStats() const override {
+    Stats stats;
+    for (unsigned s = 0; s < kNumShards; s++) {
+      shard_[s].AddStats(&stats);
+    }
+    return stats;
+  }
+
+ private:
+  // The shard is selected by a different hash than the one used by the shard tables.
+  static unsigned Shard(const Slice& key) {
+    return base::MurmurHash3_x86_32(key.ubuf(), key.size(), 1) >> (32 - kNumShardBits);
+  }
+
+  LRUCache shard_[kNumShards];
+  std::atomic<uint64> last_id_{0};
+};
+
+}  // namespace
+
+Cache* NewLRUCache(size_t capacity) {
+  return new ShardedLRUCache(capacity);
+}
+
+}  // namespace sstable
+}  // namespace file
@@ -4,6 +4,8 @@
 
 #include "file/sstable/filter_block.h"
 
+#include <cstring>
+#include "base/logging.h"
 #include "file/sstable/filter_policy.h"
 #include "util/coding/fixed.h"
 
@@ -14,6 +16,56 @@ using strings::Slice;
 
 FilterPolicy::~FilterPolicy() {}
 
+PrefixExtractor::~PrefixExtractor() {}
+
+namespace {
+
+class FixedPrefixExtractor : public PrefixExtractor {
+ public:
+  explicit FixedPrefixExtractor(size_t len)
+      : len_(len), name_("fixed." + std::to_string(len)) {}
+
+  const char* Name() const override { return name_.c_str(); }
+  bool InDomain(const Slice& key) const override { return key.size() >= len_; }
+  Slice Transform(const Slice& key) const override { return Slice(key.data(), len_); }
+
+ private:
+  const size_t len_;
+  const std::string name_;
+};
+
+class DelimitedPrefixExtractor : public PrefixExtractor {
+ public:
+  explicit DelimitedPrefixExtractor(char delim)
+      : delim_(delim), name_("delim." + std::to_string(static_cast<unsigned char>(delim))) {}
+
+  const char* Name() const override { return name_.c_str(); }
+
+  bool InDomain(const Slice& key) const override {
+    return memchr(key.data(), delim_, key.size()) != nullptr;
+  }
+
+  Slice Transform(const Slice& key) const override {
+    const char* end = static_cast<const char*>(memchr(key.data(), delim_, key.size()));
+    DCHECK(end != nullptr);
+    return Slice(key.data(), end + 1 - key.data());
+  }
+
+ private:
+  const char delim_;
+  const std::string name_;
+};
+
+}  // namespace
+
+const PrefixExtractor* NewFixedPrefixExtractor(size_t len) {
+  return new FixedPrefixExtractor(len);
+}
+
+const PrefixExtractor* NewDelimitedPrefixExtractor(char delim) {
+  return new DelimitedPrefixExtractor(delim);
+}
+
 // See doc/table_format.txt for an explanation of the filter block format.
 
 // Generate new filter every 2KB of data
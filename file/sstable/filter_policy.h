@@ -17,7 +17,7 @@
 #define _FILE_SSTABLE_FILTER_POLICY_H_
 
 #include <string>
-#include "strings/slice.h"
+#include "strings/stringpiece.h"
 
 namespace file {
 namespace sstable {
@@ -65,6 +65,32 @@ class FilterPolicy {
 // trailing spaces in keys.
 extern const FilterPolicy* NewBloomFilterPolicy(uint32_t bits_per_key);
 
+// Maps keys to prefixes, e.g. "user_id|" of "user_id|timestamp", so that filters can answer
+// whether a block contains keys with a given prefix. See Options::prefix_extractor.
+class PrefixExtractor {
+ public:
+  virtual ~PrefixExtractor();
+
+  // The name is stored in the table. If the extraction changes, the name must change too.
+  virtual const char* Name() const = 0;
+
+  // Whether key has a prefix. Keys without one do not add a prefix to the filters.
+  virtual bool InDomain(const strings::Slice& key) const = 0;
+
+  // Returns the prefix of key, which must be a prefix of key in the byte order.
+  // REQUIRES: InDomain(key)
+  virtual strings::Slice Transform(const strings::Slice& key) const = 0;
+};
+
+// Prefixes are the first len bytes of keys. Shorter keys have no prefix.
+// Callers must delete the result when it is no longer used.
+extern const PrefixExtractor* NewFixedPrefixExtractor(size_t len);
+
+// Prefixes are the keys up to and including the first delim byte, e.g. "user_id|" with '|'.
+// Keys without delim have no prefix.
+// Callers must delete the result when it is no longer used.
+extern const PrefixExtractor* NewDelimitedPrefixExtractor(char delim);
+
 }  // namespace sstable
 }  // namespace file
 
@@ -4,12 +4,14 @@
 
 #include "file/sstable/format.h"
 
+#include <cstring>
 #include <memory>
 #include <snappy-c.h>
 #include "base/logging.h"
 #include "file/file.h"
 #include "util/coding/fixed.h"
 #include "util/coding/varint.h"
+#include "util/compressors.h"
 #include "util/crc32c.h"
 
 using base::Status;
@@ -26,6 +28,11 @@ const uint64 kTableMagicNumber = 0xf968d1dde8e3d8d6ull;
 // 1-byte type + 32-bit crc
 const size_t kBlockTrailerSize = 5;
 
+// ReadBlocks() merges the reads of blocks that are at most kMaxReadGap bytes apart
+// into a single read of up to kMaxCoalescedRead bytes.
+const uint64 kMaxReadGap = 4096;
+const uint64 kMaxCoalescedRead = 1 << 20;
+
 bool GetVarint64(Slice* s, uint64* value) {
   const uint8* next = Varint::Parse64WithLimit(s->ubuf(), s->uend(), value);
   if (next == nullptr)
@@ -38,12 +45,26 @@ inline Status Corruption(const char* str) {
   return Status(base::StatusCode::IO_ERROR, str);
 }
 
+namespace compressors = util::compressors;
+
+compressors::Method CompressorMethod(uint8 type) {
+  switch (type) {
+    case sstable::kLZ4Compression: return compressors::LZ4_METHOD;
+    case sstable::kZlibCompression: return compressors::ZLIB_METHOD;
+    default:;
+  }
+  return compressors::UNKNOWN_METHOD;
+}
+
 }  // namespace
 
 namespace sstable {
 
 const char kFilterNamePrefix[] = "!filter.";
 const char kMetaBlockKey[] = "!meta_block";
+const char kPartitionedIndexKey[] = "!index.partitioned";
+const char kPrefixExtractorPrefix[] = "!prefix.";
+const char kPropertiesBlockKey[] = "!properties";
 
 void BlockHandle::EncodeTo(std::string* dst) const {
   // Sanity check that all fields have been set
@@ -86,29 +107,29 @@ Status Footer::DecodeFrom(Slice input) {
   return result;
 }
 
-Status ReadBlock(ReadonlyFile* file,
-                 const ReadOptions& options,
-                 const BlockHandle& handle,
-                 BlockContents* result) {
-  result->data = Slice();
-  result->cachable = false;
-  result->heap_allocated = false;
-
-  // Read the block contents as well as the type/crc footer.
-  // See table_builder.cc for the code that built this structure.
-  size_t n = static_cast<size_t>(handle.size());
-  std::unique_ptr<uint8[]> buf(new uint8[n + kBlockTrailerSize]);
-  Slice contents;
-  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf.get());
-  if (!s.ok()) {
-    return s;
-  }
-  if (contents.size() != n + kBlockTrailerSize) {
-    return Corruption("truncated block read");
-  }
+// Verifies and uncompresses the block at "data" of size n followed by its trailer.
+// "file_data" is true if data points to memory owned by the file (i.e. mmapped), in which case
+// uncompressed blocks point into it and hold "pin" if it is set.
+// Otherwise, uncompressed blocks take ownership of *buf if it holds exactly the block
+// or copy the data out of it.
+// Compressed blocks are uncompressed into a new array, or into *scratch if it is set.
+static Status DecodeBlock(const ReadOptions& options, const uint8* data, size_t n,
+                          bool file_data, const std::shared_ptr<const void>& pin,
+                          std::unique_ptr<uint8[]>* buf, BlockContents* result,
+                          std::vector<uint8>* scratch = nullptr) {
+  // Returns the destination of the uncompressed data.
+  std::unique_ptr<uint8[]> ubuf;
+  auto uncompressed = [&ubuf, scratch](size_t size) {
+    if (scratch == nullptr) {
+      ubuf.reset(new uint8[size]);
+      return ubuf.get();
+    }
+    if (scratch->size() < size)
+      scratch->resize(size);
+    return scratch->data();
+  };
 
   // Check the crc of the type and the block contents
-  const uint8* data = contents.ubuf();    // Pointer to where Read put the data
   if (options.verify_checksums) {
     const uint32_t crc = util::crc32c::Unmask(coding::DecodeFixed32(data + n + 1));
     const uint32_t actual = util::crc32c::Value(data, n + 1);
@@ -119,15 +140,22 @@ Status ReadBlock(ReadonlyFile* file,
 
   switch (data[n]) {
     case kNoCompression:
-      if (data != buf.get()) {
+      if (file_data) {
         // File implementation gave us pointer to some other data.
         // Use it directly under the assumption that it will be live
         // while the file is open.
         result->data = Slice(data, n);
         result->heap_allocated = false;
         result->cachable = false;  // Do not double-cache
+        result->pin = pin;
+      } else if (data == buf->get()) {
+        result->data.set(reinterpret_cast<char*>(buf->release()), n);
+        result->heap_allocated = true;
+        result->cachable = true;
       } else {
-        result->data.set(reinterpret_cast<char*>(buf.release()), n);
+        uint8* copy = new uint8[n];
+        memcpy(copy, data, n);
+        result->data = Slice(copy, n);
         result->heap_allocated = true;
         result->cachable = true;
       }
@@ -140,20 +168,204 @@ Status ReadBlock(ReadonlyFile* file,
         LOG(ERROR) << "snappy_uncompressed_length error with n " << n;
         return Corruption("corrupted compressed block contents");
       }
-      std::unique_ptr<char[]> ubuf(new char[ulength]);
-      if (snappy_uncompress(strings::charptr(data), n, ubuf.get(), &ulength) != SNAPPY_OK) {
+      char* dest = reinterpret_cast<char*>(uncompressed(ulength));
+      if (snappy_uncompress(strings::charptr(data), n, dest, &ulength) != SNAPPY_OK) {
         return Corruption("corrupted compressed block contents");
       }
-      result->data = Slice(ubuf.release(), ulength);
-      result->heap_allocated = true;
-      result->cachable = true;
+      result->data = Slice(dest, ulength);
+      break;
+    }
+    case kLZ4Compression:
+    case kZlibCompression: {
+      uint32 ulength = 0;
+      const uint8* next = Varint::Parse32WithLimit(data, data + n, &ulength);
+      if (next == nullptr) {
+        return Corruption("corrupted compressed block contents");
+      }
+      compressors::UncompressFunction uncompress = nullptr;
+      compressors::Method method = CompressorMethod(data[n]);
+      if (!compressors::GetUncompress(method, &uncompress).ok()) {
+        LOG(ERROR) << "Could not find uncompress method " << compressors::MethodName(method);
+        return Corruption("unsupported block compression");
+      }
+      uint8* dest = uncompressed(ulength);
+      size_t usize = ulength;
+      Status st = uncompress(next, data + n - next, dest, &usize);
+      if (!st.ok() || usize != ulength) {
+        return Corruption("corrupted compressed block contents");
+      }
+      result->data = Slice(dest, ulength);
       break;
     }
     default:
       return Corruption("bad block type");
   }
+  if (data[n] != kNoCompression && scratch == nullptr) {
+    ubuf.release();
+    result->heap_allocated = true;
+    result->cachable = true;
+  }
+  return Status::OK;
+}
+
+bool CompressBlockContents(CompressionType type, int level, const Slice& raw,
+                           std::string* output) {
+  compressors::Method method = CompressorMethod(type);
+  compressors::CompressFunction compress = nullptr;
+  size_t bound = 0;
+  if (!compressors::MaxCompressBound(method, raw.size(), &bound).ok() ||
+      !compressors::GetCompress(method, &compress).ok()) {
+    LOG(ERROR) << "Compression method " << compressors::MethodName(method)
+               << " is not available";
+    return false;
+  }
+  output->resize(Varint::kMax32 + bound);
+  uint8* start = reinterpret_cast<uint8*>(&output->front());
+  uint8* next = Varint::Encode32(start, raw.size());
+  size_t compressed_size = bound;
+  if (!compress(level, raw.ubuf(), raw.size(), next, &compressed_size).ok())
+    return false;
+  output->resize(next - start + compressed_size);
+  return true;
+}
+
+Status ReadBlock(ReadonlyFile* file,
+                 const ReadOptions& options,
+                 const BlockHandle& handle,
+                 BlockContents* result) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+  result->pin.reset();
+
+  // Read the block contents as well as the type/crc footer.
+  // See table_builder.cc for the code that built this structure.
+  size_t n = static_cast<size_t>(handle.size());
+  std::unique_ptr<uint8[]> buf;
+  std::shared_ptr<const void> pin;
+  Slice contents;
+
+  // Mapped files need no buffer: uncompressed blocks are neither allocated nor copied.
+  if (!file->ReadMapped(handle.offset(), n + kBlockTrailerSize, &contents, &pin)) {
+    buf.reset(new uint8[n + kBlockTrailerSize]);
+    Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf.get());
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  if (contents.size() != n + kBlockTrailerSize) {
+    return Corruption("truncated block read");
+  }
+
+  // Pointer to where Read put the data
+  const uint8* data = contents.ubuf();
+  return DecodeBlock(options, data, n, data != buf.get(), pin, &buf, result);
+}
+
+Status ReadBlock(ReadonlyFile* file,
+                 const ReadOptions& options,
+                 const BlockHandle& handle,
+                 BlockBuffer* buffer,
+                 BlockContents* result) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+  result->pin.reset();
+
+  size_t n = static_cast<size_t>(handle.size());
+  std::shared_ptr<const void> pin;
+  Slice contents;
+  if (!file->ReadMapped(handle.offset(), n + kBlockTrailerSize, &contents, &pin)) {
+    if (buffer->read.size() < n + kBlockTrailerSize)
+      buffer->read.resize(n + kBlockTrailerSize);
+    Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents,
+                          buffer->read.data());
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  if (contents.size() != n + kBlockTrailerSize) {
+    return Corruption("truncated block read");
+  }
+
+  // Uncompressed blocks point to the data where it was read, like the blocks of mapped files.
+  std::unique_ptr<uint8[]> no_buf;
+  return DecodeBlock(options, contents.ubuf(), n, true, pin, &no_buf, result,
+                     &buffer->uncompressed);
+}
+
+static Status ReadCoalesced(ReadonlyFile* file, const ReadOptions& options,
+                            const BlockHandle* handles, unsigned count, BlockContents* results) {
+  unsigned i = 0;
+  while (i < count) {
+    // Extend the range while the next block follows closely.
+    const uint64 start = handles[i].offset();
+    uint64 end = start + handles[i].size() + kBlockTrailerSize;
+    unsigned j = i + 1;
+    for (; j < count; ++j) {
+      uint64 next = handles[j].offset();
+      if (next < end || next - end > kMaxReadGap ||
+          next + handles[j].size() + kBlockTrailerSize - start > kMaxCoalescedRead) {
+        break;
+      }
+      end = next + handles[j].size() + kBlockTrailerSize;
+    }
+
+    if (j == i + 1) {
+      Status s = ReadBlock(file, options, handles[i], results + i);
+      if (!s.ok()) return s;
+      ++i;
+      continue;
+    }
+
+    size_t range = end - start;
+    std::unique_ptr<uint8[]> buf;
+    std::shared_ptr<const void> pin;
+    Slice contents;
+    if (!file->ReadMapped(start, range, &contents, &pin)) {
+      buf.reset(new uint8[range]);
+      Status s = file->Read(start, range, &contents, buf.get());
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    if (contents.size() != range) {
+      return Corruption("truncated block read");
+    }
+    // Uncompressed blocks are copied out of the shared buffer.
+    const bool file_data = contents.ubuf() != buf.get();
+    std::unique_ptr<uint8[]> no_buf;
+    for (; i < j; ++i) {
+      const uint8* data = contents.ubuf() + (handles[i].offset() - start);
+      Status s = DecodeBlock(options, data, handles[i].size(), file_data, pin, &no_buf,
+                             results + i);
+      if (!s.ok()) return s;
+    }
+  }
   return Status::OK;
 }
 
+Status ReadBlocks(ReadonlyFile* file, const ReadOptions& options,
+                  const BlockHandle* handles, unsigned count, BlockContents* results) {
+  for (unsigned i = 0; i < count; ++i) {
+    results[i].data = Slice();
+    results[i].cachable = false;
+    results[i].heap_allocated = false;
+    results[i].pin.reset();
+  }
+  Status s = ReadCoalesced(file, options, handles, count, results);
+  if (!s.ok()) {
+    for (unsigned i = 0; i < count; ++i) {
+      if (results[i].heap_allocated) {
+        delete[] results[i].data.ubuf();
+      }
+      results[i].data = Slice();
+      results[i].heap_allocated = false;
+      results[i].pin.reset();
+    }
+  }
+  return s;
+}
+
 }  // namespace sstable
 }  // namespace file
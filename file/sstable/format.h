@@ -6,9 +6,12 @@
 #ifndef _FILE_SSTABLE_TABLE_FORMAT_H_
 #define _FILE_SSTABLE_TABLE_FORMAT_H_
 
+#include <memory>
 #include <string>
+#include <vector>
 #include <stdint.h>
 #include "strings/stringpiece.h"
+#include "base/hash.h"
 #include "base/status.h"
 #include "file/sstable/options.h"
 
@@ -18,10 +21,34 @@ class ReadonlyFile;
 
 namespace sstable {
 
+// Block hash index encoding, see block_builder.cc.
+constexpr uint32 kBlockHashIndexFlag = 1u << 31;
+constexpr uint32 kBlockHashMaxRestarts = 253;
+constexpr uint32 kBlockHashMaxBuckets = 1 << 16;
+constexpr uint8 kBlockHashCollision = 254;
+constexpr uint8 kBlockHashNoEntry = 255;
+
+// Marks blocks with the fixed width layout, see block_builder.cc.
+constexpr uint32 kBlockFixedWidthFlag = 1u << 30;
+
+inline uint32 BlockKeyHash(const strings::Slice& key) {
+  return base::MurmurHash3_x86_32(key.ubuf(), key.size(), 0);
+}
+
 // All internal key names start with "!".
 extern const char kFilterNamePrefix[];
 extern const char kMetaBlockKey[];
 
+// Present in the metaindex when the index block is a top-level index over index partitions.
+extern const char kPartitionedIndexKey[];
+
+// Followed by the name of Options::prefix_extractor if the filters hold prefixes.
+// The value is "1" if they also hold the whole keys and "0" otherwise.
+extern const char kPrefixExtractorPrefix[];
+
+// Maps to the handle of the block with the encoded TableProperties.
+extern const char kPropertiesBlockKey[];
+
 // BlockHandle is a pointer to the extent of a file that stores a data
 // block or a meta block.
 class BlockHandle {
@@ -82,6 +109,9 @@ struct BlockContents {
   strings::Slice data;           // Actual contents of data
   bool cachable;        // True iff data can be cached
   bool heap_allocated;  // True iff caller should delete[] data.data()
+
+  // Keeps data mapped when it points directly into a file mapping (see ReadonlyFile::ReadMapped).
+  std::shared_ptr<const void> pin;
 };
 
 // Read the block identified by "handle" from "file".  On failure
@@ -91,6 +121,35 @@ base::Status ReadBlock(ReadonlyFile* file,
                        const BlockHandle& handle,
                        BlockContents* result);
 
+// Buffers for blocks that are read for a single use, e.g. by point lookups.
+// They grow to the largest block read and are reused by the following reads.
+struct BlockBuffer {
+  std::vector<uint8> read;          // The block with its trailer, as read from the file.
+  std::vector<uint8> uncompressed;
+};
+
+// Like ReadBlock(), but reads and uncompresses into *buffer, so that reads do not allocate
+// once the buffer has grown to the size of the blocks. The result points into *buffer or into
+// the file mapping and is valid until the next read into *buffer. It is not cachable.
+base::Status ReadBlock(ReadonlyFile* file,
+                       const ReadOptions& options,
+                       const BlockHandle& handle,
+                       BlockBuffer* buffer,
+                       BlockContents* result);
+
+// Compresses raw with the util::compressors method of type (kLZ4Compression or
+// kZlibCompression) and stores varint32 of raw size followed by the compressed data in *output.
+// Returns false if the method is not available or fails.
+bool CompressBlockContents(CompressionType type, int level, const strings::Slice& raw,
+                           std::string* output);
+
+// Reads the blocks identified by handles[0, count) into results[0, count).
+// Reads of neighbouring blocks are merged into a single file read.
+// REQUIRES: handles are sorted by offset.
+// On failure returns non-OK and no result holds data.
+base::Status ReadBlocks(ReadonlyFile* file, const ReadOptions& options,
+                        const BlockHandle* handles, unsigned count, BlockContents* results);
+
 }  // namespace sstable
 
 }  // namespace file
@@ -4,6 +4,8 @@
 
 #include "file/sstable/iterator.h"
 
+#include <memory>
+
 namespace file {
 namespace sstable {
 
@@ -17,9 +19,9 @@ Iterator::Iterator() {
 
 Iterator::~Iterator() {
   if (cleanup_.function != NULL) {
-    (*cleanup_.function)(cleanup_.arg1);
+    (*cleanup_.function)(cleanup_.arg1, cleanup_.arg2);
     for (Cleanup* c = cleanup_.next; c != NULL; ) {
-      (*c->function)(c->arg1);
+      (*c->function)(c->arg1, c->arg2);
       Cleanup* next = c->next;
       delete c;
       c = next;
@@ -27,7 +29,7 @@ Iterator::~Iterator() {
   }
 }
 
-void Iterator::RegisterCleanup(CleanupFunction func, void* arg1) {
+void Iterator::RegisterCleanup(CleanupFunction func, void* arg1, void* arg2) {
   assert(func != NULL);
   Cleanup* c;
   if (cleanup_.function == NULL) {
@@ -39,6 +41,7 @@ void Iterator::RegisterCleanup(CleanupFunction func, void* arg1) {
   }
   c->function = func;
   c->arg1 = arg1;
+  c->arg2 = arg2;
 }
 
 namespace {
@@ -57,6 +60,75 @@ class EmptyIterator : public Iterator {
  private:
   Status status_;
 };
+
+class BoundedIterator : public Iterator {
+ public:
+  BoundedIterator(Iterator* iter, const std::string& lower, const std::string& upper)
+      : iter_(iter), lower_(lower), upper_(upper) {
+  }
+
+  bool Valid() const override { return valid_; }
+
+  void Seek(const Slice& target) override {
+    if (!lower_.empty() && target.compare(Slice(lower_)) < 0) {
+      iter_->Seek(lower_);
+    } else {
+      iter_->Seek(target);
+    }
+    Update();
+  }
+
+  void SeekToFirst() override {
+    if (lower_.empty()) {
+      iter_->SeekToFirst();
+    } else {
+      iter_->Seek(lower_);
+    }
+    Update();
+  }
+
+  void SeekToLast() override {
+    if (upper_.empty()) {
+      iter_->SeekToLast();
+    } else {
+      iter_->Seek(upper_);
+      if (iter_->Valid()) {
+        iter_->Prev();
+      } else {
+        iter_->SeekToLast();
+      }
+    }
+    Update();
+  }
+
+  void Next() override {
+    assert(valid_);
+    iter_->Next();
+    Update();
+  }
+
+  void Prev() override {
+    assert(valid_);
+    iter_->Prev();
+    Update();
+  }
+
+  Slice key() const override { return iter_->key(); }
+  Slice value() const override { return iter_->value(); }
+  Status status() const override { return iter_->status(); }
+
+ private:
+  void Update() {
+    valid_ = iter_->Valid() &&
+             (lower_.empty() || iter_->key().compare(Slice(lower_)) >= 0) &&
+             (upper_.empty() || iter_->key().compare(Slice(upper_)) < 0);
+  }
+
+  std::unique_ptr<Iterator> iter_;
+  std::string lower_, upper_;
+  bool valid_ = false;
+};
+
 }  // namespace
 
 Iterator* NewEmptyIterator() {
@@ -67,5 +139,10 @@ Iterator* NewErrorIterator(const Status& status) {
   return new EmptyIterator(status);
 }
 
+Iterator* NewBoundedIterator(Iterator* iter, const std::string& lower_bound,
+                             const std::string& upper_bound) {
+  return new BoundedIterator(iter, lower_bound, upper_bound);
+}
+
 }  // namespace sstable
 }  // namespace file
@@ -15,6 +15,8 @@
 #ifndef _FILE_SSTABLE_ITERATOR_H_
 #define _FILE_SSTABLE_ITERATOR_H_
 
+#include <string>
+
 #include "base/status.h"
 #include "strings/stringpiece.h"
 
@@ -73,13 +75,14 @@ class Iterator {
   //
   // Note that unlike all of the preceding methods, this method is
   // not abstract and therefore clients should not override it.
-  typedef void (*CleanupFunction)(void* arg1);
-  void RegisterCleanup(CleanupFunction function, void* arg1);
+  typedef void (*CleanupFunction)(void* arg1, void* arg2);
+  void RegisterCleanup(CleanupFunction function, void* arg1, void* arg2 = nullptr);
 
  private:
   struct Cleanup {
     CleanupFunction function;
     void* arg1;
+    void* arg2;
     Cleanup* next;
   };
   Cleanup cleanup_;
@@ -95,6 +98,11 @@ extern Iterator* NewEmptyIterator();
 // Return an empty iterator with the specified status.
 extern Iterator* NewErrorIterator(const base::Status& status);
 
+// Return an iterator that yields the keys of "iter" that are >= lower_bound and < upper_bound.
+// An empty bound is ignored. Takes ownership of "iter".
+extern Iterator* NewBoundedIterator(Iterator* iter, const std::string& lower_bound,
+                                    const std::string& upper_bound);
+
 }  // namespace sstable
 }  // namespace file
 
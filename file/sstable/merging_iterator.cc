@@ -0,0 +1,236 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/sstable/merging_iterator.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "base/logging.h"
+#include "file/sstable/iterator_wrapper.h"
+
+namespace file {
+namespace sstable {
+
+using strings::Slice;
+using base::Status;
+
+namespace {
+
+// Keeps the valid children that are not positioned at key() in a heap ordered by their keys:
+// a min-heap when moving forward and a max-heap when moving backwards.
+// current_ holds the children positioned at key(), in the order of their indices.
+class MergingIterator : public Iterator {
+ public:
+  MergingIterator(Iterator** children, unsigned n, const MergingOptions& options)
+      : children_(new IteratorWrapper[n]), n_(n), options_(options) {
+    for (unsigned i = 0; i < n; ++i) {
+      children_[i].Set(children[i]);
+    }
+    heap_.reserve(n);
+    current_.reserve(n);
+  }
+
+  bool Valid() const override { return !current_.empty(); }
+
+  void SeekToFirst() override {
+    for (unsigned i = 0; i < n_; ++i) {
+      children_[i].SeekToFirst();
+    }
+    direction_ = kForward;
+    Rebuild();
+  }
+
+  void SeekToLast() override {
+    for (unsigned i = 0; i < n_; ++i) {
+      children_[i].SeekToLast();
+    }
+    direction_ = kReverse;
+    Rebuild();
+  }
+
+  void Seek(const Slice& target) override {
+    for (unsigned i = 0; i < n_; ++i) {
+      children_[i].Seek(target);
+    }
+    direction_ = kForward;
+    Rebuild();
+  }
+
+  void Next() override {
+    DCHECK(Valid());
+    if (direction_ != kForward) {
+      // The other children are positioned before key(). Move all of them past it.
+      saved_key_ = key().as_string();
+      Slice k(saved_key_);
+      for (unsigned i = 0; i < n_; ++i) {
+        IteratorWrapper& child = children_[i];
+        child.Seek(k);
+        if (child.Valid() && child.key() == k) {
+          child.Next();
+        }
+      }
+      direction_ = kForward;
+      Rebuild();
+      return;
+    }
+
+    for (unsigned i : current_) {
+      children_[i].Next();
+      Push(i);
+    }
+    FindCurrent();
+  }
+
+  void Prev() override {
+    DCHECK(Valid());
+    if (direction_ != kReverse) {
+      // The other children are positioned after key(). Move all of them before it.
+      saved_key_ = key().as_string();
+      Slice k(saved_key_);
+      for (unsigned i = 0; i < n_; ++i) {
+        IteratorWrapper& child = children_[i];
+        child.Seek(k);
+        if (child.Valid()) {
+          child.Prev();
+        } else {
+          // Child has no entries >= key().  Position at last entry.
+          child.SeekToLast();
+        }
+      }
+      direction_ = kReverse;
+      Rebuild();
+      return;
+    }
+
+    for (unsigned i : current_) {
+      children_[i].Prev();
+      Push(i);
+    }
+    FindCurrent();
+  }
+
+  Slice key() const override {
+    DCHECK(Valid());
+    return children_[current_.front()].key();
+  }
+
+  Slice value() const override {
+    DCHECK(Valid());
+    switch (options_.duplicates) {
+      case MergingOptions::FIRST_WINS:
+        break;
+      case MergingOptions::LAST_WINS:
+        return children_[current_.back()].value();
+      case MergingOptions::MERGE:
+        if (current_.size() > 1) {
+          if (!merged_valid_) {
+            values_.clear();
+            for (unsigned i : current_) {
+              values_.push_back(children_[i].value());
+            }
+            merged_.clear();
+            options_.merge(key(), values_.data(), values_.size(), &merged_);
+            merged_valid_ = true;
+          }
+          return merged_;
+        }
+        break;
+    }
+    return children_[current_.front()].value();
+  }
+
+  Status status() const override {
+    for (unsigned i = 0; i < n_; ++i) {
+      Status s = children_[i].status();
+      if (!s.ok())
+        return s;
+    }
+    return Status::OK;
+  }
+
+ private:
+  enum Direction { kForward, kReverse };
+
+  // Whether child a should be below child b in the heap.
+  bool HeapLess(unsigned a, unsigned b) const {
+    int res = children_[a].key().compare(children_[b].key());
+    return direction_ == kForward ? res > 0 : res < 0;
+  }
+
+  void Push(unsigned i) {
+    if (!children_[i].Valid())
+      return;
+    heap_.push_back(i);
+    std::push_heap(heap_.begin(), heap_.end(), HeapOrder{this});
+  }
+
+  unsigned Pop() {
+    std::pop_heap(heap_.begin(), heap_.end(), HeapOrder{this});
+    unsigned i = heap_.back();
+    heap_.pop_back();
+    return i;
+  }
+
+  void Rebuild() {
+    heap_.clear();
+    for (unsigned i = 0; i < n_; ++i) {
+      if (children_[i].Valid())
+        heap_.push_back(i);
+    }
+    std::make_heap(heap_.begin(), heap_.end(), HeapOrder{this});
+    FindCurrent();
+  }
+
+  // Moves the children positioned at the next key from the heap to current_.
+  void FindCurrent() {
+    current_.clear();
+    merged_valid_ = false;
+    if (heap_.empty())
+      return;
+    current_.push_back(Pop());
+    Slice k = children_[current_.front()].key();
+    while (!heap_.empty() && children_[heap_.front()].key() == k) {
+      current_.push_back(Pop());
+    }
+    if (current_.size() > 1) {
+      std::sort(current_.begin(), current_.end());
+    }
+  }
+
+  struct HeapOrder {
+    const MergingIterator* it;
+    bool operator()(unsigned a, unsigned b) const { return it->HeapLess(a, b); }
+  };
+
+  std::unique_ptr<IteratorWrapper[]> children_;
+  const unsigned n_;
+  const MergingOptions options_;
+  Direction direction_ = kForward;
+
+  std::vector<unsigned> heap_;
+  std::vector<unsigned> current_;
+  std::string saved_key_;
+
+  // Lazily computed value of a key found in several children with MERGE.
+  mutable std::vector<Slice> values_;
+  mutable std::string merged_;
+  mutable bool merged_valid_ = false;
+};
+
+}  // namespace
+
+Iterator* NewMergingIterator(Iterator** children, unsigned n, const MergingOptions& options) {
+  CHECK(options.duplicates != MergingOptions::MERGE || options.merge)
+      << "MERGE requires a merge function";
+  if (n == 0) {
+    return NewEmptyIterator();
+  } else if (n == 1) {
+    return children[0];
+  }
+  return new MergingIterator(children, n, options);
+}
+
+}  // namespace sstable
+}  // namespace file
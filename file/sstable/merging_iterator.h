@@ -0,0 +1,43 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#ifndef _FILE_SSTABLE_MERGING_ITERATOR_H_
+#define _FILE_SSTABLE_MERGING_ITERATOR_H_
+
+#include <functional>
+#include <string>
+
+#include "file/sstable/iterator.h"
+
+namespace file {
+namespace sstable {
+
+struct MergingOptions {
+  // Which value is yielded for a key that is found in several children.
+  // Children are ordered by their index in the array passed to NewMergingIterator().
+  enum Duplicates {
+    FIRST_WINS,  // The value of the first child that has the key.
+    LAST_WINS,   // The value of the last child that has the key.
+    MERGE,       // The value computed by merge.
+  };
+  Duplicates duplicates = FIRST_WINS;
+
+  // Required for MERGE. Called only for keys found in more than one child, with their values
+  // in the order of the children. Stores the merged value into *result.
+  std::function<void(const strings::Slice& key, const strings::Slice* values, unsigned count,
+                     std::string* result)> merge;
+};
+
+// Return an iterator that provides the union of the data in children[0,n-1].
+// Each key is yielded once, with the value selected by options.duplicates.
+// Takes ownership of the child iterators and will delete them when the result
+// iterator is deleted. The array itself is not owned.
+//
+// The children are kept in a binary heap, so a step costs O(log n) key comparisons.
+extern Iterator* NewMergingIterator(Iterator** children, unsigned n,
+                                    const MergingOptions& options = MergingOptions());
+
+}  // namespace sstable
+}  // namespace file
+
+#endif  // _FILE_SSTABLE_MERGING_ITERATOR_H_
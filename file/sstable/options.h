@@ -6,11 +6,16 @@
 #define _FILE_SSTABLE_OPTIONS_H_
 
 #include <stddef.h>
+#include <string>
+
+#include "util/sp_task_pool.h"
 
 namespace file {
 namespace sstable {
 
+class Cache;
 class FilterPolicy;
+class PrefixExtractor;
 
 // DB contents are stored in a set of blocks, each of which holds a
 // sequence of key,value pairs.  Each block may be compressed before
@@ -20,15 +25,52 @@ enum CompressionType {
   // NOTE: do not change the values of existing entries, as these are
   // part of the persistent format on disk.
   kNoCompression     = 0x0,
-  kSnappyCompression = 0x1
+  kSnappyCompression = 0x1,
+
+  // Compressed with util::compressors. The block is prefixed with varint32 of its
+  // uncompressed size.
+  kLZ4Compression    = 0x2,  // Fast decompression for serving.
+  kZlibCompression   = 0x3,  // Higher ratio for cold data.
 };
 
 // Options that control read operations
 struct ReadOptions {
   const FilterPolicy* filter_policy = nullptr;
+
+  // The prefix extractor the table was built with, if any. Lets Table::NewPrefixIterator()
+  // skip the data blocks whose filters do not have the prefix.
+  const PrefixExtractor* prefix_extractor = nullptr;
+
   // If true, all data read from underlying storage will be
   // verified against corresponding checksums.
   bool verify_checksums = false;
+
+  // If non-NULL, uncompressed data blocks are kept in this cache.  The cache may be shared
+  // by multiple tables and must outlive them.  See NewLRUCache() in cache.h.
+  Cache* block_cache = nullptr;
+
+  // Should the data read for this iteration be cached in memory?
+  // Callers may wish to set this field to false for bulk scans.
+  bool fill_cache = true;
+};
+
+// Options for Table::NewIterator().
+struct IteratorOptions {
+  // If positive, forward iteration reads and uncompresses up to that many data blocks
+  // following the current one in the background, which hides the read latency of long
+  // range scans. The window starts at one block, doubles whenever the iterator has to wait
+  // for a block and goes back to one block when prefetched blocks are discarded by a seek
+  // or a change of direction. Requires readahead_pool, blocks are read synchronously without it.
+  unsigned readahead_blocks = 0;
+
+  // Runs the read-ahead reads and may be shared by many iterators. Not owned.
+  // Iterators that use it must not run on its threads.
+  util::FuncTaskPool* readahead_pool = nullptr;
+
+  // If not empty, the iterator yields only keys >= lower_bound and < upper_bound.
+  // Read-ahead stops at the upper bound as well. See Table::PlanSplits().
+  std::string lower_bound;
+  std::string upper_bound;
 };
 
 // Options to control the behavior of a database (passed to DB::Open)
@@ -56,6 +98,10 @@ struct Options {
   // efficiently detect that and will switch to uncompressed mode.
   CompressionType compression = kSnappyCompression;
 
+  // Compression level passed to the compressor of kLZ4Compression and kZlibCompression.
+  // LZ4 switches to its high compression mode from level 3. -1 for zlib means its default level.
+  int compression_level = -1;
+
   // If non-NULL, use the specified filter policy to reduce disk reads.
   // Many applications will benefit from passing the result of
   // NewBloomFilterPolicy() here.
@@ -63,12 +109,48 @@ struct Options {
   // Default: NULL
   const FilterPolicy* filter_policy = nullptr;
 
+  // Used with filter_policy. If non-NULL, the filters also hold the prefixes of the keys in
+  // the domain of the extractor, so that Table::NewPrefixIterator() can skip the data blocks
+  // without a prefix. The table must be read with the same extractor for that.
+  const PrefixExtractor* prefix_extractor = nullptr;
+
+  // Used with prefix_extractor. If false, the filters hold only the prefixes, which makes
+  // them smaller, but Table::Get() can only check the prefixes of the keys.
+  bool whole_key_filtering = true;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
   // compression is enabled.
   unsigned block_size = 16384;
 
+  // If true, data blocks get a hash index that lets Table::Get() find the restart interval
+  // of a key without a binary search. Costs about 1.4 bytes per key.
+  // Readers from before this option can not read tables built with it.
+  bool data_block_hash_index = false;
+
+  // If positive, data blocks are compressed and checksummed by that many background
+  // threads while Add() continues to fill the next block. The blocks are still written in
+  // order and the output is identical to the one built with 0, which compresses inline.
+  unsigned compression_threads = 0;
+
+  // If positive, the index is split into partitions of about that many bytes and only a
+  // small top-level index that points to them is read by Table::Open(). The partitions are
+  // loaded on demand, through the block cache if there is one. Reduces the open time and
+  // the resident memory of very large tables.
+  unsigned index_partition_size = 0;
+
+  // If positive, every key has exactly that many bytes, e.g. 8 for big-endian integer ids.
+  // Blocks then keep their keys in a dense array without delta encoding that is searched
+  // without decoding entries, and the index holds the full last key of every data block.
+  // TableBuilder::Add() fails on keys of other sizes. data_block_hash_index is ignored.
+  // Readers from before this option can not read tables built with it.
+  unsigned fixed_key_size = 0;
+
+  // Used with fixed_key_size. If positive, every value has exactly that many bytes and
+  // blocks do not store value offsets.
+  unsigned fixed_value_size = 0;
+
   // Create an Options object with default values for all fields.
   Options() {}
 };
@@ -0,0 +1,464 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+// The keys are hashed to 64 bits and mapped to slots [0, num_keys) by a BBHash style
+// minimal perfect hash function: level i is a bit array of gamma * n_i bits, where n_i is
+// the number of keys that collided on all previous levels. A key that does not collide on
+// level i sets its bit there and its slot is the rank of that bit among all the set bits.
+// The few keys left after kMaxLevels levels are kept in a sorted array of hashes and get
+// the slots that follow.
+//
+// File format, all integers are little-endian:
+//     records: (key_size: varint32, value_size: varint32, key, value)[num_keys]
+//     padding to 8 bytes
+//     index:
+//       level_bits: uint64[total_words]        // The bit arrays of all levels.
+//       ranks: uint64[blocks + 1]              // Set bits before every 512 bit block.
+//       fallback: uint64[num_fallback]         // Sorted hashes of the remaining keys.
+//       entries: uint64[num_keys]              // record offset << 24 | record size
+//       fingerprints: uint16[num_keys]         // Padded to 8 bytes.
+//       level_words: uint64[num_levels]
+//     footer: index_offset, num_keys, num_levels, num_fallback, seed, magic: fixed64
+// entries and fingerprints are ordered by slot. The record size of an entry is 0 if it does
+// not fit into 24 bits, in which case it is read from the record header.
+// All the arrays of the index are 8 byte aligned, so the index can be used in place when
+// the file is mapped into memory.
+
+#include "file/sstable/perfect_hash_table.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "base/hash.h"
+#include "base/logging.h"
+#include "file/file.h"
+#include "util/coding/fixed.h"
+#include "util/coding/varint.h"
+#include "util/sinksource.h"
+
+namespace file {
+namespace sstable {
+
+using base::Status;
+using base::StatusCode;
+using strings::Slice;
+using std::string;
+
+namespace {
+
+constexpr unsigned kMaxLevels = 32;
+constexpr unsigned kRecordSizeBits = 24;
+constexpr uint64 kMaxRecordOffset = 1ULL << (64 - kRecordSizeBits);
+constexpr size_t kFooterSize = 6 * sizeof(uint64);
+constexpr uint64 kMagic = 0x3168706d75626fULL;  // "obumph1"
+constexpr size_t kWriteBufferSize = 1 << 16;
+
+inline uint64 KeyHash(const Slice& key, uint32 seed) {
+  return base::FingerprintXX64(key.data(), key.size(), seed);
+}
+
+inline uint64 LevelHash(uint64 hash, unsigned level) {
+  // Murmur3 finalizer over a distinct offset per level.
+  uint64 h = hash + (level + 1) * 0x9e3779b97f4a7c15ULL;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Maps hash uniformly to [0, range) without a division.
+inline uint64 Reduce(uint64 hash, uint64 range) {
+  return static_cast<uint64>((static_cast<unsigned __int128>(hash) * range) >> 64);
+}
+
+inline uint16 KeyFingerprint(uint64 hash) {
+  return hash >> 48;
+}
+
+inline bool TestBit(const uint64* words, uint64 pos) {
+  return (words[pos >> 6] >> (pos & 63)) & 1;
+}
+
+// One rank per block of 8 words, followed by the total.
+inline uint64 RankWords(uint64 total_words) {
+  return (total_words + 7) / 8 + 1;
+}
+
+inline size_t FingerprintsSize(uint64 num_keys) {
+  return (num_keys * sizeof(uint16) + 7) & ~size_t(7);
+}
+
+inline Status Corruption(const char* msg) {
+  return Status(StatusCode::IO_ERROR, msg);
+}
+
+void AppendWords(const uint64* words, size_t count, string* dest) {
+  dest->append(reinterpret_cast<const char*>(words), count * sizeof(uint64));
+}
+
+}  // namespace
+
+struct PerfectHashTableBuilder::Rep {
+  PerfectHashOptions options;
+  util::Sink* sink;
+  Status status;
+  uint64 offset = 0;
+  string buf;
+
+  // Indexed by the order of Add().
+  std::vector<uint64> hashes;
+  std::vector<uint64> entries;
+
+  Rep(const PerfectHashOptions& opts, util::Sink* s) : options(opts), sink(s) {}
+
+  void Write(const Slice data) {
+    if (status.ok()) {
+      status = sink->Append(data);
+    }
+    offset += data.size();
+  }
+
+  void FlushBuffer() {
+    Write(buf);
+    buf.clear();
+  }
+};
+
+PerfectHashTableBuilder::PerfectHashTableBuilder(const PerfectHashOptions& options,
+                                                 util::Sink* sink)
+    : rep_(new Rep(options, sink)) {
+  CHECK_GE(options.gamma, 1.0);
+}
+
+PerfectHashTableBuilder::~PerfectHashTableBuilder() {
+}
+
+void PerfectHashTableBuilder::Add(const Slice key, const Slice value) {
+  Rep* r = rep_.get();
+  if (!r->status.ok())
+    return;
+
+  const uint64 record_offset = r->offset + r->buf.size();
+  if (record_offset >= kMaxRecordOffset) {
+    r->status = Status(StatusCode::INVALID_ARGUMENT, "perfect hash table is too large");
+    return;
+  }
+  const size_t start = r->buf.size();
+  Varint::Append32(&r->buf, key.size());
+  Varint::Append32(&r->buf, value.size());
+  r->buf.append(key.data(), key.size());
+  r->buf.append(value.data(), value.size());
+  uint64 size = r->buf.size() - start;
+  if (size >= (1ULL << kRecordSizeBits))
+    size = 0;
+
+  r->hashes.push_back(KeyHash(key, r->options.seed));
+  r->entries.push_back(record_offset << kRecordSizeBits | size);
+  if (r->buf.size() >= kWriteBufferSize) {
+    r->FlushBuffer();
+  }
+}
+
+Status PerfectHashTableBuilder::Finish() {
+  Rep* r = rep_.get();
+  r->buf.append((8 - (r->offset + r->buf.size()) % 8) % 8, '\0');
+  r->FlushBuffer();
+  RETURN_IF_ERROR(r->status);
+
+  const uint64 num_keys = r->hashes.size();
+  const uint64 index_offset = r->offset;
+
+  // Bit position of every key that was placed by one of the levels.
+  std::vector<uint64> positions(num_keys);
+  std::vector<uint64> level_bits, level_words;
+  std::vector<uint32> keys(num_keys), next;
+  std::iota(keys.begin(), keys.end(), 0);
+  std::vector<uint64> seen, collided;
+  uint64 bit_base = 0;
+
+  for (unsigned level = 0; level < kMaxLevels && !keys.empty(); ++level) {
+    const uint64 words = std::max<uint64>(1, std::ceil(r->options.gamma * keys.size() / 64));
+    const uint64 range = words * 64;
+    seen.assign(words, 0);
+    collided.assign(words, 0);
+    for (uint32 k : keys) {
+      uint64 pos = Reduce(LevelHash(r->hashes[k], level), range);
+      uint64 bit = 1ULL << (pos & 63);
+      if (seen[pos >> 6] & bit) {
+        collided[pos >> 6] |= bit;
+      } else {
+        seen[pos >> 6] |= bit;
+      }
+    }
+    next.clear();
+    for (uint32 k : keys) {
+      uint64 pos = Reduce(LevelHash(r->hashes[k], level), range);
+      if (TestBit(collided.data(), pos)) {
+        next.push_back(k);
+      } else {
+        positions[k] = bit_base + pos;
+      }
+    }
+    for (uint64 i = 0; i < words; ++i) {
+      level_bits.push_back(seen[i] & ~collided[i]);
+    }
+    level_words.push_back(words);
+    bit_base += range;
+    keys.swap(next);
+  }
+
+  std::vector<uint64> ranks(RankWords(level_bits.size()));
+  uint64 num_placed = 0;
+  for (size_t i = 0; i < level_bits.size(); ++i) {
+    if (i % 8 == 0)
+      ranks[i / 8] = num_placed;
+    num_placed += __builtin_popcountll(level_bits[i]);
+  }
+  ranks.back() = num_placed;
+
+  // Keys that collide on all levels. Equal hashes always collide, so duplicates end up here.
+  std::sort(keys.begin(), keys.end(),
+            [r](uint32 a, uint32 b) { return r->hashes[a] < r->hashes[b]; });
+  std::vector<uint64> fallback(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    fallback[i] = r->hashes[keys[i]];
+    if (i > 0 && fallback[i] == fallback[i - 1]) {
+      return Status(StatusCode::INVALID_ARGUMENT, "duplicate key or 64-bit hash collision");
+    }
+  }
+
+  std::vector<uint64> entries(num_keys);
+  std::vector<uint16> fingerprints(FingerprintsSize(num_keys) / sizeof(uint16));
+  auto place = [&](uint32 k, uint64 slot) {
+    entries[slot] = r->entries[k];
+    fingerprints[slot] = KeyFingerprint(r->hashes[k]);
+  };
+  for (size_t i = 0; i < keys.size(); ++i) {
+    place(keys[i], num_placed + i);
+    positions[keys[i]] = kuint64max;
+  }
+  for (uint32 k = 0; k < num_keys; ++k) {
+    uint64 pos = positions[k];
+    if (pos == kuint64max)
+      continue;
+    uint64 block = pos >> 9, word = pos >> 6;
+    uint64 slot = ranks[block];
+    for (uint64 w = block * 8; w < word; ++w) {
+      slot += __builtin_popcountll(level_bits[w]);
+    }
+    slot += __builtin_popcountll(level_bits[word] & ((1ULL << (pos & 63)) - 1));
+    place(k, slot);
+  }
+
+  AppendWords(level_bits.data(), level_bits.size(), &r->buf);
+  AppendWords(ranks.data(), ranks.size(), &r->buf);
+  AppendWords(fallback.data(), fallback.size(), &r->buf);
+  AppendWords(entries.data(), entries.size(), &r->buf);
+  r->buf.append(reinterpret_cast<const char*>(fingerprints.data()), FingerprintsSize(num_keys));
+  AppendWords(level_words.data(), level_words.size(), &r->buf);
+
+  const uint64 footer[] = {index_offset, num_keys, level_words.size(), fallback.size(),
+                           r->options.seed, kMagic};
+  for (uint64 val : footer) {
+    coding::AppendFixed64(val, &r->buf);
+  }
+  r->FlushBuffer();
+  return r->status;
+}
+
+uint64 PerfectHashTableBuilder::NumEntries() const {
+  return rep_->hashes.size();
+}
+
+uint64 PerfectHashTableBuilder::FileSize() const {
+  return rep_->offset + rep_->buf.size();
+}
+
+struct PerfectHashTable::Rep {
+  ReadonlyFile* file;
+  uint32 seed;
+  uint64 num_keys;
+  uint64 num_fallback;
+  uint64 num_placed;
+  std::vector<uint64> level_words;
+
+  // Point either into the mapped file, kept by pin, or into index_data.
+  const uint64* level_bits;
+  const uint64* ranks;
+  const uint64* fallback;
+  const uint64* entries;
+  const uint16* fingerprints;
+  std::shared_ptr<const void> pin;
+  std::unique_ptr<uint64[]> index_data;
+
+  // Returns the slot of the key or num_keys if it can not be in the table.
+  uint64 Slot(uint64 hash) const;
+};
+
+uint64 PerfectHashTable::Rep::Slot(uint64 hash) const {
+  uint64 bit_base = 0;
+  for (unsigned level = 0; level < level_words.size(); ++level) {
+    const uint64 range = level_words[level] * 64;
+    const uint64 pos = bit_base + Reduce(LevelHash(hash, level), range);
+    if (TestBit(level_bits, pos)) {
+      uint64 block = pos >> 9, word = pos >> 6;
+      uint64 slot = ranks[block];
+      for (uint64 w = block * 8; w < word; ++w) {
+        slot += __builtin_popcountll(level_bits[w]);
+      }
+      return slot + __builtin_popcountll(level_bits[word] & ((1ULL << (pos & 63)) - 1));
+    }
+    bit_base += range;
+  }
+  const uint64* end = fallback + num_fallback;
+  const uint64* it = std::lower_bound(fallback, end, hash);
+  if (it == end || *it != hash)
+    return num_keys;
+  return num_placed + (it - fallback);
+}
+
+PerfectHashTable::PerfectHashTable(Rep* rep) : rep_(rep) {
+}
+
+PerfectHashTable::~PerfectHashTable() {
+}
+
+base::StatusObject<PerfectHashTable*> PerfectHashTable::Open(ReadonlyFile* file) {
+  const size_t size = file->Size();
+  if (size < kFooterSize) {
+    return Status(StatusCode::INVALID_ARGUMENT, "file is too short to be a perfect hash table");
+  }
+  uint8 footer_buf[kFooterSize];
+  Slice footer_input;
+  RETURN_IF_ERROR(file->Read(size - kFooterSize, kFooterSize, &footer_input, footer_buf));
+  if (footer_input.size() != kFooterSize) {
+    return Corruption("truncated perfect hash table footer");
+  }
+  uint64 footer[6];
+  for (unsigned i = 0; i < 6; ++i) {
+    coding::DecodeFixed64(footer_input.ubuf() + i * sizeof(uint64), &footer[i]);
+  }
+  if (footer[5] != kMagic) {
+    return Status(StatusCode::INVALID_ARGUMENT, "not a perfect hash table");
+  }
+
+  std::unique_ptr<Rep> rep(new Rep);
+  rep->file = file;
+  const uint64 index_offset = footer[0];
+  rep->num_keys = footer[1];
+  const uint64 num_levels = footer[2];
+  rep->num_fallback = footer[3];
+  rep->seed = footer[4];
+  if (index_offset % 8 != 0 || index_offset > size - kFooterSize || num_levels > kMaxLevels) {
+    return Corruption("bad perfect hash table footer");
+  }
+
+  // Use the index in place if the file is mapped and the mapping is aligned.
+  const size_t index_size = size - kFooterSize - index_offset;
+  Slice index;
+  if (!file->ReadMapped(index_offset, index_size, &index, &rep->pin) ||
+      reinterpret_cast<uintptr_t>(index.data()) % sizeof(uint64) != 0) {
+    rep->pin.reset();
+    rep->index_data.reset(new uint64[index_size / sizeof(uint64) + 1]);
+    uint8* buf = reinterpret_cast<uint8*>(rep->index_data.get());
+    RETURN_IF_ERROR(file->Read(index_offset, index_size, &index, buf));
+    if (index.size() != index_size) {
+      return Corruption("truncated perfect hash table index");
+    }
+    if (index.ubuf() != buf) {
+      memcpy(buf, index.data(), index_size);
+    }
+    index = Slice(buf, index_size);
+  }
+
+  const uint64* words = reinterpret_cast<const uint64*>(index.data());
+  if (index_size < num_levels * sizeof(uint64)) {
+    return Corruption("bad perfect hash table index");
+  }
+  const uint64* level_words = words + (index_size / sizeof(uint64) - num_levels);
+  rep->level_words.assign(level_words, level_words + num_levels);
+  uint64 total_words = 0;
+  for (uint64 w : rep->level_words) {
+    total_words += w;
+  }
+  const uint64 expected = (total_words + RankWords(total_words) + rep->num_fallback +
+      rep->num_keys + num_levels) * sizeof(uint64) + FingerprintsSize(rep->num_keys);
+  if (index_size % 8 != 0 || expected != index_size) {
+    return Corruption("bad perfect hash table index");
+  }
+
+  rep->level_bits = words;
+  rep->ranks = rep->level_bits + total_words;
+  rep->fallback = rep->ranks + RankWords(total_words);
+  rep->entries = rep->fallback + rep->num_fallback;
+  rep->fingerprints = reinterpret_cast<const uint16*>(rep->entries + rep->num_keys);
+  rep->num_placed = rep->ranks[RankWords(total_words) - 1];
+  if (rep->num_placed + rep->num_fallback != rep->num_keys) {
+    return Corruption("bad perfect hash table index");
+  }
+  return new PerfectHashTable(rep.release());
+}
+
+base::StatusObject<bool> PerfectHashTable::Get(const Slice& key, string* value) const {
+  const Rep* r = rep_.get();
+  const uint64 hash = KeyHash(key, r->seed);
+  const uint64 slot = r->Slot(hash);
+  if (slot == r->num_keys || r->fingerprints[slot] != KeyFingerprint(hash))
+    return false;
+
+  const uint64 entry = r->entries[slot];
+  const uint64 offset = entry >> kRecordSizeBits;
+  uint64 size = entry & ((1ULL << kRecordSizeBits) - 1);
+  uint32 key_size, value_size;
+
+  // Mapped files are parsed in place. The pins keep the mapping valid, a concurrent lookup may
+  // move the file to another region.
+  std::shared_ptr<const void> pin;
+  if (size == 0) {
+    // A large record, its size is in the header.
+    uint8 header_buf[Varint::kMax32 * 2];
+    Slice header;
+    if (!r->file->ReadMapped(offset, sizeof(header_buf), &header, &pin)) {
+      RETURN_IF_ERROR(r->file->Read(offset, sizeof(header_buf), &header, header_buf));
+    }
+    const uint8* ptr = Varint::Parse32WithLimit(header.ubuf(), header.ubuf() + header.size(),
+                                                &key_size);
+    if (ptr)
+      ptr = Varint::Parse32WithLimit(ptr, header.ubuf() + header.size(), &value_size);
+    if (!ptr)
+      return Corruption("bad perfect hash table record");
+    size = (ptr - header.ubuf()) + key_size + value_size;
+  }
+
+  Slice record;
+  if (!r->file->ReadMapped(offset, size, &record, &pin)) {
+    // Not into *value, which must stay intact when the record belongs to another key.
+    static thread_local string scratch;
+    scratch.resize(size);
+    RETURN_IF_ERROR(r->file->Read(offset, size, &record,
+                                  reinterpret_cast<uint8*>(&scratch.front())));
+  }
+  const uint8* limit = record.ubuf() + record.size();
+  const uint8* ptr = Varint::Parse32WithLimit(record.ubuf(), limit, &key_size);
+  if (ptr)
+    ptr = Varint::Parse32WithLimit(ptr, limit, &value_size);
+  if (!ptr || uint64(limit - ptr) != uint64(key_size) + value_size)
+    return Corruption("bad perfect hash table record");
+
+  // The fingerprint may match for an absent key.
+  if (key != Slice(ptr, key_size))
+    return false;
+  ptr += key_size;
+  value->assign(reinterpret_cast<const char*>(ptr), value_size);
+  return true;
+}
+
+uint64 PerfectHashTable::NumEntries() const {
+  return rep_->num_keys;
+}
+
+}  // namespace sstable
+}  // namespace file
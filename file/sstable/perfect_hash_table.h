@@ -0,0 +1,98 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+// A read-only key/value file for exact-match lookups. Keys are mapped to slots by a minimal
+// perfect hash function, so a lookup costs one hash computation, a few accesses to the index
+// that is kept in memory and one read of the record. Unlike Table, there is no ordering and
+// no iteration. See perfect_hash_table.cc for the file format.
+//
+#ifndef _FILE_SSTABLE_PERFECT_HASH_TABLE_H_
+#define _FILE_SSTABLE_PERFECT_HASH_TABLE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/status.h"
+#include "strings/stringpiece.h"
+
+namespace util {
+class Sink;
+}  // namespace util
+
+namespace file {
+
+class ReadonlyFile;
+
+namespace sstable {
+
+struct PerfectHashOptions {
+  // Bits of the hash function per key and level. Larger values build faster and need fewer
+  // levels per lookup at the cost of a larger index (about 1.44 * gamma bits per key).
+  double gamma = 2.0;
+
+  // Seed of the key hash. Two keys with the same 64-bit hash can not be told apart by the
+  // hash function and fail the build. This is very unlikely, but can be fixed by another seed.
+  uint32 seed = 0;
+};
+
+class PerfectHashTableBuilder {
+ public:
+  // Does not take ownership of sink. Records are appended to it as they are added and the
+  // index is written by Finish().
+  PerfectHashTableBuilder(const PerfectHashOptions& options, util::Sink* sink);
+  ~PerfectHashTableBuilder();
+
+  // Keys must be unique but may come in any order, so the stream of a TableBuilder fits.
+  // Keeps 16 bytes per key in memory until Finish().
+  void Add(const strings::Slice key, const strings::Slice value);
+
+  // Builds the hash function and writes the index.
+  // Fails with INVALID_ARGUMENT if a key was added twice.
+  base::Status Finish();
+
+  uint64 NumEntries() const;
+
+  // Size of the file generated so far.
+  uint64 FileSize() const;
+
+ private:
+  struct Rep;
+  std::unique_ptr<Rep> rep_;
+
+  PerfectHashTableBuilder(const PerfectHashTableBuilder&) = delete;
+  void operator=(const PerfectHashTableBuilder&) = delete;
+};
+
+// Safe for concurrent lookups.
+class PerfectHashTable {
+ public:
+  // Reads the index into memory, or uses it in place if the file is mapped.
+  // *file must remain live while the table is in use.
+  // Lookups read records at random offsets, so files that are larger than the mapping window
+  // of ReadonlyFile are better opened without use_mmap: every read would move the window.
+  static base::StatusObject<PerfectHashTable*> Open(ReadonlyFile* file);
+
+  ~PerfectHashTable();
+
+  // Returns true and fills *value if the table contains key.
+  // Most absent keys are rejected by their fingerprints without reading from the file.
+  base::StatusObject<bool> Get(const strings::Slice& key, std::string* value) const;
+
+  uint64 NumEntries() const;
+
+ private:
+  struct Rep;
+  explicit PerfectHashTable(Rep* rep);
+
+  std::unique_ptr<Rep> rep_;
+
+  PerfectHashTable(const PerfectHashTable&) = delete;
+  void operator=(const PerfectHashTable&) = delete;
+};
+
+}  // namespace sstable
+}  // namespace file
+
+#endif  // _FILE_SSTABLE_PERFECT_HASH_TABLE_H_
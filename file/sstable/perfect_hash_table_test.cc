@@ -0,0 +1,251 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/sstable/perfect_hash_table.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "base/random.h"
+#include "file/file.h"
+#include "file/filesource.h"
+#include "file/sstable/cache.h"
+#include "file/sstable/filter_policy.h"
+#include "file/sstable/sstable.h"
+#include "file/sstable/sstable_builder.h"
+#include "strings/stringprintf.h"
+
+namespace file {
+namespace sstable {
+
+using std::string;
+using strings::Slice;
+
+class PerfectHashTableTest : public testing::Test {
+ protected:
+  static string Key(unsigned i) { return StringPrintf("key%07u", i); }
+  static string Value(unsigned i) { return StringPrintf("value%u", i) + string(i % 50, 'v'); }
+
+  void Build(const string& name, unsigned count) {
+    path_ = base::GetTestTempPath(name);
+    Sink sink(Open(path_), TAKE_OWNERSHIP);
+    PerfectHashTableBuilder builder(PerfectHashOptions(), &sink);
+    // Unsorted keys.
+    for (unsigned i = 0; i < count; ++i) {
+      unsigned k = (i * 7919) % count;
+      builder.Add(Key(k), Value(k));
+    }
+    ASSERT_EQ(count, builder.NumEntries());
+    ASSERT_TRUE(builder.Finish().ok());
+  }
+
+  void OpenTable(bool use_mmap) {
+    table_.reset();
+    if (file_) {
+      ASSERT_TRUE(file_->Close().ok());
+    }
+
+    ReadonlyFile::Options file_opts;
+    file_opts.use_mmap = use_mmap;
+    auto res = ReadonlyFile::Open(path_, file_opts);
+    ASSERT_TRUE(res.ok()) << res.status;
+    file_.reset(res.obj);
+    auto table_res = PerfectHashTable::Open(file_.get());
+    ASSERT_TRUE(table_res.ok()) << table_res.status;
+    table_.reset(table_res.obj);
+  }
+
+  void TearDown() override {
+    table_.reset();
+    if (file_) {
+      EXPECT_TRUE(file_->Close().ok());
+    }
+  }
+
+  string path_;
+  std::unique_ptr<ReadonlyFile> file_;
+  std::unique_ptr<PerfectHashTable> table_;
+};
+
+TEST_F(PerfectHashTableTest, Get) {
+  const unsigned kCount = 100000;
+  Build("phash.mph", kCount);
+
+  for (bool use_mmap : {false, true}) {
+    OpenTable(use_mmap);
+    EXPECT_EQ(kCount, table_->NumEntries());
+    string value;
+    for (unsigned i = 0; i < kCount; ++i) {
+      auto res = table_->Get(Key(i), &value);
+      ASSERT_TRUE(res.ok() && res.obj) << i;
+      ASSERT_EQ(Value(i), value);
+    }
+    // Enough absent keys for some of them to match the fingerprints of their slots.
+    value = "unchanged";
+    for (unsigned i = kCount; i < kCount + 500000; ++i) {
+      auto res = table_->Get(Key(i), &value);
+      ASSERT_TRUE(res.ok());
+      ASSERT_FALSE(res.obj) << i;
+      ASSERT_EQ("unchanged", value) << i;
+    }
+    EXPECT_FALSE(table_->Get("", &value).obj);
+  }
+}
+
+// Lookups from several threads over a mapped file that is larger than the mapping window,
+// so that they keep moving the window under each other.
+TEST_F(PerfectHashTableTest, ConcurrentMmap) {
+  const unsigned kCount = 40000;
+  auto value = [](unsigned i) { return Value(i) + string(1000, 'a' + i % 26); };
+  path_ = base::GetTestTempPath("concurrent.mph");
+  {
+    Sink sink(Open(path_), TAKE_OWNERSHIP);
+    PerfectHashTableBuilder builder(PerfectHashOptions(), &sink);
+    for (unsigned i = 0; i < kCount; ++i) {
+      builder.Add(Key(i), value(i));
+    }
+    ASSERT_TRUE(builder.Finish().ok());
+  }
+  OpenTable(true);
+  ASSERT_GT(file_->Size(), 32 << 20);
+
+  std::vector<std::thread> threads;
+  std::atomic_int mismatches{0};
+  for (unsigned t = 0; t < 8; ++t) {
+    threads.emplace_back([&, t] {
+      MTRandom rnd(t);
+      string result;
+      for (unsigned j = 0; j < 20000; ++j) {
+        unsigned i = rnd.Rand32() % kCount;
+        auto res = table_->Get(Key(i), &result);
+        if (!res.ok() || !res.obj || result != value(i))
+          ++mismatches;
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  EXPECT_EQ(0, mismatches);
+}
+
+TEST_F(PerfectHashTableTest, Edges) {
+  Build("empty.mph", 0);
+  OpenTable(false);
+  string value;
+  EXPECT_EQ(0, table_->NumEntries());
+  EXPECT_FALSE(table_->Get("a", &value).obj);
+
+  // A record that does not fit the size bits of its entry, and an empty value.
+  path_ = base::GetTestTempPath("large.mph");
+  const string large(20 << 20, 'x');
+  {
+    Sink sink(Open(path_), TAKE_OWNERSHIP);
+    PerfectHashTableBuilder builder(PerfectHashOptions(), &sink);
+    builder.Add("large", large);
+    builder.Add("empty", "");
+    builder.Add("small", "abc");
+    ASSERT_TRUE(builder.Finish().ok());
+  }
+  OpenTable(false);
+  ASSERT_TRUE(table_->Get("large", &value).obj);
+  EXPECT_TRUE(value == large);
+  ASSERT_TRUE(table_->Get("empty", &value).obj);
+  EXPECT_EQ("", value);
+  ASSERT_TRUE(table_->Get("small", &value).obj);
+  EXPECT_EQ("abc", value);
+
+  // Duplicates fail the build.
+  Sink sink(Open(base::GetTestTempPath("dup.mph")), TAKE_OWNERSHIP);
+  PerfectHashTableBuilder builder(PerfectHashOptions(), &sink);
+  builder.Add("a", "1");
+  builder.Add("b", "2");
+  builder.Add("a", "3");
+  EXPECT_EQ(base::StatusCode::INVALID_ARGUMENT, builder.Finish().code());
+
+  // Tables are not perfect hash tables.
+  path_ = base::GetTestTempPath("table.sst");
+  {
+    Sink sink(Open(path_), TAKE_OWNERSHIP);
+    TableBuilder builder(Options(), &sink);
+    builder.Add("a", "1");
+    ASSERT_TRUE(builder.Finish().ok());
+  }
+  auto res = ReadonlyFile::Open(path_);
+  ASSERT_TRUE(res.ok());
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  EXPECT_FALSE(PerfectHashTable::Open(file.get()).ok());
+  EXPECT_TRUE(file->Close().ok());
+}
+
+// Point lookups of present (range_y = 1) or absent keys in a Table with a block cache (0),
+// a Table with a bloom filter and a block cache (1) and a PerfectHashTable (2).
+// The files are read with pread, see PerfectHashTable::Open(). The label shows the file size.
+static void BM_Get(benchmark::State& state) {
+  const unsigned kCount = 1000000;
+  const int kind = state.range_x();
+  const bool hits = state.range_y();
+  string path = base::GetTestTempPath(StringPrintf("bench_get%d", kind));
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  {
+    Sink sink(Open(path), TAKE_OWNERSHIP);
+    if (kind == 2) {
+      PerfectHashTableBuilder builder(PerfectHashOptions(), &sink);
+      for (unsigned i = 0; i < kCount; ++i) {
+        builder.Add(StringPrintf("key%07u", i), StringPrintf("value%u", i));
+      }
+      CHECK_STATUS(builder.Finish());
+    } else {
+      Options options;
+      if (kind == 1)
+        options.filter_policy = policy.get();
+      TableBuilder builder(options, &sink);
+      for (unsigned i = 0; i < kCount; ++i) {
+        builder.Add(StringPrintf("key%07u", i), StringPrintf("value%u", i));
+      }
+      CHECK_STATUS(builder.Finish());
+    }
+  }
+  ReadonlyFile::Options file_opts;
+  file_opts.use_mmap = false;
+  auto res = ReadonlyFile::Open(path, file_opts);
+  CHECK_STATUS(res.status);
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  std::unique_ptr<Cache> cache(NewLRUCache(256 << 20));
+  std::unique_ptr<Table> table;
+  std::unique_ptr<PerfectHashTable> hash_table;
+  if (kind == 2) {
+    hash_table.reset(CHECK_NOTNULL(PerfectHashTable::Open(file.get()).obj));
+  } else {
+    ReadOptions read_options;
+    read_options.block_cache = cache.get();
+    if (kind == 1)
+      read_options.filter_policy = policy.get();
+    table.reset(CHECK_NOTNULL(Table::Open(read_options, file.get()).obj));
+  }
+
+  std::vector<string> keys(4096);
+  MTRandom rnd(10);
+  for (auto& k : keys) {
+    k = StringPrintf(hits ? "key%07u" : "kez%07u", rnd.Rand32() % kCount);
+  }
+  string value;
+  unsigned i = 0;
+  while (state.KeepRunning()) {
+    const string& key = keys[i++ % keys.size()];
+    bool found = hash_table ? hash_table->Get(key, &value).obj : table->Get(key, &value).obj;
+    CHECK_EQ(hits, found);
+  }
+  state.SetLabel(StringPrintf("%lu bytes", file->Size()));
+  table.reset();
+  hash_table.reset();
+  CHECK(file->Close().ok());
+}
+BENCHMARK(BM_Get)->ArgPair(0, 1)->ArgPair(1, 1)->ArgPair(2, 1)
+                 ->ArgPair(0, 0)->ArgPair(1, 0)->ArgPair(2, 0);
+
+}  // namespace sstable
+}  // namespace file
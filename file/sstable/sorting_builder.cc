@@ -2,4 +2,385 @@
 // Author: Roman Gershman (roman@ubimo.com)
 //
 
-#include "file/sstable/sorting_builder.h"
\ No newline at end of file
+#include "file/sstable/sorting_builder.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "base/logging.h"
+#include "file/file.h"
+#include "file/filesource.h"
+#include "file/list_file.h"
+#include "file/sstable/sstable_builder.h"
+#include "strings/strcat.h"
+#include "strings/stringprintf.h"
+#include "util/coding/varint.h"
+#include "util/sp_task_pool.h"
+
+namespace file {
+namespace sstable {
+
+using base::Status;
+using base::StatusCode;
+using strings::Slice;
+using std::string;
+
+namespace {
+
+constexpr size_t kMinBatchSize = 1 << 16;
+
+// Tournament tree of losers for k-way merging. less(a, b) compares the current heads of the
+// sources a and b. An exhausted source must compare greater than any other source.
+template <typename Less> class LoserTree {
+ public:
+  LoserTree(unsigned k, Less less) : k_(k), less_(less), tree_(k) {
+    // Leaves are k..2k-1, every internal node keeps the loser of its match.
+    std::vector<unsigned> winner(2 * k);
+    for (unsigned i = 0; i < k; ++i)
+      winner[k + i] = i;
+    for (unsigned i = k - 1; i > 0; --i) {
+      unsigned a = winner[2 * i], b = winner[2 * i + 1];
+      if (less_(b, a))
+        std::swap(a, b);
+      winner[i] = a;
+      tree_[i] = b;
+    }
+    tree_[0] = k > 1 ? winner[1] : 0;
+  }
+
+  unsigned top() const { return tree_[0]; }
+
+  // Must be called after the top source has advanced. Takes log(k) comparisons.
+  void Replay() {
+    unsigned w = tree_[0];
+    for (unsigned node = (w + k_) / 2; node > 0; node /= 2) {
+      if (less_(tree_[node], w))
+        std::swap(tree_[node], w);
+    }
+    tree_[0] = w;
+  }
+
+ private:
+  unsigned k_;
+  Less less_;
+  std::vector<unsigned> tree_;
+};
+
+}  // namespace
+
+struct SortingBuilder::Buffer {
+  struct Entry {
+    const char* data;
+    uint32 key_size;
+    uint32 value_size;
+
+    Slice key() const { return Slice(data, key_size); }
+    Slice value() const { return Slice(data + key_size, value_size); }
+  };
+
+  base::Arena arena;
+  std::vector<Entry> entries;
+
+  size_t MemoryUsage() const {
+    return arena.MemoryUsage() + entries.capacity() * sizeof(Entry);
+  }
+
+  void Sort() {
+    // Stable, so that the first added value of a key wins.
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+      return a.key().compare(b.key()) < 0;
+    });
+  }
+};
+
+// Reads a spilled run. The next batch of records is loaded by the pool while the current one
+// is being merged. A run that can not be opened, is corrupted or does not hold all the records
+// that were spilled ends the run with an error status.
+class SortingBuilder::RunReader {
+ public:
+  RunReader(const string& name, uint64 num_records, size_t batch_size,
+            util::FuncTaskPool* pool)
+      : name_(name), num_records_(num_records), batch_size_(batch_size), pool_(pool) {
+    auto res = ReadonlyFile::Open(name);
+    if (!res.ok()) {
+      status_ = res.status;
+      eof_ = true;
+      return;
+    }
+    reader_.reset(new ListReader(res.obj, TAKE_OWNERSHIP, true,
+                                 [this](size_t bytes, const Status& st) {
+      if (status_.ok())
+        status_ = Status(StatusCode::IO_ERROR, "Corrupted run " + name_ + ": " + st.ToString());
+    }));
+    LoadNext();
+  }
+
+  ~RunReader() {
+    std::unique_lock<std::mutex> lock(mu_);
+    loaded_.wait(lock, [this] { return !loading_; });
+  }
+
+  // Returns false when the run is exhausted.
+  bool Next() {
+    if (pos_ == current_.size()) {
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        loaded_.wait(lock, [this] { return !loading_; });
+      }
+      current_.swap(next_);
+      next_.clear();
+      pos_ = 0;
+      if (current_.empty())
+        return false;
+      LoadNext();
+    }
+
+    const uint8* ptr = reinterpret_cast<const uint8*>(current_.data()) + pos_;
+    uint32 record_size, key_size;
+    ptr = Varint::Parse32(ptr, &record_size);
+    const uint8* record = Varint::Parse32(ptr, &key_size);
+    uint32 value_size = record_size - (record - ptr) - key_size;
+    key_ = Slice(record, key_size);
+    value_ = Slice(record + key_size, value_size);
+    pos_ = reinterpret_cast<const char*>(ptr) + record_size - current_.data();
+    return true;
+  }
+
+  Slice key() const { return key_; }
+  Slice value() const { return value_; }
+
+  // Valid once Next() returned false.
+  Status status() const { return status_; }
+
+ private:
+  // Appends records to next_ prefixed with their size.
+  void LoadNext() {
+    if (eof_)
+      return;
+    loading_ = true;
+    pool_->RunTask([this] {
+      Slice record;
+      string scratch;
+      uint8 buf[Varint::kMax32];
+      while (next_.size() < batch_size_) {
+        if (!reader_->ReadRecord(&record, &scratch) || !status_.ok()) {
+          eof_ = true;
+          if (status_.ok() && records_read_ != num_records_) {
+            status_ = Status(StatusCode::IO_ERROR, StrCat("Run ", name_, " holds ",
+                             records_read_, " records instead of ", num_records_));
+          }
+          break;
+        }
+        ++records_read_;
+        uint8* end = Varint::Encode32(buf, record.size());
+        next_.append(reinterpret_cast<char*>(buf), end - buf);
+        next_.append(record.data(), record.size());
+      }
+      std::lock_guard<std::mutex> lock(mu_);
+      loading_ = false;
+      loaded_.notify_all();
+    });
+  }
+
+  const string name_;
+  const uint64 num_records_;
+  std::unique_ptr<ListReader> reader_;
+  const size_t batch_size_;
+  util::FuncTaskPool* pool_;
+  uint64 records_read_ = 0;
+
+  // Written by the loading task, read after it finished.
+  Status status_;
+
+  string current_, next_;
+  size_t pos_ = 0;
+  Slice key_, value_;
+  bool eof_ = false;
+
+  std::mutex mu_;
+  std::condition_variable loaded_;
+  bool loading_ = false;
+};
+
+SortingBuilder::SortingBuilder(StringPiece basename, Options options)
+    : basename_(basename.as_string()), options_(options), buffer_(new Buffer) {
+  CHECK_GT(options_.mem_sort_size_mb, 0);
+  unsigned threads = std::max(1u, options_.sort_threads);
+  buffer_limit_ = (size_t(options_.mem_sort_size_mb) << 20) / (threads + 1);
+  pool_.reset(new util::FuncTaskPool("sort", 2, threads));
+  pool_->Launch();
+}
+
+SortingBuilder::~SortingBuilder() {
+  WaitForSpills();
+  pool_->WaitForTasksToComplete();
+}
+
+string SortingBuilder::RunName(unsigned index) const {
+  return basename_ + StringPrintf("%05d.lst", index);
+}
+
+void SortingBuilder::Add(Slice key, Slice value) {
+  CHECK_LE(key.size(), kuint32max);
+  CHECK_LE(value.size(), kuint32max);
+  size_t size = key.size() + value.size();
+  char* ptr = buffer_->arena.Allocate(std::max<size_t>(size, 1));
+  memcpy(ptr, key.data(), key.size());
+  memcpy(ptr + key.size(), value.data(), value.size());
+  buffer_->entries.push_back(
+      Buffer::Entry{ptr, static_cast<uint32>(key.size()), static_cast<uint32>(value.size())});
+
+  if (buffer_->MemoryUsage() >= buffer_limit_)
+    Spill();
+}
+
+Status SortingBuilder::status() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return status_;
+}
+
+void SortingBuilder::Spill() {
+  {
+    const unsigned max_spills = std::max(1u, options_.sort_threads);
+    std::unique_lock<std::mutex> lock(mu_);
+    spill_done_.wait(lock, [this, max_spills] { return spills_in_flight_ < max_spills; });
+    ++spills_in_flight_;
+  }
+
+  Buffer* buffer = buffer_.release();
+  buffer_.reset(new Buffer);
+  string name = RunName(num_runs_++);
+  run_sizes_.push_back(buffer->entries.size());
+  VLOG(1) << "Spilling " << buffer->entries.size() << " entries to " << name;
+
+  pool_->RunTask([this, buffer, name] {
+    Status st = SortAndWrite(name, buffer);
+    delete buffer;
+
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!st.ok() && status_.ok())
+      status_ = st;
+    --spills_in_flight_;
+    spill_done_.notify_all();
+  });
+}
+
+void SortingBuilder::WaitForSpills() {
+  std::unique_lock<std::mutex> lock(mu_);
+  spill_done_.wait(lock, [this] { return spills_in_flight_ == 0; });
+}
+
+Status SortingBuilder::SortAndWrite(const string& name, Buffer* buffer) {
+  buffer->Sort();
+
+  ListWriter::Options opts;
+  opts.block_size_multiplier = 4;
+  opts.compress_method = list_file::kCompressionSnappy;
+  ListWriter writer(name, opts);
+  RETURN_IF_ERROR(writer.Init());
+
+  // Record: varint key size, key, value.
+  string record;
+  uint8 buf[Varint::kMax32];
+  for (const Buffer::Entry& e : buffer->entries) {
+    uint8* end = Varint::Encode32(buf, e.key_size);
+    record.assign(reinterpret_cast<char*>(buf), end - buf);
+    record.append(e.data, e.key_size + e.value_size);
+    RETURN_IF_ERROR(writer.AddRecord(record));
+  }
+  return writer.Flush();
+}
+
+Status SortingBuilder::Merge(TableBuilder* builder) {
+  // Two batches per run fit into the memory budget.
+  size_t batch_size = std::max(kMinBatchSize,
+                               (size_t(options_.mem_sort_size_mb) << 20) / (2 * num_runs_));
+  std::vector<std::unique_ptr<RunReader>> runs(num_runs_);
+  std::vector<bool> valid(num_runs_);
+  for (unsigned i = 0; i < num_runs_; ++i) {
+    runs[i].reset(new RunReader(RunName(i), run_sizes_[i], batch_size, pool_.get()));
+    valid[i] = runs[i]->Next();
+  }
+
+  // Ties are resolved by the run index, the earlier run holds the earlier added value.
+  auto less = [&](unsigned a, unsigned b) {
+    if (!valid[a])
+      return false;
+    if (!valid[b])
+      return true;
+    int res = runs[a]->key().compare(runs[b]->key());
+    return res < 0 || (res == 0 && a < b);
+  };
+  LoserTree<decltype(less)> tree(num_runs_, less);
+
+  string last_key;
+  bool has_last = false;
+  while (valid[tree.top()]) {
+    RunReader* run = runs[tree.top()].get();
+    if (!has_last || run->key() != last_key) {
+      builder->Add(run->key(), run->value());
+      last_key.assign(run->key().data(), run->key().size());
+      has_last = true;
+    }
+    valid[tree.top()] = run->Next();
+    tree.Replay();
+  }
+
+  // A run that ended early must not leave a table with missing rows behind.
+  for (const auto& run : runs) {
+    RETURN_IF_ERROR(run->status());
+  }
+  return builder->status();
+}
+
+Status SortingBuilder::Finish(sstable::Options options) {
+  RETURN_IF_ERROR(status());
+
+  string name = basename_ + ".sst";
+  File* fl = Open(name);
+  if (fl == nullptr)
+    return Status(StatusCode::IO_ERROR, "Could not open " + name);
+  Sink sink(fl, TAKE_OWNERSHIP);
+  TableBuilder builder(options, &sink);
+  return Finish(&builder);
+}
+
+Status SortingBuilder::Finish(TableBuilder* builder) {
+  if (num_runs_ > 0 && !buffer_->entries.empty())
+    Spill();
+  WaitForSpills();
+
+  Status st = status();
+  if (st.ok() && num_runs_ == 0) {
+    buffer_->Sort();
+    const Buffer::Entry* last = nullptr;
+    for (const Buffer::Entry& e : buffer_->entries) {
+      if (last == nullptr || e.key() != last->key())
+        builder->Add(e.key(), e.value());
+      last = &e;
+    }
+    st = builder->status();
+  } else if (st.ok()) {
+    st = Merge(builder);
+  }
+  buffer_.reset(new Buffer);
+
+  if (st.ok()) {
+    st = builder->Finish();
+  } else {
+    builder->Abandon();
+  }
+
+  for (unsigned i = 0; i < num_runs_; ++i) {
+    Delete(RunName(i));
+  }
+  num_runs_ = 0;
+  run_sizes_.clear();
+
+  std::lock_guard<std::mutex> lock(mu_);
+  status_ = st;
+  return st;
+}
+
+}  // namespace sstable
+}  // namespace file
@@ -4,30 +4,48 @@
 #ifndef _FILE_SSTABLE_SORTED_SSTABLE_BUILDER_H
 #define _FILE_SSTABLE_SORTED_SSTABLE_BUILDER_H
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "base/arena.h"
 #include "base/status.h"
 
 #include "strings/stringpiece.h"
 #include "file/sstable/options.h"
+#include "util/sp_task_pool.h"
 
 namespace file {
 namespace sstable {
 
+class TableBuilder;
+
 // SortingBuilder helps creating disk based sstables when the order of added keys is not in
 // increasing order as required by sstable builder.
+//
+// It is an external sort: the pairs are buffered in memory, sorted runs are spilled to temporary
+// list files by a thread pool while Add() continues to fill a new buffer, and Finish() merges
+// the runs into the table. If all the data fits into memory, no temporary files are created.
+// When the same key is added more than once, the table keeps the value that was added first.
 class SortingBuilder {
 public:
   struct Options {
     // How much memory is allocated for storing the temporary table before sorting it and dumping
-    // it on disk.
+    // it on disk. The budget is shared by the buffer being filled and the runs being sorted.
     unsigned mem_sort_size_mb = 128;
+
+    // Number of threads that sort and spill the runs and read ahead during the merge.
+    unsigned sort_threads = 2;
   };
 
   // basename is path to the output sstable not including the extension .sst.
   // For example, "/somepath/mytable".
   // SortingBuilder might create temporary lst files in format
-  // basename + "%5d.lst"
+  // basename + "%05d.lst"
   SortingBuilder(StringPiece basename, Options options);
+  ~SortingBuilder();
 
   void Add(strings::Slice key, strings::Slice value);
 
@@ -39,11 +57,42 @@ public:
   // REQUIRES: Finish() have not been called.
   // sstable::Options are used for creating the sstable.
   base::Status Finish(sstable::Options options);
+
+  // Adds the sorted pairs to builder and finishes it, instead of creating the table file.
+  // The caller owns builder and its sink.
+  base::Status Finish(TableBuilder* builder);
+
+  // Number of runs spilled to disk so far.
+  unsigned num_runs() const { return num_runs_; }
 private:
+  struct Buffer;
+  class RunReader;
+
+  std::string RunName(unsigned index) const;
+
+  // Hands the current buffer to the pool. Blocks if too many runs are being sorted.
+  void Spill();
+  void WaitForSpills();
+  static base::Status SortAndWrite(const std::string& name, Buffer* buffer);
+
+  base::Status Merge(TableBuilder* builder);
+
+  std::string basename_;
+  const Options options_;
+  size_t buffer_limit_;
+  std::unique_ptr<util::FuncTaskPool> pool_;
+
+  std::unique_ptr<Buffer> buffer_;
+  unsigned num_runs_ = 0;
+  std::vector<uint64> run_sizes_;  // Records of every run.
 
+  mutable std::mutex mu_;
+  std::condition_variable spill_done_;
+  unsigned spills_in_flight_ = 0;
+  base::Status status_;
 };
 
 }  // namespace sstable
 }  // namespace file
 
-#endif  // _FILE_SSTABLE_SORTED_SSTABLE_BUILDER_H
\ No newline at end of file
+#endif  // _FILE_SSTABLE_SORTED_SSTABLE_BUILDER_H
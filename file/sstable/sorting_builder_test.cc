@@ -0,0 +1,156 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/sstable/sorting_builder.h"
+
+#include <unistd.h>
+
+#include <map>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "base/random.h"
+#include "file/file.h"
+#include "file/sstable/sstable.h"
+#include "strings/stringprintf.h"
+
+namespace file {
+namespace sstable {
+
+using std::string;
+
+class SortingBuilderTest : public testing::Test {
+ protected:
+  // Checks that the table at basename.sst contains exactly expected.
+  static void Verify(const string& basename, const std::map<string, string>& expected) {
+    auto res = ReadonlyFile::Open(basename + ".sst");
+    ASSERT_TRUE(res.ok()) << res.status;
+    std::unique_ptr<ReadonlyFile> file(res.obj);
+    auto table_res = Table::Open(ReadOptions(), file.get());
+    ASSERT_TRUE(table_res.ok()) << table_res.status;
+    std::unique_ptr<Table> table(table_res.obj);
+    std::unique_ptr<Iterator> it(table->NewIterator());
+
+    auto expected_it = expected.begin();
+    for (it->SeekToFirst(); it->Valid(); it->Next(), ++expected_it) {
+      ASSERT_TRUE(expected_it != expected.end());
+      ASSERT_EQ(expected_it->first, it->key());
+      ASSERT_EQ(expected_it->second, it->value());
+    }
+    EXPECT_TRUE(expected_it == expected.end());
+    EXPECT_TRUE(it->status().ok());
+    it.reset();
+    table.reset();
+    EXPECT_TRUE(file->Close().ok());
+  }
+};
+
+TEST_F(SortingBuilderTest, InMemory) {
+  string basename = base::GetTestTempPath("in_memory");
+  SortingBuilder::Options opts;
+  SortingBuilder builder(basename, opts);
+
+  std::map<string, string> expected;
+  MTRandom rnd(10);
+  for (unsigned i = 0; i < 10000; ++i) {
+    string key = StringPrintf("key%06u", rnd.Rand32() % 5000);
+    string value = std::to_string(i);
+    builder.Add(key, value);
+    expected.emplace(key, value);  // The first value wins.
+  }
+  builder.Add("", "empty");
+  expected.emplace("", "empty");
+
+  ASSERT_TRUE(builder.Finish(Options()).ok());
+  EXPECT_EQ(0, builder.num_runs());
+  EXPECT_FALSE(Exists(basename + "00000.lst"));
+  Verify(basename, expected);
+}
+
+TEST_F(SortingBuilderTest, Spill) {
+  string basename = base::GetTestTempPath("spill");
+  SortingBuilder::Options opts;
+  opts.mem_sort_size_mb = 1;
+  opts.sort_threads = 3;
+  SortingBuilder builder(basename, opts);
+
+  std::map<string, string> expected;
+  MTRandom rnd(20);
+  const string kValue(100, 'v');
+  unsigned runs = 0;
+  for (unsigned i = 0; i < 100000; ++i) {
+    string key = StringPrintf("key%08u", rnd.Rand32() % 80000);
+    string value = kValue + std::to_string(i);
+    builder.Add(key, value);
+    expected.emplace(key, value);
+    runs = builder.num_runs();
+  }
+  EXPECT_GT(runs, 10);
+  ASSERT_TRUE(builder.status().ok());
+
+  ASSERT_TRUE(builder.Finish(Options()).ok());
+  for (unsigned i = 0; i < runs; ++i) {
+    EXPECT_FALSE(Exists(basename + StringPrintf("%05d.lst", i)));
+  }
+  Verify(basename, expected);
+}
+
+// Damaged runs fail Finish instead of silently dropping their rows.
+TEST_F(SortingBuilderTest, DamagedRun) {
+  string basename = base::GetTestTempPath("damaged");
+  SortingBuilder::Options opts;
+  opts.mem_sort_size_mb = 1;
+  opts.sort_threads = 1;
+  const string kValue(100, 'v');
+  const string run0 = basename + "00000.lst";
+
+  for (bool truncate : {true, false}) {
+    SortingBuilder builder(basename, opts);
+    // With a single sort thread, run 0 is complete once run 2 is being written.
+    for (unsigned i = 0; builder.num_runs() < 3; ++i) {
+      builder.Add(StringPrintf("key%08u", i * 7919 % 100003), kValue);
+    }
+    if (truncate) {
+      auto res = ReadonlyFile::Open(run0);
+      ASSERT_TRUE(res.ok());
+      size_t size = res.obj->Size();
+      EXPECT_TRUE(res.obj->Close().ok());
+      delete res.obj;
+      ASSERT_EQ(0, ::truncate(run0.c_str(), size / 2));
+    } else {
+      ASSERT_TRUE(Delete(run0));
+    }
+    EXPECT_FALSE(builder.Finish(Options()).ok());
+  }
+}
+
+// Sorts 10 times more data than the memory budget.
+static void BM_SortingBuilder(benchmark::State& state) {
+  const unsigned kMemMb = 8;
+  const string kValue(90, 'v');
+  string basename = base::GetTestTempPath("bench");
+  uint64 bytes = 0;
+
+  while (state.KeepRunning()) {
+    SortingBuilder::Options opts;
+    opts.mem_sort_size_mb = kMemMb;
+    opts.sort_threads = state.range_x();
+    SortingBuilder builder(basename, opts);
+
+    MTRandom rnd(10);
+    char key[16];
+    uint64 added = 0;
+    while (added < kMemMb * 10ULL << 20) {
+      snprintf(key, sizeof(key), "%010u", rnd.Rand32());
+      builder.Add(key, kValue);
+      added += 10 + kValue.size();
+    }
+    CHECK_STATUS(builder.Finish(Options()));
+    bytes += added;
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_SortingBuilder)->Arg(1)->Arg(4);
+
+}  // namespace sstable
+}  // namespace file
@@ -4,7 +4,11 @@
 
 #include "file/sstable/sstable.h"
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
+#include <numeric>
+#include <vector>
 
 #include "base/logging.h"
 #include "file/file.h"
@@ -12,9 +16,12 @@
 #include "file/sstable/filter_policy.h"
 #include "file/sstable/options.h"
 #include "file/sstable/block.h"
+#include "file/sstable/cache.h"
 #include "file/sstable/filter_block.h"
 #include "file/sstable/format.h"
+#include "file/sstable/table_properties.h"
 #include "file/sstable/two_level_iterator.h"
+#include "util/coding/fixed.h"
 
 namespace file {
 namespace sstable {
@@ -24,6 +31,8 @@ using base::Status;
 using base::StatusCode;
 using std::string;
 
+static constexpr size_t kFilterAlignment = 64;
+
 struct Table::Rep {
   ~Rep() {
     delete filter;
@@ -33,12 +42,20 @@ struct Table::Rep {
   ReadOptions options;
   Status status;
   ReadonlyFile* file;
+  uint64 cache_id;
   FilterBlockReader* filter;
   std::unique_ptr<uint8[]> filter_data;
+  std::shared_ptr<const void> filter_pin;  // Set if the filter points into a file mapping.
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
-  Block* index_block;
+  Block* index_block;  // The top-level index when partitioned_index is true.
+  bool partitioned_index = false;
+
+  // Set if the filters hold the prefixes of options.prefix_extractor.
+  const PrefixExtractor* prefix_extractor = nullptr;
+  bool whole_key_filter = true;  // Whether the filters hold the whole keys.
   MetaMapBlock meta_map_block;
+  std::unique_ptr<TableProperties> properties;
 };
 
  base::StatusObject<Table*> Table::Open(const ReadOptions& options,
@@ -69,6 +86,7 @@ struct Table::Rep {
   Rep* rep = new Table::Rep;
   rep->options = options;
   rep->file = file;
+  rep->cache_id = options.block_cache ? options.block_cache->NewId() : 0;
   rep->metaindex_handle = footer.metaindex_handle();
   rep->index_block = new Block(contents);
   rep->filter_data = NULL;
@@ -100,6 +118,10 @@ void Table::ReadMeta(const Footer& footer) {
       ReadFilter(iter->value());
     }
   }
+  Slice partitioned_key(kPartitionedIndexKey);
+  iter->Seek(partitioned_key);
+  rep_->partitioned_index = iter->Valid() && iter->key() == partitioned_key;
+
   Slice meta_map_key(kMetaBlockKey);
   iter->Seek(meta_map_key);
   if (iter->Valid() && iter->key() == meta_map_key) {
@@ -108,9 +130,53 @@ void Table::ReadMeta(const Footer& footer) {
       LOG(ERROR) << "Could not decode meta block";
     }
   }
+
+  // The filters may hold prefixes of another extractor, in which case they can not be used.
+  Slice prefix_key(kPrefixExtractorPrefix);
+  iter->Seek(prefix_key);
+  if (iter->Valid() && iter->key().starts_with(prefix_key)) {
+    rep_->whole_key_filter = iter->value() == Slice("1");
+    Slice name = iter->key();
+    name.remove_prefix(prefix_key.size());
+    const PrefixExtractor* extractor = rep_->options.prefix_extractor;
+    if (extractor != NULL && name == Slice(extractor->Name())) {
+      rep_->prefix_extractor = extractor;
+    }
+  }
+
+  Slice properties_key(kPropertiesBlockKey);
+  iter->Seek(properties_key);
+  if (iter->Valid() && iter->key() == properties_key) {
+    ReadProperties(iter->value());
+  }
   delete meta;
 }
 
+void Table::ReadProperties(const Slice& properties_handle_value) {
+  Slice v = properties_handle_value;
+  BlockHandle handle;
+  if (!handle.DecodeFrom(&v).ok()) {
+    return;
+  }
+  ReadOptions opt;
+  opt.verify_checksums = true;
+  BlockContents block;
+  if (!ReadBlock(rep_->file, opt, handle, &block).ok()) {
+    LOG(ERROR) << "Error reading properties block";
+    return;
+  }
+  std::unique_ptr<TableProperties> props(new TableProperties);
+  Status st = props->DecodeFrom(block.data);
+  if (block.heap_allocated) {
+    delete[] block.data.ubuf();
+  }
+  if (!st.ok()) {
+    LOG(ERROR) << "Could not decode properties block: " << st;
+    return;
+  }
+  rep_->properties = std::move(props);
+}
+
 void Table::ReadFilter(const Slice& filter_handle_value) {
   Slice v = filter_handle_value;
   BlockHandle filter_handle;
@@ -125,8 +191,22 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
   if (!ReadBlock(rep_->file, opt, filter_handle, &block).ok()) {
     return;
   }
-  if (block.heap_allocated) {
-    rep_->filter_data.reset(const_cast<uint8*>(block.data.ubuf()));     // Will need to delete later
+  const uint8* data = block.data.ubuf();
+  if (reinterpret_cast<uintptr_t>(data) % kFilterAlignment != 0) {
+    // Filters may align their probing units relative to the block start (see bloom.cc).
+    // Copy the block into an aligned buffer so that those units match the cache lines.
+    uint8* buf = new uint8[block.data.size() + kFilterAlignment];
+    uint8* aligned = buf + kFilterAlignment - reinterpret_cast<uintptr_t>(buf) % kFilterAlignment;
+    memcpy(aligned, data, block.data.size());
+    if (block.heap_allocated) {
+      delete[] data;
+    }
+    rep_->filter_data.reset(buf);
+    block.data = Slice(aligned, block.data.size());
+  } else if (block.heap_allocated) {
+    rep_->filter_data.reset(const_cast<uint8*>(data));     // Will need to delete later
+  } else {
+    rep_->filter_pin = block.pin;
   }
   rep_->filter = new FilterBlockReader(rep_->options.filter_policy, block.data);
 }
@@ -135,44 +215,357 @@ Table::~Table() {
   delete rep_;
 }
 
-static void DeleteBlock(void* arg) {
+static void DeleteBlock(void* arg, void* ignored) {
   delete reinterpret_cast<Block*>(arg);
 }
 
+static void DeleteCachedBlock(const Slice& key, void* value) {
+  delete reinterpret_cast<Block*>(value);
+}
+
+static void ReleaseBlock(void* arg, void* h) {
+  Cache* cache = reinterpret_cast<Cache*>(arg);
+  Cache::Handle* handle = reinterpret_cast<Cache::Handle*>(h);
+  cache->Release(handle);
+}
+
+static constexpr unsigned kCacheKeySize = 16;
+
+static Slice BlockCacheKey(uint64 cache_id, const BlockHandle& handle, uint8* buf) {
+  coding::EncodeFixed64(cache_id, buf);
+  coding::EncodeFixed64(handle.offset(), buf + 8);
+  return Slice(buf, kCacheKeySize);
+}
+
+// The buffers of the lookups of a thread, see Table::Get().
+struct Table::LookupScratch {
+  std::string key;  // Keys decoded by block lookups.
+  BlockBuffer buffer;
+  Block block;      // Points into buffer or into the file mapping.
+};
+
+struct Table::BlockRef {
+  Block* block = NULL;
+  Cache* cache = NULL;
+  Cache::Handle* cache_handle = NULL;
+  bool scratch = false;  // block belongs to a LookupScratch.
+
+  ~BlockRef() {
+    if (cache_handle != NULL) {
+      cache->Release(cache_handle);
+    } else if (scratch) {
+      block->Reset(BlockContents());  // Unpins the file mapping.
+    } else {
+      delete block;
+    }
+  }
+
+  // Passes the ownership to the cleanup of iter.
+  void Transfer(Iterator* iter) {
+    DCHECK(!scratch);
+    if (cache_handle == NULL) {
+      iter->RegisterCleanup(&DeleteBlock, block);
+    } else {
+      iter->RegisterCleanup(&ReleaseBlock, cache, cache_handle);
+    }
+    block = NULL;
+    cache_handle = NULL;
+  }
+};
+
+Status Table::GetBlock(const BlockHandle& handle, BlockRef* ref, LookupScratch* scratch) const {
+  const ReadOptions& options = rep_->options;
+  Cache* block_cache = options.block_cache;
+  BlockContents contents;
+  auto use_scratch = [ref, scratch, &contents] {
+    scratch->block.Reset(contents);
+    ref->block = &scratch->block;
+    ref->scratch = true;
+  };
+
+  if (block_cache != NULL) {
+    uint8 cache_key_buffer[kCacheKeySize];
+    Slice key = BlockCacheKey(rep_->cache_id, handle, cache_key_buffer);
+    ref->cache = block_cache;
+    ref->cache_handle = block_cache->Lookup(key);
+    if (ref->cache_handle != NULL) {
+      ref->block = reinterpret_cast<Block*>(block_cache->Value(ref->cache_handle));
+      return Status::OK;
+    }
+    if (options.fill_cache) {
+      RETURN_IF_ERROR(ReadBlock(rep_->file, options, handle, &contents));
+      if (contents.cachable) {
+        ref->block = new Block(contents);
+        ref->cache_handle = block_cache->Insert(key, ref->block, ref->block->size(),
+                                                &DeleteCachedBlock);
+      } else if (scratch != NULL) {
+        use_scratch();  // Blocks that point into the file mapping are not cached.
+      } else {
+        ref->block = new Block(contents);
+      }
+      return Status::OK;
+    }
+  }
+
+  if (scratch != NULL) {
+    RETURN_IF_ERROR(ReadBlock(rep_->file, options, handle, &scratch->buffer, &contents));
+    use_scratch();
+    return Status::OK;
+  }
+  RETURN_IF_ERROR(ReadBlock(rep_->file, options, handle, &contents));
+  ref->block = new Block(contents);
+  return Status::OK;
+}
+
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg,
                              const Slice& index_value) {
   Table* table = reinterpret_cast<Table*>(arg);
-  Block* block = NULL;
+
   BlockHandle handle;
   Slice input = index_value;
   Status s = handle.DecodeFrom(&input);
   // We intentionally allow extra stuff in index_value so that we
   // can add more features in the future.
 
+  BlockRef ref;
   if (s.ok()) {
-    BlockContents contents;
-    s = ReadBlock(table->rep_->file, table->rep_->options, handle, &contents);
-    if (s.ok()) {
-      block = new Block(contents);
-      Iterator* iter = block->NewIterator();
-      iter->RegisterCleanup(&DeleteBlock, block);
-      return iter;
+    s = table->GetBlock(handle, &ref);
+  }
+  if (!s.ok())
+    return NewErrorIterator(s);
+
+  Iterator* iter = ref.block->NewIterator();
+  ref.Transfer(iter);
+  return iter;
+}
+
+namespace {
+
+struct PrefixBlockArg {
+  Table* table;
+  std::string prefix;
+};
+
+void DeletePrefixBlockArg(void* arg, void*) {
+  delete reinterpret_cast<PrefixBlockArg*>(arg);
+}
+
+// Returns the smallest key that is greater than all the keys starting with prefix,
+// or an empty string if there is none.
+std::string PrefixSuccessor(const Slice& prefix) {
+  std::string res = prefix.as_string();
+  while (!res.empty()) {
+    uint8 last = res.back();
+    if (last != 0xff) {
+      res.back() = last + 1;
+      break;
     }
+    res.pop_back();
+  }
+  return res;
+}
+
+}  // namespace
+
+// Skips the data blocks whose filters do not have the prefix.
+Iterator* Table::PrefixBlockReader(void* arg, const Slice& index_value) {
+  PrefixBlockArg* prefix_arg = reinterpret_cast<PrefixBlockArg*>(arg);
+  BlockHandle handle;
+  Slice input = index_value;
+  if (handle.DecodeFrom(&input).ok() &&
+      !prefix_arg->table->rep_->filter->KeyMayMatch(handle.offset(), prefix_arg->prefix)) {
+    return NewEmptyIterator();
   }
+  return BlockReader(prefix_arg->table, index_value);
+}
 
-  return NewErrorIterator(s);
+Iterator* Table::NewIndexIterator() const {
+  Iterator* iter = rep_->index_block->NewIterator();
+  if (!rep_->partitioned_index)
+    return iter;
+
+  // Index partitions are regular blocks, so BlockReader loads them through the block cache.
+  return NewTwoLevelIterator(iter, &Table::BlockReader, const_cast<Table*>(this));
 }
 
 Iterator* Table::NewIterator() const {
   return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(),
+      NewIndexIterator(),
       &Table::BlockReader, const_cast<Table*>(this));
 }
 
+Iterator* Table::NewIterator(const IteratorOptions& options) const {
+  Iterator* iter = NewTwoLevelIterator(
+      NewIndexIterator(),
+      &Table::BlockReader, const_cast<Table*>(this), options);
+  if (options.lower_bound.empty() && options.upper_bound.empty())
+    return iter;
+  return NewBoundedIterator(iter, options.lower_bound, options.upper_bound);
+}
+
+Iterator* Table::NewPrefixIterator(const Slice& prefix) const {
+  IteratorOptions options;
+  options.lower_bound = prefix.as_string();
+  options.upper_bound = PrefixSuccessor(prefix);
+
+  const PrefixExtractor* extractor = rep_->prefix_extractor;
+  if (rep_->filter == NULL || extractor == NULL || !extractor->InDomain(prefix) ||
+      extractor->Transform(prefix) != prefix) {
+    return NewIterator(options);
+  }
+
+  // The two-level iterator stops at the upper bound, so it does not go over the filters of
+  // the following blocks.
+  PrefixBlockArg* arg = new PrefixBlockArg{const_cast<Table*>(this), options.lower_bound};
+  Iterator* iter = NewTwoLevelIterator(NewIndexIterator(), &Table::PrefixBlockReader, arg,
+                                       options);
+  iter->RegisterCleanup(&DeletePrefixBlockArg, arg);
+  return NewBoundedIterator(iter, options.lower_bound, options.upper_bound);
+}
+
+bool Table::KeyMayMatch(uint64_t block_offset, const Slice& key) const {
+  if (rep_->filter == NULL)
+    return true;
+  if (rep_->whole_key_filter)
+    return rep_->filter->KeyMayMatch(block_offset, key);
+
+  // The filters hold only prefixes.
+  const PrefixExtractor* extractor = rep_->prefix_extractor;
+  if (extractor != NULL && extractor->InDomain(key))
+    return rep_->filter->KeyMayMatch(block_offset, extractor->Transform(key));
+  return true;
+}
+
+base::StatusObject<bool> Table::Get(const Slice& key, string* value) const {
+  // Blocks that are not cached are read into the scratch, and the index is searched in place.
+  static thread_local LookupScratch scratch;
+
+  BlockHandle handle;
+  Slice input;
+  Status s;
+  if (!rep_->index_block->LowerBound(key, &input, &s, &scratch.key))
+    return s.ok() ? base::StatusObject<bool>(false) : s;
+  RETURN_IF_ERROR(handle.DecodeFrom(&input));
+
+  if (rep_->partitioned_index) {
+    // The partition is released before the data block is read into the scratch.
+    BlockRef partition;
+    RETURN_IF_ERROR(GetBlock(handle, &partition, &scratch));
+    if (!partition.block->LowerBound(key, &input, &s, &scratch.key))
+      return s.ok() ? base::StatusObject<bool>(false) : s;
+    RETURN_IF_ERROR(handle.DecodeFrom(&input));
+  }
+  if (!KeyMayMatch(handle.offset(), key)) {
+    return false;
+  }
+
+  BlockRef ref;
+  RETURN_IF_ERROR(GetBlock(handle, &ref, &scratch));
+  Slice block_value;
+  if (!ref.block->Get(key, &block_value, &s, &scratch.key))
+    return s.ok() ? base::StatusObject<bool>(false) : s;
+  value->assign(block_value.data(), block_value.size());
+  return true;
+}
+
+Status Table::MultiGet(const Slice* keys, uint32_t n, string* values, bool* found) const {
+  std::vector<uint32_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+  std::fill(found, found + n, false);
+
+  struct Group {
+    BlockHandle handle;
+    uint32_t begin, end;  // range in candidates.
+    Block* block;
+    Cache::Handle* cache_handle;
+  };
+
+  // Group the keys that pass the filter by their data block.
+  // Since the keys are sorted, the index is sought only when a key is past the current block.
+  std::vector<Group> groups;
+  std::vector<uint32_t> candidates;
+  std::unique_ptr<Iterator> index_iter(NewIndexIterator());
+  BlockHandle handle;
+  for (uint32_t i : order) {
+    const Slice& key = keys[i];
+    if (!index_iter->Valid() || index_iter->key() < key) {
+      index_iter->Seek(key);
+      if (!index_iter->Valid())
+        break;  // The rest of the keys are past the last key in the table.
+      Slice input = index_iter->value();
+      RETURN_IF_ERROR(handle.DecodeFrom(&input));
+    }
+    if (!KeyMayMatch(handle.offset(), key))
+      continue;
+    if (groups.empty() || groups.back().handle.offset() != handle.offset()) {
+      groups.push_back(Group{handle, uint32_t(candidates.size()), 0, NULL, NULL});
+    }
+    candidates.push_back(i);
+    groups.back().end = candidates.size();
+  }
+  RETURN_IF_ERROR(index_iter->status());
+  index_iter.reset();
+
+  // Take the cached blocks and read all the others together.
+  const ReadOptions& options = rep_->options;
+  Cache* block_cache = options.block_cache;
+  uint8 cache_key_buffer[kCacheKeySize];
+  std::vector<BlockHandle> to_read;
+  std::vector<Group*> to_read_groups;
+  for (Group& g : groups) {
+    if (block_cache != NULL) {
+      g.cache_handle = block_cache->Lookup(
+          BlockCacheKey(rep_->cache_id, g.handle, cache_key_buffer));
+      if (g.cache_handle != NULL) {
+        g.block = reinterpret_cast<Block*>(block_cache->Value(g.cache_handle));
+        continue;
+      }
+    }
+    to_read.push_back(g.handle);
+    to_read_groups.push_back(&g);
+  }
+
+  std::vector<BlockContents> contents(to_read.size());
+  Status s = ReadBlocks(rep_->file, options, to_read.data(), to_read.size(), contents.data());
+  if (s.ok()) {
+    for (size_t j = 0; j < to_read.size(); ++j) {
+      Group* g = to_read_groups[j];
+      g->block = new Block(contents[j]);
+      if (block_cache != NULL && contents[j].cachable && options.fill_cache) {
+        g->cache_handle = block_cache->Insert(
+            BlockCacheKey(rep_->cache_id, g->handle, cache_key_buffer), g->block,
+            g->block->size(), &DeleteCachedBlock);
+      }
+    }
+  }
+
+  // Each block is read once for all of its keys.
+  for (Group& g : groups) {
+    if (g.block == NULL)
+      continue;
+    Slice value;
+    for (uint32_t c = g.begin; c < g.end && s.ok(); ++c) {
+      uint32_t i = candidates[c];
+      if (g.block->Get(keys[i], &value, &s)) {
+        values[i].assign(value.data(), value.size());
+        found[i] = true;
+      }
+    }
+    if (g.cache_handle != NULL) {
+      block_cache->Release(g.cache_handle);
+    } else {
+      delete g.block;
+    }
+  }
+  return s;
+}
+
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter = rep_->index_block->NewIterator();
+  Iterator* index_iter = NewIndexIterator();
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
@@ -197,9 +590,46 @@ uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
   return result;
 }
 
+std::vector<KeyRange> Table::PlanSplits(unsigned n) const {
+  CHECK_GT(n, 0);
+  std::vector<string> keys;
+  std::vector<uint64> sizes;
+  uint64 total = 0;
+  std::unique_ptr<Iterator> index_iter(NewIndexIterator());
+  BlockHandle handle;
+  for (index_iter->SeekToFirst(); index_iter->Valid(); index_iter->Next()) {
+    Slice input = index_iter->value();
+    if (!handle.DecodeFrom(&input).ok())
+      break;
+    keys.push_back(index_iter->key().as_string());
+    sizes.push_back(handle.size());
+    total += handle.size();
+  }
+
+  // A range ends after the block that reaches its share of the total size. The index key
+  // of that block is >= all of its keys and < the keys of the next block, so the smallest
+  // key greater than it separates the ranges.
+  std::vector<KeyRange> res(1);
+  uint64 acc = 0;
+  for (size_t i = 0; i + 1 < keys.size() && res.size() < n; ++i) {
+    acc += sizes[i];
+    if (acc * n >= total * res.size()) {
+      string limit = keys[i];
+      limit.push_back('\0');
+      res.back().limit = limit;
+      res.push_back(KeyRange{limit, string()});
+    }
+  }
+  return res;
+}
+
 const std::map<string, string>& Table::GetMeta() const {
   return rep_->meta_map_block.meta();
 }
 
+const TableProperties* Table::GetProperties() const {
+  return rep_->properties.get();
+}
+
 }  // namespace sstable
 }  // namespace file
\ No newline at end of file
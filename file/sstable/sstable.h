@@ -6,6 +6,8 @@
 #define _FILE_SSTABLE_TABLE_H_
 
 #include <cstdint>
+#include <string>
+#include <vector>
 #include "file/sstable/iterator.h"
 #include "file/sstable/options.h"
 
@@ -18,6 +20,7 @@ namespace sstable {
 class Block;
 class BlockHandle;
 class Footer;
+struct TableProperties;
 
 /* TODO:
 enum SstCountEnum
@@ -47,6 +50,13 @@ enum SstCountEnum
 
 */
 
+// Keys in [start, limit). An empty start or limit stands for the beginning or the end of
+// the table.
+struct KeyRange {
+  std::string start;
+  std::string limit;
+};
+
 // A Table is a sorted map from strings to strings.  Tables are
 // immutable and persistent.  A Table may be safely accessed from
 // multiple threads without external synchronization.
@@ -72,6 +82,27 @@ class Table {
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
   Iterator* NewIterator() const;
+  Iterator* NewIterator(const IteratorOptions& options) const;
+
+  // Returns a new iterator over the entries whose keys start with prefix. It stops at the
+  // end of the prefix range. If the table was built with Options::prefix_extractor, is read
+  // with the same ReadOptions::prefix_extractor and prefix is an extracted prefix, the data
+  // blocks whose filters do not have it are skipped without being read.
+  Iterator* NewPrefixIterator(const strings::Slice& prefix) const;
+
+  // Point lookup. Returns true and fills *value if the table contains "key".
+  // If the table was opened with the filter policy it was built with, the filter is consulted
+  // before the data block is read, so most lookups of absent keys do not touch the file.
+  // Lookups use per-thread buffers instead of iterators and do not allocate once the buffers
+  // have grown, unless they read blocks into the block cache or *value has to grow.
+  base::StatusObject<bool> Get(const strings::Slice& key, std::string* value) const;
+
+  // Batched point lookup of keys[0, n). Sets found[i] and, if found, values[i] for every key.
+  // The keys are sorted internally and grouped by data block, so each block is read and
+  // decoded once per batch and reads of neighbouring blocks are merged.
+  // Keys do not need to be sorted or unique.
+  base::Status MultiGet(const strings::Slice* keys, uint32_t n, std::string* values,
+                        bool* found) const;
 
   // Given a key, return an approximate byte offset in the file where
   // the data for that key begins (or would begin if the key were
@@ -81,16 +112,42 @@ class Table {
   // be close to the file length.
   uint64_t ApproximateOffsetOf(const strings::Slice& key) const;
 
+  // Splits the table into at most n consecutive key ranges of roughly equal size on disk, based
+  // on the block handles in the index. The ranges cover the whole key space and can be passed
+  // as bounds to NewIterator() in order to scan the table with several threads.
+  std::vector<KeyRange> PlanSplits(unsigned n) const;
+
   const std::map<std::string, std::string>& GetMeta() const;
+
+  // Statistics that were computed when the table was built, without touching the data blocks.
+  // Returns NULL for tables that were written without a properties block.
+  const TableProperties* GetProperties() const;
  private:
   struct Rep;
   Rep* rep_;
 
   explicit Table(Rep* rep) { rep_ = rep; }
   static Iterator* BlockReader(void*, const strings::Slice&);
+  static Iterator* PrefixBlockReader(void*, const strings::Slice&);
+
+  // Whether the filter of the data block at block_offset may have key, if there is a filter.
+  bool KeyMayMatch(uint64_t block_offset, const strings::Slice& key) const;
+
+  // Returns an iterator over the index entries of the data blocks. For a partitioned index
+  // it iterates over the partitions, which are loaded on demand.
+  Iterator* NewIndexIterator() const;
+
+  // A data block pinned either in the block cache or by this object.
+  struct BlockRef;
+  struct LookupScratch;
+  // Returns the block pointed by handle, from the block cache if possible.
+  // Blocks that are not cached are read into *scratch if it is set.
+  base::Status GetBlock(const BlockHandle& handle, BlockRef* ref,
+                        LookupScratch* scratch = nullptr) const;
 
   void ReadMeta(const Footer& footer);
   void ReadFilter(const strings::Slice& filter_handle_value);
+  void ReadProperties(const strings::Slice& properties_handle_value);
 
   // No copying allowed
   Table(const Table&);
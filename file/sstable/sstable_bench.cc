@@ -0,0 +1,435 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+// Benchmarks the sstable subsystem on generated data, in the spirit of leveldb's db_bench.
+// Builds a table for every combination of --block_sizes and --restart_intervals and runs the
+// --benchmarks on it. Reports throughput, latency percentiles and bytes per key.
+//
+// Usage: sstable_bench --num=1000000 --value_dist=exp --benchmarks=build,readhit,readmt
+//
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "base/init.h"
+#include "base/logging.h"
+#include "base/random.h"
+#include "base/walltime.h"
+#include "file/file.h"
+#include "file/file_util.h"
+#include "file/filesource.h"
+#include "file/sstable/cache.h"
+#include "file/sstable/filter_policy.h"
+#include "file/sstable/sstable.h"
+#include "file/sstable/sstable_builder.h"
+#include "file/sstable/table_properties.h"
+#include "strings/numbers.h"
+#include "strings/split.h"
+#include "strings/stringprintf.h"
+
+DEFINE_string(benchmarks, "build,readhit,readmiss,scan,scanfull,readmt",
+              "Comma separated list of benchmarks to run on every table:\n"
+              "build - builds the table, always done before the other benchmarks\n"
+              "readhit - random point lookups of present keys\n"
+              "readmiss - random point lookups of absent keys that fall between present keys\n"
+              "scan - range scans of --scan_length entries from random keys\n"
+              "scanfull - one sequential scan of the whole table\n"
+              "readmt - readhit from --threads threads that share the table\n"
+              "The read benchmarks run with and without the filter if --bloom_bits is set.");
+DEFINE_string(path, "/tmp/sstable_bench.sst", "Path of the generated table.");
+DEFINE_int32(num, 1000000, "Number of entries in the table.");
+DEFINE_int32(reads, 0, "Number of point lookups per benchmark. 0 means --num.");
+DEFINE_int32(scans, 10000, "Number of range scans.");
+DEFINE_int32(scan_length, 100, "Entries per range scan.");
+DEFINE_int32(threads, 4, "Threads of readmt.");
+
+DEFINE_string(key_dist, "fixed", "Distribution of the key sizes: fixed (--key_size), "
+                                 "uniform in [--key_size, --key_size_max] or exp with mean "
+                                 "--key_size, capped at --key_size_max.");
+DEFINE_int32(key_size, 16, "Key size, at least 12.");
+DEFINE_int32(key_size_max, 64, "Maximal key size of the uniform and exp distributions.");
+DEFINE_string(value_dist, "fixed", "Distribution of the value sizes, see --key_dist.");
+DEFINE_int32(value_size, 100, "Value size, see --key_size.");
+DEFINE_int32(value_size_max, 1000, "Maximal value size, see --key_size_max.");
+
+DEFINE_string(block_sizes, "4096", "Comma separated data block sizes.");
+DEFINE_string(restart_intervals, "16", "Comma separated restart intervals of the blocks.");
+DEFINE_string(compression, "lz4", "none, snappy, lz4 or zlib.");
+DEFINE_int32(bloom_bits, 10, "Bits per key of the bloom filter. 0 builds no filter.");
+DEFINE_int32(cache_mb, 64, "Size of the block cache. 0 reads without one.");
+DEFINE_bool(use_mmap, false, "Whether the table is read through a file mapping.");
+
+using namespace file;
+using namespace file::sstable;
+using strings::Slice;
+using std::string;
+
+namespace {
+
+constexpr int kKeyDigits = 12;
+
+uint64 Mix(uint64 x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// Size of item i, drawn from the distribution dist.
+size_t SampleSize(const string& dist, int min_size, int max_size, uint64 i) {
+  if (dist == "fixed")
+    return min_size;
+  double u = (Mix(i) >> 11) * (1.0 / (1ULL << 53));
+  if (dist == "uniform")
+    return min_size + size_t(u * (max_size - min_size + 1));
+  CHECK_EQ("exp", dist) << "Unknown size distribution";
+  double size = -std::log(1 - u) * min_size;
+  return std::min<size_t>(max_size, std::max<size_t>(1, size));
+}
+
+// Generates the entries of the table. Entry i has key number 2 * i, so keys with odd numbers
+// are absent and sort between present keys.
+class Generator {
+ public:
+  Generator() {
+    // Half compressible data: every chunk of 32 random characters is repeated.
+    MTRandom rnd(301);
+    data_.resize(std::max(1 << 20, 2 * FLAGS_value_size_max));
+    for (size_t i = 0; i < data_.size(); i += 64) {
+      for (size_t j = 0; j < 32 && i + j < data_.size(); ++j)
+        data_[i + j] = ' ' + rnd.Rand32() % 95;
+      for (size_t j = 32; j < 64 && i + j < data_.size(); ++j)
+        data_[i + j] = data_[i + j - 32];
+    }
+  }
+
+  void Key(uint64 number, string* key) const {
+    size_t size = SampleSize(FLAGS_key_dist, FLAGS_key_size, FLAGS_key_size_max, number / 2);
+    *key = StringPrintf("%0*llu", kKeyDigits, static_cast<unsigned long long>(number));
+    if (size > key->size())
+      key->append(data_, number % 1024, size - key->size());
+  }
+
+  Slice Value(uint64 i) const {
+    size_t size = SampleSize(FLAGS_value_dist, FLAGS_value_size, FLAGS_value_size_max,
+                             i + (1ULL << 40));
+    return Slice(data_.data() + Mix(i) % (data_.size() - size), size);
+  }
+
+ private:
+  string data_;
+};
+
+// Throughput and latencies of a benchmark.
+class Stats {
+ public:
+  void Start() {
+    latencies_.clear();
+    bytes_ = 0;
+    start_ = GetMonotonicMicros();
+  }
+
+  void Stop() { micros_ = GetMonotonicMicros() - start_; }
+
+  void AddOp(uint64 cycles, size_t bytes) {
+    latencies_.push_back(cycles);
+    bytes_ += bytes;
+  }
+
+  // Adds the operations of a thread. The elapsed time is the one of *this.
+  void Merge(const Stats& other) {
+    latencies_.insert(latencies_.end(), other.latencies_.begin(), other.latencies_.end());
+    bytes_ += other.bytes_;
+  }
+
+  void Report(const string& name) {
+    if (latencies_.empty()) {
+      printf("%-16s : no operations\n", name.c_str());
+      return;
+    }
+    std::sort(latencies_.begin(), latencies_.end());
+    const double cycles_per_micro = CycleClock::CycleFreq() / 1e6;
+    auto percentile = [this, cycles_per_micro](double p) {
+      size_t i = std::min(latencies_.size() - 1, size_t(p * latencies_.size()));
+      return latencies_[i] / cycles_per_micro;
+    };
+    const double seconds = std::max<int64>(micros_, 1) * 1e-6;
+    printf("%-16s : %10.0f ops/sec %8.1f MB/s; micros/op p50 %.2f p99 %.2f p99.9 %.2f "
+           "max %.2f\n", name.c_str(), latencies_.size() / seconds, bytes_ / seconds / 1e6,
+           percentile(0.5), percentile(0.99), percentile(0.999), percentile(1));
+    fflush(stdout);
+  }
+
+ private:
+  std::vector<uint64> latencies_;  // In cycles.
+  uint64 bytes_ = 0;
+  int64 start_ = 0;
+  int64 micros_ = 0;
+};
+
+class Benchmark {
+ public:
+  Benchmark() {
+    if (FLAGS_bloom_bits > 0)
+      filter_policy_.reset(NewBloomFilterPolicy(FLAGS_bloom_bits));
+    if (FLAGS_cache_mb > 0)
+      cache_.reset(NewLRUCache(size_t(FLAGS_cache_mb) << 20));
+  }
+
+  ~Benchmark() { Close(); }
+
+  void Build(const Options& options);
+
+  // Opens the table that was built last, with the filter or without it.
+  void OpenTable(bool use_filter);
+
+  void ReadRandom(bool hits, const string& name);
+  void Scan();
+  void ScanFull();
+  void ReadMultiThreaded(const string& name);
+
+ private:
+  void Close();
+
+  // Looks up reads random keys, adding to *stats.
+  void Read(bool hits, unsigned reads, uint32 seed, Stats* stats) const;
+
+  Generator gen_;
+  std::unique_ptr<const FilterPolicy> filter_policy_;
+  std::unique_ptr<Cache> cache_;
+  std::unique_ptr<ReadonlyFile> file_;
+  std::unique_ptr<Table> table_;
+};
+
+void Benchmark::Close() {
+  table_.reset();
+  if (file_)
+    CHECK_STATUS(file_->Close());
+  file_.reset();
+}
+
+void Benchmark::Build(const Options& options) {
+  Close();
+  Stats stats;
+  string key;
+  {
+    File* fl = Open(FLAGS_path);
+    CHECK(fl != nullptr) << "Could not open " << FLAGS_path;
+    Sink sink(fl, TAKE_OWNERSHIP);
+    TableBuilder builder(options, &sink);
+    stats.Start();
+    for (int i = 0; i < FLAGS_num; ++i) {
+      gen_.Key(2 * i, &key);
+      Slice value = gen_.Value(i);
+      uint64 start = CycleClock::Now();
+      builder.Add(key, value);
+      stats.AddOp(CycleClock::Now() - start, key.size() + value.size());
+    }
+    CHECK_STATUS(builder.Finish());
+    stats.Stop();
+  }
+  stats.Report("build");
+
+  OpenTable(false);
+  const TableProperties* props = table_->GetProperties();
+  CHECK(props != nullptr);
+  const double num = std::max(FLAGS_num, 1);
+  printf("%-16s : file %.1f (raw %.1f), data %.1f, index %.3f, filter %.3f; %llu blocks\n",
+         "bytes/key", file_->Size() / num, (props->raw_key_size + props->raw_value_size) / num,
+         props->data_size / num, props->index_size / num, props->filter_size / num,
+         static_cast<unsigned long long>(props->num_data_blocks));
+}
+
+void Benchmark::OpenTable(bool use_filter) {
+  Close();
+  ReadonlyFile::Options file_opts;
+  file_opts.use_mmap = FLAGS_use_mmap;
+  auto res = ReadonlyFile::Open(FLAGS_path, file_opts);
+  CHECK_STATUS(res.status);
+  file_.reset(res.obj);
+
+  ReadOptions options;
+  options.block_cache = cache_.get();
+  if (use_filter)
+    options.filter_policy = filter_policy_.get();
+  auto table_res = Table::Open(options, file_.get());
+  CHECK_STATUS(table_res.status);
+  table_.reset(table_res.obj);
+}
+
+void Benchmark::Read(bool hits, unsigned reads, uint32 seed, Stats* stats) const {
+  MTRandom rnd(seed);
+  string key, value;
+  for (unsigned i = 0; i < reads; ++i) {
+    gen_.Key(2 * (rnd.Rand32() % FLAGS_num) + !hits, &key);
+    uint64 start = CycleClock::Now();
+    auto res = table_->Get(key, &value);
+    uint64 cycles = CycleClock::Now() - start;
+    CHECK(res.ok() && res.obj == hits) << key;
+    stats->AddOp(cycles, key.size() + (hits ? value.size() : 0));
+  }
+}
+
+void Benchmark::ReadRandom(bool hits, const string& name) {
+  Stats stats;
+  stats.Start();
+  Read(hits, FLAGS_reads, 1000, &stats);
+  stats.Stop();
+  stats.Report(name);
+}
+
+void Benchmark::Scan() {
+  Stats stats;
+  MTRandom rnd(2000);
+  string key;
+  std::unique_ptr<Iterator> it(table_->NewIterator());
+  stats.Start();
+  for (int i = 0; i < FLAGS_scans; ++i) {
+    gen_.Key(2 * (rnd.Rand32() % FLAGS_num), &key);
+    size_t bytes = 0;
+    uint64 start = CycleClock::Now();
+    it->Seek(key);
+    for (int n = 0; n < FLAGS_scan_length && it->Valid(); ++n) {
+      bytes += it->key().size() + it->value().size();
+      it->Next();
+    }
+    stats.AddOp(CycleClock::Now() - start, bytes);
+  }
+  CHECK_STATUS(it->status());
+  stats.Stop();
+  stats.Report("scan");
+}
+
+void Benchmark::ScanFull() {
+  util::FuncTaskPool pool("readahead", 8, 4);
+  pool.Launch();
+  IteratorOptions options;
+  options.readahead_blocks = 8;
+  options.readahead_pool = &pool;
+  std::unique_ptr<Iterator> it(table_->NewIterator(options));
+  Stats stats;
+  stats.Start();
+  uint64 start = CycleClock::Now();
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    uint64 now = CycleClock::Now();
+    stats.AddOp(now - start, it->key().size() + it->value().size());
+    start = now;
+  }
+  CHECK_STATUS(it->status());
+  stats.Stop();
+  stats.Report("scanfull");
+}
+
+void Benchmark::ReadMultiThreaded(const string& name) {
+  std::vector<Stats> thread_stats(FLAGS_threads);
+  std::vector<std::thread> threads;
+  const unsigned reads = FLAGS_reads / FLAGS_threads;
+  Stats stats;
+  stats.Start();
+  for (int t = 0; t < FLAGS_threads; ++t) {
+    threads.emplace_back([this, t, reads, &thread_stats] {
+      Read(true, reads, 3000 + t, &thread_stats[t]);
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  stats.Stop();
+  for (const auto& s : thread_stats)
+    stats.Merge(s);
+  stats.Report(StringPrintf("%s/%d", name.c_str(), FLAGS_threads));
+}
+
+CompressionType ParseCompression(const string& name) {
+  if (name == "none")
+    return kNoCompression;
+  if (name == "snappy")
+    return kSnappyCompression;
+  if (name == "lz4")
+    return kLZ4Compression;
+  if (name == "zlib")
+    return kZlibCompression;
+  LOG(FATAL) << "Unknown compression " << name;
+  return kNoCompression;
+}
+
+std::vector<int32> ParseList(const string& list) {
+  std::vector<int32> res;
+  for (strings::Slice item : strings::Split(list, ",", strings::SkipWhitespace())) {
+    int32 val = 0;
+    CHECK(safe_strto32(item, &val) && val > 0) << "Bad number in list " << list;
+    res.push_back(val);
+  }
+  return res;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  MainInitGuard guard(&argc, &argv);
+
+  CHECK_GT(FLAGS_num, 0);
+  CHECK_GE(FLAGS_key_size, kKeyDigits);
+  CHECK_GE(FLAGS_key_size_max, FLAGS_key_size);
+  CHECK_GE(FLAGS_value_size_max, FLAGS_value_size);
+  CHECK_GT(FLAGS_threads, 0);
+  if (FLAGS_reads <= 0)
+    FLAGS_reads = FLAGS_num;
+
+  std::vector<string> benchmarks;
+  for (strings::Slice name : strings::Split(FLAGS_benchmarks, ",", strings::SkipWhitespace()))
+    benchmarks.push_back(name.as_string());
+
+  printf("Entries: %d, keys: %s %d-%d bytes, values: %s %d-%d bytes, compression: %s, "
+         "bloom bits: %d, cache: %d MB, mmap: %d\n", FLAGS_num, FLAGS_key_dist.c_str(),
+         FLAGS_key_size, FLAGS_key_size_max, FLAGS_value_dist.c_str(), FLAGS_value_size,
+         FLAGS_value_size_max, FLAGS_compression.c_str(), FLAGS_bloom_bits, FLAGS_cache_mb,
+         FLAGS_use_mmap);
+
+  Benchmark bench;
+  std::unique_ptr<const FilterPolicy> build_policy;
+  if (FLAGS_bloom_bits > 0)
+    build_policy.reset(NewBloomFilterPolicy(FLAGS_bloom_bits));
+
+  for (int32 block_size : ParseList(FLAGS_block_sizes)) {
+    for (int32 restart_interval : ParseList(FLAGS_restart_intervals)) {
+      printf("------------------------------------------------\n");
+      printf("block size: %d, restart interval: %d\n", block_size, restart_interval);
+      Options options;
+      options.block_size = block_size;
+      options.block_restart_interval = restart_interval;
+      options.compression = ParseCompression(FLAGS_compression);
+      options.filter_policy = build_policy.get();
+      bench.Build(options);
+
+      // Every read benchmark runs without the filter and, if there is one, with it.
+      for (bool use_filter : {false, true}) {
+        if (use_filter && !build_policy)
+          break;
+        bench.OpenTable(use_filter);
+        const char* suffix = use_filter ? "+filter" : "";
+        for (const string& name : benchmarks) {
+          if (name == "build") {
+            continue;
+          } else if (name == "readhit") {
+            bench.ReadRandom(true, name + suffix);
+          } else if (name == "readmiss") {
+            bench.ReadRandom(false, name + suffix);
+          } else if (name == "readmt") {
+            bench.ReadMultiThreaded(name + suffix);
+          } else if (use_filter) {
+            continue;  // Scans do not use the filter.
+          } else if (name == "scan") {
+            bench.Scan();
+          } else if (name == "scanfull") {
+            bench.ScanFull();
+          } else {
+            LOG(FATAL) << "Unknown benchmark " << name;
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
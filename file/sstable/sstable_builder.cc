@@ -4,6 +4,12 @@
 
 #include "file/sstable/sstable_builder.h"
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include <snappy-c.h>
 #include "file/file.h"
 #include "file/meta_map_block.h"
@@ -12,9 +18,11 @@
 #include "file/sstable/filter_block.h"
 #include "file/sstable/filter_policy.h"
 #include "file/sstable/format.h"
+#include "file/sstable/table_properties.h"
 #include "util/sinksource.h"
 #include "util/crc32c.h"
 #include "util/coding/fixed.h"
+#include "util/sp_task_pool.h"
 
 namespace file {
 namespace sstable {
@@ -58,6 +66,68 @@ static void FindShortSuccessor(std::string* key) {
   // *key is a run of 0xffs.  Leave it alone.
 }
 
+// Compresses raw into *compressed if it pays off and returns the type of the stored block.
+// *contents points to the data to store.
+static CompressionType CompressBlock(CompressionType type, int level, const Slice& raw,
+                                     std::string* compressed, Slice* contents) {
+  switch (type) {
+    case kNoCompression:
+      *contents = raw;
+      return type;
+
+    case kSnappyCompression: {
+      size_t output_length = snappy_max_compressed_length(raw.size());
+      compressed->resize(output_length);
+      snappy_status st = snappy_compress(raw.data(), raw.size(), &compressed->front(),
+                                         &output_length);
+      if (st != SNAPPY_OK) {
+        LOG(ERROR) << "Error snappy compressing " << st;
+        compressed->clear();
+      } else {
+        compressed->resize(output_length);
+      }
+      break;
+    }
+    case kLZ4Compression:
+    case kZlibCompression:
+      if (!CompressBlockContents(type, level, raw, compressed)) {
+        compressed->clear();
+      }
+      break;
+  }
+
+  if (!compressed->empty() && compressed->size() < raw.size() - (raw.size() / 8u)) {
+    *contents = *compressed;
+    return type;
+  }
+  // Compression failed or compressed less than 12.5%, so just
+  // store uncompressed form
+  *contents = raw;
+  return kNoCompression;
+}
+
+static void EncodeBlockTrailer(const Slice& contents, CompressionType type, uint8* trailer) {
+  trailer[0] = type;
+  uint32_t crc = crc32c::Value(contents.ubuf(), contents.size());
+  crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
+  coding::EncodeFixed32(crc32c::Mask(crc), trailer+1);
+}
+
+// A data block that is compressed in the background.
+struct BlockJob {
+  std::string raw;
+  std::string compressed;
+  Slice contents;  // points either to raw or to compressed.
+  CompressionType type = kNoCompression;  // The type of the stored block.
+  uint8 trailer[kBlockTrailerSize];
+
+  // The keys of the block, added to the filter when the block is written.
+  std::string keys;
+  std::vector<size_t> key_ends;
+
+  bool done = false;
+};
+
 struct TableBuilder::Rep {
   Options options;
   Options index_block_options;
@@ -84,31 +154,102 @@ struct TableBuilder::Rep {
   BlockHandle pending_handle;  // Handle to add to index block
 
   std::string compressed_output;
-  uint32 num_data_blocks = 0;
   MetaMapBlock meta_block;
 
+  // The last prefix added to the filter for the current data block.
+  std::string last_prefix;
+  bool has_block_prefix = false;
+  TableProperties props;
+
+  // Parallel compression state, used when options.compression_threads > 0.
+  // Jobs are written in the order they were submitted, so the output is the same as
+  // in the serial mode. Since the handle of a block is known only when it is written,
+  // index entries wait in index_keys/written_handles until both parts are known.
+  std::deque<std::unique_ptr<BlockJob>> jobs;
+  std::unique_ptr<BlockJob> current_job;  // Collects the filter keys of data_block.
+  std::deque<std::string> index_keys;
+  std::deque<BlockHandle> written_handles;
+
+  // Complete index partitions, used when options.index_partition_size > 0.
+  // They are kept in memory and written by Finish() so that they do not move the data
+  // blocks away from the offsets already passed to the filter builder.
+  std::vector<std::string> index_partitions;
+  std::vector<std::string> partition_last_keys;
+  std::string last_index_key;
+  std::mutex mu;
+  std::condition_variable job_done;
+
+  // Declared after the jobs so that it is destroyed first.
+  std::unique_ptr<util::FuncTaskPool> pool;
+
   Rep(const Options& opt, util::Sink* f)
       : options(opt),
         index_block_options(opt),
         sink(f),
         offset(0),
-        data_block(&options),
-        index_block(&index_block_options),
+        data_block(&options, opt.data_block_hash_index, opt.fixed_key_size > 0),
+        index_block(&index_block_options, false, opt.fixed_key_size > 0),
         num_entries(0),
         closed(false),
         filter_block(opt.filter_policy == NULL ? NULL
                      : new FilterBlockBuilder(opt.filter_policy)),
         pending_index_entry(false) {
     index_block_options.block_restart_interval = 1;
+    index_block_options.fixed_value_size = 0;  // Block handles have variable sizes.
+  }
+
+  void AddFilterKey(const Slice& key) {
+    if (pool) {
+      BlockJob* job = current_job.get();
+      job->keys.append(key.data(), key.size());
+      job->key_ends.push_back(job->keys.size());
+    } else {
+      filter_block->AddKey(key);
+    }
   }
 
   void AddEntryToIndex() {
     DCHECK(pending_index_entry);
+    pending_index_entry = false;
 
+    if (pool) {
+      index_keys.push_back(last_key);
+      AddWrittenEntriesToIndex();
+      return;
+    }
+    AddIndexEntry(last_key, pending_handle);
+  }
+
+  void AddWrittenEntriesToIndex() {
+    while (!index_keys.empty() && !written_handles.empty()) {
+      AddIndexEntry(index_keys.front(), written_handles.front());
+      index_keys.pop_front();
+      written_handles.pop_front();
+    }
+  }
+
+  void AddIndexEntry(const std::string& key, const BlockHandle& handle) {
     std::string handle_encoding;
-    pending_handle.EncodeTo(&handle_encoding);
-    index_block.Add(last_key, Slice(handle_encoding));
-    pending_index_entry = false;
+    handle.EncodeTo(&handle_encoding);
+    index_block.Add(key, Slice(handle_encoding));
+    ++props.num_index_entries;
+    if (options.index_partition_size > 0) {
+      last_index_key = key;
+      if (index_block.CurrentSizeEstimate() >= options.index_partition_size) {
+        CutIndexPartition();
+      }
+    }
+  }
+
+  void RecordDataBlock(size_t raw_size, const BlockHandle& handle, CompressionType type) {
+    props.AddDataBlock(raw_size, handle.size(),
+                       options.compression != kNoCompression && type == kNoCompression);
+  }
+
+  void CutIndexPartition() {
+    index_partitions.push_back(index_block.Finish().as_string());
+    partition_last_keys.push_back(last_index_key);
+    index_block.Reset();
   }
 };
 
@@ -117,6 +258,11 @@ TableBuilder::TableBuilder(const Options& options, util::Sink* file)
   if (rep_->filter_block != NULL) {
     rep_->filter_block->StartBlock(0);
   }
+  if (options.compression_threads > 0) {
+    rep_->pool.reset(new util::FuncTaskPool("compress", 2, options.compression_threads));
+    rep_->pool->Launch();
+    rep_->current_job.reset(new BlockJob);
+  }
 }
 
 TableBuilder::~TableBuilder() {
@@ -132,18 +278,49 @@ void TableBuilder::Add(const Slice key, const Slice value) {
   if (r->num_entries > 0) {
     DCHECK(key.compare(Slice(r->last_key)) > 0);
   }
+  if (r->options.fixed_key_size > 0 &&
+      (key.size() != r->options.fixed_key_size ||
+       (r->options.fixed_value_size > 0 && value.size() != r->options.fixed_value_size))) {
+    r->status = Status(base::StatusCode::INVALID_ARGUMENT,
+                       "key or value size differs from the fixed width");
+    return;
+  }
 
   if (r->pending_index_entry) {
     // Add an entry to the index block.
+    // Index keys of fixed width tables are the full last keys of the blocks.
     DCHECK(r->data_block.empty());
-    FindShortestSeparator(key, &r->last_key);
+    if (r->options.fixed_key_size == 0) {
+      FindShortestSeparator(key, &r->last_key);
+    }
     r->AddEntryToIndex();
   }
 
   if (r->filter_block != NULL) {
-    r->filter_block->AddKey(key);
+    const PrefixExtractor* extractor = r->options.prefix_extractor;
+    if (extractor == NULL || r->options.whole_key_filtering) {
+      r->AddFilterKey(key);
+    }
+    if (extractor != NULL && extractor->InDomain(key)) {
+      // Keys with the same prefix are adjacent, so a prefix is added once per block.
+      Slice prefix = extractor->Transform(key);
+      if (!r->has_block_prefix || prefix != Slice(r->last_prefix)) {
+        r->AddFilterKey(prefix);
+        r->last_prefix.assign(prefix.data(), prefix.size());
+        r->has_block_prefix = true;
+      }
+    }
   }
 
+  if (r->num_entries == 0) {
+    r->props.smallest_key.assign(key.data(), key.size());
+    r->props.smallest_value_size = value.size();
+  }
+  r->props.raw_key_size += key.size();
+  r->props.raw_value_size += value.size();
+  r->props.smallest_value_size = std::min<uint64>(r->props.smallest_value_size, value.size());
+  r->props.largest_value_size = std::max<uint64>(r->props.largest_value_size, value.size());
+
   r->last_key.assign(key.data(), key.size());
   r->num_entries++;
   r->data_block.Add(key, value);
@@ -164,12 +341,19 @@ void TableBuilder::Flush() {
   if (!ok()) return;
   if (r->data_block.empty()) return;
   DCHECK(!r->pending_index_entry);
-  WriteBlock(&r->data_block, &r->pending_handle);
+  r->has_block_prefix = false;
+  if (r->pool) {
+    SubmitBlock();
+    return;
+  }
+  Slice raw = r->data_block.Finish();
+  CompressionType type = WriteBlock(raw, &r->pending_handle);
   if (ok()) {
+    r->RecordDataBlock(raw.size(), r->pending_handle, type);
     r->pending_index_entry = true;
-    r->num_data_blocks++;
     r->status = r->sink->Flush();
   }
+  r->data_block.Reset();
   if (r->filter_block != NULL) {
     r->filter_block->StartBlock(r->offset);
   }
@@ -181,54 +365,141 @@ void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
   //    type: uint8
   //    crc: uint32
   DCHECK(ok());
-  Rep* r = rep_;
-  Slice raw = block->Finish();
+  WriteBlock(block->Finish(), handle);
+  block->Reset();
+}
 
+CompressionType TableBuilder::WriteBlock(const Slice raw, BlockHandle* handle) {
+  Rep* r = rep_;
   Slice block_contents;
-  CompressionType type = r->options.compression;
-  // TODO(postrelease): Support more compression options: zlib?
-  switch (type) {
-    case kNoCompression:
-      block_contents = raw;
-      break;
+  CompressionType type = CompressBlock(r->options.compression, r->options.compression_level,
+                                       raw, &r->compressed_output, &block_contents);
+  WriteRawBlock(block_contents, type, handle);
+  r->compressed_output.clear();
+  return type;
+}
 
-    case kSnappyCompression: {
-      size_t output_length = snappy_max_compressed_length(raw.size());
-      r->compressed_output.resize(output_length);
-      snappy_status st = snappy_compress(raw.data(), raw.size(), &r->compressed_output.front(),
-                                         &output_length);
-      if (st != SNAPPY_OK) {
-        LOG(ERROR) << "Error snappy compressing " << st;
-      } else if (output_length < raw.size() - (raw.size() / 8u)) {
-        block_contents = Slice(r->compressed_output.data(), output_length);
-      } else {
-        // Snappy not supported, or compressed less than 12.5%, so just
-        // store uncompressed form
-        block_contents = raw;
-        type = kNoCompression;
+void TableBuilder::WritePartitionedIndex(BlockHandle* handle) {
+  Rep* r = rep_;
+  if (!r->index_block.empty()) {
+    r->CutIndexPartition();
+  }
+
+  // The top-level index maps the last key of each partition to its handle, which is exactly
+  // the format of the regular index, so it can be read as one.
+  BlockBuilder top_index(&r->index_block_options, false, r->options.fixed_key_size > 0);
+  std::string handle_encoding;
+  BlockHandle partition_handle;
+  for (size_t i = 0; i < r->index_partitions.size() && ok(); ++i) {
+    WriteBlock(r->index_partitions[i], &partition_handle);
+    r->props.index_size += partition_handle.size();
+    handle_encoding.clear();
+    partition_handle.EncodeTo(&handle_encoding);
+    top_index.Add(r->partition_last_keys[i], Slice(handle_encoding));
+  }
+  r->index_partitions.clear();
+  r->partition_last_keys.clear();
+  if (ok()) {
+    WriteBlock(&top_index, handle);
+  }
+}
+
+void TableBuilder::SubmitBlock() {
+  Rep* r = rep_;
+
+  // Bound the memory held by the jobs in flight.
+  const size_t max_jobs = 2 * r->options.compression_threads;
+  while (r->jobs.size() >= max_jobs && ok()) {
+    WriteCompletedBlocks(true);
+  }
+
+  BlockJob* job = r->current_job.release();
+  r->jobs.emplace_back(job);
+  r->current_job.reset(new BlockJob);
+  Slice raw = r->data_block.Finish();
+  job->raw.assign(raw.data(), raw.size());
+  r->data_block.Reset();
+  r->pending_index_entry = true;
+
+  const CompressionType type = r->options.compression;
+  const int level = r->options.compression_level;
+  r->pool->RunTask([r, job, type, level] {
+    job->type = CompressBlock(type, level, job->raw, &job->compressed, &job->contents);
+    EncodeBlockTrailer(job->contents, job->type, job->trailer);
+
+    std::lock_guard<std::mutex> lock(r->mu);
+    job->done = true;
+    r->job_done.notify_all();
+  });
+  WriteCompletedBlocks(false);
+}
+
+void TableBuilder::WriteCompletedBlocks(bool wait) {
+  Rep* r = rep_;
+  while (!r->jobs.empty() && ok()) {
+    BlockJob* job = r->jobs.front().get();
+    {
+      std::unique_lock<std::mutex> lock(r->mu);
+      if (!job->done) {
+        if (!wait)
+          return;
+        r->job_done.wait(lock, [job] { return job->done; });
       }
-      break;
     }
+    wait = false;  // Wait for a single block at most.
+
+    // Same sequence of filter calls as in the serial mode.
+    if (r->filter_block != NULL) {
+      size_t start = 0;
+      for (size_t end : job->key_ends) {
+        r->filter_block->AddKey(Slice(job->keys.data() + start, end - start));
+        start = end;
+      }
+    }
+    BlockHandle handle;
+    AppendBlock(job->contents, job->trailer, &handle);
+    if (ok()) {
+      r->RecordDataBlock(job->raw.size(), handle, job->type);
+      r->written_handles.push_back(handle);
+      r->AddWrittenEntriesToIndex();
+      r->status = r->sink->Flush();
+    }
+    if (r->filter_block != NULL) {
+      r->filter_block->StartBlock(r->offset);
+    }
+    r->jobs.pop_front();
   }
-  WriteRawBlock(block_contents, type, handle);
-  r->compressed_output.clear();
-  block->Reset();
+}
+
+void TableBuilder::WaitForJobs() {
+  Rep* r = rep_;
+  if (!r->pool)
+    return;
+
+  // Even when an error occurred, the jobs must complete before they are released.
+  r->pool->WaitForTasksToComplete();
+  while (!r->jobs.empty() && ok()) {
+    WriteCompletedBlocks(true);
+  }
+  r->jobs.clear();
 }
 
 void TableBuilder::WriteRawBlock(const Slice block_contents,
                                  CompressionType type,
                                  BlockHandle* handle) {
+  uint8 trailer[kBlockTrailerSize];
+  EncodeBlockTrailer(block_contents, type, trailer);
+  AppendBlock(block_contents, trailer, handle);
+}
+
+void TableBuilder::AppendBlock(const Slice block_contents, const uint8* trailer,
+                               BlockHandle* handle) {
   Rep* r = rep_;
   handle->set_offset(r->offset);
   handle->set_size(block_contents.size());
   r->status = r->sink->Append(block_contents);
   if (!r->status.ok())
     return;
-  uint8 trailer[kBlockTrailerSize];
-  trailer[0] = type;
-  uint32_t crc = crc32c::Value(block_contents.ubuf(), block_contents.size());
-  crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
-  coding::EncodeFixed32(crc32c::Mask(crc), trailer+1);
   r->status = r->sink->Append(Slice(trailer, kBlockTrailerSize));
   if (r->status.ok()) {
     r->offset += block_contents.size() + kBlockTrailerSize;
@@ -244,13 +515,45 @@ Status TableBuilder::Finish() {
   Flush();
   DCHECK(!r->closed);
   r->closed = true;
+  r->props.largest_key = r->last_key;
 
-  BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle;
+  if (r->pending_index_entry) {
+    if (r->options.fixed_key_size == 0) {
+      FindShortSuccessor(&r->last_key);
+    }
+    r->AddEntryToIndex();
+  }
+  if (r->pool) {
+    WaitForJobs();
+    DCHECK(!ok() || r->index_keys.empty());
+  }
+
+  BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle,
+      properties_block_handle;
 
   // Write filter block
   if (ok() && r->filter_block != NULL) {
     WriteRawBlock(r->filter_block->Finish(), kNoCompression,
                   &filter_block_handle);
+    r->props.filter_size = filter_block_handle.size();
+  }
+
+  // Write index block
+  if (ok()) {
+    if (r->options.index_partition_size > 0) {
+      WritePartitionedIndex(&index_block_handle);
+    } else {
+      WriteBlock(&r->index_block, &index_block_handle);
+    }
+    r->props.index_size += index_block_handle.size();
+  }
+
+  // Write properties block. It is stored uncompressed so that it can be read cheaply.
+  if (ok()) {
+    r->props.num_entries = r->num_entries;
+    std::string tmp_encoding;
+    r->props.EncodeTo(&tmp_encoding);
+    WriteRawBlock(tmp_encoding, kNoCompression, &properties_block_handle);
   }
 
   // Write metaindex block
@@ -266,21 +569,23 @@ Status TableBuilder::Finish() {
     }
     tmp_encoding.clear();
     r->meta_block.EncodeTo(&tmp_encoding);
+    if (r->options.index_partition_size > 0) {
+      meta_index_block.Add(StringPiece(kPartitionedIndexKey), Slice());
+    }
     meta_index_block.Add(StringPiece(kMetaBlockKey), tmp_encoding);
+    if (r->filter_block != NULL && r->options.prefix_extractor != NULL) {
+      std::string key(kPrefixExtractorPrefix);
+      key.append(r->options.prefix_extractor->Name());
+      meta_index_block.Add(key, r->options.whole_key_filtering ? "1" : "0");
+    }
 
-    // TODO(postrelease): Add stats and other meta blocks
+    // Keys of the metaindex must be added in sorted order.
+    tmp_encoding.clear();
+    properties_block_handle.EncodeTo(&tmp_encoding);
+    meta_index_block.Add(StringPiece(kPropertiesBlockKey), tmp_encoding);
     WriteBlock(&meta_index_block, &metaindex_block_handle);
   }
 
-  // Write index block
-  if (ok()) {
-    if (r->pending_index_entry) {
-      FindShortSuccessor(&r->last_key);
-      r->AddEntryToIndex();
-    }
-    WriteBlock(&r->index_block, &index_block_handle);
-  }
-
   // Write footer
   if (ok()) {
     Footer footer;
@@ -300,6 +605,10 @@ void TableBuilder::Abandon() {
   Rep* r = rep_;
   DCHECK(!r->closed);
   r->closed = true;
+  if (r->pool) {
+    r->pool->WaitForTasksToComplete();
+    r->jobs.clear();
+  }
 }
 
 uint64 TableBuilder::NumEntries() const {
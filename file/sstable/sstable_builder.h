@@ -78,7 +78,19 @@ class TableBuilder {
  private:
   bool ok() const { return status().ok(); }
   void WriteBlock(BlockBuilder* block, BlockHandle* handle);
+  CompressionType WriteBlock(const strings::Slice raw, BlockHandle* handle);
   void WriteRawBlock(const strings::Slice data, CompressionType, BlockHandle* handle);
+  void AppendBlock(const strings::Slice data, const uint8* trailer, BlockHandle* handle);
+
+  // Writes the index partitions followed by the top-level index that points to them.
+  void WritePartitionedIndex(BlockHandle* handle);
+
+  // Parallel compression of data blocks.
+  void SubmitBlock();
+  // Writes the compressed blocks at the head of the queue. If wait is true, waits for
+  // the first block to complete.
+  void WriteCompletedBlocks(bool wait);
+  void WaitForJobs();
 
   struct Rep;
   Rep* rep_;
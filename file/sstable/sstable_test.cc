@@ -0,0 +1,1258 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/sstable/sstable.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "base/endian.h"
+#include "base/random.h"
+#include "file/file.h"
+#include "file/file_util.h"
+#include "file/filesource.h"
+#include "file/sstable/block.h"
+#include "file/sstable/block_builder.h"
+#include "file/sstable/cache.h"
+#include "file/sstable/filter_policy.h"
+#include "file/sstable/format.h"
+#include "file/sstable/merging_iterator.h"
+#include "file/sstable/sstable_builder.h"
+#include "file/sstable/table_properties.h"
+#include "strings/stringprintf.h"
+
+namespace file {
+namespace sstable {
+
+using std::string;
+using strings::Slice;
+using base::Status;
+
+class SstableTest : public testing::Test {
+ protected:
+  static string Key(unsigned i) { return StringPrintf("key%07u", i); }
+  static string Value(unsigned i) { return StringPrintf("value%u", i) + string(50, 'v'); }
+
+  // Builds a table with keys [0, count) and opens it.
+  void Build(const string& name, unsigned count, const Options& options = Options()) {
+    path_ = base::GetTestTempPath(name);
+    File* fl = Open(path_);
+    ASSERT_TRUE(fl != nullptr);
+    Sink sink(fl, TAKE_OWNERSHIP);
+    TableBuilder builder(options, &sink);
+    for (unsigned i = 0; i < count; ++i) {
+      builder.Add(Key(i), Value(i));
+    }
+    ASSERT_TRUE(builder.Finish().ok());
+  }
+
+  // Blocks that point into a mapped file are not cached, hence no mmap by default.
+  void OpenTable(const ReadOptions& options, bool use_mmap = false) {
+    table_.reset();
+    if (file_) {
+      ASSERT_TRUE(file_->Close().ok());
+    }
+
+    ReadonlyFile::Options file_opts;
+    file_opts.use_mmap = use_mmap;
+    auto res = ReadonlyFile::Open(path_, file_opts);
+    ASSERT_TRUE(res.ok()) << res.status;
+    file_.reset(res.obj);
+    auto table_res = Table::Open(options, file_.get());
+    ASSERT_TRUE(table_res.ok()) << table_res.status;
+    table_.reset(table_res.obj);
+  }
+
+  void TearDown() override {
+    table_.reset();
+    if (file_) {
+      EXPECT_TRUE(file_->Close().ok());
+    }
+  }
+
+  // Returns the number of keys found.
+  unsigned SeekAll(unsigned from, unsigned to) {
+    std::unique_ptr<Iterator> it(table_->NewIterator());
+    unsigned found = 0;
+    for (unsigned i = from; i < to; ++i) {
+      it->Seek(Key(i));
+      if (it->Valid() && it->key() == Key(i) && it->value() == Value(i))
+        ++found;
+    }
+    return found;
+  }
+
+  string path_;
+  std::unique_ptr<ReadonlyFile> file_;
+  std::unique_ptr<Table> table_;
+};
+
+TEST_F(SstableTest, Cache) {
+  std::unique_ptr<Cache> cache(NewLRUCache(100));
+
+  static unsigned deleted;
+  deleted = 0;
+  auto deleter = [](const Slice& key, void* value) { ++deleted; };
+
+  Cache::Handle* h1 = cache->Insert("a", reinterpret_cast<void*>(1), 1, deleter);
+  EXPECT_EQ(reinterpret_cast<void*>(1), cache->Value(h1));
+  Cache::Handle* h2 = cache->Lookup("a");
+  ASSERT_TRUE(h2 != nullptr);
+  EXPECT_TRUE(cache->Lookup("b") == nullptr);
+  cache->Release(h2);
+
+  // Replacing the entry keeps the pinned value alive.
+  cache->Release(cache->Insert("a", reinterpret_cast<void*>(2), 1, deleter));
+  EXPECT_EQ(0, deleted);
+  EXPECT_EQ(reinterpret_cast<void*>(1), cache->Value(h1));
+  cache->Release(h1);
+  EXPECT_EQ(1, deleted);
+
+  // Unpinned entries are evicted in LRU order.
+  for (unsigned i = 0; i < 1000; ++i) {
+    cache->Release(cache->Insert(std::to_string(i), nullptr, 1, deleter));
+  }
+  Cache::Stats stats = cache->GetStats();
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(1, stats.misses);
+  EXPECT_LE(stats.charge, 100 + 15);
+  EXPECT_TRUE(cache->Lookup("0") == nullptr);
+
+  Cache::Handle* last = cache->Lookup("999");
+  ASSERT_TRUE(last != nullptr);
+  cache->Release(last);
+
+  cache.reset();
+  EXPECT_EQ(1002, deleted);
+}
+
+TEST_F(SstableTest, BlockCache) {
+  const unsigned kCount = 20000;
+  Build("cached.sst", kCount);
+
+  std::unique_ptr<Cache> cache(NewLRUCache(64 << 20));
+  ReadOptions opts;
+  opts.block_cache = cache.get();
+  OpenTable(opts);
+
+  EXPECT_EQ(kCount, SeekAll(0, kCount));
+  Cache::Stats stats = cache->GetStats();
+  EXPECT_GT(stats.misses, 10);
+  EXPECT_GT(stats.charge, 0);
+
+  // The second pass is served from the cache.
+  EXPECT_EQ(kCount, SeekAll(0, kCount));
+  Cache::Stats stats2 = cache->GetStats();
+  EXPECT_EQ(stats.misses, stats2.misses);
+  EXPECT_GT(stats2.hits, stats.hits);
+
+  // A tiny cache keeps evicting but never breaks pinned blocks.
+  cache.reset(NewLRUCache(1));
+  opts.block_cache = cache.get();
+  OpenTable(opts);
+  std::unique_ptr<Iterator> it(table_->NewIterator());
+  unsigned count = 0;
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    ASSERT_EQ(Key(count), it->key());
+    ++count;
+  }
+  EXPECT_EQ(kCount, count);
+  EXPECT_EQ(kCount, SeekAll(0, kCount));
+  it.reset();
+
+  // Every shard keeps at most its last released block.
+  EXPECT_LE(cache->GetStats().charge, 16 * (1 << 15));
+}
+
+TEST_F(SstableTest, BloomFilter) {
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  std::vector<string> keys;
+  for (unsigned i = 0; i < 10000; ++i) {
+    keys.push_back(Key(i));
+  }
+  std::vector<Slice> slices(keys.begin(), keys.end());
+
+  // Filters are appended to existing data at an arbitrary offset.
+  string filter("abc");
+  policy->CreateFilter(slices.data(), slices.size(), &filter);
+  Slice fslice(filter, 3, filter.size() - 3);
+  EXPECT_EQ(0, (fslice.size() - 2 - fslice.ubuf()[fslice.size() - 1]) % 64);
+
+  for (const auto& k : keys) {
+    ASSERT_TRUE(policy->KeyMayMatch(k, fslice)) << k;
+  }
+  unsigned false_positives = 0;
+  for (unsigned i = 0; i < 10000; ++i) {
+    false_positives += policy->KeyMayMatch(Key(1000000 + i), fslice);
+  }
+  EXPECT_LT(false_positives, 300);  // ~1% for a classic bloom filter, a bit more when blocked.
+
+  string empty;
+  policy->CreateFilter(nullptr, 0, &empty);
+  EXPECT_FALSE(policy->KeyMayMatch("foo", empty));
+}
+
+TEST_F(SstableTest, Get) {
+  const unsigned kCount = 20000;
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  Options options;
+  options.filter_policy = policy.get();
+
+  // Even keys only, so that misses fall inside the key range.
+  path_ = base::GetTestTempPath("get.sst");
+  {
+    Sink sink(Open(path_), TAKE_OWNERSHIP);
+    TableBuilder builder(options, &sink);
+    for (unsigned i = 0; i < kCount; i += 2) {
+      builder.Add(Key(i), Value(i));
+    }
+    ASSERT_TRUE(builder.Finish().ok());
+  }
+
+  std::unique_ptr<Cache> cache(NewLRUCache(64 << 20));
+  for (bool use_filter : {false, true}) {
+    ReadOptions opts;
+    opts.block_cache = cache.get();
+    if (use_filter)
+      opts.filter_policy = policy.get();
+    OpenTable(opts);
+
+    Cache::Stats before = cache->GetStats();
+    string value;
+    for (unsigned i = 0; i < kCount; i += 2) {
+      auto res = table_->Get(Key(i), &value);
+      ASSERT_TRUE(res.ok()) << res.status;
+      ASSERT_TRUE(res.obj) << Key(i);
+      ASSERT_EQ(Value(i), value);
+    }
+    Cache::Stats hits = cache->GetStats();
+
+    for (unsigned i = 1; i < kCount; i += 2) {
+      auto res = table_->Get(Key(i), &value);
+      ASSERT_TRUE(res.ok()) << res.status;
+      ASSERT_FALSE(res.obj) << Key(i);
+    }
+
+    // With the filter, most misses do not look for a block.
+    uint64 hit_lookups = hits.hits + hits.misses - before.hits - before.misses;
+    Cache::Stats after = cache->GetStats();
+    uint64 miss_lookups = after.hits + after.misses - hits.hits - hits.misses;
+    EXPECT_EQ(kCount / 2, hit_lookups);
+    if (use_filter) {
+      EXPECT_LT(miss_lookups, hit_lookups / 20);
+    } else {
+      EXPECT_EQ(kCount / 2, miss_lookups);
+    }
+
+    auto res = table_->Get(Key(kCount + 1), &value);
+    ASSERT_TRUE(res.ok() && !res.obj);
+    res = table_->Get("a", &value);
+    ASSERT_TRUE(res.ok() && !res.obj);
+  }
+}
+
+TEST_F(SstableTest, MultiGet) {
+  const unsigned kCount = 20000;
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  Options options;
+  options.filter_policy = policy.get();
+  Build("multiget.sst", kCount, options);
+
+  std::unique_ptr<Cache> cache(NewLRUCache(64 << 20));
+  ReadOptions opts;
+  opts.block_cache = cache.get();
+  opts.filter_policy = policy.get();
+  OpenTable(opts);
+
+  // Unsorted keys with duplicates and misses in every block and past the end.
+  MTRandom rnd(10);
+  std::vector<string> keys;
+  for (unsigned i = 0; i < 3000; ++i) {
+    unsigned k = rnd.Rand32() % (kCount + 1000);
+    keys.push_back(i % 3 == 0 ? Key(k) + "x" : Key(k));
+  }
+  keys.push_back(keys.front());
+  keys.push_back("");
+
+  std::vector<Slice> slices(keys.begin(), keys.end());
+  std::vector<string> values(keys.size());
+  std::unique_ptr<bool[]> found(new bool[keys.size()]);
+  ASSERT_TRUE(table_->MultiGet(slices.data(), slices.size(), values.data(), found.get()).ok());
+
+  unsigned num_found = 0;
+  string expected;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto res = table_->Get(keys[i], &expected);
+    ASSERT_TRUE(res.ok());
+    ASSERT_EQ(res.obj, found[i]) << keys[i];
+    if (found[i]) {
+      EXPECT_EQ(expected, values[i]);
+      ++num_found;
+    }
+  }
+  EXPECT_GT(num_found, 1500);
+
+  // A second batch over a cold cache looks each block up once.
+  cache.reset(NewLRUCache(64 << 20));
+  opts.block_cache = cache.get();
+  OpenTable(opts);
+  std::vector<string> sorted(keys.begin(), keys.begin() + 100);
+  std::sort(sorted.begin(), sorted.end());
+  slices.assign(sorted.begin(), sorted.end());
+  ASSERT_TRUE(table_->MultiGet(slices.data(), slices.size(), values.data(), found.get()).ok());
+  Cache::Stats stats = cache->GetStats();
+  EXPECT_EQ(0, stats.hits);
+  EXPECT_LE(stats.misses, 100);
+
+  EXPECT_TRUE(table_->MultiGet(nullptr, 0, nullptr, nullptr).ok());
+}
+
+TEST_F(SstableTest, ParallelCompression) {
+  const unsigned kCount = 50000;
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  Options options;
+  options.filter_policy = policy.get();
+  options.block_size = 1024;
+
+  // Small blocks, so that many jobs are in flight and complete out of order.
+  auto build = [&](const string& name) {
+    path_ = base::GetTestTempPath(name);
+    Sink sink(Open(path_), TAKE_OWNERSHIP);
+    TableBuilder builder(options, &sink);
+    for (unsigned i = 0; i < kCount; ++i) {
+      builder.Add(Key(i), Value(i));
+      if (i % 10000 == 0)
+        builder.Flush();
+    }
+    builder.AddMeta("foo", "bar");
+    EXPECT_TRUE(builder.Finish().ok());
+    string contents;
+    file_util::ReadFileToStringOrDie(path_, &contents);
+    return contents;
+  };
+
+  string serial = build("serial.sst");
+  options.compression_threads = 4;
+  string parallel = build("parallel.sst");
+  ASSERT_EQ(serial.size(), parallel.size());
+  EXPECT_TRUE(serial == parallel);
+
+  ReadOptions opts;
+  opts.filter_policy = policy.get();
+  OpenTable(opts);
+  EXPECT_EQ(kCount, SeekAll(0, kCount));
+  EXPECT_EQ("bar", table_->GetMeta().at("foo"));
+
+  // Abandoning a builder waits for its jobs.
+  {
+    Sink sink(Open(base::GetTestTempPath("abandon.sst")), TAKE_OWNERSHIP);
+    TableBuilder builder(options, &sink);
+    for (unsigned i = 0; i < kCount; ++i) {
+      builder.Add(Key(i), Value(i));
+    }
+    builder.Abandon();
+  }
+}
+
+TEST_F(SstableTest, Codecs) {
+  const unsigned kCount = 20000;
+  const CompressionType kTypes[] = {kNoCompression, kLZ4Compression, kZlibCompression};
+  size_t sizes[3];
+
+  for (unsigned i = 0; i < 3; ++i) {
+    Options options;
+    options.compression = kTypes[i];
+    Build(StringPrintf("codec%d.sst", kTypes[i]), kCount, options);
+
+    ReadOptions opts;
+    opts.verify_checksums = true;
+    OpenTable(opts);
+    sizes[i] = file_->Size();
+    EXPECT_EQ(kCount, SeekAll(0, kCount)) << kTypes[i];
+  }
+  EXPECT_LT(sizes[1], sizes[0] / 2);
+  EXPECT_LT(sizes[2], sizes[1]);
+
+  // High compression levels.
+  Options options;
+  options.compression = kLZ4Compression;
+  options.compression_level = 9;
+  Build("lz4hc.sst", kCount, options);
+  OpenTable(ReadOptions());
+  EXPECT_LE(file_->Size(), sizes[1]);
+  EXPECT_EQ(kCount, SeekAll(0, kCount));
+}
+
+TEST_F(SstableTest, BlockHashIndex) {
+  Options options;
+  options.block_restart_interval = 4;
+
+  for (unsigned count : {1, 100, 1000, 2000}) {
+    BlockBuilder builder(&options, true);
+    for (unsigned i = 0; i < count; ++i) {
+      builder.Add(Key(i * 2), Value(i));
+    }
+    Slice raw = builder.Finish();
+    Block block(BlockContents{raw, false, false});
+
+    // Blocks with too many restart points are written without the index.
+    EXPECT_EQ(count <= 4 * kBlockHashMaxRestarts, block.has_hash_index()) << count;
+
+    Slice value;
+    Status status;
+    for (unsigned i = 0; i < count; ++i) {
+      ASSERT_TRUE(block.Get(Key(i * 2), &value, &status)) << i;
+      EXPECT_EQ(Value(i), value);
+      ASSERT_FALSE(block.Get(Key(i * 2 + 1), &value, &status));
+    }
+    EXPECT_FALSE(block.Get("", &value, &status));
+    EXPECT_TRUE(status.ok());
+
+    // Iteration ends before the index.
+    std::unique_ptr<Iterator> it(block.NewIterator());
+    unsigned n = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      ASSERT_EQ(Key(n * 2), it->key());
+      ++n;
+    }
+    EXPECT_EQ(count, n);
+    it->SeekToLast();
+    ASSERT_TRUE(it->Valid());
+    EXPECT_EQ(Key((count - 1) * 2), it->key());
+    it->Seek(Key(count * 2));
+    EXPECT_FALSE(it->Valid());
+  }
+
+  const unsigned kCount = 20000;
+  options = Options();
+  options.data_block_hash_index = true;
+  Build("hash.sst", kCount, options);
+  OpenTable(ReadOptions());
+  EXPECT_EQ(kCount, SeekAll(0, kCount));
+  string value;
+  for (unsigned i = 0; i < kCount; ++i) {
+    auto res = table_->Get(Key(i), &value);
+    ASSERT_TRUE(res.ok() && res.obj) << i;
+    ASSERT_EQ(Value(i), value);
+    res = table_->Get(Key(i) + "a", &value);
+    ASSERT_TRUE(res.ok() && !res.obj) << i;
+  }
+}
+
+TEST_F(SstableTest, PartitionedIndex) {
+  const unsigned kCount = 50000;
+  Options options;
+  options.block_size = 1024;
+  Build("flat.sst", kCount, options);
+  OpenTable(ReadOptions());
+  std::vector<uint64_t> offsets;
+  for (unsigned i = 0; i <= kCount; i += 1000) {
+    offsets.push_back(table_->ApproximateOffsetOf(Key(i)));
+  }
+
+  std::unique_ptr<Cache> cache(NewLRUCache(1 << 20));
+  options.index_partition_size = 512;
+  for (unsigned threads : {0, 4}) {
+    options.compression_threads = threads;
+    Build("partitioned.sst", kCount, options);
+
+    ReadOptions opts;
+    opts.block_cache = cache.get();
+    OpenTable(opts);
+    EXPECT_EQ(kCount, SeekAll(0, kCount));
+    EXPECT_EQ(0, SeekAll(kCount, kCount + 10));
+
+    std::unique_ptr<Iterator> it(table_->NewIterator());
+    unsigned n = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      ASSERT_EQ(Key(n), it->key());
+      ++n;
+    }
+    EXPECT_EQ(kCount, n);
+    it->SeekToLast();
+    ASSERT_TRUE(it->Valid());
+    EXPECT_EQ(Key(kCount - 1), it->key());
+
+    string value;
+    std::vector<string> keys;
+    for (unsigned i = 0; i < kCount; i += 7) {
+      auto res = table_->Get(Key(i), &value);
+      ASSERT_TRUE(res.ok() && res.obj) << i;
+      ASSERT_EQ(Value(i), value);
+      keys.push_back(Key(i) + "a");
+    }
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::vector<string> values(keys.size());
+    std::unique_ptr<bool[]> found(new bool[keys.size()]);
+    ASSERT_TRUE(table_->MultiGet(slices.data(), slices.size(), values.data(), found.get()).ok());
+    EXPECT_EQ(found.get() + keys.size(), std::find(found.get(), found.get() + keys.size(), true));
+
+    // Offsets move by the size of the partitions that precede the top-level index only.
+    for (unsigned i = 0; i <= kCount; i += 1000) {
+      uint64_t offset = table_->ApproximateOffsetOf(Key(i));
+      if (i < kCount) {
+        EXPECT_EQ(offsets[i / 1000], offset) << i;
+      } else {
+        EXPECT_GE(offset, offsets.back());
+      }
+    }
+  }
+}
+
+TEST_F(SstableTest, MmapBlocks) {
+  // Larger than the mmap window of the file, so that reads move it around.
+  const unsigned kCount = 300000;
+  Build("mmap.sst", kCount);
+  OpenTable(ReadOptions(), true);
+  ASSERT_GT(file_->Size(), 16 << 20);
+
+  std::unique_ptr<Iterator> it(table_->NewIterator());
+  it->SeekToFirst();
+  ASSERT_TRUE(it->Valid());
+
+  string value;
+  auto res = table_->Get(Key(kCount - 1), &value);
+  ASSERT_TRUE(res.ok() && res.obj);
+  EXPECT_EQ(Value(kCount - 1), value);
+
+  // The first block still points into its window.
+  EXPECT_EQ(Key(0), it->key());
+  EXPECT_EQ(Value(0), it->value());
+  it->Next();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(1), it->key());
+
+  for (unsigned i = 0; i < kCount; i += 97) {
+    res = table_->Get(Key(i), &value);
+    ASSERT_TRUE(res.ok() && res.obj) << i;
+    ASSERT_EQ(Value(i), value);
+  }
+  EXPECT_EQ(1000, SeekAll(kCount - 1000, kCount + 10));
+
+  // Blocks outlive the file.
+  it->Seek(Key(kCount / 2));
+  ASSERT_TRUE(file_->Close().ok());
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Value(kCount / 2), it->value());
+  it.reset();
+  table_.reset();
+  file_.reset();
+}
+
+TEST_F(SstableTest, MergingIterator) {
+  // Child c has the keys that are multiples of c + 2, with values "c".
+  const unsigned kChildren = 3, kMax = 60;
+  Options options;
+  std::vector<std::unique_ptr<Block>> blocks;
+  std::vector<string> raw(kChildren);
+  for (unsigned c = 0; c < kChildren; ++c) {
+    BlockBuilder builder(&options);
+    for (unsigned i = 0; i < kMax; i += c + 2) {
+      builder.Add(Key(i), std::to_string(c));
+    }
+    raw[c] = builder.Finish().as_string();
+    blocks.emplace_back(new Block(BlockContents{raw[c], false, false}));
+  }
+  auto merge = [&](const MergingOptions& opts) {
+    std::vector<Iterator*> children;
+    for (auto& b : blocks)
+      children.push_back(b->NewIterator());
+    return std::unique_ptr<Iterator>(NewMergingIterator(children.data(), kChildren, opts));
+  };
+  auto expected = [](unsigned i, MergingOptions::Duplicates duplicates) {
+    string res;
+    for (unsigned c = 0; c < kChildren; ++c) {
+      if (i % (c + 2) == 0)
+        res += std::to_string(c);
+    }
+    if (duplicates == MergingOptions::FIRST_WINS)
+      return res.substr(0, 1);
+    if (duplicates == MergingOptions::LAST_WINS)
+      return res.substr(res.size() - 1);
+    return res;
+  };
+  std::vector<unsigned> keys;
+  for (unsigned i = 0; i < kMax; ++i) {
+    if (i % 2 == 0 || i % 3 == 0)
+      keys.push_back(i);
+  }
+
+  MergingOptions opts;
+  std::unique_ptr<Iterator> it = merge(opts);
+  size_t n = 0;
+  for (it->SeekToFirst(); it->Valid(); it->Next(), ++n) {
+    ASSERT_LT(n, keys.size());
+    ASSERT_EQ(Key(keys[n]), it->key());
+    EXPECT_EQ(expected(keys[n], opts.duplicates), it->value()) << keys[n];
+  }
+  EXPECT_EQ(keys.size(), n);
+
+  opts.duplicates = MergingOptions::LAST_WINS;
+  it = merge(opts);
+  n = keys.size();
+  for (it->SeekToLast(); it->Valid(); it->Prev()) {
+    ASSERT_GT(n, 0);
+    --n;
+    ASSERT_EQ(Key(keys[n]), it->key());
+    EXPECT_EQ(expected(keys[n], opts.duplicates), it->value()) << keys[n];
+  }
+  EXPECT_EQ(0, n);
+
+  opts.duplicates = MergingOptions::MERGE;
+  opts.merge = [](const Slice& key, const Slice* values, unsigned count, string* result) {
+    for (unsigned i = 0; i < count; ++i)
+      result->append(values[i].data(), values[i].size());
+  };
+  it = merge(opts);
+
+  // Changes direction on a key that is in all the children.
+  it->Seek(Key(23));
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(24), it->key());
+  EXPECT_EQ("012", it->value());
+  it->Prev();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(22), it->key());
+  EXPECT_EQ("0", it->value());
+  it->Next();
+  it->Next();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(26), it->key());
+  it->Prev();
+  it->Prev();
+  it->Next();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(24), it->key());
+  EXPECT_EQ("012", it->value());
+  it->Seek(Key(kMax));
+  EXPECT_FALSE(it->Valid());
+  EXPECT_TRUE(it->status().ok());
+}
+
+TEST_F(SstableTest, ReadAhead) {
+  const unsigned kCount = 50000;
+  Options options;
+  options.block_size = 1024;
+  Build("readahead.sst", kCount, options);
+  std::unique_ptr<Cache> cache(NewLRUCache(1 << 20));
+  ReadOptions opts;
+  opts.block_cache = cache.get();
+  OpenTable(opts);
+
+  util::FuncTaskPool pool("readahead", 8, 2);
+  pool.Launch();
+  IteratorOptions iter_opts;
+  iter_opts.readahead_blocks = 8;
+  iter_opts.readahead_pool = &pool;
+  std::unique_ptr<Iterator> it(table_->NewIterator(iter_opts));
+  unsigned n = 0;
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    ASSERT_EQ(Key(n), it->key());
+    ASSERT_EQ(Value(n), it->value());
+    ++n;
+  }
+  EXPECT_EQ(kCount, n);
+  EXPECT_TRUE(it->status().ok());
+
+  // Seeks and changes of direction while blocks are prefetched.
+  for (unsigned i = 1000; i < kCount; i += 7919) {
+    it->Seek(Key(i));
+    for (unsigned j = 0; j < 500 && it->Valid(); ++j)
+      it->Next();
+    ASSERT_TRUE(it->Valid());
+    EXPECT_EQ(Key(i + 500), it->key());
+    for (unsigned j = 0; j < 700; ++j)
+      it->Prev();
+    ASSERT_TRUE(it->Valid());
+    EXPECT_EQ(Key(i - 200), it->key());
+    it->Next();
+    ASSERT_TRUE(it->Valid());
+    EXPECT_EQ(Key(i - 199), it->key());
+  }
+  it->SeekToLast();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(kCount - 1), it->key());
+
+  // Destroyed in the middle of a scan.
+  it->Seek(Key(10));
+  it->Next();
+}
+
+TEST_F(SstableTest, PlanSplits) {
+  const unsigned kCount = 50000;
+  Options options;
+  options.block_size = 1024;
+  Build("splits.sst", kCount, options);
+  OpenTable(ReadOptions());
+
+  const unsigned kSplits = 8;
+  std::vector<KeyRange> ranges = table_->PlanSplits(kSplits);
+  ASSERT_EQ(kSplits, ranges.size());
+  EXPECT_EQ("", ranges.front().start);
+  EXPECT_EQ("", ranges.back().limit);
+  for (unsigned i = 0; i + 1 < kSplits; ++i) {
+    EXPECT_EQ(ranges[i].limit, ranges[i + 1].start);
+  }
+
+  // Every range is scanned by its own thread, half of them share a read-ahead pool.
+  util::FuncTaskPool pool("readahead", 8, 2);
+  pool.Launch();
+  std::vector<unsigned> counts(kSplits), first(kSplits);
+  std::vector<bool> ordered(kSplits);
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < kSplits; ++i) {
+    threads.emplace_back([&, i] {
+      IteratorOptions opts;
+      opts.lower_bound = ranges[i].start;
+      opts.upper_bound = ranges[i].limit;
+      opts.readahead_blocks = 4;
+      opts.readahead_pool = i % 2 ? &pool : nullptr;
+      std::unique_ptr<Iterator> it(table_->NewIterator(opts));
+      it->SeekToFirst();
+      first[i] = it->Valid() ? std::stoul(it->key().as_string().substr(3)) : kCount;
+      ordered[i] = true;
+      for (; it->Valid(); it->Next()) {
+        ordered[i] = ordered[i] && it->key() == Key(first[i] + counts[i]);
+        ++counts[i];
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  unsigned total = 0;
+  for (unsigned i = 0; i < kSplits; ++i) {
+    EXPECT_EQ(total, first[i]) << i;
+    EXPECT_TRUE(ordered[i]) << i;
+    EXPECT_NEAR(kCount / kSplits, counts[i], kCount / kSplits / 5) << i;
+    total += counts[i];
+  }
+  EXPECT_EQ(kCount, total);
+
+  EXPECT_EQ(1, table_->PlanSplits(1).size());
+  Build("small.sst", 10);
+  OpenTable(ReadOptions());
+  ranges = table_->PlanSplits(4);
+  ASSERT_EQ(1, ranges.size());
+  EXPECT_EQ("", ranges[0].start);
+  EXPECT_EQ("", ranges[0].limit);
+}
+
+TEST_F(SstableTest, IteratorBounds) {
+  const unsigned kCount = 10000;
+  Options options;
+  options.block_size = 1024;
+  Build("bounds.sst", kCount, options);
+  OpenTable(ReadOptions());
+
+  util::FuncTaskPool pool("readahead", 4, 1);
+  pool.Launch();
+  IteratorOptions opts;
+  opts.lower_bound = Key(100);
+  opts.upper_bound = Key(2000);
+  opts.readahead_blocks = 4;
+  opts.readahead_pool = &pool;
+  std::unique_ptr<Iterator> it(table_->NewIterator(opts));
+  unsigned n = 0;
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    ASSERT_EQ(Key(100 + n), it->key());
+    ++n;
+  }
+  EXPECT_EQ(1900, n);
+  it->SeekToLast();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(1999), it->key());
+  it->Next();
+  EXPECT_FALSE(it->Valid());
+  it->Seek(Key(50));
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(Key(100), it->key());
+  it->Prev();
+  EXPECT_FALSE(it->Valid());
+  it->Seek(Key(2000));
+  EXPECT_FALSE(it->Valid());
+  EXPECT_TRUE(it->status().ok());
+}
+
+TEST_F(SstableTest, Properties) {
+  const unsigned kCount = 10000;
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  Options options;
+  options.filter_policy = policy.get();
+  options.block_size = 1024;
+  options.compression = kLZ4Compression;
+  Build("props.sst", kCount, options);
+  OpenTable(ReadOptions());
+
+  const TableProperties* props = table_->GetProperties();
+  ASSERT_TRUE(props != nullptr);
+  EXPECT_EQ(kCount, props->num_entries);
+  EXPECT_EQ(props->num_data_blocks, props->num_index_entries);
+  EXPECT_GT(props->num_data_blocks, 10);
+  EXPECT_EQ(0, props->num_compression_aborted);
+  EXPECT_EQ(kCount * Key(0).size(), props->raw_key_size);
+  EXPECT_EQ(Key(0), props->smallest_key);
+  EXPECT_EQ(Key(kCount - 1), props->largest_key);
+  EXPECT_EQ(Value(0).size(), props->smallest_value_size);
+  EXPECT_EQ(Value(kCount - 1).size(), props->largest_value_size);
+  EXPECT_LT(props->data_size, props->raw_data_size);
+  EXPECT_GT(props->filter_size, 0);
+  EXPECT_LT(props->data_size + props->index_size + props->filter_size, file_->Size());
+
+  uint64 value_size = 0, blocks = 0;
+  for (unsigned i = 0; i < kCount; ++i) {
+    value_size += Value(i).size();
+  }
+  EXPECT_EQ(value_size, props->raw_value_size);
+  for (uint64 count : props->block_size_histogram) {
+    blocks += count;
+  }
+  EXPECT_EQ(props->num_data_blocks, blocks);
+
+  // Random values do not compress.
+  path_ = base::GetTestTempPath("props_random.sst");
+  {
+    Sink sink(Open(path_), TAKE_OWNERSHIP);
+    TableBuilder builder(options, &sink);
+    MTRandom rnd(10);
+    string value(100, '\0');
+    for (unsigned i = 0; i < kCount; ++i) {
+      for (char& c : value)
+        c = rnd.Rand32();
+      builder.Add(Key(i), value);
+    }
+    ASSERT_TRUE(builder.Finish().ok());
+  }
+  OpenTable(ReadOptions());
+  props = table_->GetProperties();
+  ASSERT_TRUE(props != nullptr);
+  EXPECT_EQ(props->num_data_blocks, props->num_compression_aborted);
+  EXPECT_EQ(props->raw_data_size, props->data_size);
+
+  TableProperties decoded;
+  string encoded;
+  props->EncodeTo(&encoded);
+  ASSERT_TRUE(decoded.DecodeFrom(encoded).ok());
+  EXPECT_EQ(props->ToString(), decoded.ToString());
+}
+
+TEST_F(SstableTest, PrefixIterator) {
+  const unsigned kUsers = 300;
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  std::unique_ptr<const PrefixExtractor> extractor(NewDelimitedPrefixExtractor('|'));
+  auto user = [](unsigned u) { return StringPrintf("user%05u|", u); };
+
+  // Even users have u % 7 + 1 events, odd users have none.
+  for (bool whole_key : {true, false}) {
+    Options options;
+    options.block_size = 512;
+    options.filter_policy = policy.get();
+    options.prefix_extractor = extractor.get();
+    options.whole_key_filtering = whole_key;
+    path_ = base::GetTestTempPath(StringPrintf("prefix%d.sst", whole_key));
+    {
+      Sink sink(Open(path_), TAKE_OWNERSHIP);
+      TableBuilder builder(options, &sink);
+      for (unsigned u = 0; u < kUsers; u += 2) {
+        for (unsigned ts = 0; ts <= u % 7; ++ts) {
+          builder.Add(user(u) + StringPrintf("ts%04u", ts), Value(ts));
+        }
+      }
+      ASSERT_TRUE(builder.Finish().ok());
+    }
+    ReadOptions read_options;
+    read_options.filter_policy = policy.get();
+    read_options.prefix_extractor = extractor.get();
+    OpenTable(read_options);
+
+    for (unsigned u = 0; u < kUsers; ++u) {
+      std::unique_ptr<Iterator> it(table_->NewPrefixIterator(user(u)));
+      unsigned n = 0;
+      for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        ASSERT_EQ(user(u) + StringPrintf("ts%04u", n), it->key());
+        ++n;
+      }
+      ASSERT_TRUE(it->status().ok());
+      ASSERT_EQ(u % 2 ? 0 : u % 7 + 1, n) << u;
+    }
+
+    // Prefixes that are not extracted prefixes fall back to a bounded scan.
+    std::unique_ptr<Iterator> it(table_->NewPrefixIterator("user0001"));
+    unsigned n = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next())
+      ++n;
+    EXPECT_EQ(5 + 3 + 1 + 6 + 4, n);  // Users 10, 12, 14, 16 and 18.
+
+    string result;
+    auto res = table_->Get(user(4) + "ts0004", &result);
+    ASSERT_TRUE(res.ok() && res.obj);
+    EXPECT_EQ(Value(4), result);
+    EXPECT_FALSE(table_->Get(user(4) + "ts0005", &result).obj);
+    EXPECT_FALSE(table_->Get(user(5) + "ts0000", &result).obj);
+  }
+}
+
+TEST_F(SstableTest, ConcurrentGet) {
+  const unsigned kCount = 20000;
+  Options options;
+  options.block_size = 1024;
+  options.index_partition_size = 512;
+  options.compression = kLZ4Compression;
+  Build("concurrent.sst", kCount, options);
+
+  // Blocks that are not cached are read into per-thread buffers.
+  std::unique_ptr<Cache> cache(NewLRUCache(64 << 10));
+  for (Cache* block_cache : {static_cast<Cache*>(nullptr), cache.get()}) {
+    for (bool use_mmap : {false, true}) {
+      ReadOptions opts;
+      opts.block_cache = block_cache;
+      OpenTable(opts, use_mmap);
+      std::vector<unsigned> errors(4);
+      std::vector<std::thread> threads;
+      for (unsigned t = 0; t < errors.size(); ++t) {
+        threads.emplace_back([this, t, &errors] {
+          string value;
+          for (unsigned i = t; i < kCount + 100; i += 3) {
+            auto res = table_->Get(Key(i), &value);
+            if (!res.ok() || res.obj != (i < kCount) || (res.obj && value != Value(i)))
+              ++errors[t];
+          }
+        });
+      }
+      for (auto& t : threads)
+        t.join();
+      EXPECT_EQ(std::vector<unsigned>(errors.size()), errors);
+    }
+  }
+}
+
+// 8 byte big-endian ids with gaps, so that lookups between the keys can be tested.
+static string IdKey(uint64 id) {
+  char buf[8];
+  BigEndian::Store64(buf, id * 3);
+  return string(buf, 8);
+}
+
+TEST_F(SstableTest, FixedWidthKeys) {
+  const unsigned kCount = 20000;
+  for (unsigned value_size : {0, 8}) {
+    Options options;
+    options.block_size = 1024;
+    options.fixed_key_size = 8;
+    options.fixed_value_size = value_size;
+    options.index_partition_size = value_size ? 256 : 0;
+    auto value = [value_size](unsigned i) {
+      return value_size ? StringPrintf("v%07u", i) : StringPrintf("value%u", i);
+    };
+
+    path_ = base::GetTestTempPath(StringPrintf("fixed%u.sst", value_size));
+    {
+      Sink sink(Open(path_), TAKE_OWNERSHIP);
+      TableBuilder builder(options, &sink);
+      for (unsigned i = 0; i < kCount; ++i) {
+        builder.Add(IdKey(i), value(i));
+      }
+      ASSERT_TRUE(builder.Finish().ok());
+    }
+    OpenTable(ReadOptions());
+
+    string result;
+    for (unsigned i = 0; i < kCount; ++i) {
+      auto res = table_->Get(IdKey(i), &result);
+      ASSERT_TRUE(res.ok() && res.obj) << i;
+      ASSERT_EQ(value(i), result);
+    }
+    char buf[8];
+    BigEndian::Store64(buf, 3 * 500 + 1);
+    EXPECT_FALSE(table_->Get(Slice(buf, 8), &result).obj);
+    EXPECT_FALSE(table_->Get(IdKey(kCount), &result).obj);
+    EXPECT_FALSE(table_->Get("abc", &result).obj);
+
+    std::unique_ptr<Iterator> it(table_->NewIterator());
+    unsigned n = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      ASSERT_EQ(IdKey(n), it->key());
+      ASSERT_EQ(value(n), it->value());
+      ++n;
+    }
+    EXPECT_EQ(kCount, n);
+    for (it->SeekToLast(); it->Valid(); it->Prev()) {
+      --n;
+      ASSERT_EQ(IdKey(n), it->key());
+    }
+    EXPECT_EQ(0, n);
+
+    // Seek to a key between the ids and to a key of another size.
+    it->Seek(Slice(buf, 8));
+    ASSERT_TRUE(it->Valid());
+    EXPECT_EQ(IdKey(501), it->key());
+    it->Seek(Slice(buf, 3));
+    ASSERT_TRUE(it->Valid());
+    EXPECT_EQ(IdKey(0), it->key());
+    EXPECT_TRUE(it->status().ok());
+  }
+
+  // Keys of other sizes are rejected.
+  Options options;
+  options.fixed_key_size = 8;
+  Sink sink(Open(base::GetTestTempPath("fixed_bad.sst")), TAKE_OWNERSHIP);
+  TableBuilder builder(options, &sink);
+  builder.Add(IdKey(1), "a");
+  builder.Add("abc", "b");
+  EXPECT_EQ(base::StatusCode::INVALID_ARGUMENT, builder.Finish().code());
+}
+
+static void BM_BlockGet(benchmark::State& state) {
+  Options options;
+  BlockBuilder builder(&options, state.range_x());
+  const unsigned kCount = 300;
+  for (unsigned i = 0; i < kCount; ++i) {
+    builder.Add(StringPrintf("key%07u", i * 2), "value");
+  }
+  Block block(BlockContents{builder.Finish(), false, false});
+  std::vector<string> keys;
+  for (unsigned i = 0; i < 2 * kCount; ++i) {
+    keys.push_back(StringPrintf("key%07u", i));
+  }
+
+  Slice value;
+  Status status;
+  unsigned i = 0;
+  while (state.KeepRunning()) {
+    block.Get(keys[i], &value, &status);
+    i = (i + 7) % keys.size();
+  }
+}
+BENCHMARK(BM_BlockGet)->Arg(0)->Arg(1);
+
+static void BM_TableBuilder(benchmark::State& state) {
+  Options options;
+  options.compression_threads = state.range_x();
+  string path = base::GetTestTempPath("bench_build.sst");
+  string value;
+  uint64 bytes = 0;
+
+  while (state.KeepRunning()) {
+    Sink sink(Open(path), TAKE_OWNERSHIP);
+    TableBuilder builder(options, &sink);
+    for (unsigned i = 0; i < 200000; ++i) {
+      value = StringPrintf("value%u", i) + string(100, 'a' + i % 3);
+      builder.Add(StringPrintf("key%07u", i), value);
+      bytes += 10 + value.size();
+    }
+    CHECK_STATUS(builder.Finish());
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_TableBuilder)->Arg(0)->Arg(4);
+
+static void BM_MultiGet(benchmark::State& state) {
+  const unsigned kCount = 200000;
+  static string* path = nullptr;
+  if (path == nullptr) {
+    path = new string(base::GetTestTempPath("bench.sst"));
+    Sink sink(Open(*path), TAKE_OWNERSHIP);
+    TableBuilder builder(Options(), &sink);
+    for (unsigned i = 0; i < kCount; ++i) {
+      builder.Add(StringPrintf("key%07u", i), StringPrintf("value%u", i) + string(50, 'v'));
+    }
+    CHECK_STATUS(builder.Finish());
+  }
+  ReadonlyFile::Options file_opts;
+  file_opts.use_mmap = false;
+  auto res = ReadonlyFile::Open(*path, file_opts);
+  CHECK_STATUS(res.status);
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  std::unique_ptr<Table> table(CHECK_NOTNULL(Table::Open(ReadOptions(), file.get()).obj));
+
+  const unsigned batch = state.range_x();
+  MTRandom rnd(10);
+  std::vector<string> keys(batch);
+  std::vector<Slice> slices(batch);
+  std::vector<string> values(batch);
+  std::unique_ptr<bool[]> found(new bool[batch]);
+  uint64 items = 0;
+  while (state.KeepRunning()) {
+    for (unsigned i = 0; i < batch; ++i) {
+      keys[i] = StringPrintf("key%07u", rnd.Rand32() % kCount);
+      slices[i] = keys[i];
+    }
+    if (batch == 1) {
+      CHECK(table->Get(slices[0], &values[0]).obj);
+    } else {
+      CHECK_STATUS(table->MultiGet(slices.data(), batch, values.data(), found.get()));
+    }
+    items += batch;
+  }
+  state.SetItemsProcessed(items);
+  table.reset();
+  CHECK(file->Close().ok());
+}
+BENCHMARK(BM_MultiGet)->Arg(1)->Arg(16)->Arg(256)->Arg(4096);
+
+// Point lookups from several threads sharing a table, with a block cache (range_x = 1)
+// or without one (0).
+static void BM_ConcurrentGet(benchmark::State& state) {
+  const unsigned kCount = 200000;
+  static Cache* cache = NewLRUCache(64 << 20);
+  static Table* table[2] = {nullptr, nullptr};
+  static std::once_flag once;
+  std::call_once(once, [] {
+    string path = base::GetTestTempPath("bench_concurrent.sst");
+    {
+      Sink sink(Open(path), TAKE_OWNERSHIP);
+      TableBuilder builder(Options(), &sink);
+      for (unsigned i = 0; i < kCount; ++i) {
+        builder.Add(StringPrintf("key%07u", i), StringPrintf("value%u", i) + string(50, 'v'));
+      }
+      CHECK_STATUS(builder.Finish());
+    }
+    ReadonlyFile::Options file_opts;
+    file_opts.use_mmap = false;
+    ReadonlyFile* file = CHECK_NOTNULL(ReadonlyFile::Open(path, file_opts).obj);
+    ReadOptions opts;
+    table[0] = CHECK_NOTNULL(Table::Open(opts, file).obj);
+    opts.block_cache = cache;
+    table[1] = CHECK_NOTNULL(Table::Open(opts, file).obj);
+  });
+
+  const Table* t = table[state.range_x()];
+  std::vector<string> keys(4096);
+  MTRandom rnd(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  for (auto& k : keys) {
+    k = StringPrintf("key%07u", rnd.Rand32() % kCount);
+  }
+  string value;
+  unsigned i = 0;
+  while (state.KeepRunning()) {
+    CHECK(t->Get(keys[i++ % keys.size()], &value).obj);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ConcurrentGet)->Arg(0)->Arg(1)->ThreadRange(1, 32);
+
+// Point lookups per block codec. The label shows the file size.
+static void BM_CodecGet(benchmark::State& state) {
+  const unsigned kCount = 200000;
+  const CompressionType type = CompressionType(state.range_x());
+  string path = base::GetTestTempPath(StringPrintf("bench_codec%d.sst", type));
+  {
+    Options options;
+    options.compression = type;
+    Sink sink(Open(path), TAKE_OWNERSHIP);
+    TableBuilder builder(options, &sink);
+    for (unsigned i = 0; i < kCount; ++i) {
+      builder.Add(StringPrintf("key%07u", i),
+                  StringPrintf("value%u,%u,%u", i, i % 100, i % 7) + string(40, 'a' + i % 3));
+    }
+    CHECK_STATUS(builder.Finish());
+  }
+  ReadonlyFile::Options file_opts;
+  file_opts.use_mmap = false;
+  auto res = ReadonlyFile::Open(path, file_opts);
+  CHECK_STATUS(res.status);
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  std::unique_ptr<Table> table(CHECK_NOTNULL(Table::Open(ReadOptions(), file.get()).obj));
+
+  MTRandom rnd(10);
+  string value;
+  while (state.KeepRunning()) {
+    CHECK(table->Get(StringPrintf("key%07u", rnd.Rand32() % kCount), &value).obj);
+  }
+  state.SetLabel(StringPrintf("%lu bytes", file->Size()));
+  table.reset();
+  CHECK(file->Close().ok());
+}
+BENCHMARK(BM_CodecGet)->Arg(kNoCompression)->Arg(kSnappyCompression)->Arg(kLZ4Compression)
+    ->Arg(kZlibCompression);
+
+// Full scans of a zlib table with the given read-ahead window.
+static void BM_Scan(benchmark::State& state) {
+  const unsigned kCount = 200000;
+  string path = base::GetTestTempPath("bench_scan.sst");
+  {
+    Options options;
+    options.compression = kZlibCompression;
+    Sink sink(Open(path), TAKE_OWNERSHIP);
+    TableBuilder builder(options, &sink);
+    for (unsigned i = 0; i < kCount; ++i) {
+      builder.Add(StringPrintf("key%07u", i),
+                  StringPrintf("value%u,%u,%u", i, i % 100, i % 7) + string(40, 'a' + i % 3));
+    }
+    CHECK_STATUS(builder.Finish());
+  }
+  ReadonlyFile::Options file_opts;
+  file_opts.use_mmap = false;
+  auto res = ReadonlyFile::Open(path, file_opts);
+  CHECK_STATUS(res.status);
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  std::unique_ptr<Table> table(CHECK_NOTNULL(Table::Open(ReadOptions(), file.get()).obj));
+
+  util::FuncTaskPool pool("readahead", 16, 4);
+  pool.Launch();
+  IteratorOptions iter_opts;
+  iter_opts.readahead_blocks = state.range_x();
+  iter_opts.readahead_pool = &pool;
+  uint64 items = 0;
+  while (state.KeepRunning()) {
+    std::unique_ptr<Iterator> it(table->NewIterator(iter_opts));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      ++items;
+    }
+  }
+  state.SetItemsProcessed(items);
+  table.reset();
+  CHECK(file->Close().ok());
+}
+BENCHMARK(BM_Scan)->Arg(0)->Arg(4)->Arg(16);
+
+// Point lookups in cached blocks of 8 byte big-endian ids, with the prefix compressed (0) or
+// the fixed width (1) layout. The label shows the index size.
+static void BM_FixedKeyGet(benchmark::State& state) {
+  const unsigned kCount = 200000;
+  Options options;
+  if (state.range_x()) {
+    options.fixed_key_size = 8;
+    options.fixed_value_size = 8;
+  }
+  string path = base::GetTestTempPath("bench_fixed" + std::to_string(state.range_x()) + ".sst");
+  {
+    Sink sink(Open(path), TAKE_OWNERSHIP);
+    TableBuilder builder(options, &sink);
+    for (unsigned i = 0; i < kCount; ++i) {
+      builder.Add(IdKey(i), StringPrintf("v%07u", i));
+    }
+    CHECK_STATUS(builder.Finish());
+  }
+  ReadonlyFile::Options file_opts;
+  file_opts.use_mmap = false;
+  auto res = ReadonlyFile::Open(path, file_opts);
+  CHECK_STATUS(res.status);
+  std::unique_ptr<ReadonlyFile> file(res.obj);
+  std::unique_ptr<Cache> cache(NewLRUCache(64 << 20));
+  ReadOptions read_options;
+  read_options.block_cache = cache.get();
+  std::unique_ptr<Table> table(CHECK_NOTNULL(Table::Open(read_options, file.get()).obj));
+
+  std::vector<string> keys(4096);
+  MTRandom rnd(10);
+  for (auto& k : keys) {
+    k = IdKey(rnd.Rand32() % kCount);
+  }
+  string value;
+  unsigned i = 0;
+  while (state.KeepRunning()) {
+    CHECK(table->Get(keys[i++ % keys.size()], &value).obj);
+  }
+  state.SetLabel(StringPrintf("index %lu bytes", table->GetProperties()->index_size));
+  table.reset();
+  CHECK(file->Close().ok());
+}
+BENCHMARK(BM_FixedKeyGet)->Arg(0)->Arg(1);
+
+}  // namespace sstable
+}  // namespace file
@@ -0,0 +1,244 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+// Merges sstables into a single table.
+// Usage: sstmerge --output=<path> <table1> <table2> ...
+//
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "base/init.h"
+#include "base/logging.h"
+#include "file/file.h"
+#include "file/filesource.h"
+#include "file/sstable/filter_policy.h"
+#include "file/sstable/merging_iterator.h"
+#include "file/sstable/sstable.h"
+#include "file/sstable/sstable_builder.h"
+#include "util/coding/varint.h"
+#include "util/sp_task_pool.h"
+
+DEFINE_string(output, "", "Path of the merged table.");
+DEFINE_string(duplicates, "first", "Value of a key found in several tables: the one of the "
+                                   "'first' or of the 'last' table that has it.");
+DEFINE_string(compression, "snappy", "none, snappy, lz4 or zlib.");
+DEFINE_int32(block_size, 16384, "Data block size of the merged table.");
+DEFINE_int32(bloom_bits, 0, "If positive, the merged table has a bloom filter with that many "
+                            "bits per key.");
+DEFINE_int32(compression_threads, 2, "Threads that compress the data blocks of the merged table.");
+DEFINE_int32(readahead_threads, 4, "Threads that read the input tables ahead of the merge.");
+DEFINE_int32(readahead_kb, 1024, "Size of a read-ahead batch per input table.");
+
+using namespace file;
+using namespace file::sstable;
+using strings::Slice;
+using std::string;
+
+namespace {
+
+// Copies batches of entries of a table on the pool, one batch ahead of the consumer, so that
+// reading and decompressing the inputs runs in parallel with the merge.
+// Supports only forward iteration that starts with SeekToFirst().
+class ReadAheadIterator : public Iterator {
+ public:
+  ReadAheadIterator(Iterator* iter, size_t batch_size, util::FuncTaskPool* pool)
+      : iter_(iter), batch_size_(batch_size), pool_(pool) {
+  }
+
+  ~ReadAheadIterator() {
+    Wait();
+  }
+
+  bool Valid() const override { return valid_; }
+
+  void SeekToFirst() override {
+    Wait();
+    iter_->SeekToFirst();
+    current_.clear();
+    next_.clear();
+    pos_ = 0;
+    eof_ = false;
+    LoadNext();
+    Advance();
+  }
+
+  void Next() override {
+    DCHECK(valid_);
+    Advance();
+  }
+
+  void SeekToLast() override { LOG(FATAL) << "Not supported"; }
+  void Seek(const Slice& target) override { LOG(FATAL) << "Not supported"; }
+  void Prev() override { LOG(FATAL) << "Not supported"; }
+
+  Slice key() const override { return key_; }
+  Slice value() const override { return value_; }
+
+  base::Status status() const override {
+    std::lock_guard<std::mutex> lock(mu_);
+    return status_;
+  }
+
+ private:
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mu_);
+    loaded_.wait(lock, [this] { return !loading_; });
+  }
+
+  void Advance() {
+    if (pos_ == current_.size()) {
+      Wait();
+      current_.swap(next_);
+      next_.clear();
+      pos_ = 0;
+      if (current_.empty()) {
+        valid_ = false;
+        return;
+      }
+      LoadNext();
+    }
+
+    // Entry: varint key size, varint value size, key, value.
+    const uint8* ptr = reinterpret_cast<const uint8*>(current_.data()) + pos_;
+    uint32 key_size, value_size;
+    ptr = Varint::Parse32(ptr, &key_size);
+    ptr = Varint::Parse32(ptr, &value_size);
+    key_ = Slice(ptr, key_size);
+    value_ = Slice(ptr + key_size, value_size);
+    pos_ = reinterpret_cast<const char*>(ptr) + key_size + value_size - current_.data();
+    valid_ = true;
+  }
+
+  void LoadNext() {
+    if (eof_)
+      return;
+    loading_ = true;
+    pool_->RunTask([this] {
+      uint8 buf[Varint::kMax32 * 2];
+      while (next_.size() < batch_size_ && iter_->Valid()) {
+        Slice key = iter_->key(), value = iter_->value();
+        uint8* end = Varint::Encode32(Varint::Encode32(buf, key.size()), value.size());
+        next_.append(reinterpret_cast<char*>(buf), end - buf);
+        next_.append(key.data(), key.size());
+        next_.append(value.data(), value.size());
+        iter_->Next();
+      }
+      eof_ = !iter_->Valid();
+
+      std::lock_guard<std::mutex> lock(mu_);
+      if (eof_)
+        status_ = iter_->status();
+      loading_ = false;
+      loaded_.notify_all();
+    });
+  }
+
+  std::unique_ptr<Iterator> iter_;
+  const size_t batch_size_;
+  util::FuncTaskPool* pool_;
+
+  string current_, next_;
+  size_t pos_ = 0;
+  Slice key_, value_;
+  bool valid_ = false;
+  bool eof_ = false;
+
+  mutable std::mutex mu_;
+  std::condition_variable loaded_;
+  bool loading_ = false;
+  base::Status status_;
+};
+
+CompressionType ParseCompression(const string& name) {
+  if (name == "none")
+    return kNoCompression;
+  if (name == "snappy")
+    return kSnappyCompression;
+  if (name == "lz4")
+    return kLZ4Compression;
+  if (name == "zlib")
+    return kZlibCompression;
+  LOG(FATAL) << "Unknown compression " << name;
+  return kNoCompression;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  MainInitGuard guard(&argc, &argv);
+
+  CHECK(!FLAGS_output.empty()) << "--output is required";
+  CHECK_GT(argc, 1) << "Usage: sstmerge --output=<path> <table1> <table2> ...";
+  CHECK_GT(FLAGS_readahead_threads, 0);
+
+  MergingOptions merging_options;
+  if (FLAGS_duplicates == "last") {
+    merging_options.duplicates = MergingOptions::LAST_WINS;
+  } else {
+    CHECK_EQ("first", FLAGS_duplicates) << "Unknown --duplicates value";
+  }
+
+  util::FuncTaskPool pool("readahead", 2, FLAGS_readahead_threads);
+  pool.Launch();
+
+  ReadonlyFile::Options file_opts;
+  file_opts.use_mmap = false;
+  file_opts.sequential = true;
+
+  std::vector<std::unique_ptr<ReadonlyFile>> files;
+  std::vector<std::unique_ptr<Table>> tables;
+  std::vector<Iterator*> children;
+  std::map<string, string> meta;
+  for (int i = 1; i < argc; ++i) {
+    auto res = ReadonlyFile::Open(argv[i], file_opts);
+    CHECK(res.ok()) << "Could not open " << argv[i] << ": " << res.status;
+    files.emplace_back(res.obj);
+
+    auto table_res = Table::Open(ReadOptions(), res.obj);
+    CHECK(table_res.ok()) << "Could not open table " << argv[i] << ": " << table_res.status;
+    tables.emplace_back(table_res.obj);
+
+    // The meta values of the earlier tables win.
+    meta.insert(table_res.obj->GetMeta().begin(), table_res.obj->GetMeta().end());
+    children.push_back(new ReadAheadIterator(table_res.obj->NewIterator(),
+                                             size_t(FLAGS_readahead_kb) << 10, &pool));
+  }
+  std::unique_ptr<Iterator> iter(NewMergingIterator(children.data(), children.size(),
+                                                    merging_options));
+
+  std::unique_ptr<const FilterPolicy> filter_policy;
+  Options options;
+  options.compression = ParseCompression(FLAGS_compression);
+  options.block_size = FLAGS_block_size;
+  options.compression_threads = FLAGS_compression_threads;
+  if (FLAGS_bloom_bits > 0) {
+    filter_policy.reset(NewBloomFilterPolicy(FLAGS_bloom_bits));
+    options.filter_policy = filter_policy.get();
+  }
+
+  File* fl = Open(FLAGS_output);
+  CHECK(fl != nullptr) << "Could not open " << FLAGS_output;
+  Sink sink(fl, TAKE_OWNERSHIP);
+  TableBuilder builder(options, &sink);
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    builder.Add(iter->key(), iter->value());
+  }
+  CHECK_STATUS(iter->status());
+  for (const auto& k_v : meta) {
+    builder.AddMeta(k_v.first, k_v.second);
+  }
+  CHECK_STATUS(builder.Finish());
+  LOG(INFO) << "Merged " << builder.NumEntries() << " entries from " << tables.size()
+            << " tables into " << FLAGS_output;
+
+  // The read-ahead tasks are done once the iterators are destroyed.
+  iter.reset();
+  tables.clear();
+  for (auto& f : files) {
+    CHECK_STATUS(f->Close());
+  }
+  return 0;
+}
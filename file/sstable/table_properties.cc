@@ -0,0 +1,147 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "file/sstable/table_properties.h"
+
+#include "file/meta_map_block.h"
+#include "strings/escaping.h"
+#include "strings/stringprintf.h"
+#include "util/coding/varint.h"
+
+namespace file {
+namespace sstable {
+
+using base::Status;
+using base::StatusCode;
+using strings::Slice;
+using std::string;
+
+namespace {
+
+// Properties are stored as a MetaMapBlock of name -> value, so that tables written with newer
+// properties can still be read.
+struct NumericProperty {
+  const char* name;
+  uint64 TableProperties::* field;
+};
+
+const NumericProperty kNumericProperties[] = {
+  {"num_entries", &TableProperties::num_entries},
+  {"num_data_blocks", &TableProperties::num_data_blocks},
+  {"num_index_entries", &TableProperties::num_index_entries},
+  {"num_compression_aborted", &TableProperties::num_compression_aborted},
+  {"raw_key_size", &TableProperties::raw_key_size},
+  {"raw_value_size", &TableProperties::raw_value_size},
+  {"raw_data_size", &TableProperties::raw_data_size},
+  {"data_size", &TableProperties::data_size},
+  {"index_size", &TableProperties::index_size},
+  {"filter_size", &TableProperties::filter_size},
+  {"smallest_value_size", &TableProperties::smallest_value_size},
+  {"largest_value_size", &TableProperties::largest_value_size},
+};
+
+const char kSmallestKey[] = "smallest_key";
+const char kLargestKey[] = "largest_key";
+const char kBlockSizeHistogram[] = "block_size_histogram";
+
+bool ParseVarint(Slice* input, uint64* val) {
+  const uint8* ptr = input->ubuf();
+  const uint8* limit = ptr + input->size();
+  ptr = Varint::Parse64WithLimit(ptr, limit, val);
+  if (ptr == nullptr)
+    return false;
+  input->remove_prefix(ptr - input->ubuf());
+  return true;
+}
+
+}  // namespace
+
+void TableProperties::AddDataBlock(size_t raw_size, size_t stored_size,
+                                   bool compression_aborted) {
+  ++num_data_blocks;
+  raw_data_size += raw_size;
+  data_size += stored_size;
+  if (compression_aborted)
+    ++num_compression_aborted;
+
+  unsigned bucket = 0;
+  while ((stored_size >> (bucket + 1)) != 0)
+    ++bucket;
+  if (block_size_histogram.size() <= bucket)
+    block_size_histogram.resize(bucket + 1);
+  ++block_size_histogram[bucket];
+}
+
+void TableProperties::EncodeTo(string* dst) const {
+  MetaMapBlock block;
+  string val;
+  for (const auto& prop : kNumericProperties) {
+    val.clear();
+    Varint::Append64(&val, this->*prop.field);
+    block.Add(prop.name, val);
+  }
+  block.Add(kSmallestKey, smallest_key);
+  block.Add(kLargestKey, largest_key);
+
+  val.clear();
+  for (uint64 count : block_size_histogram) {
+    Varint::Append64(&val, count);
+  }
+  block.Add(kBlockSizeHistogram, val);
+  block.EncodeTo(dst);
+}
+
+Status TableProperties::DecodeFrom(Slice input) {
+  MetaMapBlock block;
+  RETURN_IF_ERROR(block.DecodeFrom(input));
+  const auto& meta = block.meta();
+
+  for (const auto& prop : kNumericProperties) {
+    auto it = meta.find(prop.name);
+    if (it == meta.end())
+      continue;
+    Slice src(it->second);
+    if (!ParseVarint(&src, &(this->*prop.field)) || !src.empty())
+      return Status(StatusCode::IO_ERROR, StringPrintf("bad table property %s", prop.name));
+  }
+
+  auto it = meta.find(kSmallestKey);
+  if (it != meta.end())
+    smallest_key = it->second;
+  it = meta.find(kLargestKey);
+  if (it != meta.end())
+    largest_key = it->second;
+
+  block_size_histogram.clear();
+  it = meta.find(kBlockSizeHistogram);
+  if (it != meta.end()) {
+    Slice src(it->second);
+    uint64 count;
+    while (!src.empty()) {
+      if (!ParseVarint(&src, &count))
+        return Status(StatusCode::IO_ERROR, "bad block size histogram");
+      block_size_histogram.push_back(count);
+    }
+  }
+  return Status::OK;
+}
+
+string TableProperties::ToString() const {
+  string res;
+  for (const auto& prop : kNumericProperties) {
+    StringAppendF(&res, "%s: %llu\n", prop.name,
+                  static_cast<unsigned long long>(this->*prop.field));
+  }
+  StringAppendF(&res, "%s: %s\n%s: %s\n", kSmallestKey, strings::CEscape(smallest_key).c_str(),
+                kLargestKey, strings::CEscape(largest_key).c_str());
+  for (size_t i = 0; i < block_size_histogram.size(); ++i) {
+    if (block_size_histogram[i] == 0)
+      continue;
+    StringAppendF(&res, "blocks [%llu, %llu): %llu\n", 1ULL << i, 1ULL << (i + 1),
+                  static_cast<unsigned long long>(block_size_histogram[i]));
+  }
+  return res;
+}
+
+}  // namespace sstable
+}  // namespace file
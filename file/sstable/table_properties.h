@@ -0,0 +1,56 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#ifndef _FILE_SSTABLE_TABLE_PROPERTIES_H_
+#define _FILE_SSTABLE_TABLE_PROPERTIES_H_
+
+#include <string>
+#include <vector>
+
+#include "base/integral_types.h"
+#include "base/status.h"
+#include "strings/stringpiece.h"
+
+namespace file {
+namespace sstable {
+
+// Statistics of a table that are computed by TableBuilder and stored in the properties block.
+// See Table::GetProperties().
+struct TableProperties {
+  uint64 num_entries = 0;
+  uint64 num_data_blocks = 0;
+  uint64 num_index_entries = 0;
+
+  // Data blocks that were stored uncompressed because compression did not pay off.
+  uint64 num_compression_aborted = 0;
+
+  uint64 raw_key_size = 0;       // Sum of the key sizes.
+  uint64 raw_value_size = 0;     // Sum of the value sizes.
+  uint64 raw_data_size = 0;      // Sum of the data block sizes before compression.
+  uint64 data_size = 0;          // Sum of the data block sizes as stored.
+  uint64 index_size = 0;         // Including the index partitions, if any.
+  uint64 filter_size = 0;
+
+  std::string smallest_key;
+  std::string largest_key;
+  uint64 smallest_value_size = 0;
+  uint64 largest_value_size = 0;
+
+  // block_size_histogram[i] counts the stored data blocks with sizes in [2^i, 2^(i+1)).
+  std::vector<uint64> block_size_histogram;
+
+  void AddDataBlock(size_t raw_size, size_t stored_size, bool compression_aborted);
+
+  void EncodeTo(std::string* dst) const;
+
+  // Unknown properties are ignored, missing ones keep their defaults.
+  base::Status DecodeFrom(strings::Slice input);
+
+  // Human readable multi-line description.
+  std::string ToString() const;
+};
+
+}  // namespace sstable
+}  // namespace file
+
+#endif  // _FILE_SSTABLE_TABLE_PROPERTIES_H_
@@ -4,6 +4,11 @@
 
 #include "file/sstable/two_level_iterator.h"
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
 #include "base/logging.h"
 
 #include "file/sstable/options.h"
@@ -22,7 +27,10 @@ class TwoLevelIterator: public Iterator {
   TwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
-    void* arg);
+    void* arg,
+    unsigned readahead_blocks,
+    util::FuncTaskPool* pool,
+    const std::string& upper_bound);
 
   virtual ~TwoLevelIterator();
 
@@ -63,6 +71,12 @@ class TwoLevelIterator: public Iterator {
   void SetDataIterator(Iterator* data_iter);
   bool InitDataBlock();
 
+  // Schedules the blocks that follow the current one until the window is full.
+  void ReadAhead();
+  // Makes the first prefetched block the current one.
+  void TakePrefetched();
+  void DiscardPrefetched();
+
   BlockFunction block_function_;
   void* arg_;
   Status status_;
@@ -71,22 +85,45 @@ class TwoLevelIterator: public Iterator {
   // If data_iter_ is non-NULL, then "data_block_handle_" holds the
   // "index_value" passed to block_function_ to create the data_iter_.
   std::string data_block_handle_;
+
+  // Read-ahead state. While blocks are prefetched, index_iter_ points at the last of them
+  // rather than at the block of data_iter_.
+  struct Prefetch {
+    std::string handle;
+    Iterator* iter = nullptr;
+    bool done = false;
+  };
+  const unsigned max_window_;
+  util::FuncTaskPool* const pool_;
+  const std::string upper_bound_;  // Iteration stops at the block that reaches it.
+  unsigned window_ = 1;
+  std::deque<std::unique_ptr<Prefetch>> prefetched_;
+  std::mutex mu_;
+  std::condition_variable prefetch_done_;
 };
 
 TwoLevelIterator::TwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
-    void* arg)
+    void* arg,
+    unsigned readahead_blocks,
+    util::FuncTaskPool* pool,
+    const std::string& upper_bound)
     : block_function_(block_function),
       arg_(arg),
       index_iter_(index_iter),
-      data_iter_(NULL) {
+      data_iter_(NULL),
+      max_window_(pool ? readahead_blocks : 0),
+      pool_(pool),
+      upper_bound_(upper_bound) {
 }
 
 TwoLevelIterator::~TwoLevelIterator() {
+  DiscardPrefetched();
 }
 
 void TwoLevelIterator::Seek(const Slice& target) {
+  DiscardPrefetched();
   VLOG(1) << "Seeking index to " << target.as_string();
   index_iter_.Seek(target);
   if (InitDataBlock()) {
@@ -97,6 +134,7 @@ void TwoLevelIterator::Seek(const Slice& target) {
 }
 
 void TwoLevelIterator::SeekToFirst() {
+  DiscardPrefetched();
   index_iter_.SeekToFirst();
   if (InitDataBlock()) {
     VLOG(1) << "data_iter_.SeekToFirst()";
@@ -106,6 +144,7 @@ void TwoLevelIterator::SeekToFirst() {
 }
 
 void TwoLevelIterator::SeekToLast() {
+  DiscardPrefetched();
   index_iter_.SeekToLast();
   if (InitDataBlock())
     data_iter_.SeekToLast();
@@ -120,6 +159,11 @@ void TwoLevelIterator::Next() {
 
 void TwoLevelIterator::Prev() {
   DCHECK(Valid());
+  if (max_window_ > 0) {
+    // Bring index_iter_ back to the current block.
+    DiscardPrefetched();
+    index_iter_.Seek(data_iter_.key());
+  }
   data_iter_.Prev();
   SkipEmptyDataBlocksBackward();
 }
@@ -127,16 +171,28 @@ void TwoLevelIterator::Prev() {
 
 void TwoLevelIterator::SkipEmptyDataBlocksForward() {
   while (data_iter_.iter() == NULL || !data_iter_.Valid()) {
+    if (!prefetched_.empty()) {
+      TakePrefetched();
+      data_iter_.SeekToFirst();
+      continue;
+    }
     // Move to next block
     if (!index_iter_.Valid()) {
       VLOG(2) << "SkipEmptyDataBlocksForward: Index iter not valid";
       SetDataIterator(NULL);
       return;
     }
+    // The following blocks have only keys past the upper bound. This matters when the block
+    // function skips blocks, since the whole index would be traversed otherwise.
+    if (!upper_bound_.empty() && index_iter_.key().compare(Slice(upper_bound_)) >= 0) {
+      SetDataIterator(NULL);
+      return;
+    }
     VLOG(2) << "SkipEmptyDataBlocksForward: move to next index";
     index_iter_.Next();
     if (InitDataBlock()) data_iter_.SeekToFirst();
   }
+  ReadAhead();
 }
 
 void TwoLevelIterator::SkipEmptyDataBlocksBackward() {
@@ -176,13 +232,80 @@ bool TwoLevelIterator::InitDataBlock() {
   return data_iter_.iter() != nullptr;
 }
 
+void TwoLevelIterator::ReadAhead() {
+  if (max_window_ == 0)
+    return;
+
+  while (prefetched_.size() < window_ && index_iter_.Valid()) {
+    // Index keys are >= the keys of their blocks and < the keys of the following ones.
+    if (!upper_bound_.empty() && index_iter_.key().compare(Slice(upper_bound_)) >= 0)
+      break;
+    index_iter_.Next();
+    if (!index_iter_.Valid())
+      break;
+    Prefetch* p = new Prefetch;
+    p->handle = index_iter_.value().as_string();
+    prefetched_.emplace_back(p);
+    pool_->RunTask([this, p] {
+      Iterator* iter = (*block_function_)(arg_, p->handle);
+
+      std::lock_guard<std::mutex> lock(mu_);
+      p->iter = iter;
+      p->done = true;
+      prefetch_done_.notify_all();
+    });
+  }
+}
+
+void TwoLevelIterator::TakePrefetched() {
+  std::unique_ptr<Prefetch> p(std::move(prefetched_.front()));
+  prefetched_.pop_front();
+  {
+    std::unique_lock<std::mutex> lock(mu_);
+    if (!p->done) {
+      // The scan is faster than the reads, widen the window.
+      window_ = std::min(2 * window_, max_window_);
+      prefetch_done_.wait(lock, [&p] { return p->done; });
+    }
+  }
+  data_block_handle_.swap(p->handle);
+  SetDataIterator(p->iter);
+}
+
+void TwoLevelIterator::DiscardPrefetched() {
+  if (prefetched_.empty())
+    return;
+  {
+    std::unique_lock<std::mutex> lock(mu_);
+    prefetch_done_.wait(lock, [this] {
+      for (const auto& p : prefetched_) {
+        if (!p->done)
+          return false;
+      }
+      return true;
+    });
+  }
+  for (const auto& p : prefetched_) {
+    delete p->iter;
+  }
+  prefetched_.clear();
+  window_ = 1;
+}
+
 }  // namespace
 
 Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg) {
-  return new TwoLevelIterator(index_iter, block_function, arg);
+  return new TwoLevelIterator(index_iter, block_function, arg, 0, nullptr, std::string());
+}
+
+Iterator* NewTwoLevelIterator(
+    Iterator* index_iter, BlockFunction block_function,
+    void* arg, const IteratorOptions& options) {
+  return new TwoLevelIterator(index_iter, block_function, arg, options.readahead_blocks,
+                              options.readahead_pool, options.upper_bound);
 }
 
 }  // namespace sstable
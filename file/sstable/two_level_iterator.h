@@ -6,6 +6,7 @@
 #define _FILE_SSTABLE_TWO_LEVEL_ITERATOR_H_
 
 #include "file/sstable/iterator.h"
+#include "file/sstable/options.h"
 
 namespace file {
 namespace sstable {
@@ -25,6 +26,12 @@ extern Iterator* NewTwoLevelIterator(
     Iterator* index_iter, BlockFunction block_func,
     void* arg);
 
+// Same as above with the read-ahead of data blocks configured by options, in which case
+// block_func is also called from the threads of options.readahead_pool and must be thread-safe.
+extern Iterator* NewTwoLevelIterator(
+    Iterator* index_iter, BlockFunction block_func,
+    void* arg, const IteratorOptions& options);
+
 }  // namespace sstable
 }  // namespace file
 
@@ -101,6 +101,15 @@ add_third_party(snappy
   GIT_TAG 1.1.7
 )
 
+set(LZ4_DIR "${THIRD_PARTY_LIB_DIR}/lz4")
+add_third_party(lz4
+  GIT_REPOSITORY https://github.com/lz4/lz4.git
+  GIT_TAG v1.7.5
+  BUILD_IN_SOURCE 1
+  CONFIGURE_COMMAND ""
+  INSTALL_COMMAND make install PREFIX=${LZ4_DIR}
+)
+
 add_third_party(
   benchmark
   GIT_REPOSITORY https://github.com/google/benchmark.git
@@ -177,6 +186,7 @@ declare_imported_lib(benchmark ${BENCHMARK_LIB_DIR} benchmark_project)
 declare_shared_lib(cityhash ${CITYHASH_LIB_DIR} cityhash_project)
 declare_shared_lib(gflags ${GFLAGS_LIB_DIR} gflags_project)
 declare_shared_lib(glog ${GLOG_LIB_DIR} glog_project)
+declare_imported_lib(lz4 ${LZ4_LIB_DIR} lz4_project)
 declare_shared_lib(protobuf ${PROTOBUF_LIB_DIR} protobuf_project)
 declare_imported_lib(snappy ${SNAPPY_LIB_DIR} snappy_project)
 declare_imported_lib(xxhash ${XXHASH_LIB_DIR} xxhash_project)
@@ -185,6 +195,7 @@ file(MAKE_DIRECTORY ${BENCHMARK_INCLUDE_DIR})
 file(MAKE_DIRECTORY ${CITYHASH_INCLUDE_DIR})
 file(MAKE_DIRECTORY ${GLOG_INCLUDE_DIR})
 file(MAKE_DIRECTORY ${GTEST_INCLUDE_DIR})
+file(MAKE_DIRECTORY ${LZ4_INCLUDE_DIR})
 file(MAKE_DIRECTORY ${PROTOBUF_INCLUDE_DIR})
 file(MAKE_DIRECTORY ${SNAPPY_INCLUDE_DIR})
 file(MAKE_DIRECTORY ${SPARSEHASH_INCLUDE_DIR})
@@ -195,6 +206,7 @@ set_property(TARGET cityhash PROPERTY INTERFACE_INCLUDE_DIRECTORIES ${CITYHASH_I
 set_property(TARGET gflags PROPERTY INTERFACE_INCLUDE_DIRECTORIES ${GFLAGS_INCLUDE_DIR})
 set_property(TARGET glog PROPERTY INTERFACE_INCLUDE_DIRECTORIES ${GLOG_INCLUDE_DIR})
 set_property(TARGET gtest PROPERTY INTERFACE_INCLUDE_DIRECTORIES ${GTEST_INCLUDE_DIR})
+set_property(TARGET lz4 PROPERTY INTERFACE_INCLUDE_DIRECTORIES ${LZ4_INCLUDE_DIR})
 set_property(TARGET protobuf PROPERTY INTERFACE_INCLUDE_DIRECTORIES ${PROTOBUF_INCLUDE_DIR})
 set_property(TARGET snappy PROPERTY INTERFACE_INCLUDE_DIRECTORIES ${SNAPPY_INCLUDE_DIR})
 set_property(TARGET xxhash PROPERTY INTERFACE_INCLUDE_DIRECTORIES ${XXHASH_INCLUDE_DIR})
@@ -0,0 +1,231 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "util/gzip_sink.h"
+
+#include <zlib.h>
+
+#include "base/logging.h"
+#include "strings/strcat.h"
+#include "util/proc_stats.h"
+
+using base::Status;
+using base::StatusCode;
+using strings::Slice;
+
+namespace util {
+
+namespace {
+
+constexpr size_t kWindowSize = 1 << 15;
+
+// Gzip header without the file name and with zero mtime. OS is unix.
+constexpr uint8 kGzipHeader[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+
+inline void EncodeLE32(uint32 val, uint8* dest) {
+  for (unsigned i = 0; i < 4; ++i) {
+    dest[i] = val & 0xFF;
+    val >>= 8;
+  }
+}
+
+}  // namespace
+
+struct ParallelGzipSink::Job {
+  std::string input;
+  std::string dict;
+  std::string output;
+  uint32 crc = 0;
+  bool last = false;
+
+  // Guarded by ParallelGzipSink::mu_.
+  bool done = false;
+  Status status;
+};
+
+ParallelGzipSink::ParallelGzipSink(Sink* upstream, Ownership ownership, const Options& opts)
+    : upstream_(upstream), ownership_(ownership), opts_(opts) {
+  CHECK_GE(opts_.chunk_size, kWindowSize);
+  unsigned threads = opts_.threads;
+  if (threads == 0)
+    threads = std::max(1u, sys::NumCPUs());
+  if (threads > 1) {
+    pool_.reset(new FuncTaskPool("gzip", 2, threads));
+    pool_->Launch();
+  }
+  max_jobs_ = threads * 2;
+}
+
+ParallelGzipSink::~ParallelGzipSink() {
+  if (current_ && !current_->input.empty()) {
+    LOG(WARNING) << "ParallelGzipSink is destroyed without Flush, the output is truncated";
+  }
+
+  // The pool threads may still reference our jobs.
+  if (pool_)
+    pool_->WaitForTasksToComplete();
+  if (ownership_ == TAKE_OWNERSHIP)
+    delete upstream_;
+}
+
+void ParallelGzipSink::Compress(int level, bool multi_member, Job* job) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+
+  // Raw deflate for the stitched stream, gzip wrapper for separate members.
+  int window_bits = multi_member ? 15 + 16 : -15;
+  int res = deflateInit2(&zs, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+  if (res != Z_OK) {
+    job->status = Status(StatusCode::INTERNAL_ERROR, StrCat("deflateInit2 error ", res));
+    return;
+  }
+  if (!job->dict.empty()) {
+    deflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(job->dict.data()),
+                         job->dict.size());
+  }
+
+  // Sync flush adds an empty stored block, hence the slack.
+  job->output.resize(deflateBound(&zs, job->input.size()) + 16);
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(job->input.data()));
+  zs.avail_in = job->input.size();
+  zs.next_out = reinterpret_cast<Bytef*>(&job->output.front());
+  zs.avail_out = job->output.size();
+
+  // Non-last chunks end on a byte boundary so that they can be concatenated.
+  const int flush = multi_member || job->last ? Z_FINISH : Z_SYNC_FLUSH;
+  while (true) {
+    res = deflate(&zs, flush);
+    if (res == Z_STREAM_END || (flush == Z_SYNC_FLUSH && res == Z_OK && zs.avail_out > 0))
+      break;
+    if (res != Z_OK && res != Z_BUF_ERROR) {
+      job->status = Status(StatusCode::INTERNAL_ERROR, StrCat("deflate error ", res));
+      break;
+    }
+    size_t written = zs.total_out;
+    job->output.resize(job->output.size() * 2);
+    zs.next_out = reinterpret_cast<Bytef*>(&job->output.front()) + written;
+    zs.avail_out = job->output.size() - written;
+  }
+  job->output.resize(zs.total_out);
+  job->crc = crc32(0, reinterpret_cast<const Bytef*>(job->input.data()), job->input.size());
+  deflateEnd(&zs);
+}
+
+void ParallelGzipSink::Dispatch(bool last) {
+  Job* job = current_ ? current_.release() : new Job;
+  job->last = last;
+
+  if (!opts_.multi_member) {
+    // Prime the chunk with the last window of the preceding data of this member.
+    job->dict.swap(dict_);
+    if (last) {
+      dict_.clear();
+    } else if (job->input.size() >= kWindowSize) {
+      dict_.assign(job->input, job->input.size() - kWindowSize, kWindowSize);
+    } else {
+      dict_ = job->dict + job->input;
+      if (dict_.size() > kWindowSize)
+        dict_.erase(0, dict_.size() - kWindowSize);
+    }
+  }
+  jobs_.emplace_back(job);
+
+  auto cb = [this, job] {
+    Compress(opts_.level, opts_.multi_member, job);
+    std::lock_guard<std::mutex> lock(mu_);
+    job->done = true;
+    job_done_.notify_all();
+  };
+  if (pool_)
+    pool_->RunTask(cb);
+  else
+    cb();
+}
+
+Status ParallelGzipSink::WriteFront() {
+  std::unique_ptr<Job> job;
+  {
+    std::unique_lock<std::mutex> lock(mu_);
+    Job* front = jobs_.front().get();
+    job_done_.wait(lock, [front] { return front->done; });
+    job = std::move(jobs_.front());
+    jobs_.pop_front();
+  }
+  RETURN_IF_ERROR(job->status);
+
+  if (opts_.multi_member)
+    return upstream_->Append(job->output);
+
+  if (!member_started_) {
+    RETURN_IF_ERROR(upstream_->Append(Slice(kGzipHeader, sizeof(kGzipHeader))));
+    member_started_ = true;
+  }
+  RETURN_IF_ERROR(upstream_->Append(job->output));
+  crc_ = crc32_combine(crc_, job->crc, job->input.size());
+  isize_ += job->input.size();
+
+  if (job->last) {
+    uint8 trailer[8];
+    EncodeLE32(crc_, trailer);
+    EncodeLE32(isize_, trailer + 4);
+    RETURN_IF_ERROR(upstream_->Append(Slice(trailer, sizeof(trailer))));
+    member_started_ = false;
+    crc_ = isize_ = 0;
+  }
+  return Status::OK;
+}
+
+Status ParallelGzipSink::Append(Slice slice) {
+  RETURN_IF_ERROR(status_);
+
+  while (!slice.empty()) {
+    if (!current_) {
+      current_.reset(new Job);
+      current_->input.reserve(opts_.chunk_size);
+    }
+    size_t n = std::min<size_t>(slice.size(), opts_.chunk_size - current_->input.size());
+    current_->input.append(slice.data(), n);
+    slice.remove_prefix(n);
+    pending_ = true;
+
+    if (current_->input.size() < opts_.chunk_size)
+      break;
+    Dispatch(false);
+
+    // Write everything that is ready, block only if there are too many jobs in flight.
+    while (!jobs_.empty()) {
+      if (jobs_.size() < max_jobs_) {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (!jobs_.front()->done)
+          break;
+      }
+      status_ = WriteFront();
+      RETURN_IF_ERROR(status_);
+    }
+  }
+  return Status::OK;
+}
+
+Status ParallelGzipSink::Flush() {
+  RETURN_IF_ERROR(status_);
+
+  bool has_current = current_ && !current_->input.empty();
+  if (opts_.multi_member) {
+    // Every chunk is a complete member, we only need to make sure that the output is not empty.
+    if (has_current || (!pending_ && !flushed_))
+      Dispatch(true);
+  } else if (pending_ || !flushed_) {
+    Dispatch(true);
+  }
+
+  while (!jobs_.empty()) {
+    status_ = WriteFront();
+    RETURN_IF_ERROR(status_);
+  }
+  pending_ = false;
+  flushed_ = true;
+
+  return upstream_->Flush();
+}
+
+}  // namespace util
@@ -0,0 +1,87 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#ifndef _UTIL_GZIP_SINK_H
+#define _UTIL_GZIP_SINK_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "util/sinksource.h"
+#include "util/sp_task_pool.h"
+
+namespace util {
+
+// Gzip compressing sink that deflates its input on multiple threads (in the spirit of pigz).
+// The input is cut into chunks of chunk_size bytes that are compressed independently and
+// written to the upstream sink in order.
+//
+// By default every chunk is primed with the last 32KB of the previous one and all chunks are
+// stitched into a single deflate stream, therefore the output is a regular single-member gzip
+// file with a compression ratio close to the serial one.
+// With multi_member set, every chunk becomes a self-contained gzip member. The ratio is slightly
+// worse but such files can be decompressed in parallel as well.
+//
+// Flush() terminates the current gzip member. Appending after Flush() starts a new member,
+// which is still a valid gzip stream.
+class ParallelGzipSink : public Sink {
+ public:
+  struct Options {
+    int level = 6;
+
+    // 0 means the number of cpus. 1 compresses on the calling thread.
+    unsigned threads = 0;
+    size_t chunk_size = 1 << 18;
+    bool multi_member = false;
+
+    Options() {}
+  };
+
+  ParallelGzipSink(Sink* upstream, Ownership ownership, const Options& opts = Options());
+  ~ParallelGzipSink();
+
+  base::Status Append(strings::Slice slice) override;
+
+  // Compresses the pending data, terminates the gzip member and flushes the upstream.
+  base::Status Flush() override;
+
+ private:
+  struct Job;
+
+  // Hands the current chunk to the pool.
+  void Dispatch(bool last);
+
+  // Waits for the oldest job and writes its output upstream.
+  base::Status WriteFront();
+
+  static void Compress(int level, bool multi_member, Job* job);
+
+  Sink* upstream_;
+  Ownership ownership_;
+  const Options opts_;
+  std::unique_ptr<FuncTaskPool> pool_;
+
+  std::unique_ptr<Job> current_;
+  std::string dict_;  // The tail of the last dispatched chunk.
+  bool member_started_ = false;
+  bool pending_ = false;  // data was appended since the last Flush.
+  bool flushed_ = false;
+  uint32 crc_ = 0;
+  uint32 isize_ = 0;
+
+  std::mutex mu_;
+  std::condition_variable job_done_;
+  std::deque<std::unique_ptr<Job>> jobs_;
+  unsigned max_jobs_;
+
+  base::Status status_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelGzipSink);
+};
+
+}  // namespace util
+
+#endif  // _UTIL_GZIP_SINK_H
@@ -0,0 +1,133 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "util/gzip_sink.h"
+
+#include <zlib.h>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "base/random.h"
+
+namespace util {
+
+using std::string;
+
+// Inflates all the gzip members in input. Returns the number of members via members.
+static bool Gunzip(const string& input, string* output, unsigned* members) {
+  output->clear();
+  *members = 0;
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  CHECK_EQ(Z_OK, inflateInit2(&zs, 15 + 16));
+
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  zs.avail_in = input.size();
+  char buf[1 << 16];
+  while (zs.avail_in > 0) {
+    zs.next_out = reinterpret_cast<Bytef*>(buf);
+    zs.avail_out = sizeof(buf);
+    int res = inflate(&zs, Z_NO_FLUSH);
+    output->append(buf, sizeof(buf) - zs.avail_out);
+    if (res == Z_STREAM_END) {
+      ++*members;
+      inflateReset(&zs);
+    } else if (res != Z_OK) {
+      inflateEnd(&zs);
+      return false;
+    }
+  }
+  inflateEnd(&zs);
+  return true;
+}
+
+class GzipSinkTest : public testing::Test {
+ protected:
+  static string Compressible(size_t len) {
+    MTRandom rnd(10);
+    string res;
+    while (res.size() < len) {
+      res.append("token").append(std::to_string(rnd.Rand32() % 1000)).append(" ");
+    }
+    res.resize(len);
+    return res;
+  }
+
+  string Compress(const string& input, const ParallelGzipSink::Options& opts,
+                  size_t append_size = 10000) {
+    StringSink* dest = new StringSink;
+    ParallelGzipSink sink(dest, DO_NOT_TAKE_OWNERSHIP, opts);
+    for (size_t i = 0; i < input.size(); i += append_size) {
+      CHECK_STATUS(sink.Append(strings::Slice(input, i, append_size)));
+    }
+    CHECK_STATUS(sink.Flush());
+    string res = std::move(dest->contents());
+    delete dest;
+    return res;
+  }
+};
+
+TEST_F(GzipSinkTest, SingleMember) {
+  string input = Compressible(3000000);
+  ParallelGzipSink::Options opts;
+  opts.threads = 4;
+  opts.chunk_size = 1 << 16;
+
+  string compressed = Compress(input, opts);
+  string output;
+  unsigned members = 0;
+  ASSERT_TRUE(Gunzip(compressed, &output, &members));
+  EXPECT_EQ(1, members);
+  EXPECT_TRUE(output == input);
+
+  // Dictionary priming keeps the ratio close to the serial one.
+  opts.threads = 1;
+  string serial = Compress(input, opts);
+  EXPECT_TRUE(serial == compressed);
+
+  uLongf bound = compressBound(input.size());
+  string zlib(bound, '\0');
+  ASSERT_EQ(Z_OK, compress2(reinterpret_cast<Bytef*>(&zlib.front()), &bound,
+                            reinterpret_cast<const Bytef*>(input.data()), input.size(), 6));
+  EXPECT_LT(compressed.size(), bound * 1.01);
+}
+
+TEST_F(GzipSinkTest, MultiMember) {
+  string input = Compressible(1000000);
+  ParallelGzipSink::Options opts;
+  opts.threads = 3;
+  opts.chunk_size = 1 << 17;
+  opts.multi_member = true;
+
+  string compressed = Compress(input, opts, 77777);
+  string output;
+  unsigned members = 0;
+  ASSERT_TRUE(Gunzip(compressed, &output, &members));
+  EXPECT_EQ((input.size() + opts.chunk_size - 1) / opts.chunk_size, members);
+  EXPECT_TRUE(output == input);
+}
+
+TEST_F(GzipSinkTest, EmptyAndFlush) {
+  ParallelGzipSink::Options opts;
+  opts.threads = 2;
+
+  string output;
+  unsigned members = 0;
+  ASSERT_TRUE(Gunzip(Compress("", opts), &output, &members));
+  EXPECT_EQ(1, members);
+  EXPECT_TRUE(output.empty());
+
+  // Appending after Flush starts a new member.
+  StringSink dest;
+  ParallelGzipSink sink(&dest, DO_NOT_TAKE_OWNERSHIP, opts);
+  ASSERT_TRUE(sink.Append("hello ").ok());
+  ASSERT_TRUE(sink.Flush().ok());
+  ASSERT_TRUE(sink.Flush().ok());
+  ASSERT_TRUE(sink.Append("world").ok());
+  ASSERT_TRUE(sink.Flush().ok());
+  ASSERT_TRUE(Gunzip(dest.contents(), &output, &members));
+  EXPECT_EQ(2, members);
+  EXPECT_EQ("hello world", output);
+}
+
+}  // namespace util
@@ -1,10 +1,57 @@
 // Copyright 2015, Ubimo.com .  All rights reserved.
 // Author: Roman Gershman (roman@ubimo.com)
 //
+#include <lz4.h>
+#include <lz4hc.h>
+
+#include "util/compressors.h"
+
+using base::Status;
 
 namespace util {
 namespace compressors {
+
+// Referenced from compressors.cc so that the linker keeps this module and its registration.
 int dummy_lz4() { return 0; }
+
+namespace {
+
+// Levels below the minimal HC level use the fast compressor.
+constexpr int kMinHCLevel = 3;
+
+size_t BoundFunctionLZ4(size_t len) {
+  return LZ4_compressBound(len);
 }
+
+Status CompressLZ4(int level, const void* src, size_t len, void* dest, size_t* compress_size) {
+  if (len > LZ4_MAX_INPUT_SIZE)
+    return Status("Input is too large for LZ4");
+  const char* source = reinterpret_cast<const char*>(src);
+  char* dst = reinterpret_cast<char*>(dest);
+  int res;
+  if (level >= kMinHCLevel) {
+    res = LZ4_compress_HC(source, dst, len, *compress_size, level);
+  } else {
+    res = LZ4_compress_default(source, dst, len, *compress_size);
+  }
+  if (res <= 0)
+    return Status("LZ4 compression failed");
+  *compress_size = res;
+  return Status::OK;
+}
+
+Status UncompressLZ4(const void* src, size_t len, void* dest, size_t* uncompress_size) {
+  int res = LZ4_decompress_safe(reinterpret_cast<const char*>(src),
+                                reinterpret_cast<char*>(dest), len, *uncompress_size);
+  if (res < 0)
+    return Status("Corrupted LZ4 input");
+  *uncompress_size = res;
+  return Status::OK;
 }
-// REGISTER_COMPRESS(
+
+}  // namespace
+
+REGISTER_COMPRESS(LZ4_METHOD, &BoundFunctionLZ4, &CompressLZ4, &UncompressLZ4);
+
+}  // namespace compressors
+}  // namespace util
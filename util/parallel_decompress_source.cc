@@ -0,0 +1,571 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "util/parallel_decompress_source.h"
+
+#include <bzlib.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "strings/strcat.h"
+#include "util/proc_stats.h"
+
+using base::Status;
+using base::StatusCode;
+using strings::Slice;
+
+namespace util {
+
+namespace {
+
+constexpr size_t kReadSize = 1 << 22;
+constexpr size_t kSerialOutputSize = 1 << 20;
+
+constexpr uint64 kBzipBlockMagic = 0x314159265359ULL;
+constexpr uint64 kBzipEosMagic = 0x177245385090ULL;
+constexpr uint64 kMask48 = (1ULL << 48) - 1;
+
+inline bool IsGzipHeader(const uint8* p) {
+  // Reserved flag bits must be zero, extra flags are 0, 2 or 4.
+  return p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 && (p[3] & 0xe0) == 0 &&
+         (p[8] == 0 || p[8] == 2 || p[8] == 4);
+}
+
+class BitWriter {
+ public:
+  explicit BitWriter(std::string* dest) : dest_(dest) {}
+
+  // bits <= 32.
+  void Put(uint32 val, unsigned bits) {
+    acc_ = (acc_ << bits) | val;
+    pending_ += bits;
+    while (pending_ >= 8) {
+      pending_ -= 8;
+      dest_->push_back(char(acc_ >> pending_));
+    }
+    acc_ &= (1ULL << pending_) - 1;
+  }
+
+  void Finish() {
+    if (pending_)
+      dest_->push_back(char(acc_ << (8 - pending_)));
+    acc_ = pending_ = 0;
+  }
+
+ private:
+  std::string* dest_;
+  uint64 acc_ = 0;
+  unsigned pending_ = 0;
+};
+
+inline unsigned GetBit(const uint8* src, uint64 bit) {
+  return (src[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+// Inflates a single gzip member with zs. Stops when the member ends, the input is exhausted or
+// the output reaches max_output. In the latter case zs can continue the member.
+void InflateMember(z_stream* zs, const std::string& input, size_t max_output,
+                   std::string* output, uint64* consumed, bool* complete, bool* full,
+                   Status* status) {
+  // Zero padding after the last member is ignored like gzip does.
+  if (std::all_of(input.begin(), input.end(), [](char c) { return c == 0; })) {
+    *consumed = input.size();
+    *complete = true;
+    return;
+  }
+
+  output->resize(std::min(std::max<size_t>(input.size() * 4, 1 << 16), max_output));
+  zs->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  zs->avail_in = input.size();
+  zs->next_out = reinterpret_cast<Bytef*>(&output->front());
+  zs->avail_out = output->size();
+
+  while (true) {
+    int res = inflate(zs, Z_NO_FLUSH);
+    if (res == Z_STREAM_END) {
+      *complete = true;
+      break;
+    }
+    if (res != Z_OK && res != Z_BUF_ERROR) {
+      *status = Status(StatusCode::IO_ERROR, StrCat("inflate error ", res));
+      break;
+    }
+    if (zs->avail_out == 0) {
+      if (output->size() >= max_output) {
+        *full = true;
+        break;
+      }
+      size_t written = zs->total_out;
+      output->resize(std::min(output->size() * 2, max_output));
+      zs->next_out = reinterpret_cast<Bytef*>(&output->front()) + written;
+      zs->avail_out = output->size() - written;
+    } else if (zs->avail_in == 0) {
+      break;  // the member continues past the segment.
+    }
+  }
+  output->resize(zs->total_out);
+  *consumed = zs->total_in;
+}
+
+// Wraps nbits of a bzip2 block starting at bit_offset of src into a standalone bzip2 stream.
+// The stream crc of a single-block stream equals the block crc that follows the block magic.
+void WrapBzipBlock(const uint8* src, unsigned bit_offset, uint64 nbits, std::string* dest) {
+  dest->reserve(nbits / 8 + 16);
+  dest->assign("BZh9");  // block size 9 accepts blocks of any level.
+
+  BitWriter writer(dest);
+  const uint64 bytes = nbits / 8;
+  if (bit_offset == 0) {
+    dest->append(reinterpret_cast<const char*>(src), bytes);
+  } else {
+    for (uint64 i = 0; i < bytes; ++i) {
+      writer.Put(uint8((src[i] << bit_offset) | (src[i + 1] >> (8 - bit_offset))), 8);
+    }
+  }
+  for (uint64 bit = bytes * 8; bit < nbits; ++bit) {
+    writer.Put(GetBit(src, bit_offset + bit), 1);
+  }
+
+  uint32 crc = 0;
+  for (unsigned bit = 48; bit < 80; ++bit) {
+    crc = (crc << 1) | GetBit(src, bit_offset + bit);
+  }
+  writer.Put(kBzipEosMagic >> 32, 16);
+  writer.Put(kBzipEosMagic & 0xFFFFFFFF, 32);
+  writer.Put(crc, 32);
+  writer.Finish();
+}
+
+void DecodeBzipBlock(const std::string& stream, std::string* output, bool* complete,
+                     Status* status) {
+  bz_stream bz;
+  memset(&bz, 0, sizeof(bz));
+  int res = BZ2_bzDecompressInit(&bz, 0, 0);
+  if (res != BZ_OK) {
+    *status = Status(StatusCode::INTERNAL_ERROR, StrCat("BZ2_bzDecompressInit error ", res));
+    return;
+  }
+
+  output->resize(std::max<size_t>(stream.size() * 8, 1 << 20));
+  bz.next_in = const_cast<char*>(stream.data());
+  bz.avail_in = stream.size();
+  bz.next_out = &output->front();
+  bz.avail_out = output->size();
+
+  while (true) {
+    res = BZ2_bzDecompress(&bz);
+    if (res == BZ_STREAM_END) {
+      *complete = true;
+      break;
+    }
+    if (res != BZ_OK) {
+      *status = Status(StatusCode::IO_ERROR, StrCat("BZip error ", res));
+      break;
+    }
+    if (bz.avail_out == 0) {
+      size_t written = bz.total_out_lo32;
+      output->resize(output->size() * 2);
+      bz.next_out = &output->front() + written;
+      bz.avail_out = output->size() - written;
+    } else if (bz.avail_in == 0) {
+      *status = Status(StatusCode::IO_ERROR, "Truncated bzip2 block");
+      break;
+    }
+  }
+  output->resize(bz.total_out_lo32);
+  BZ2_bzDecompressEnd(&bz);
+}
+
+}  // namespace
+
+struct ParallelDecompressSource::SerialState {
+  z_stream zs;
+
+  SerialState() {
+    memset(&zs, 0, sizeof(zs));
+    CHECK_EQ(Z_OK, inflateInit2(&zs, 15 + 16));
+  }
+
+  ~SerialState() { inflateEnd(&zs); }
+};
+
+struct ParallelDecompressSource::Job {
+  // Segment [start, end) in format positions.
+  uint64 start = 0;
+  uint64 end = 0;
+
+  std::string input;
+  unsigned bit_offset = 0;
+
+  std::string output;
+  uint64 consumed = 0;  // gzip only.
+  bool complete = false;
+
+  // Set when the output of a gzip member reached max_output, continues the member.
+  std::unique_ptr<SerialState> inflater;
+
+  // Guarded by ParallelDecompressSource::mu_.
+  bool done = false;
+  Status status;
+};
+
+ParallelDecompressSource::ParallelDecompressSource(Source* sub_source, Ownership ownership,
+                                                   Format format, const Options& opts)
+    : sub_(sub_source), ownership_(ownership), format_(format), max_segment_(opts.max_segment),
+      max_output_(std::max<size_t>(opts.max_output, 1 << 16)) {
+  threads_ = opts.threads;
+  if (threads_ == 0)
+    threads_ = std::max(1u, sys::NumCPUs());
+
+  // The first gzip member is streamed, a regular single-member file gains nothing from the
+  // pool. SerialInflate switches to the parallel mode at the end of the member.
+  if (format_ == GZIP)
+    serial_.reset(new SerialState);
+  max_jobs_ = threads_ * 2;
+}
+
+ParallelDecompressSource::~ParallelDecompressSource() {
+  // The pool threads may still reference our jobs.
+  if (pool_)
+    pool_->WaitForTasksToComplete();
+  if (ownership_ == TAKE_OWNERSHIP)
+    delete sub_;
+}
+
+Slice ParallelDecompressSource::Peek(uint32 minimal_size) {
+  const size_t wanted = std::max<uint32>(minimal_size, 1);
+  while (!eof_ && cur_.size() - cur_pos_ < wanted) {
+    std::string next;
+    if (!Advance(&next)) {
+      eof_ = true;
+      break;
+    }
+    if (cur_pos_ == cur_.size()) {
+      cur_.swap(next);
+    } else {
+      cur_.erase(0, cur_pos_);
+      cur_.append(next);
+    }
+    cur_pos_ = 0;
+  }
+  return Slice(cur_.data() + cur_pos_, cur_.size() - cur_pos_);
+}
+
+void ParallelDecompressSource::Skip(size_t n) {
+  DCHECK_LE(n, cur_.size() - cur_pos_);
+  cur_pos_ += n;
+}
+
+bool ParallelDecompressSource::Advance(std::string* output) {
+  while (status_.ok()) {
+    if (serial_) {
+      if (!SerialInflate(output))
+        return false;
+      if (!output->empty())
+        return true;
+      continue;
+    }
+
+    Schedule();
+    if (!status_.ok())
+      return false;
+    if (jobs_.empty()) {
+      if (finished_)
+        return false;
+
+      // The segment at cursor_ does not fit into the window or is the last gzip member.
+      if (format_ == BZIP2) {
+        status_ = Status(StatusCode::IO_ERROR,
+                         StrCat("bzip2 block at offset ", ToByte(cursor_), " is too large"));
+        return false;
+      }
+      serial_.reset(new SerialState);
+      continue;
+    }
+
+    std::unique_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      Job* front = jobs_.front().get();
+      job_done_.wait(lock, [front] { return front->done; });
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+
+    if (job->inflater) {
+      // The output of the member is too large to be held at once, the rest of it is streamed.
+      Restart(job->start + job->consumed);
+      serial_ = std::move(job->inflater);
+      output->swap(job->output);
+      return true;
+    }
+
+    if (job->complete && job->status.ok()) {
+      // A gzip member that ends before the next candidate header.
+      if (job->consumed < job->input.size() && format_ == GZIP)
+        Restart(job->start + job->consumed);
+      output->swap(job->output);
+      if (!output->empty())
+        return true;
+      continue;
+    }
+
+    // Decoding a prefix of a gzip member never fails, only runs out of input.
+    if (format_ == GZIP && !job->status.ok()) {
+      status_ = job->status;
+      return false;
+    }
+
+    // The segment was cut by a false boundary, merge it with the following one.
+    VLOG(1) << "Merging segment at " << job->start << " with the next one";
+    Restart(job->start);
+    min_end_ = job->end + 1;
+  }
+  return false;
+}
+
+void ParallelDecompressSource::Schedule() {
+  while (jobs_.size() < max_jobs_ && !finished_ && status_.ok()) {
+    Scan();
+
+    uint64 start, end;
+    if (NextSegment(&start, &end)) {
+      Dispatch(start, end);
+      continue;
+    }
+    if (finished_ || !status_.ok())
+      break;
+
+    uint64 needed = ToByte(jobs_.empty() ? cursor_ : jobs_.front()->start);
+    if (in_eof_ || in_end() - needed >= max_segment_)
+      break;
+    Fill();
+  }
+}
+
+bool ParallelDecompressSource::NextSegment(uint64* start, uint64* end) {
+  if (format_ == GZIP) {
+    while (!candidates_.empty() &&
+           (candidates_.front().pos <= cursor_ || candidates_.front().pos < min_end_)) {
+      candidates_.pop_front();
+    }
+    if (in_eof_ && cursor_ >= in_end()) {
+      finished_ = true;
+      return false;
+    }
+    if (!candidates_.empty()) {
+      *start = cursor_;
+      *end = candidates_.front().pos;
+      return true;
+    }
+
+    // The last member is streamed by SerialInflate, decoding it as a job would hold its whole
+    // output in memory. Zero padding after the last member is ignored like gzip does.
+    if (in_eof_ && std::all_of(in_.begin() + (cursor_ - in_start_), in_.end(),
+                               [](char c) { return c == 0; })) {
+      finished_ = true;
+    }
+    return false;
+  }
+
+  // bzip2 segments start at a block magic and end at the next block or end-of-stream magic.
+  while (!candidates_.empty() &&
+         (candidates_.front().pos < cursor_ || !candidates_.front().start)) {
+    candidates_.pop_front();
+  }
+  if (candidates_.empty()) {
+    if (in_eof_ && scan_pos_ >= in_end())
+      finished_ = true;
+    return false;
+  }
+  *start = candidates_.front().pos;
+  cursor_ = *start;
+  for (size_t i = 1; i < candidates_.size(); ++i) {
+    if (candidates_[i].pos >= min_end_ && candidates_[i].pos >= *start + 48) {
+      *end = candidates_[i].pos;
+      return true;
+    }
+  }
+  if (in_eof_ && scan_pos_ >= in_end()) {
+    status_ = Status(StatusCode::IO_ERROR,
+                     StrCat("Corrupted bzip2 block at offset ", ToByte(*start)));
+  }
+  return false;
+}
+
+void ParallelDecompressSource::Dispatch(uint64 start, uint64 end) {
+  Job* job = new Job;
+  job->start = start;
+  job->end = end;
+
+  uint64 first = ToByte(start);
+  uint64 last = format_ == BZIP2 ? (end + 7) / 8 : end;
+  job->input.assign(in_, first - in_start_, last - first);
+  if (format_ == BZIP2)
+    job->bit_offset = start % 8;
+  jobs_.emplace_back(job);
+  cursor_ = end;
+  min_end_ = 0;
+
+  // The pool is started at the second segment, inputs that have a single one do not need it.
+  if (!pool_ && threads_ > 1 && dispatched_ > 0) {
+    pool_.reset(new FuncTaskPool("decompress", 2, threads_));
+    pool_->Launch();
+  }
+  ++dispatched_;
+
+  const Format format = format_;
+  const size_t max_output = max_output_;
+  auto cb = [this, job, format, max_output] {
+    Decode(format, max_output, job);
+    std::lock_guard<std::mutex> lock(mu_);
+    job->done = true;
+    job_done_.notify_all();
+  };
+  if (pool_)
+    pool_->RunTask(cb);
+  else
+    cb();
+}
+
+void ParallelDecompressSource::Decode(Format format, size_t max_output, Job* job) {
+  if (format == GZIP) {
+    std::unique_ptr<SerialState> inflater(new SerialState);
+    bool full = false;
+    InflateMember(&inflater->zs, job->input, max_output, &job->output, &job->consumed,
+                  &job->complete, &full, &job->status);
+    if (full && job->status.ok())
+      job->inflater = std::move(inflater);
+    return;
+  }
+  std::string stream;
+  WrapBzipBlock(reinterpret_cast<const uint8*>(job->input.data()), job->bit_offset,
+                job->end - job->start, &stream);
+  DecodeBzipBlock(stream, &job->output, &job->complete, &job->status);
+}
+
+void ParallelDecompressSource::Fill() {
+  // Keep the input of the oldest unverified segment, it may need to be merged.
+  uint64 needed = ToByte(jobs_.empty() ? cursor_ : jobs_.front()->start);
+  if (needed > in_start_ && needed - in_start_ >= in_.size() / 2) {
+    in_.erase(0, needed - in_start_);
+    in_start_ = needed;
+  }
+
+  Slice src = sub_->Peek();
+  if (src.empty()) {
+    in_eof_ = true;
+    if (!sub_->status().ok())
+      status_ = sub_->status();
+    return;
+  }
+  size_t n = std::min<size_t>(src.size(), kReadSize);
+  in_.append(src.data(), n);
+  sub_->Skip(n);
+}
+
+void ParallelDecompressSource::Scan() {
+  if (format_ == GZIP)
+    ScanGzip();
+  else
+    ScanBzip2();
+}
+
+void ParallelDecompressSource::ScanGzip() {
+  // A candidate needs 10 header bytes.
+  const uint64 limit = in_end() >= 10 ? in_end() - 9 : 0;
+  const uint8* base = reinterpret_cast<const uint8*>(in_.data());
+  uint64 pos = scan_pos_;
+  while (pos < limit) {
+    const uint8* next = reinterpret_cast<const uint8*>(
+        memchr(base + pos - in_start_, 0x1f, limit - pos));
+    if (next == nullptr)
+      break;
+    pos = next - base + in_start_;
+    if (IsGzipHeader(next))
+      candidates_.push_back(Candidate{pos, true});
+    ++pos;
+  }
+  scan_pos_ = in_eof_ ? in_end() : std::max(scan_pos_, limit);
+}
+
+void ParallelDecompressSource::ScanBzip2() {
+  const uint8* base = reinterpret_cast<const uint8*>(in_.data());
+  for (uint64 pos = scan_pos_; pos < in_end(); ++pos) {
+    bz_reg_ = (bz_reg_ << 8) | base[pos - in_start_];
+    bz_reg_bits_ = std::min(bz_reg_bits_ + 8, 64u);
+    if (bz_reg_bits_ < 48)
+      continue;
+
+    // The windows that end within this byte, from the earliest one.
+    for (int shift = std::min(7u, bz_reg_bits_ - 48); shift >= 0; --shift) {
+      uint64 val = (bz_reg_ >> shift) & kMask48;
+      if (val == kBzipBlockMagic || val == kBzipEosMagic) {
+        uint64 bit = pos * 8 + 8 - shift - 48;
+        candidates_.push_back(Candidate{bit, val == kBzipBlockMagic});
+      }
+    }
+  }
+  scan_pos_ = in_end();
+}
+
+void ParallelDecompressSource::Restart(uint64 pos) {
+  {
+    std::unique_lock<std::mutex> lock(mu_);
+    for (const auto& job : jobs_) {
+      Job* ptr = job.get();
+      job_done_.wait(lock, [ptr] { return ptr->done; });
+    }
+  }
+  jobs_.clear();
+  candidates_.clear();
+  cursor_ = pos;
+  min_end_ = 0;
+  scan_pos_ = ToByte(pos);
+  bz_reg_ = 0;
+  bz_reg_bits_ = 0;
+  finished_ = false;
+}
+
+bool ParallelDecompressSource::SerialInflate(std::string* output) {
+  z_stream& zs = serial_->zs;
+  size_t produced = 0;
+  output->resize(kSerialOutputSize);
+  zs.next_out = reinterpret_cast<Bytef*>(&output->front());
+  zs.avail_out = output->size();
+
+  while (zs.avail_out > 0) {
+    size_t offset = cursor_ - in_start_;
+    if (offset == in_.size()) {
+      if (in_eof_) {
+        status_ = Status(StatusCode::IO_ERROR, "Truncated gzip input");
+        break;
+      }
+      Fill();
+      continue;
+    }
+    zs.next_in = reinterpret_cast<Bytef*>(&in_[offset]);
+    zs.avail_in = in_.size() - offset;
+    uint32 avail_in = zs.avail_in;
+    int res = inflate(&zs, Z_NO_FLUSH);
+    cursor_ += avail_in - zs.avail_in;
+    produced = output->size() - zs.avail_out;
+
+    if (res == Z_STREAM_END) {
+      // The following members may be small enough to be decoded in parallel again.
+      serial_.reset();
+      Restart(cursor_);
+      break;
+    }
+    if (res != Z_OK && res != Z_BUF_ERROR) {
+      status_ = Status(StatusCode::IO_ERROR, StrCat("inflate error ", res));
+      break;
+    }
+  }
+  output->resize(produced);
+  return status_.ok();
+}
+
+}  // namespace util
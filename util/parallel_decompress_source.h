@@ -0,0 +1,130 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#ifndef _UTIL_PARALLEL_DECOMPRESS_SOURCE_H
+#define _UTIL_PARALLEL_DECOMPRESS_SOURCE_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "util/sinksource.h"
+#include "util/sp_task_pool.h"
+
+namespace util {
+
+// Decompresses gzip or bzip2 input on multiple threads and yields the output in order.
+//
+// The compressed input is split into segments that can be decoded independently:
+// for bzip2 these are the compression blocks (found by their 48-bit magic at any bit offset),
+// for gzip these are the members of a multi-member file (found by their header bytes).
+// Since the boundary markers may also appear inside compressed data, every decoded segment is
+// verified in order. A segment that fails verification is merged with the following one and
+// decoded again.
+//
+// Gzip input is inflated on the reading thread until the end of its first member, so a regular
+// single-member file is streamed like ZlibSource does. Afterwards only members that are
+// followed by another member header are decoded in parallel. The last member and members
+// larger than max_segment are streamed on the reading thread as well.
+//
+// Memory is bounded by max_segment for the compressed input plus the output of at most
+// 2 * threads segments, each capped by max_output. The threads are started only when the input
+// turns out to have more than one segment.
+class ParallelDecompressSource : public Source {
+ public:
+  enum Format { GZIP, BZIP2 };
+
+  struct Options {
+    // 0 means the number of cpus.
+    unsigned threads = 0;
+    size_t max_segment = 1 << 26;
+
+    // Caps the output that a task holds for a gzip member, the rest of a member with larger
+    // output is streamed on the reading thread.
+    size_t max_output = 1 << 26;
+
+    Options() {}
+  };
+
+  ParallelDecompressSource(Source* sub_source, Ownership ownership, Format format,
+                           const Options& opts = Options());
+  ~ParallelDecompressSource();
+
+  strings::Slice Peek(uint32 minimal_size = 0) override;
+  void Skip(size_t n) override;
+  base::Status status() const override { return status_; }
+
+ private:
+  struct Job;
+  struct Candidate {
+    uint64 pos;
+    bool start;  // bzip2 end-of-stream markers only end segments.
+  };
+
+  // Positions are in bytes for gzip and in bits for bzip2.
+  uint64 ToByte(uint64 pos) const { return format_ == BZIP2 ? pos / 8 : pos; }
+  uint64 in_end() const { return in_start_ + in_.size(); }
+
+  // Produces the next piece of output. Returns false at the end of the stream or on error.
+  bool Advance(std::string* output);
+
+  // Reads input, finds segments and hands them to the pool as long as there is capacity.
+  void Schedule();
+  bool NextSegment(uint64* start, uint64* end);
+  void Dispatch(uint64 start, uint64 end);
+  void Fill();
+  void Scan();
+  void ScanGzip();
+  void ScanBzip2();
+
+  // Drops the queued jobs and restarts scanning from pos.
+  void Restart(uint64 pos);
+
+  // Inflates the current gzip member on the calling thread.
+  bool SerialInflate(std::string* output);
+
+  static void Decode(Format format, size_t max_output, Job* job);
+
+  Source* sub_;
+  Ownership ownership_;
+  const Format format_;
+  const size_t max_segment_;
+  const size_t max_output_;
+  unsigned threads_;
+  std::unique_ptr<FuncTaskPool> pool_;
+  unsigned max_jobs_;
+  uint64 dispatched_ = 0;
+
+  // Compressed input window [in_start_, in_start_ + in_.size()) in bytes.
+  std::string in_;
+  uint64 in_start_ = 0;
+  bool in_eof_ = false;
+
+  uint64 cursor_ = 0;   // start of the next segment.
+  uint64 min_end_ = 0;  // the next segment must not end before this position.
+  uint64 scan_pos_ = 0;
+  uint64 bz_reg_ = 0;   // last scanned bits.
+  unsigned bz_reg_bits_ = 0;
+  std::deque<Candidate> candidates_;
+  bool finished_ = false;
+
+  struct SerialState;
+  std::unique_ptr<SerialState> serial_;
+
+  std::mutex mu_;
+  std::condition_variable job_done_;
+  std::deque<std::unique_ptr<Job>> jobs_;
+
+  std::string cur_;
+  size_t cur_pos_ = 0;
+  bool eof_ = false;
+  base::Status status_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelDecompressSource);
+};
+
+}  // namespace util
+
+#endif  // _UTIL_PARALLEL_DECOMPRESS_SOURCE_H
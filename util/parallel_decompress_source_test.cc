@@ -0,0 +1,164 @@
+// Copyright 2016, Ubimo.com .  All rights reserved.
+// Author: Roman Gershman (roman@ubimo.com)
+//
+#include "util/parallel_decompress_source.h"
+
+#include <bzlib.h>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "base/random.h"
+#include "util/gzip_sink.h"
+
+namespace util {
+
+using std::string;
+
+class ParallelDecompressSourceTest : public testing::Test {
+ protected:
+  static string Compressible(size_t len, unsigned seed = 10) {
+    MTRandom rnd(seed);
+    string res;
+    while (res.size() < len) {
+      res.append("token").append(std::to_string(rnd.Rand32() % 1000)).append(" ");
+    }
+    res.resize(len);
+    return res;
+  }
+
+  static string Gzip(const string& input, int level, size_t chunk_size, bool multi_member) {
+    ParallelGzipSink::Options opts;
+    opts.level = level;
+    opts.threads = 2;
+    opts.chunk_size = chunk_size;
+    opts.multi_member = multi_member;
+
+    StringSink dest;
+    ParallelGzipSink sink(&dest, DO_NOT_TAKE_OWNERSHIP, opts);
+    CHECK_STATUS(sink.Append(input));
+    CHECK_STATUS(sink.Flush());
+    return dest.contents();
+  }
+
+  static string Bzip(const string& input, int level) {
+    string res(input.size() + input.size() / 100 + 600, '\0');
+    unsigned len = res.size();
+    CHECK_EQ(BZ_OK, BZ2_bzBuffToBuffCompress(&res.front(), &len, const_cast<char*>(input.data()),
+                                             input.size(), level, 0, 0));
+    res.resize(len);
+    return res;
+  }
+
+  // Reads with varying minimal sizes.
+  static base::Status ReadAll(const string& compressed, ParallelDecompressSource::Format format,
+                              const ParallelDecompressSource::Options& opts, string* output) {
+    output->clear();
+    ParallelDecompressSource src(new StringSource(compressed, 100000), TAKE_OWNERSHIP, format,
+                                 opts);
+    for (unsigned i = 0;; ++i) {
+      strings::Slice s = src.Peek(i % 3 == 0 ? 70000 : 0);
+      if (s.empty())
+        break;
+      size_t n = std::min<size_t>(s.size(), 50000);
+      output->append(s.data(), n);
+      src.Skip(n);
+    }
+    return src.status();
+  }
+};
+
+TEST_F(ParallelDecompressSourceTest, GzipMembers) {
+  string input = Compressible(3000000);
+  string compressed = Gzip(input, 6, 1 << 16, true);
+
+  ParallelDecompressSource::Options opts;
+  opts.threads = 4;
+  string output;
+  ASSERT_TRUE(ReadAll(compressed, ParallelDecompressSource::GZIP, opts, &output).ok());
+  EXPECT_TRUE(output == input);
+
+  opts.threads = 1;
+  ASSERT_TRUE(ReadAll(compressed, ParallelDecompressSource::GZIP, opts, &output).ok());
+  EXPECT_TRUE(output == input);
+
+  // The members produce more than max_output, their tails are streamed.
+  compressed = Gzip(input, 6, 1 << 18, true);
+  opts.threads = 4;
+  opts.max_output = 1 << 16;
+  ASSERT_TRUE(ReadAll(compressed, ParallelDecompressSource::GZIP, opts, &output).ok());
+  EXPECT_TRUE(output == input);
+}
+
+TEST_F(ParallelDecompressSourceTest, FalseGzipHeaders) {
+  // Stored blocks keep the fake headers in the compressed stream.
+  const string kFake("\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\x03", 10);
+  string input;
+  for (unsigned i = 0; i < 2000; ++i) {
+    input.append(Compressible(500, i)).append(kFake);
+  }
+  string compressed = Gzip(input, 0, 1 << 17, true);
+
+  ParallelDecompressSource::Options opts;
+  opts.threads = 3;
+  string output;
+  ASSERT_TRUE(ReadAll(compressed, ParallelDecompressSource::GZIP, opts, &output).ok());
+  EXPECT_TRUE(output == input);
+}
+
+TEST_F(ParallelDecompressSourceTest, LargeGzipMember) {
+  // A member larger than max_segment followed by small ones.
+  string input = Compressible(2000000);
+  string compressed = Gzip(input.substr(0, 1500000), 6, 1 << 18, false) +
+                      Gzip(input.substr(1500000), 6, 1 << 16, true);
+
+  ParallelDecompressSource::Options opts;
+  opts.threads = 2;
+  opts.max_segment = 1 << 16;
+  string output;
+  ASSERT_TRUE(ReadAll(compressed, ParallelDecompressSource::GZIP, opts, &output).ok());
+  EXPECT_TRUE(output == input);
+
+  compressed.resize(compressed.size() - 100);
+  EXPECT_FALSE(ReadAll(compressed, ParallelDecompressSource::GZIP, opts, &output).ok());
+}
+
+TEST_F(ParallelDecompressSourceTest, SingleGzipMember) {
+  string input = Compressible(10000000);
+  string compressed = Gzip(input, 6, 1 << 20, false);
+
+  // A regular gzip file is streamed rather than inflated at once.
+  ParallelDecompressSource::Options opts;
+  opts.threads = 4;
+  ParallelDecompressSource src(new StringSource(compressed, 100000), TAKE_OWNERSHIP,
+                               ParallelDecompressSource::GZIP, opts);
+  EXPECT_LE(src.Peek().size(), 1 << 20);
+
+  string output;
+  ASSERT_TRUE(ReadAll(compressed, ParallelDecompressSource::GZIP, opts, &output).ok());
+  EXPECT_TRUE(output == input);
+
+  // Zero padding after the member is ignored.
+  compressed.append(1000, '\0');
+  ASSERT_TRUE(ReadAll(compressed, ParallelDecompressSource::GZIP, opts, &output).ok());
+  EXPECT_TRUE(output == input);
+}
+
+TEST_F(ParallelDecompressSourceTest, Bzip2Blocks) {
+  // Level 1 produces 100KB blocks, concatenated streams are valid bzip2 as well.
+  string input = Compressible(1500000);
+  string compressed = Bzip(input.substr(0, 1000000), 1) + Bzip(input.substr(1000000), 2);
+
+  ParallelDecompressSource::Options opts;
+  opts.threads = 4;
+  string output;
+  ASSERT_TRUE(ReadAll(compressed, ParallelDecompressSource::BZIP2, opts, &output).ok());
+  EXPECT_TRUE(output == input);
+
+  compressed.resize(compressed.size() / 2);
+  EXPECT_FALSE(ReadAll(compressed, ParallelDecompressSource::BZIP2, opts, &output).ok());
+
+  ASSERT_TRUE(ReadAll(Bzip("", 9), ParallelDecompressSource::BZIP2, opts, &output).ok());
+  EXPECT_TRUE(output.empty());
+}
+
+}  // namespace util
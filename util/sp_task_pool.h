@@ -5,6 +5,7 @@
 #define _UTIL_SP_TASK_POOL_H
 
 #include <atomic>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -294,6 +295,19 @@ public:
   SharedTuple shared_data_;
 };
 
+// Runs arbitrary closures. Useful for ad-hoc parallelism where the producer waits for its own
+// batch of tasks (see base/blocking_counter.h) rather than for the whole pool.
+// Example:
+//   util::FuncTaskPool pool("fetch", 4, 8);
+//   pool.Launch();
+//   pool.RunTask([] { ... });
+struct FuncTask {
+  void operator()(std::function<void()> f) { f(); }
+  void Finalize() {}
+};
+
+using FuncTaskPool = SingleProducerTaskPool<FuncTask>;
+
 }  // namespace util
 
 #endif  // _UTIL_SP_TASK_POOL_H
@@ -15,6 +15,7 @@
 
 #include "file/list_file.h"
 #include "file/sstable/sstable.h"
+#include "file/sstable/table_properties.h"
 #include "file/proto_writer.h"
 #include "strings/escaping.h"
 
@@ -40,6 +41,7 @@ DEFINE_bool(sizes, false, "Prints a rough estimation of the size of every field"
 DEFINE_bool(parallel, true, "");
 DEFINE_string(sample_key, "", "");
 DEFINE_int32(sample_factor, 0, "If bigger than 0 samples and outputs record once in k times");
+DEFINE_bool(properties, false, "Prints the properties of sstables instead of their records");
 
 using namespace util::pprint;
 using strings::Slice;
@@ -203,6 +205,17 @@ int main(int argc, char **argv) {
       auto res2 = sstable::Table::Open(sstable::ReadOptions(), file.get());
       CHECK(res2.status.ok()) << res2.status.ToString();
       std::unique_ptr<sstable::Table> table(res2.obj);
+      if (FLAGS_properties) {
+        const sstable::TableProperties* props = table->GetProperties();
+        if (props != nullptr) {
+          std::cout << path << ":\n" << props->ToString();
+        } else {
+          std::cout << path << ": no properties\n";
+        }
+        table.reset();
+        CHECK(file->Close().ok());
+        continue;
+      }
       std::unique_ptr<sstable::Iterator> it(table->NewIterator());
       const auto& meta = table->GetMeta();
       ptype = FindWithDefault(meta, file::kProtoTypeKey, kEmptyKey);
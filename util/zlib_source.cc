@@ -74,6 +74,12 @@ bool ZlibSource::RefillInternal() {
     if (zerror_ != Z_OK) {
       if (zerror_ == Z_STREAM_END) {
         zerror_ = Z_OK;
+
+        // Concatenated gzip members form a single gzip stream.
+        if (format_ != ZLIB) {
+          inflateReset(&zcontext_);
+          continue;
+        }
       } else {
         LOG(WARNING) << "inflate error: " << zerror_ << " message: "
                    << zcontext_.msg;